@@ -0,0 +1,995 @@
+// Throughput and latency benchmark for the host build.
+//
+//   bench_host [--quick] [--mtu N] [--interval-us N] [--packets N] [--mbufs N] [--line-len N]
+//              [--profile default|high-throughput|low-power] [--framing line|cobs|slip|varint]
+//              [--coalesce-ms N]
+//
+// RX numbers measure the component's receive path (the central writes as fast as the
+// access callback returns); TX numbers are bounded by the simulated link, so they show
+// how well the component fills each connection event. The bulk upload numbers model the
+// central's pacing, see bench_bulk().
+#include "esp_attr.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nordic-uart-private.h"
+#include "sim_link.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+struct bench_options {
+  bool quick;
+  size_t line_len;
+  enum nordic_uart_link_profile profile;
+  enum nordic_uart_framing framing;
+  uint32_t coalesce_ms;
+  struct sim_link_config link;
+};
+
+static int _cmp_i64(const void *a, const void *b) {
+  const int64_t x = *(const int64_t *)a;
+  const int64_t y = *(const int64_t *)b;
+  return (x > y) - (x < y);
+}
+
+static void print_latency(const char *label, int64_t *samples, size_t count) {
+  if (count == 0) {
+    printf("%-18s no samples\n", label);
+    return;
+  }
+  qsort(samples, count, sizeof(samples[0]), _cmp_i64);
+  printf("%-18s p50 %lld  p90 %lld  p99 %lld  max %lld us (%zu samples)\n", label,
+         (long long)samples[count * 50 / 100], (long long)samples[count * 90 / 100],
+         (long long)samples[count * 99 / 100], (long long)samples[count - 1], count);
+}
+
+static uint16_t connect_central(void) {
+  if (!sim_link_wait_advertising(1000)) {
+    fprintf(stderr, "not advertising\n");
+    exit(EXIT_FAILURE);
+  }
+  const uint16_t conn = sim_link_connect();
+  vTaskDelay(pdMS_TO_TICKS(50)); // let the MTU exchange settle
+  return conn;
+}
+
+/* RX: lines/s and write-to-reader latency */
+
+struct rx_state {
+  size_t expected;
+  volatile size_t received;
+  int64_t *line_written_us; // indexed by line number, set by the writer
+  int64_t *latency_us;
+  size_t batch;   // lines per nordic_uart_receive_batch(), 0 to take them one by one
+  size_t wakeups; // receive calls that returned data
+  SemaphoreHandle_t done;
+};
+
+static void rx_record(struct rx_state *state, const char *line, int64_t now) {
+  const size_t number = strtoul(line, NULL, 10);
+  if (number < state->expected)
+    state->latency_us[state->received] = now - state->line_written_us[number];
+  state->received++;
+}
+
+static void rx_reader_task(void *arg) {
+  struct rx_state *state = arg;
+  struct nordic_uart_rx_line lines[64];
+  while (state->received < state->expected) {
+    if (state->batch) {
+      const size_t count = nordic_uart_receive_batch(lines, MIN(state->batch, 64), 0, pdMS_TO_TICKS(1000));
+      if (count == 0)
+        break;
+      const int64_t now = esp_timer_get_time();
+      for (size_t i = 0; i < count; ++i)
+        rx_record(state, lines[i].data, now);
+      nordic_uart_release_batch(lines, count);
+    } else {
+      size_t item_size;
+      char *item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(1000));
+      if (item == NULL)
+        break;
+      rx_record(state, item, esp_timer_get_time());
+      nordic_uart_return_item(item);
+    }
+    state->wakeups++;
+  }
+  xSemaphoreGive(state->done);
+  vTaskDelete(NULL);
+}
+
+// The central's count of the flow control credits it has spent, which follows the framing
+// the way the device charges them: a byte each, and NORDIC_UART_FLOW_LINE_COST more for
+// every byte that ends a line or frame.
+struct flow_meter {
+  enum nordic_uart_framing framing;
+  uint32_t spent;
+  uint32_t frame_left; // varint: length, then payload bytes left
+  uint8_t frame_shift; // varint: bits of the length read so far
+  bool frame_body;     // varint: the length is complete
+};
+
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+static bool flow_frame_ends(struct flow_meter *meter, uint8_t c) {
+  switch (meter->framing) {
+  case NORDIC_UART_FRAMING_COBS:
+    return c == 0;
+  case NORDIC_UART_FRAMING_SLIP:
+    return c == 0xc0;
+  case NORDIC_UART_FRAMING_VARINT:
+    if (meter->frame_body) {
+      meter->frame_left--;
+    } else {
+      meter->frame_left |= (uint32_t)(c & 0x7f) << meter->frame_shift;
+      meter->frame_shift += 7;
+      if (c & 0x80)
+        return false;
+      meter->frame_body = true;
+    }
+    if (meter->frame_left)
+      return false;
+    meter->frame_shift = 0;
+    meter->frame_body = false;
+    return true;
+  default:
+    return c == '\n' || c == '\0' || c == '\003';
+  }
+}
+#endif
+
+// Like a well behaved central, spend no more credits than the device has granted, splitting writes as needed.
+static void write_within_credits(uint16_t conn, const uint8_t *data, size_t len, struct flow_meter *meter) {
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+  while (len > 0) {
+    const uint32_t granted = _nordic_uart_flow_granted(conn);
+    struct flow_meter after = *meter;
+    size_t piece = 0;
+    for (; piece < len; ++piece) {
+      struct flow_meter next = after;
+      next.spent += 1 + (flow_frame_ends(&next, data[piece]) ? NORDIC_UART_FLOW_LINE_COST : 0);
+      if ((int32_t)(granted - next.spent) < 0)
+        break;
+      after = next;
+    }
+    if (piece == 0) {
+      usleep(20);
+      continue;
+    }
+    sim_link_write(conn, data, piece);
+    *meter = after;
+    data += piece;
+    len -= piece;
+  }
+#else
+  sim_link_write(conn, data, len);
+#endif
+}
+
+static void bench_rx(const struct bench_options *options, size_t batch) {
+  const size_t lines = options->quick ? 20000 : 200000;
+  const size_t line_len = options->line_len; // including '\n'
+  struct rx_state state = {
+      .expected = lines,
+      .line_written_us = calloc(lines, sizeof(int64_t)),
+      .latency_us = calloc(lines, sizeof(int64_t)),
+      .batch = batch,
+      .done = xSemaphoreCreateBinary(),
+  };
+
+  nordic_uart_set_framing(options->framing);
+  nordic_uart_start("Nordic UART", NULL);
+  const uint16_t conn = connect_central();
+  const size_t write_len = _nordic_uart_tx_chunk_size(); // the central writes MTU - 3 bytes at a time
+  xTaskCreate(rx_reader_task, "rx_reader", 4096, &state, 5, NULL);
+
+  uint8_t *write_buf = malloc(write_len);
+  char *line_buf = malloc(line_len + 1);
+  uint8_t *frame_buf = malloc(NORDIC_UART_FRAME_ENCODED_MAX(line_len));
+  size_t pending = 0;
+  size_t unstamped = 0; // first line not yet handed to the component
+  struct flow_meter meter = {.framing = options->framing};
+  const int64_t start = esp_timer_get_time();
+  for (size_t line = 0; line < lines; ++line) {
+    snprintf(line_buf, line_len + 1, "%08zu%0*d", line, (int)(line_len > 8 ? line_len - 8 : 0), 0);
+    // lines end in '\n', other framings encode the same payload
+    const uint8_t *frame = (const uint8_t *)line_buf;
+    size_t frame_len = line_len;
+    line_buf[line_len - 1] = '\n';
+    if (options->framing != NORDIC_UART_FRAMING_LINE) {
+      frame_len = nordic_uart_frame_encode(options->framing, line_buf, line_len - 1, frame_buf,
+                                           NORDIC_UART_FRAME_ENCODED_MAX(line_len));
+      frame = frame_buf;
+    }
+    for (size_t i = 0; i < frame_len; ++i) {
+      write_buf[pending++] = frame[i];
+      const bool line_done = i == frame_len - 1;
+      if (pending == write_len || (line == lines - 1 && line_done)) {
+        // every line that ends in this write is stamped with its send time
+        const size_t stamp_end = line_done ? line + 1 : line;
+        const int64_t now = esp_timer_get_time();
+        for (; unstamped < stamp_end; ++unstamped)
+          state.line_written_us[unstamped] = now;
+        write_within_credits(conn, write_buf, pending, &meter);
+        pending = 0;
+      }
+    }
+  }
+  xSemaphoreTake(state.done, portMAX_DELAY);
+  const double elapsed = (esp_timer_get_time() - start) / 1e6;
+
+  static const char *const framing_names[] = {"line", "cobs", "slip", "varint"};
+  if (batch) {
+    printf("%-18s %.0f (batches of up to %zu, %.1f lines per wakeup)\n", "rx batch lines/s", state.received / elapsed,
+           batch, state.wakeups ? (double)state.received / state.wakeups : 0.0);
+    print_latency("rx batch latency", state.latency_us, state.received);
+  } else {
+    printf("%-18s %.0f (%zu of %zu %s frames, %zu bytes each, %zu byte writes)\n", "rx lines/s",
+           state.received / elapsed, state.received, lines, framing_names[options->framing], line_len, write_len);
+    printf("%-18s %.0f\n", "rx bytes/s", state.received * line_len / elapsed);
+    print_latency("rx latency", state.latency_us, state.received);
+  }
+
+  sim_link_disconnect(conn);
+  nordic_uart_stop();
+  vSemaphoreDelete(state.done);
+  free(write_buf);
+  free(line_buf);
+  free(frame_buf);
+  free(state.line_written_us);
+  free(state.latency_us);
+}
+
+/* RX transport: the host task to reader hand-off alone, NOSPLIT ring buffer against the SPSC ring.
+ * The writer task stands in for the host task; on the host the ring buffer's critical section is a
+ * mutex, so the gap shows the lock and wakeup cost rather than the exact figure on target. */
+
+struct transport_state {
+  size_t lines;
+  size_t line_len;
+  RingbufHandle_t ringbuf; // NULL to use spsc
+  struct nordic_uart_spsc *spsc;
+  SemaphoreHandle_t done;
+};
+
+static void transport_writer_task(void *arg) {
+  struct transport_state *state = arg;
+  char *line = malloc(state->line_len + 3);
+  memset(line, 'x', state->line_len);
+  line[state->line_len] = '\0';
+  const uint16_t conn = 1;
+  for (size_t i = 0; i < state->lines; ++i) {
+    if (state->ringbuf) {
+      // the same item layout as _nordic_uart_send_line_buf_to_ring_buf()
+      memcpy(&line[state->line_len + 1], &conn, sizeof(conn));
+      xRingbufferSend(state->ringbuf, line, state->line_len + 3, portMAX_DELAY);
+    } else {
+      _nordic_uart_spsc_push(state->spsc, line, state->line_len, conn, portMAX_DELAY);
+    }
+  }
+  free(line);
+  xSemaphoreGive(state->done);
+  vTaskDelete(NULL);
+}
+
+static double transport_run(struct transport_state *state) {
+  size_t received = 0;
+  size_t bytes = 0;
+  const int64_t start = esp_timer_get_time();
+  xTaskCreate(transport_writer_task, "transport_writer", 4096, state, 5, NULL);
+  while (received < state->lines) {
+    size_t len;
+    char *item;
+    if (state->ringbuf) {
+      item = xRingbufferReceive(state->ringbuf, &len, pdMS_TO_TICKS(1000));
+      if (item == NULL)
+        break;
+      bytes += _nordic_uart_rx_item_len(len);
+      vRingbufferReturnItem(state->ringbuf, item);
+    } else {
+      item = _nordic_uart_spsc_receive(state->spsc, &len, NULL, pdMS_TO_TICKS(1000));
+      if (item == NULL)
+        break;
+      bytes += len;
+      _nordic_uart_spsc_release(state->spsc, item);
+    }
+    ++received;
+  }
+  xSemaphoreTake(state->done, portMAX_DELAY);
+  const double elapsed = (esp_timer_get_time() - start) / 1e6;
+  if (received != state->lines || bytes != received * state->line_len)
+    fprintf(stderr, "transport lost lines: %zu of %zu\n", received, state->lines);
+  return received / elapsed;
+}
+
+static void bench_rx_transport(const struct bench_options *options) {
+  static WORD_ALIGNED_ATTR uint8_t spsc_storage[CONFIG_NORDIC_UART_RX_BUFFER_SIZE];
+  struct nordic_uart_spsc spsc;
+  struct transport_state state = {
+      .lines = options->quick ? 100000 : 1000000,
+      .line_len = options->line_len - 1, // without '\n'
+      .done = xSemaphoreCreateBinary(),
+  };
+
+  state.ringbuf = xRingbufferCreate(CONFIG_NORDIC_UART_RX_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+  const double ringbuf_rate = transport_run(&state);
+  vRingbufferDelete(state.ringbuf);
+
+  state.ringbuf = NULL;
+  state.spsc = &spsc;
+  _nordic_uart_spsc_init(&spsc, spsc_storage, sizeof(spsc_storage));
+  const double spsc_rate = transport_run(&state);
+  _nordic_uart_spsc_deinit(&spsc);
+
+  printf("%-18s ringbuf %.0f  spsc %.0f (%zu lines of %zu bytes, %.1fx)\n", "rx handoff lines/s", ringbuf_rate,
+         spsc_rate, state.lines, state.line_len, ringbuf_rate > 0 ? spsc_rate / ringbuf_rate : 0.0);
+  vSemaphoreDelete(state.done);
+}
+
+#if defined(CONFIG_NORDIC_UART_RX_WORKER) && defined(CONFIG_NORDIC_UART_TRACE)
+/* RX worker: the same line traffic framed on the host task and on the RX worker. The time each write
+ * spends in the access callback, taken by the trace hook, is how long the host task is kept from the
+ * radio; on target the worker runs on the other core, on the host it is one more thread. */
+
+struct busy_state {
+  int64_t start_us;
+  int64_t *samples;
+  size_t count;
+  size_t max_count;
+};
+static struct busy_state busy;
+
+static void busy_trace_hook(enum nordic_uart_trace_event event, uint16_t conn_handle, size_t len) {
+  if (event == NORDIC_UART_TRACE_RECEIVE_START)
+    busy.start_us = esp_timer_get_time();
+  else if (event == NORDIC_UART_TRACE_RECEIVE_END && busy.count < busy.max_count)
+    busy.samples[busy.count++] = esp_timer_get_time() - busy.start_us;
+}
+
+static void bench_rx_worker(const struct bench_options *options) {
+  const size_t lines = options->quick ? 20000 : 200000;
+  const size_t line_len = options->line_len; // including '\n'
+  for (int worker = 0; worker < 2; ++worker) {
+    struct rx_state state = {
+        .expected = lines,
+        .line_written_us = calloc(lines, sizeof(int64_t)),
+        .latency_us = calloc(lines, sizeof(int64_t)),
+        .batch = 16,
+        .done = xSemaphoreCreateBinary(),
+    };
+    nordic_uart_set_rx_worker(worker);
+    nordic_uart_start("Nordic UART", NULL);
+    const uint16_t conn = connect_central();
+    const size_t write_len = _nordic_uart_tx_chunk_size();
+    xTaskCreate(rx_reader_task, "rx_reader", 4096, &state, 5, NULL);
+
+    // credit limits split some writes, leave room for them
+    busy = (struct busy_state){.max_count = 2 * (lines * line_len / write_len + 2)};
+    busy.samples = calloc(busy.max_count, sizeof(int64_t));
+    nordic_uart_set_trace_hook(busy_trace_hook);
+    uint8_t *write_buf = malloc(write_len);
+    char *line_buf = malloc(line_len + 1);
+    size_t pending = 0;
+    size_t unstamped = 0;
+    struct flow_meter meter = {.framing = NORDIC_UART_FRAMING_LINE};
+    const int64_t start = esp_timer_get_time();
+    for (size_t line = 0; line < lines; ++line) {
+      snprintf(line_buf, line_len + 1, "%08zu%0*d", line, (int)(line_len > 8 ? line_len - 8 : 0), 0);
+      line_buf[line_len - 1] = '\n';
+      for (size_t i = 0; i < line_len; ++i) {
+        write_buf[pending++] = line_buf[i];
+        if (pending < write_len && !(line == lines - 1 && i == line_len - 1))
+          continue;
+        const int64_t now = esp_timer_get_time();
+        for (; unstamped < (i == line_len - 1 ? line + 1 : line); ++unstamped)
+          state.line_written_us[unstamped] = now;
+        write_within_credits(conn, write_buf, pending, &meter);
+        pending = 0;
+      }
+    }
+    xSemaphoreTake(state.done, portMAX_DELAY);
+    const double elapsed = (esp_timer_get_time() - start) / 1e6;
+    nordic_uart_set_trace_hook(NULL);
+
+    const char *label = worker ? "rx worker" : "rx host task";
+    printf("%-18s %.0f lines/s (%zu of %zu lines, %zu bytes each)\n", label, state.received / elapsed,
+           state.received, lines, line_len);
+    print_latency("  host per write", busy.samples, busy.count);
+    print_latency("  line latency", state.latency_us, state.received);
+
+    sim_link_disconnect(conn);
+    nordic_uart_stop();
+    vSemaphoreDelete(state.done);
+    free(busy.samples);
+    free(write_buf);
+    free(line_buf);
+    free(state.line_written_us);
+    free(state.latency_us);
+  }
+  nordic_uart_set_rx_worker(false);
+}
+#endif
+
+/* TX: bytes/s for blocking and queued writes */
+
+static void report_tx(const char *label, size_t len, int64_t start) {
+  const double elapsed = (esp_timer_get_time() - start) / 1e6;
+  struct sim_link_stats stats;
+  sim_link_get_stats(&stats);
+  const double avg = stats.notifications ? (double)stats.notified_bytes / stats.notifications : 0;
+  printf("%-18s %.0f (%zu bytes, %u notifications, avg %.1f / max %u bytes, %u ENOMEM)\n", label, len / elapsed, len,
+         stats.notifications, avg, _nordic_uart_tx_chunk_size(), stats.mbuf_enomem);
+}
+
+static void bench_tx(const struct bench_options *options) {
+  const size_t len = options->quick ? 32 * 1024 : 256 * 1024;
+  uint8_t *data = malloc(len);
+  for (size_t i = 0; i < len; ++i)
+    data[i] = (uint8_t)i;
+
+  nordic_uart_start("Nordic UART", NULL);
+  uint16_t conn = connect_central();
+
+  sim_link_reset_stats();
+  int64_t start = esp_timer_get_time();
+  nordic_uart_write(data, len);
+  sim_link_wait_received(conn, 0, len, 60000);
+  report_tx("tx write bytes/s", len, start);
+  while (sim_link_received(conn, 0, data, len) > 0) {
+  }
+
+  // queued writes of a typical log line size
+  const size_t piece = 100;
+  sim_link_reset_stats();
+  start = esp_timer_get_time();
+  for (size_t off = 0; off < len; off += piece) {
+    while (nordic_uart_write_async(data + off, MIN(piece, len - off)) != ESP_OK)
+      vTaskDelay(1);
+  }
+  sim_link_wait_received(conn, 0, len, 60000);
+  report_tx("tx async bytes/s", len, start);
+  printf("%-18s %zu bytes\n", "tx queue peak", nordic_uart_tx_queue_high_watermark());
+
+  sim_link_disconnect(conn);
+  nordic_uart_stop();
+  free(data);
+}
+
+/* TX chatty: many short sends, each its own notification unless coalesced */
+
+static void bench_tx_chatty(const struct bench_options *options) {
+  const size_t count = options->quick ? 2000 : 20000;
+  char message[17];
+
+  nordic_uart_start("Nordic UART", NULL);
+  const uint16_t conn = connect_central();
+  for (int coalesce = 0; coalesce < 2; ++coalesce) {
+    nordic_uart_set_tx_coalescing(coalesce ? options->coalesce_ms : 0);
+    sim_link_reset_stats();
+    const int64_t start = esp_timer_get_time();
+    for (size_t i = 0; i < count; ++i) {
+      snprintf(message, sizeof(message), "k%06zu=%08zu", i, i * 7);
+      nordic_uart_send(message);
+    }
+    sim_link_wait_received(conn, 0, count * 16, 60000);
+    char label[32];
+    snprintf(label, sizeof(label), "tx chatty %ums", coalesce ? (unsigned)options->coalesce_ms : 0);
+    report_tx(label, count * 16, start);
+    while (sim_link_received(conn, 0, message, sizeof(message)) > 0) {
+    }
+  }
+  nordic_uart_set_tx_coalescing(0);
+
+  sim_link_disconnect(conn);
+  nordic_uart_stop();
+}
+
+/* TX latency: one short message at a time, from the call to delivery at the central */
+
+struct tx_latency_state {
+  volatile int64_t delivered_us;
+};
+
+static void tx_notify_handler(uint16_t conn_handle, uint16_t attr_handle, const uint8_t *data, size_t len,
+                              void *arg) {
+  struct tx_latency_state *state = arg;
+  state->delivered_us = esp_timer_get_time();
+}
+
+static void bench_tx_latency(const struct bench_options *options) {
+  const size_t count = options->quick ? 100 : 1000;
+  int64_t *latency_us = calloc(count, sizeof(int64_t));
+  struct tx_latency_state state = {0};
+
+  nordic_uart_start("Nordic UART", NULL);
+  const uint16_t conn = connect_central();
+  sim_link_set_notify_handler(tx_notify_handler, &state);
+
+  size_t samples = 0;
+  for (size_t i = 0; i < count; ++i) {
+    state.delivered_us = 0;
+    const int64_t start = esp_timer_get_time();
+    nordic_uart_send("0123456789abcdef\r\n");
+    while (state.delivered_us == 0 && esp_timer_get_time() - start < 1000000)
+      usleep(50);
+    if (state.delivered_us)
+      latency_us[samples++] = state.delivered_us - start;
+    // desynchronise from the connection interval
+    usleep(rand() % options->link.conn_interval_us);
+  }
+  print_latency("tx latency", latency_us, samples);
+
+  sim_link_set_notify_handler(NULL, NULL);
+  sim_link_disconnect(conn);
+  nordic_uart_stop();
+  free(latency_us);
+}
+
+/* Restart: a full stop and start against nordic_uart_suspend() and nordic_uart_resume(), each timed until the
+ * device advertises again with a central connected before. The host build has no controller to bring up, so the
+ * cold numbers are a floor for a board. */
+
+static int64_t wait_advertising_us(int64_t start) {
+  while (!sim_link_advertising())
+    usleep(10);
+  return esp_timer_get_time() - start;
+}
+
+static void bench_restart(const struct bench_options *options) {
+  const size_t cycles = options->quick ? 20 : 200;
+  int64_t *down_us = calloc(cycles, sizeof(int64_t));
+  int64_t *up_us = calloc(cycles, sizeof(int64_t));
+
+  for (size_t i = 0; i < cycles; ++i) {
+    nordic_uart_start("Nordic UART", NULL);
+    wait_advertising_us(esp_timer_get_time());
+    sim_link_connect();
+    int64_t start = esp_timer_get_time();
+    nordic_uart_stop();
+    down_us[i] = esp_timer_get_time() - start;
+    start = esp_timer_get_time();
+    nordic_uart_start("Nordic UART", NULL);
+    up_us[i] = wait_advertising_us(start);
+    nordic_uart_stop();
+  }
+  print_latency("cold stop", down_us, cycles);
+  print_latency("cold start", up_us, cycles);
+
+  nordic_uart_start("Nordic UART", NULL);
+  wait_advertising_us(esp_timer_get_time());
+  for (size_t i = 0; i < cycles; ++i) {
+    sim_link_connect();
+    int64_t start = esp_timer_get_time();
+    nordic_uart_suspend(portMAX_DELAY);
+    down_us[i] = esp_timer_get_time() - start;
+    start = esp_timer_get_time();
+    nordic_uart_resume();
+    up_us[i] = wait_advertising_us(start);
+  }
+  print_latency("warm suspend", down_us, cycles);
+  print_latency("warm resume", up_us, cycles);
+  nordic_uart_stop();
+
+  free(down_us);
+  free(up_us);
+}
+
+#ifdef CONFIG_NORDIC_UART_LATENCY
+/* Latency mode: paced lines echoed by the device, round trip at the central and the device's own report */
+
+struct echo_state {
+  size_t count;
+  int64_t *sent_us;       // indexed by line number, set by the writer
+  int64_t *round_trip_us; // in the order the echoes came back
+  volatile size_t echoed;
+  char text[512]; // what arrived since the last complete line
+  size_t text_len;
+  char report[512];
+  volatile size_t report_lines;
+  size_t report_len;
+  uint16_t tx_handle; // the Nordic UART TX characteristic; credit grants are notified too
+};
+
+// Echoes are "%06zu\r\n" lines; anything else is part of the device's report.
+static void echo_line(struct echo_state *state, const char *line, size_t len, int64_t now) {
+  char *end;
+  const size_t number = strtoul(line, &end, 10);
+  if (len == 6 && end == line + 6 && number < state->count) {
+    state->round_trip_us[state->echoed] = now - state->sent_us[number];
+    state->echoed++;
+  } else if (state->report_len + len + 2 < sizeof(state->report)) {
+    memcpy(state->report + state->report_len, line, len);
+    memcpy(state->report + state->report_len + len, "\n", 2);
+    state->report_len += len + 1;
+    state->report_lines++;
+  }
+}
+
+static void echo_notify_handler(uint16_t conn_handle, uint16_t attr_handle, const uint8_t *data, size_t len,
+                                void *arg) {
+  struct echo_state *state = arg;
+  const int64_t now = esp_timer_get_time();
+  if (attr_handle != state->tx_handle)
+    return;
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i] == '\n') {
+      const size_t line_len = state->text_len && state->text[state->text_len - 1] == '\r' ? state->text_len - 1
+                                                                                           : state->text_len;
+      echo_line(state, state->text, line_len, now);
+      state->text_len = 0;
+    } else if (state->text_len < sizeof(state->text)) {
+      state->text[state->text_len++] = data[i];
+    }
+  }
+}
+
+static const ble_uuid128_t tx_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x03, 0x00, 0x40, 0x6e);
+
+// Paced lines, like the "Measure latency" button of web/index.html. Every echo takes a notification of its own,
+// so the rate stays below what the link carries (800 per second with the default 7.5 ms and 6 packets per event).
+static void bench_latency(const struct bench_options *options) {
+  static struct echo_state state;
+  const int64_t period_us = 2000;
+  state.count = options->quick ? 500 : 5000;
+  state.sent_us = calloc(state.count, sizeof(int64_t));
+  state.round_trip_us = calloc(state.count, sizeof(int64_t));
+  state.echoed = state.text_len = state.report_len = state.report_lines = 0;
+
+  nordic_uart_set_framing(NORDIC_UART_FRAMING_LINE);
+  nordic_uart_set_latency_mode(true);
+  nordic_uart_start("Nordic UART", NULL);
+  const uint16_t conn = connect_central();
+  state.tx_handle = sim_link_chr_handle(&tx_uuid.u);
+  sim_link_set_notify_handler(echo_notify_handler, &state);
+
+  char line[16];
+  struct flow_meter meter = {.framing = NORDIC_UART_FRAMING_LINE};
+  const int64_t start = esp_timer_get_time();
+  for (size_t i = 0; i < state.count; ++i) {
+    const int64_t due = start + (int64_t)i * period_us;
+    const int64_t now = esp_timer_get_time();
+    if (due > now)
+      usleep(due - now);
+    const int len = snprintf(line, sizeof(line), "%06zu\n", i);
+    state.sent_us[i] = esp_timer_get_time();
+    write_within_credits(conn, (const uint8_t *)line, len, &meter);
+  }
+  for (int64_t wait = esp_timer_get_time(); state.echoed < state.count && esp_timer_get_time() - wait < 2000000;)
+    usleep(1000);
+  printf("%-18s %zu of %zu lines at %.0f Hz\n", "echo", (size_t)state.echoed, state.count, 1e6 / period_us);
+  print_latency("echo round trip", state.round_trip_us, state.echoed);
+
+  // the report as the central sees it: a header and one line per stage
+  write_within_credits(conn, (const uint8_t *)"#latency\n", 9, &meter);
+  for (int64_t wait = esp_timer_get_time();
+       state.report_lines < 1 + NORDIC_UART_LATENCY_STAGES && esp_timer_get_time() - wait < 2000000;)
+    usleep(1000);
+  fputs(state.report, stdout);
+
+  sim_link_set_notify_handler(NULL, NULL);
+  sim_link_disconnect(conn);
+  nordic_uart_stop();
+  nordic_uart_set_latency_mode(false);
+  nordic_uart_set_framing(options->framing);
+  free(state.sent_us);
+  free(state.round_trip_us);
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+/* Compression: ratio and CPU cost on log lines, and what it saves on the link */
+
+// ESP-IDF style log lines: a level, a timestamp, a tag and a short message with numbers.
+static size_t make_log(char *buf, size_t size) {
+  static const char *const tags[] = {"wifi", "sensor", "app_main", "mqtt", "nvs"};
+  static const char *const messages[] = {
+      "temperature %d.%d C",   "humidity %d.%d %%", "publish ok, msg_id=%d%d", "rssi -%d dBm (ch %d)",
+      "heap free %d%d bytes",
+  };
+  size_t len = 0;
+  srand(7);
+  for (unsigned i = 0; len + 100 < size; ++i) {
+    const int kind = rand() % 5;
+    len += snprintf(buf + len, size - len, "%c (%u) %s: ", rand() % 10 ? 'I' : 'W', 1000 + i * 53 + rand() % 20,
+                    tags[kind]);
+    len += snprintf(buf + len, size - len, messages[kind], rand() % 100, rand() % 10);
+    len += snprintf(buf + len, size - len, "\r\n");
+  }
+  return len;
+}
+
+static void bench_compress(const struct bench_options *options) {
+  const size_t size = options->quick ? 32 * 1024 : 256 * 1024;
+  char *log = malloc(size);
+  uint8_t *packed = malloc(_NORDIC_UART_LZ_BOUND(size) * 2);
+  uint8_t *unpacked = malloc(size);
+  struct nordic_uart_lz_enc *enc = malloc(sizeof(*enc));
+  struct nordic_uart_lz_dec *dec = malloc(sizeof(*dec));
+  const size_t len = make_log(log, size);
+
+  // each line is a send of its own, the way a device logs
+  _nordic_uart_lz_enc_reset(enc);
+  int64_t start = esp_timer_get_time();
+  size_t packed_len = 0;
+  for (size_t pos = 0; pos < len;) {
+    const char *eol = memchr(log + pos, '\n', len - pos);
+    const size_t line_len = eol ? (size_t)(eol - (log + pos)) + 1 : len - pos;
+    packed_len += _nordic_uart_lz_compress(enc, (const uint8_t *)log + pos, line_len, packed + packed_len);
+    packed_len += _nordic_uart_lz_flush(enc, packed + packed_len);
+    pos += line_len;
+  }
+  const int64_t compress_us = esp_timer_get_time() - start;
+
+  _nordic_uart_lz_dec_reset(dec);
+  bool error = false;
+  const uint8_t *in = packed;
+  size_t in_len = packed_len;
+  start = esp_timer_get_time();
+  const size_t unpacked_len = _nordic_uart_lz_decompress(dec, &in, &in_len, unpacked, size, &error);
+  const int64_t decompress_us = esp_timer_get_time() - start;
+  if (error || unpacked_len != len || memcmp(log, unpacked, len) != 0)
+    fprintf(stderr, "compressed log does not round trip\n");
+  printf("%-18s %.2f (%zu -> %zu bytes, %u byte window)\n", "compress ratio", (double)len / packed_len, len,
+         packed_len, _NORDIC_UART_LZ_WINDOW);
+  printf("%-18s compress %.1f  decompress %.1f us/KB (host CPU)\n", "compress cost", compress_us * 1024.0 / len,
+         decompress_us * 1024.0 / len);
+
+  // the same lines over the link, to a plain central and to one that asked for compression
+  static const ble_uuid128_t caps_uuid =
+      BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x05, 0x00, 0x40, 0x6e);
+  nordic_uart_start("Nordic UART", NULL);
+  const uint16_t conn = connect_central();
+  for (int compressed = 0; compressed < 2; ++compressed) {
+    sim_link_write_chr(conn, &caps_uuid.u, compressed ? "\x01" : "\x00", 1);
+    _nordic_uart_lz_dec_reset(dec);
+    sim_link_reset_stats();
+    start = esp_timer_get_time();
+    for (size_t pos = 0; pos < len;) {
+      const char *eol = memchr(log + pos, '\n', len - pos);
+      const size_t line_len = eol ? (size_t)(eol - (log + pos)) + 1 : len - pos;
+      nordic_uart_write(log + pos, line_len);
+      pos += line_len;
+    }
+    // wait until the central has everything, expanding the stream as it comes
+    size_t delivered = 0;
+    while (delivered < len && esp_timer_get_time() - start < 60000000) {
+      in_len = sim_link_received(conn, 0, packed, _NORDIC_UART_LZ_BOUND(size));
+      if (in_len == 0) {
+        usleep(200);
+        continue;
+      }
+      if (!compressed) {
+        delivered += in_len;
+        continue;
+      }
+      in = packed;
+      while (in_len)
+        delivered += _nordic_uart_lz_decompress(dec, &in, &in_len, unpacked, size, &error);
+    }
+    report_tx(compressed ? "tx log compressed" : "tx log plain", len, start);
+  }
+  sim_link_disconnect(conn);
+  nordic_uart_stop();
+
+  free(log);
+  free(packed);
+  free(unpacked);
+  free(enc);
+  free(dec);
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_BULK
+/* Bulk: uploads paced like the central sends them, and downloads */
+
+// The central's writes are instantaneous in the simulation, so the link is modelled here: a write
+// with response costs a connection event, writes without response go out packets_per_event at a time.
+struct upload_state {
+  uint8_t *sink;
+  size_t len;           // filled by the nordic_uart_yield() callback
+  size_t bulk_received; // filled by nordic_uart_bulk_receive()
+  esp_err_t bulk_result;
+  SemaphoreHandle_t done;
+};
+static struct upload_state upload;
+
+static void upload_receive(struct ble_gatt_access_ctxt *ctxt) {
+  for (const struct os_mbuf *om = ctxt->om; om; om = SLIST_NEXT(om, om_next)) {
+    memcpy(upload.sink + upload.len, om->om_data, om->om_len);
+    upload.len += om->om_len;
+  }
+}
+
+static void upload_bulk_task(void *arg) {
+  const size_t size = (size_t)arg;
+  upload.bulk_result = nordic_uart_bulk_receive(upload.sink, size, &upload.bulk_received, pdMS_TO_TICKS(60000));
+  xSemaphoreGive(upload.done);
+  vTaskDelete(NULL);
+}
+
+static void report_upload(const char *label, size_t len, int64_t start, int64_t device_us, size_t writes) {
+  const double elapsed = (esp_timer_get_time() - start) / 1e6;
+  printf("%-18s %.0f (%zu bytes in %zu writes, %.1f us/KB in the write handler)\n", label, len / elapsed, len, writes,
+         device_us * 1024.0 / len);
+}
+
+static void bench_bulk(const struct bench_options *options) {
+  static const ble_uuid128_t bulk_uuid =
+      BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x06, 0x00, 0x40, 0x6e);
+  static const ble_uuid128_t bulk_control_uuid =
+      BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x07, 0x00, 0x40, 0x6e);
+  const size_t len = options->quick ? 16 * 1024 : 256 * 1024;
+  const uint32_t interval_us = options->link.conn_interval_us;
+  uint8_t *data = malloc(len);
+  uint8_t *received = malloc(len + len / 8 + 64);
+  uint8_t block[BLE_ATT_MTU_MAX];
+  upload.sink = malloc(len);
+  upload.done = xSemaphoreCreateBinary();
+  for (size_t i = 0; i < len; ++i)
+    data[i] = (uint8_t)(i * 7);
+
+  nordic_uart_start("Nordic UART", NULL);
+  const uint16_t conn = connect_central();
+  const uint16_t bulk_handle = sim_link_chr_handle(&bulk_uuid.u);
+  const uint16_t control_handle = sim_link_chr_handle(&bulk_control_uuid.u);
+
+  // what web/index.html did: 128 byte writes, each awaited, handed to a nordic_uart_yield() callback
+  upload.len = 0;
+  nordic_uart_yield(upload_receive);
+  int64_t device_us = 0;
+  size_t writes = 0;
+  int64_t start = esp_timer_get_time();
+  for (size_t off = 0; off < len; off += 128, ++writes) {
+    const int64_t t = esp_timer_get_time();
+    sim_link_write(conn, data + off, MIN(128, len - off));
+    device_us += esp_timer_get_time() - t;
+    usleep(interval_us);
+  }
+  for (int i = 0; i < 1000 && upload.len < len; ++i)
+    usleep(1000);
+  report_upload("rx acked bytes/s", upload.len, start, device_us, writes);
+  nordic_uart_yield(NULL);
+
+  // bulk: one START, then blocks written without response
+  xTaskCreate(upload_bulk_task, "bulk_rx", 4096, (void *)len, 5, NULL);
+  vTaskDelay(pdMS_TO_TICKS(20));
+  device_us = 0;
+  writes = 0;
+  start = esp_timer_get_time();
+  const uint8_t msg[5] = {NORDIC_UART_BULK_START, len, len >> 8, len >> 16, len >> 24};
+  sim_link_write_chr(conn, &bulk_control_uuid.u, msg, sizeof(msg));
+  usleep(interval_us); // the write and the READY notification
+  uint8_t ready[3] = {0};
+  sim_link_wait_received(conn, control_handle, sizeof(ready), 1000);
+  sim_link_received(conn, control_handle, ready, sizeof(ready));
+  const size_t payload = ready[1] | ready[2] << 8;
+  uint16_t seq = 0;
+  for (size_t off = 0; payload && off < len; off += payload, ++seq, ++writes) {
+    const size_t n = MIN(payload, len - off);
+    block[0] = seq;
+    block[1] = seq >> 8;
+    memcpy(block + 2, data + off, n);
+    const uint32_t crc = _nordic_uart_crc32(0, block, n + 2);
+    for (int i = 0; i < 4; ++i)
+      block[n + 2 + i] = crc >> (8 * i);
+    const int64_t t = esp_timer_get_time();
+    sim_link_write_chr(conn, &bulk_uuid.u, block, n + NORDIC_UART_BULK_OVERHEAD);
+    device_us += esp_timer_get_time() - t;
+    if ((writes + 1) % options->link.packets_per_event == 0)
+      usleep(interval_us);
+  }
+  xSemaphoreTake(upload.done, portMAX_DELAY);
+  if (upload.bulk_result != ESP_OK || memcmp(upload.sink, data, len) != 0)
+    fprintf(stderr, "bulk upload failed: %s\n", esp_err_to_name(upload.bulk_result));
+  report_upload("rx bulk bytes/s", upload.bulk_received, start, device_us, writes);
+  while (sim_link_received(conn, control_handle, block, sizeof(block)) > 0) {
+  }
+
+  // downloads: the console stream against bulk blocks with their sequence numbers and CRCs
+  sim_link_reset_stats();
+  start = esp_timer_get_time();
+  nordic_uart_write(data, len);
+  sim_link_wait_received(conn, 0, len, 60000);
+  report_tx("tx write bytes/s", len, start);
+  while (sim_link_received(conn, 0, received, len) > 0) {
+  }
+  const size_t blocks = (len + payload - 1) / payload;
+  sim_link_reset_stats();
+  start = esp_timer_get_time();
+  nordic_uart_bulk_send(conn, data, len);
+  sim_link_wait_received(conn, bulk_handle, len + blocks * NORDIC_UART_BULK_OVERHEAD, 60000);
+  report_tx("tx bulk bytes/s", len, start);
+
+  sim_link_disconnect(conn);
+  nordic_uart_stop();
+  vSemaphoreDelete(upload.done);
+  free(upload.sink);
+  free(received);
+  free(data);
+}
+#endif
+
+static void usage(void) {
+  fprintf(stderr, "usage: bench_host [--quick] [--mtu N] [--interval-us N] [--packets N] [--mbufs N] "
+                  "[--line-len N] [--profile default|high-throughput|low-power] [--framing line|cobs|slip|varint] "
+                  "[--coalesce-ms N]\n");
+  exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv) {
+  struct bench_options options = {.line_len = 32, .coalesce_ms = 5};
+  sim_link_default_config(&options.link);
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--quick") == 0) {
+      options.quick = true;
+    } else if (i + 1 < argc && strcmp(argv[i], "--mtu") == 0) {
+      options.link.mtu = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "--interval-us") == 0) {
+      options.link.conn_interval_us = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "--packets") == 0) {
+      options.link.packets_per_event = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "--mbufs") == 0) {
+      options.link.mbuf_count = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "--line-len") == 0) {
+      options.line_len = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "--profile") == 0) {
+      ++i;
+      if (strcmp(argv[i], "high-throughput") == 0)
+        options.profile = NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT;
+      else if (strcmp(argv[i], "low-power") == 0)
+        options.profile = NORDIC_UART_LINK_PROFILE_LOW_POWER;
+      else if (strcmp(argv[i], "default") != 0)
+        usage();
+    } else if (i + 1 < argc && strcmp(argv[i], "--coalesce-ms") == 0) {
+      options.coalesce_ms = atoi(argv[++i]);
+    } else if (i + 1 < argc && strcmp(argv[i], "--framing") == 0) {
+      ++i;
+      if (strcmp(argv[i], "cobs") == 0)
+        options.framing = NORDIC_UART_FRAMING_COBS;
+      else if (strcmp(argv[i], "slip") == 0)
+        options.framing = NORDIC_UART_FRAMING_SLIP;
+      else if (strcmp(argv[i], "varint") == 0)
+        options.framing = NORDIC_UART_FRAMING_VARINT;
+      else if (strcmp(argv[i], "line") != 0)
+        usage();
+    } else {
+      usage();
+    }
+  }
+  if (options.line_len < 2 || options.line_len > CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1)
+    usage();
+
+  esp_log_level_set("*", ESP_LOG_WARN);
+  sim_link_configure(&options.link);
+  nordic_uart_set_link_profile(options.profile);
+  printf("link: mtu %u, interval %u us, %u packets/event, %u mbufs of %u bytes\n", options.link.mtu,
+         options.link.conn_interval_us, options.link.packets_per_event, options.link.mbuf_count,
+         options.link.mbuf_block_size);
+
+  bench_rx(&options, 0);
+  bench_rx(&options, 16);
+  bench_rx_transport(&options);
+#if defined(CONFIG_NORDIC_UART_RX_WORKER) && defined(CONFIG_NORDIC_UART_TRACE)
+  bench_rx_worker(&options);
+#endif
+  bench_tx(&options);
+  bench_tx_chatty(&options);
+  bench_tx_latency(&options);
+  bench_restart(&options);
+#ifdef CONFIG_NORDIC_UART_LATENCY
+  bench_latency(&options);
+#endif
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  bench_compress(&options);
+#endif
+#ifdef CONFIG_NORDIC_UART_BULK
+  bench_bulk(&options);
+#endif
+  return EXIT_SUCCESS;
+}
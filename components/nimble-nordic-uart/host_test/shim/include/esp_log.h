@@ -0,0 +1,28 @@
+#pragma once
+
+#include <stdio.h>
+
+#include "esp_err.h"
+
+typedef enum {
+  ESP_LOG_NONE,
+  ESP_LOG_ERROR,
+  ESP_LOG_WARN,
+  ESP_LOG_INFO,
+  ESP_LOG_DEBUG,
+  ESP_LOG_VERBOSE,
+} esp_log_level_t;
+
+extern esp_log_level_t shim_log_level;
+void esp_log_level_set(const char *tag, esp_log_level_t level);
+
+#define SHIM_LOG(level, letter, tag, fmt, ...)                                                                        \
+  do {                                                                                                                \
+    if (shim_log_level >= (level))                                                                                    \
+      fprintf(stderr, letter " (%s) " fmt "\n", tag, ##__VA_ARGS__);                                                  \
+  } while (0)
+#define ESP_LOGE(tag, fmt, ...) SHIM_LOG(ESP_LOG_ERROR, "E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) SHIM_LOG(ESP_LOG_WARN, "W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) SHIM_LOG(ESP_LOG_INFO, "I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) SHIM_LOG(ESP_LOG_DEBUG, "D", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGV(tag, fmt, ...) SHIM_LOG(ESP_LOG_VERBOSE, "V", tag, fmt, ##__VA_ARGS__)
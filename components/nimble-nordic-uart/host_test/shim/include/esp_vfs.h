@@ -0,0 +1,49 @@
+// Host stand-in for the ESP-IDF VFS registry. Only the entry points the component fills in exist;
+// libc is not hooked, so tests reach a registered device through the shim_vfs_* calls below.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/select.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "esp_err.h"
+
+#define ESP_VFS_FLAG_DEFAULT 0
+
+typedef struct {
+  bool is_sem_local;
+  void *sem;
+} esp_vfs_select_sem_t;
+
+typedef struct {
+  int flags;
+  ssize_t (*write)(int fd, const void *data, size_t size);
+  ssize_t (*read)(int fd, void *dst, size_t size);
+  int (*open)(const char *path, int flags, int mode);
+  int (*close)(int fd);
+  int (*fstat)(int fd, struct stat *st);
+  int (*fcntl)(int fd, int cmd, int arg);
+  int (*fsync)(int fd);
+  esp_err_t (*start_select)(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds, esp_vfs_select_sem_t sem,
+                            void **end_select_args);
+  esp_err_t (*end_select)(void *end_select_args);
+} esp_vfs_t;
+
+esp_err_t esp_vfs_register(const char *base_path, const esp_vfs_t *vfs, void *ctx);
+esp_err_t esp_vfs_unregister(const char *base_path);
+void esp_vfs_select_triggered(esp_vfs_select_sem_t sem);
+
+// Host only: what newlib would do for a path below a registered base path. File descriptors are
+// the device's own, the calls return -1 with errno set like their POSIX namesakes.
+int shim_vfs_open(const char *path, int flags);
+ssize_t shim_vfs_read(const char *path, int fd, void *dst, size_t size);
+ssize_t shim_vfs_write(const char *path, int fd, const void *data, size_t size);
+int shim_vfs_close(const char *path, int fd);
+int shim_vfs_fstat(const char *path, int fd, struct stat *st);
+int shim_vfs_fcntl(const char *path, int fd, int cmd, int arg);
+int shim_vfs_fsync(const char *path, int fd);
+// select() on one descriptor: returns 1 with *readable / *writable set, 0 on timeout, -1 on error.
+int shim_vfs_select(const char *path, int fd, bool *readable, bool *writable, uint32_t timeout_ms);
@@ -0,0 +1,39 @@
+// Host stand-in for the subset of FreeRTOS used by the component.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t StackType_t;
+
+#define pdTRUE 1
+#define pdFALSE 0
+#define pdPASS 1
+#define pdFAIL 0
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define configTICK_RATE_HZ 1000
+#define portTICK_PERIOD_MS (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(ms))
+#define tskNO_AFFINITY 0x7FFFFFFF
+#define configMAX_PRIORITIES 25
+
+typedef struct {
+  int unused;
+} portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED {0}
+void shim_critical_enter(void);
+void shim_critical_exit(void);
+#define portENTER_CRITICAL(mux) ((void)(mux), shim_critical_enter())
+#define portEXIT_CRITICAL(mux) ((void)(mux), shim_critical_exit())
+#define portENTER_CRITICAL_ISR(mux) shim_critical_enter()
+#define portEXIT_CRITICAL_ISR(mux) shim_critical_exit()
+#define taskENTER_CRITICAL(mux) shim_critical_enter()
+#define taskEXIT_CRITICAL(mux) shim_critical_exit()
+
+#include "freertos/task.h"
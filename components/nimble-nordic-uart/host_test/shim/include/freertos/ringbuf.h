@@ -0,0 +1,30 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+  RINGBUF_TYPE_NOSPLIT = 0,
+  RINGBUF_TYPE_ALLOWSPLIT,
+  RINGBUF_TYPE_BYTEBUF,
+  RINGBUF_TYPE_MAX,
+} RingbufferType_t;
+
+typedef struct shim_ringbuf *RingbufHandle_t;
+
+// Storage for xRingbufferCreateStatic(); only its size matters on the host.
+typedef struct {
+  uint8_t opaque[sizeof(void *) * 24];
+} StaticRingbuffer_t;
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type);
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t *storage,
+                                        StaticRingbuffer_t *buffer);
+void vRingbufferDelete(RingbufHandle_t ringbuf);
+UBaseType_t xRingbufferSend(RingbufHandle_t ringbuf, const void *item, size_t size, TickType_t ticks);
+void *xRingbufferReceive(RingbufHandle_t ringbuf, size_t *size, TickType_t ticks);
+void *xRingbufferReceiveUpTo(RingbufHandle_t ringbuf, size_t *size, TickType_t ticks, size_t max_size);
+void vRingbufferReturnItem(RingbufHandle_t ringbuf, void *item);
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t ringbuf);
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t ringbuf);
+void vRingbufferGetInfo(RingbufHandle_t ringbuf, UBaseType_t *free, UBaseType_t *read, UBaseType_t *write,
+                        UBaseType_t *acquire, UBaseType_t *items_waiting);
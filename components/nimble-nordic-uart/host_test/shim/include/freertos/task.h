@@ -0,0 +1,41 @@
+#pragma once
+
+#include "freertos/FreeRTOS.h"
+
+typedef struct shim_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+// Storage for xTaskCreateStatic(); only its size matters on the host.
+typedef struct {
+  uint8_t opaque[sizeof(void *) * 90];
+} StaticTask_t;
+
+typedef enum { eNoAction, eSetBits, eIncrement, eSetValueWithOverwrite, eSetValueWithoutOverwrite } eNotifyAction;
+typedef enum { eRunning, eReady, eBlocked, eSuspended, eDeleted, eInvalid } eTaskState;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id);
+#define xTaskCreate(fn, name, stack, param, prio, handle)                                                             \
+  xTaskCreatePinnedToCore(fn, name, stack, param, prio, handle, tskNO_AFFINITY)
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                           UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb,
+                                           BaseType_t core_id);
+#define xTaskCreateStatic(fn, name, stack_depth, param, prio, stack, tcb)                                            \
+  xTaskCreateStaticPinnedToCore(fn, name, stack_depth, param, prio, stack, tcb, tskNO_AFFINITY)
+void vTaskDelete(TaskHandle_t task);
+void vTaskSuspend(TaskHandle_t task);
+void vTaskResume(TaskHandle_t task);
+eTaskState eTaskGetState(TaskHandle_t task);
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task);
+BaseType_t xTaskGetAffinity(TaskHandle_t task);
+// Looks the name up among the tasks that have not exited, NULL when there is none.
+TaskHandle_t xTaskGetHandle(const char *name);
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks);
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+#define xTaskNotifyFromISR(task, value, action, woken) xTaskNotify(task, value, action)
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <sys/queue.h>
+
+struct os_mbuf_pool;
+
+struct os_mbuf {
+  uint8_t *om_data;
+  uint8_t om_flags;
+  uint8_t om_pkthdr_len;
+  uint16_t om_len;
+  struct os_mbuf_pool *om_omp;
+  SLIST_ENTRY(os_mbuf) om_next;
+  uint8_t om_databuf[0];
+};
+
+struct os_mbuf_pkthdr {
+  uint16_t omp_len;
+  uint16_t omp_flags;
+  STAILQ_ENTRY(os_mbuf_pkthdr) omp_next;
+};
+
+#define OS_MBUF_PKTHDR(__om) ((struct os_mbuf_pkthdr *)(void *)((uint8_t *)&(__om)->om_data + sizeof(struct os_mbuf)))
+#define OS_MBUF_PKTLEN(__om) (os_mbuf_pktlen(__om))
+#define OS_MBUF_DATA(__om, __type) ((__type)((__om)->om_data))
+
+uint16_t os_mbuf_pktlen(const struct os_mbuf *om);
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len);
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len);
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst);
+int os_mbuf_free_chain(struct os_mbuf *om);
+int os_msys_num_free(void);
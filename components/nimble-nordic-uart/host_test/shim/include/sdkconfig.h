@@ -0,0 +1,2 @@
+// Configuration values come from the host CMakeLists.txt as compile definitions.
+#pragma once
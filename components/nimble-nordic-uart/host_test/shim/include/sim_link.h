@@ -0,0 +1,73 @@
+// Simulated BLE central and radio link for the host build.
+//
+// The component talks to the stand-in NimBLE API in shim/src/nimble.c; this
+// header is the other side of the link, used by host tests and benchmarks to
+// connect, write to characteristics and collect notifications.
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "host/ble_hs.h"
+
+struct sim_link_config {
+  uint16_t mtu;               // ATT MTU the central offers in the exchange (23 = no exchange)
+  uint32_t conn_interval_us;  // time between connection events
+  uint16_t packets_per_event; // notifications delivered per connection event
+  uint16_t mbuf_count;        // msys mbuf pool size, which bounds the notifications waiting to be sent
+  uint16_t mbuf_block_size;   // data bytes per mbuf
+  bool phy_2m;                // whether the central accepts the LE 2M PHY
+  bool reject_link_updates;   // turn down connection parameter, PHY and data length requests
+};
+
+struct sim_link_stats {
+  uint32_t notifications;
+  uint64_t notified_bytes;
+  uint32_t max_notification_len;
+  uint32_t mbuf_enomem; // allocations that found the mbuf pool empty
+  uint32_t adv_starts;
+  uint32_t adv_data_sets;
+  uint32_t conn_param_updates;
+  uint32_t phy_updates;
+  uint32_t data_len_updates;
+};
+
+void sim_link_default_config(struct sim_link_config *config);
+// Takes effect at the next nimble_port_init().
+void sim_link_configure(const struct sim_link_config *config);
+
+bool sim_link_wait_advertising(uint32_t timeout_ms);
+bool sim_link_advertising(void);
+const struct ble_gap_adv_params *sim_link_adv_params(void);
+bool sim_link_adv_directed(void);
+int32_t sim_link_adv_duration_ms(void);
+
+// Connects the central, returns BLE_HS_CONN_HANDLE_NONE when not advertising.
+uint16_t sim_link_connect(void);
+// Connects as a specific central; `peer_id` becomes the low byte of its address.
+uint16_t sim_link_connect_as(uint8_t peer_id);
+void sim_link_disconnect(uint16_t conn_handle);
+bool sim_link_connected(uint16_t conn_handle);
+uint16_t sim_link_mtu(uint16_t conn_handle);
+
+// Writes to the Nordic UART RX characteristic; returns the access callback status.
+int sim_link_write(uint16_t conn_handle, const void *data, size_t len);
+int sim_link_write_chr(uint16_t conn_handle, const ble_uuid_t *uuid, const void *data, size_t len);
+// Value handle of a characteristic, 0 when the component has none with that UUID.
+uint16_t sim_link_chr_handle(const ble_uuid_t *uuid);
+int sim_link_read_chr(uint16_t conn_handle, const ble_uuid_t *uuid, void *buf, size_t max_len, size_t *out_len);
+
+// Bytes delivered to the central by notifications on `attr_handle` (0 = any).
+size_t sim_link_received(uint16_t conn_handle, uint16_t attr_handle, void *buf, size_t max_len);
+size_t sim_link_received_pending(uint16_t conn_handle, uint16_t attr_handle);
+bool sim_link_wait_received(uint16_t conn_handle, uint16_t attr_handle, size_t len, uint32_t timeout_ms);
+// Lengths of the notifications delivered so far (oldest first), returns the count copied.
+size_t sim_link_notification_sizes(uint16_t conn_handle, uint16_t *sizes, size_t max_count);
+// Notification handler invoked from the link thread for every delivered notification.
+void sim_link_set_notify_handler(void (*handler)(uint16_t conn_handle, uint16_t attr_handle, const uint8_t *data,
+                                                 size_t len, void *arg),
+                                 void *arg);
+
+void sim_link_get_stats(struct sim_link_stats *stats);
+void sim_link_reset_stats(void);
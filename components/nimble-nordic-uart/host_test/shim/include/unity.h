@@ -0,0 +1,75 @@
+// Subset of Unity and the ESP-IDF unity component, enough to run the component's
+// TEST_CASEs on the host. Failed assertions abort the current test case only.
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+typedef void (*unity_test_fn)(void);
+
+void unity_register_test(const char *name, const char *tags, unity_test_fn fn, const char *file, int line);
+void unity_fail(const char *file, int line, const char *fmt, ...) __attribute__((noreturn, format(printf, 3, 4)));
+
+#define UNITY_CAT_(a, b) a##b
+#define UNITY_CAT(a, b) UNITY_CAT_(a, b)
+
+#define TEST_CASE(name_, tags_)                                                                                       \
+  static void UNITY_CAT(unity_test_, __LINE__)(void);                                                                 \
+  __attribute__((constructor)) static void UNITY_CAT(unity_register_, __LINE__)(void) {                               \
+    unity_register_test(name_, tags_, UNITY_CAT(unity_test_, __LINE__), __FILE__, __LINE__);                          \
+  }                                                                                                                   \
+  static void UNITY_CAT(unity_test_, __LINE__)(void)
+
+#define TEST_FAIL_MESSAGE(msg) unity_fail(__FILE__, __LINE__, "%s", msg)
+
+#define TEST_ASSERT(cond)                                                                                             \
+  do {                                                                                                                \
+    if (!(cond))                                                                                                      \
+      unity_fail(__FILE__, __LINE__, "%s", #cond);                                                                    \
+  } while (0)
+#define TEST_ASSERT_TRUE(cond) TEST_ASSERT(cond)
+#define TEST_ASSERT_FALSE(cond) TEST_ASSERT(!(cond))
+#define TEST_ASSERT_NULL(ptr) TEST_ASSERT((ptr) == NULL)
+#define TEST_ASSERT_NOT_NULL(ptr) TEST_ASSERT((ptr) != NULL)
+
+#define UNITY_CMP_INT(op, expected, actual)                                                                           \
+  do {                                                                                                                \
+    const long long unity_e = (long long)(expected);                                                                  \
+    const long long unity_a = (long long)(actual);                                                                    \
+    if (!(unity_a op unity_e))                                                                                        \
+      unity_fail(__FILE__, __LINE__, "%s: expected %s %lld, was %lld", #actual, #op, unity_e, unity_a);               \
+  } while (0)
+
+#define TEST_ASSERT_EQUAL(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_EQUAL_INT(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_EQUAL_INT32(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_EQUAL_UINT8(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_EQUAL_UINT16(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_EQUAL_UINT32(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_EQUAL_HEX8(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_EQUAL_HEX32(expected, actual) UNITY_CMP_INT(==, expected, actual)
+#define TEST_ASSERT_NOT_EQUAL(expected, actual) UNITY_CMP_INT(!=, expected, actual)
+// Unity's threshold comes first: TEST_ASSERT_GREATER_THAN(threshold, actual) checks actual > threshold
+#define TEST_ASSERT_GREATER_THAN(threshold, actual) UNITY_CMP_INT(>, threshold, actual)
+#define TEST_ASSERT_GREATER_OR_EQUAL(threshold, actual) UNITY_CMP_INT(>=, threshold, actual)
+#define TEST_ASSERT_LESS_THAN(threshold, actual) UNITY_CMP_INT(<, threshold, actual)
+#define TEST_ASSERT_LESS_OR_EQUAL(threshold, actual) UNITY_CMP_INT(<=, threshold, actual)
+
+#define TEST_ASSERT_EQUAL_STRING(expected, actual)                                                                    \
+  do {                                                                                                                \
+    const char *unity_e = (expected);                                                                                 \
+    const char *unity_a = (actual);                                                                                   \
+    if (unity_a == NULL || strcmp(unity_e, unity_a) != 0)                                                             \
+      unity_fail(__FILE__, __LINE__, "expected \"%s\", was \"%s\"", unity_e, unity_a ? unity_a : "(null)");           \
+  } while (0)
+
+#define TEST_ASSERT_EQUAL_MEMORY(expected, actual, len)                                                               \
+  do {                                                                                                                \
+    if (memcmp((expected), (actual), (len)) != 0)                                                                     \
+      unity_fail(__FILE__, __LINE__, "%s differs from %s", #actual, #expected);                                       \
+  } while (0)
+
+#define TEST_ESP_OK(rc) UNITY_CMP_INT(==, ESP_OK, rc)
+#define TEST_ESP_ERR(err, rc) UNITY_CMP_INT(==, err, rc)
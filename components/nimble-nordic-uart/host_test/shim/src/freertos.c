@@ -0,0 +1,667 @@
+// pthread-backed stand-ins for the FreeRTOS and ESP-IDF services the component uses.
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "esp_cpu.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include "nvs_flash.h"
+
+esp_log_level_t shim_log_level = ESP_LOG_WARN;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) { shim_log_level = level; }
+
+const char *esp_err_to_name(esp_err_t code) {
+  switch (code) {
+  case ESP_OK:
+    return "ESP_OK";
+  case ESP_FAIL:
+    return "ESP_FAIL";
+  case ESP_ERR_NO_MEM:
+    return "ESP_ERR_NO_MEM";
+  case ESP_ERR_INVALID_ARG:
+    return "ESP_ERR_INVALID_ARG";
+  case ESP_ERR_INVALID_STATE:
+    return "ESP_ERR_INVALID_STATE";
+  case ESP_ERR_TIMEOUT:
+    return "ESP_ERR_TIMEOUT";
+  default:
+    return "ESP_ERR";
+  }
+}
+
+esp_err_t nvs_flash_init(void) { return ESP_OK; }
+
+void *heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+void heap_caps_free(void *ptr) { free(ptr); }
+
+/* time */
+
+static struct timespec _epoch;
+static pthread_once_t _epoch_once = PTHREAD_ONCE_INIT;
+static void _epoch_init(void) { clock_gettime(CLOCK_MONOTONIC, &_epoch); }
+
+int64_t esp_timer_get_time(void) {
+  pthread_once(&_epoch_once, _epoch_init);
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (int64_t)(now.tv_sec - _epoch.tv_sec) * 1000000 + (now.tv_nsec - _epoch.tv_nsec) / 1000;
+}
+
+esp_cpu_cycle_count_t esp_cpu_get_cycle_count(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (esp_cpu_cycle_count_t)((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+TickType_t xTaskGetTickCount(void) { return (TickType_t)(esp_timer_get_time() / 1000); }
+
+// absolute CLOCK_REALTIME deadline for a tick timeout, NULL when waiting forever
+static const struct timespec *_deadline(TickType_t ticks, struct timespec *ts) {
+  if (ticks == portMAX_DELAY)
+    return NULL;
+  clock_gettime(CLOCK_REALTIME, ts);
+  ts->tv_sec += ticks / 1000;
+  ts->tv_nsec += (long)(ticks % 1000) * 1000000L;
+  if (ts->tv_nsec >= 1000000000L) {
+    ts->tv_sec += 1;
+    ts->tv_nsec -= 1000000000L;
+  }
+  return ts;
+}
+
+// wait on cond until woken or deadline; returns false on timeout
+bool shim_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline) {
+  if (deadline == NULL) {
+    pthread_cond_wait(cond, mutex);
+    return true;
+  }
+  return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+const struct timespec *shim_deadline(TickType_t ticks, struct timespec *ts) { return _deadline(ticks, ts); }
+
+/* critical sections */
+
+static pthread_mutex_t _critical;
+static pthread_once_t _critical_once = PTHREAD_ONCE_INIT;
+static void _critical_init(void) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&_critical, &attr);
+}
+void shim_critical_enter(void) {
+  pthread_once(&_critical_once, _critical_init);
+  pthread_mutex_lock(&_critical);
+}
+void shim_critical_exit(void) { pthread_mutex_unlock(&_critical); }
+
+/* tasks */
+
+struct shim_task {
+  pthread_t thread;
+  TaskFunction_t fn;
+  void *param;
+  char name[16];
+  UBaseType_t priority;
+  BaseType_t core_id;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  uint32_t notify_value;
+  bool notify_pending;
+  bool suspended; // parked in vTaskSuspend(NULL) until another task deletes it
+  bool held;      // suspended by another task, stops at its next queue or semaphore wait
+  bool deleted;
+  struct shim_task *next; // in _tasks while it runs
+};
+
+static __thread struct shim_task *_current_task;
+static struct shim_task *_tasks;
+static pthread_mutex_t _tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void _task_unlink(struct shim_task *task) {
+  pthread_mutex_lock(&_tasks_mutex);
+  for (struct shim_task **link = &_tasks; *link; link = &(*link)->next) {
+    if (*link == task) {
+      *link = task->next;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&_tasks_mutex);
+}
+
+static struct shim_task *_task_new(const char *name) {
+  struct shim_task *task = calloc(1, sizeof(*task));
+  snprintf(task->name, sizeof(task->name), "%s", name);
+  pthread_mutex_init(&task->mutex, NULL);
+  pthread_cond_init(&task->cond, NULL);
+  return task;
+}
+
+static void *_task_entry(void *arg) {
+  struct shim_task *task = arg;
+  _current_task = task;
+  task->fn(task->param);
+  _task_unlink(task);
+  return NULL;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                   UBaseType_t priority, TaskHandle_t *handle, BaseType_t core_id) {
+  struct shim_task *task = _task_new(name);
+  task->fn = fn;
+  task->param = param;
+  task->priority = priority;
+  task->core_id = core_id;
+  if (handle)
+    *handle = task;
+  pthread_mutex_lock(&_tasks_mutex);
+  task->next = _tasks;
+  _tasks = task;
+  pthread_mutex_unlock(&_tasks_mutex);
+  if (pthread_create(&task->thread, NULL, _task_entry, task) != 0) {
+    _task_unlink(task);
+    free(task);
+    return pdFAIL;
+  }
+  pthread_detach(task->thread);
+  return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char *name, uint32_t stack_depth, void *param,
+                                           UBaseType_t priority, StackType_t *stack, StaticTask_t *tcb,
+                                           BaseType_t core_id) {
+  TaskHandle_t handle;
+  if (xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, &handle, core_id) != pdPASS)
+    return NULL;
+  return handle;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void) {
+  if (_current_task == NULL) {
+    _current_task = _task_new("main");
+    _current_task->thread = pthread_self();
+    _current_task->core_id = tskNO_AFFINITY;
+  }
+  return _current_task;
+}
+
+UBaseType_t uxTaskPriorityGet(TaskHandle_t task) { return (task ? task : xTaskGetCurrentTaskHandle())->priority; }
+
+BaseType_t xTaskGetAffinity(TaskHandle_t task) { return (task ? task : xTaskGetCurrentTaskHandle())->core_id; }
+
+TaskHandle_t xTaskGetHandle(const char *name) {
+  pthread_mutex_lock(&_tasks_mutex);
+  struct shim_task *task = _tasks;
+  while (task && strcmp(task->name, name) != 0)
+    task = task->next;
+  pthread_mutex_unlock(&_tasks_mutex);
+  return task;
+}
+
+// Another task can only be deleted while it is suspended; a thread cannot be stopped anywhere else.
+void vTaskDelete(TaskHandle_t task) {
+  if (task == NULL || task == _current_task) {
+    if (_current_task)
+      _task_unlink(_current_task);
+    pthread_exit(NULL);
+  }
+  pthread_mutex_lock(&task->mutex);
+  const bool suspended = task->suspended;
+  task->deleted = true;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->mutex);
+  if (!suspended) {
+    fprintf(stderr, "vTaskDelete: the host shim only deletes suspended tasks\n");
+    abort();
+  }
+  _task_unlink(task);
+}
+
+// A thread cannot be stopped from outside, so another task is only held at its next queue or
+// semaphore wait, until vTaskResume(). A task that suspends itself waits for vTaskDelete() and exits.
+void vTaskSuspend(TaskHandle_t task) {
+  if (task != NULL && task != _current_task) {
+    pthread_mutex_lock(&task->mutex);
+    task->held = true;
+    pthread_mutex_unlock(&task->mutex);
+    return;
+  }
+  task = xTaskGetCurrentTaskHandle();
+  pthread_mutex_lock(&task->mutex);
+  task->suspended = true;
+  while (!task->deleted)
+    pthread_cond_wait(&task->cond, &task->mutex);
+  pthread_mutex_unlock(&task->mutex);
+  pthread_exit(NULL);
+}
+
+void vTaskResume(TaskHandle_t task) {
+  pthread_mutex_lock(&task->mutex);
+  task->held = false;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->mutex);
+}
+
+static void _task_hold_point(void) {
+  struct shim_task *task = _current_task;
+  if (task == NULL)
+    return;
+  pthread_mutex_lock(&task->mutex);
+  while (task->held)
+    pthread_cond_wait(&task->cond, &task->mutex);
+  pthread_mutex_unlock(&task->mutex);
+}
+
+eTaskState eTaskGetState(TaskHandle_t task) {
+  pthread_mutex_lock(&_tasks_mutex);
+  struct shim_task *found = _tasks;
+  while (found && found != task)
+    found = found->next;
+  pthread_mutex_unlock(&_tasks_mutex);
+  if (found == NULL)
+    return eDeleted;
+  pthread_mutex_lock(&task->mutex);
+  const eTaskState state = task->suspended ? eSuspended : eReady;
+  pthread_mutex_unlock(&task->mutex);
+  return state;
+}
+
+void vTaskDelay(TickType_t ticks) { usleep((useconds_t)ticks * 1000); }
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value, eNotifyAction action) {
+  BaseType_t ret = pdPASS;
+  pthread_mutex_lock(&task->mutex);
+  switch (action) {
+  case eSetBits:
+    task->notify_value |= value;
+    break;
+  case eIncrement:
+    task->notify_value++;
+    break;
+  case eSetValueWithOverwrite:
+    task->notify_value = value;
+    break;
+  case eSetValueWithoutOverwrite:
+    if (task->notify_pending)
+      ret = pdFAIL;
+    else
+      task->notify_value = value;
+    break;
+  case eNoAction:
+    break;
+  }
+  task->notify_pending = true;
+  pthread_cond_broadcast(&task->cond);
+  pthread_mutex_unlock(&task->mutex);
+  return ret;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) { return xTaskNotify(task, 0, eIncrement); }
+
+BaseType_t xTaskNotifyWait(uint32_t clear_on_entry, uint32_t clear_on_exit, uint32_t *value, TickType_t ticks) {
+  struct shim_task *task = xTaskGetCurrentTaskHandle();
+  struct timespec ts;
+  const struct timespec *deadline = _deadline(ticks, &ts);
+  BaseType_t ret = pdTRUE;
+
+  pthread_mutex_lock(&task->mutex);
+  if (!task->notify_pending)
+    task->notify_value &= ~clear_on_entry;
+  while (!task->notify_pending) {
+    if (ticks == 0 || !shim_cond_wait(&task->cond, &task->mutex, deadline)) {
+      if (!task->notify_pending) {
+        ret = pdFALSE;
+        break;
+      }
+    }
+  }
+  if (value)
+    *value = task->notify_value;
+  if (ret == pdTRUE) {
+    task->notify_value &= ~clear_on_exit;
+    task->notify_pending = false;
+  }
+  pthread_mutex_unlock(&task->mutex);
+  return ret;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks) {
+  struct shim_task *task = xTaskGetCurrentTaskHandle();
+  struct timespec ts;
+  const struct timespec *deadline = _deadline(ticks, &ts);
+  uint32_t value;
+
+  pthread_mutex_lock(&task->mutex);
+  while (task->notify_value == 0 && ticks != 0) {
+    if (!shim_cond_wait(&task->cond, &task->mutex, deadline))
+      break;
+  }
+  value = task->notify_value;
+  if (value) {
+    task->notify_value = clear_on_exit ? 0 : value - 1;
+  }
+  task->notify_pending = false;
+  pthread_mutex_unlock(&task->mutex);
+  return value;
+}
+
+/* queues and semaphores */
+
+struct shim_queue {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  UBaseType_t length;
+  UBaseType_t item_size;
+  UBaseType_t count;
+  UBaseType_t head;
+  uint8_t *storage;
+  bool static_storage;
+};
+
+static QueueHandle_t _queue_create(UBaseType_t length, UBaseType_t item_size, uint8_t *storage) {
+  struct shim_queue *queue = calloc(1, sizeof(*queue));
+  pthread_mutex_init(&queue->mutex, NULL);
+  pthread_cond_init(&queue->cond, NULL);
+  queue->length = length;
+  queue->item_size = item_size;
+  queue->static_storage = storage != NULL;
+  queue->storage = storage ? storage : calloc(length ? length : 1, item_size ? item_size : 1);
+  return queue;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t length, UBaseType_t item_size) {
+  return _queue_create(length, item_size, NULL);
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t *storage, StaticQueue_t *buffer) {
+  return _queue_create(length, item_size, storage);
+}
+
+void vQueueDelete(QueueHandle_t queue) {
+  if (queue == NULL)
+    return;
+  if (!queue->static_storage)
+    free(queue->storage);
+  free(queue);
+}
+
+static BaseType_t _queue_send(QueueHandle_t queue, const void *item, TickType_t ticks, bool front) {
+  struct timespec ts;
+  const struct timespec *deadline = _deadline(ticks, &ts);
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count >= queue->length) {
+    if (ticks == 0 || !shim_cond_wait(&queue->cond, &queue->mutex, deadline)) {
+      if (queue->count >= queue->length) {
+        pthread_mutex_unlock(&queue->mutex);
+        return pdFAIL;
+      }
+    }
+  }
+  UBaseType_t slot;
+  if (front) {
+    queue->head = (queue->head + queue->length - 1) % queue->length;
+    slot = queue->head;
+  } else {
+    slot = (queue->head + queue->count) % queue->length;
+  }
+  if (queue->item_size)
+    memcpy(queue->storage + slot * queue->item_size, item, queue->item_size);
+  queue->count++;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  return pdPASS;
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t ticks) {
+  return _queue_send(queue, item, ticks, false);
+}
+
+BaseType_t xQueueSendToFront(QueueHandle_t queue, const void *item, TickType_t ticks) {
+  return _queue_send(queue, item, ticks, true);
+}
+
+static BaseType_t _queue_receive(QueueHandle_t queue, void *item, TickType_t ticks, bool peek) {
+  _task_hold_point();
+  struct timespec ts;
+  const struct timespec *deadline = _deadline(ticks, &ts);
+  pthread_mutex_lock(&queue->mutex);
+  while (queue->count == 0) {
+    if (ticks == 0 || !shim_cond_wait(&queue->cond, &queue->mutex, deadline)) {
+      if (queue->count == 0) {
+        pthread_mutex_unlock(&queue->mutex);
+        return pdFAIL;
+      }
+    }
+  }
+  if (queue->item_size && item)
+    memcpy(item, queue->storage + queue->head * queue->item_size, queue->item_size);
+  if (!peek) {
+    queue->head = (queue->head + 1) % queue->length;
+    queue->count--;
+    pthread_cond_broadcast(&queue->cond);
+  }
+  pthread_mutex_unlock(&queue->mutex);
+  return pdPASS;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return _queue_receive(queue, item, ticks, false);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t ticks) {
+  return _queue_receive(queue, item, ticks, true);
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue) {
+  pthread_mutex_lock(&queue->mutex);
+  UBaseType_t count = queue->count;
+  pthread_mutex_unlock(&queue->mutex);
+  return count;
+}
+
+UBaseType_t uxQueueSpacesAvailable(QueueHandle_t queue) {
+  pthread_mutex_lock(&queue->mutex);
+  UBaseType_t spaces = queue->length - queue->count;
+  pthread_mutex_unlock(&queue->mutex);
+  return spaces;
+}
+
+BaseType_t xQueueReset(QueueHandle_t queue) {
+  pthread_mutex_lock(&queue->mutex);
+  queue->count = 0;
+  queue->head = 0;
+  pthread_cond_broadcast(&queue->cond);
+  pthread_mutex_unlock(&queue->mutex);
+  return pdPASS;
+}
+
+SemaphoreHandle_t xSemaphoreCreateCounting(UBaseType_t max, UBaseType_t initial) {
+  SemaphoreHandle_t sem = xQueueCreate(max, 0);
+  sem->count = initial;
+  return sem;
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void) { return xSemaphoreCreateCounting(1, 0); }
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t *buffer) { return xSemaphoreCreateBinary(); }
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void) { return xSemaphoreCreateCounting(1, 1); }
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t *buffer) { return xSemaphoreCreateMutex(); }
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t ticks) { return xQueueReceive(sem, NULL, ticks); }
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) { return xQueueSend(sem, NULL, 0); }
+
+/* event groups */
+
+struct shim_event_group {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  EventBits_t bits;
+};
+
+EventGroupHandle_t xEventGroupCreate(void) {
+  struct shim_event_group *group = calloc(1, sizeof(*group));
+  pthread_mutex_init(&group->mutex, NULL);
+  pthread_cond_init(&group->cond, NULL);
+  return group;
+}
+
+void vEventGroupDelete(EventGroupHandle_t group) { free(group); }
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->mutex);
+  group->bits |= bits;
+  EventBits_t ret = group->bits;
+  pthread_cond_broadcast(&group->cond);
+  pthread_mutex_unlock(&group->mutex);
+  return ret;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits) {
+  pthread_mutex_lock(&group->mutex);
+  EventBits_t ret = group->bits;
+  group->bits &= ~bits;
+  pthread_mutex_unlock(&group->mutex);
+  return ret;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group) {
+  pthread_mutex_lock(&group->mutex);
+  EventBits_t ret = group->bits;
+  pthread_mutex_unlock(&group->mutex);
+  return ret;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks) {
+  struct timespec ts;
+  const struct timespec *deadline = _deadline(ticks, &ts);
+  pthread_mutex_lock(&group->mutex);
+  for (;;) {
+    EventBits_t match = group->bits & bits;
+    if (wait_for_all ? match == bits : match != 0)
+      break;
+    if (ticks == 0 || !shim_cond_wait(&group->cond, &group->mutex, deadline))
+      break;
+  }
+  EventBits_t ret = group->bits;
+  EventBits_t match = group->bits & bits;
+  if (clear_on_exit && (wait_for_all ? match == bits : match != 0))
+    group->bits &= ~bits;
+  pthread_mutex_unlock(&group->mutex);
+  return ret;
+}
+
+/* esp_timer */
+
+struct shim_esp_timer {
+  esp_timer_create_args_t args;
+  pthread_t thread;
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  int64_t deadline_us;
+  uint64_t period_us;
+  bool armed;
+  bool deleted;
+};
+
+static void *_timer_thread(void *arg) {
+  struct shim_esp_timer *timer = arg;
+  pthread_mutex_lock(&timer->mutex);
+  while (!timer->deleted) {
+    if (!timer->armed) {
+      pthread_cond_wait(&timer->cond, &timer->mutex);
+      continue;
+    }
+    int64_t now = esp_timer_get_time();
+    if (now < timer->deadline_us) {
+      struct timespec ts;
+      _deadline((TickType_t)((timer->deadline_us - now + 999) / 1000), &ts);
+      pthread_cond_timedwait(&timer->cond, &timer->mutex, &ts);
+      continue;
+    }
+    if (timer->period_us)
+      timer->deadline_us += timer->period_us;
+    else
+      timer->armed = false;
+    pthread_mutex_unlock(&timer->mutex);
+    timer->args.callback(timer->args.arg);
+    pthread_mutex_lock(&timer->mutex);
+  }
+  pthread_mutex_unlock(&timer->mutex);
+  pthread_mutex_destroy(&timer->mutex);
+  free(timer);
+  return NULL;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args, esp_timer_handle_t *out_handle) {
+  struct shim_esp_timer *timer = calloc(1, sizeof(*timer));
+  timer->args = *args;
+  pthread_mutex_init(&timer->mutex, NULL);
+  pthread_cond_init(&timer->cond, NULL);
+  pthread_create(&timer->thread, NULL, _timer_thread, timer);
+  pthread_detach(timer->thread);
+  *out_handle = timer;
+  return ESP_OK;
+}
+
+static esp_err_t _timer_start(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us) {
+  pthread_mutex_lock(&timer->mutex);
+  if (timer->armed) {
+    pthread_mutex_unlock(&timer->mutex);
+    return ESP_ERR_INVALID_STATE;
+  }
+  timer->deadline_us = esp_timer_get_time() + timeout_us;
+  timer->period_us = period_us;
+  timer->armed = true;
+  pthread_cond_broadcast(&timer->cond);
+  pthread_mutex_unlock(&timer->mutex);
+  return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us) {
+  return _timer_start(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us) {
+  return _timer_start(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timer->mutex);
+  bool was_armed = timer->armed;
+  timer->armed = false;
+  pthread_cond_broadcast(&timer->cond);
+  pthread_mutex_unlock(&timer->mutex);
+  return was_armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+bool esp_timer_is_active(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timer->mutex);
+  bool armed = timer->armed;
+  pthread_mutex_unlock(&timer->mutex);
+  return armed;
+}
+
+esp_err_t esp_timer_delete(esp_timer_handle_t timer) {
+  pthread_mutex_lock(&timer->mutex);
+  timer->armed = false;
+  timer->deleted = true;
+  pthread_cond_broadcast(&timer->cond);
+  pthread_mutex_unlock(&timer->mutex);
+  return ESP_OK;
+}
@@ -0,0 +1,1202 @@
+// Stand-in NimBLE host with a simulated central on the other end of the link.
+//
+// Locking mirrors the real host: `_host_lock` serialises everything that runs
+// "in the host task" (GAP events, GATT access callbacks), while `_state_lock`
+// only guards the simulator's bookkeeping, so application tasks can notify
+// while the host task is busy, just like with ble_hs_lock on target.
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "host/ble_hs.h"
+#include "nimble/nimble_port.h"
+#include "nimble/nimble_port_freertos.h"
+#include "services/gap/ble_svc_gap.h"
+#include "services/gatt/ble_svc_gatt.h"
+#include "sim_link.h"
+
+#ifndef CONFIG_BT_NIMBLE_MAX_CONNECTIONS
+#define CONFIG_BT_NIMBLE_MAX_CONNECTIONS 3
+#endif
+
+#define SIM_MAX_CHRS 16
+#define SIM_MAX_STREAMS 4
+#define SIM_MAX_EVENTS 64
+#define SIM_MAX_SIZES 65536
+#define SIM_FIRST_HANDLE 10
+
+struct ble_hs_cfg ble_hs_cfg;
+
+static pthread_mutex_t _host_lock;
+static pthread_mutex_t _state_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _state_cond = PTHREAD_COND_INITIALIZER;
+static pthread_once_t _lock_once = PTHREAD_ONCE_INIT;
+
+static struct sim_link_config _pending_config = {
+    .mtu = 247,
+    .conn_interval_us = 7500,
+    .packets_per_event = 6,
+    .mbuf_count = 24,
+    .mbuf_block_size = 256,
+    .phy_2m = true,
+};
+static struct sim_link_config _config;
+static struct sim_link_stats _stats;
+
+/* mbufs */
+
+static int _mbuf_free;
+
+uint16_t os_mbuf_pktlen(const struct os_mbuf *om) {
+  uint32_t len = 0;
+  for (; om; om = SLIST_NEXT(om, om_next))
+    len += om->om_len;
+  return (uint16_t)len;
+}
+
+static struct os_mbuf *_mbuf_get(uint16_t pkthdr_len) {
+  pthread_mutex_lock(&_state_lock);
+  if (_mbuf_free <= 0) {
+    _stats.mbuf_enomem++;
+    pthread_mutex_unlock(&_state_lock);
+    return NULL;
+  }
+  _mbuf_free--;
+  pthread_mutex_unlock(&_state_lock);
+
+  struct os_mbuf *om = calloc(1, sizeof(struct os_mbuf) + pkthdr_len + _config.mbuf_block_size);
+  om->om_pkthdr_len = (uint8_t)pkthdr_len;
+  om->om_data = om->om_databuf + pkthdr_len;
+  return om;
+}
+
+static uint16_t _mbuf_trailing_space(const struct os_mbuf *om) {
+  const uint8_t *end = om->om_databuf + om->om_pkthdr_len + _config.mbuf_block_size;
+  return (uint16_t)(end - (om->om_data + om->om_len));
+}
+
+struct os_mbuf *os_msys_get_pkthdr(uint16_t dsize, uint16_t user_hdr_len) {
+  return _mbuf_get(sizeof(struct os_mbuf_pkthdr) + user_hdr_len);
+}
+
+int os_msys_num_free(void) {
+  pthread_mutex_lock(&_state_lock);
+  int ret = _mbuf_free;
+  pthread_mutex_unlock(&_state_lock);
+  return ret;
+}
+
+int os_mbuf_append(struct os_mbuf *om, const void *data, uint16_t len) {
+  const uint8_t *src = data;
+  struct os_mbuf *last = om;
+  while (SLIST_NEXT(last, om_next))
+    last = SLIST_NEXT(last, om_next);
+  while (len > 0) {
+    uint16_t space = _mbuf_trailing_space(last);
+    if (space == 0) {
+      struct os_mbuf *next = _mbuf_get(0);
+      if (next == NULL)
+        return BLE_HS_ENOMEM;
+      SLIST_NEXT(last, om_next) = next;
+      last = next;
+      continue;
+    }
+    uint16_t n = len < space ? len : space;
+    memcpy(last->om_data + last->om_len, src, n);
+    last->om_len += n;
+    src += n;
+    len -= n;
+  }
+  return 0;
+}
+
+int os_mbuf_copydata(const struct os_mbuf *om, int off, int len, void *dst) {
+  uint8_t *out = dst;
+  for (; om && len > 0; om = SLIST_NEXT(om, om_next)) {
+    if (off >= om->om_len) {
+      off -= om->om_len;
+      continue;
+    }
+    int n = om->om_len - off < len ? om->om_len - off : len;
+    memcpy(out, om->om_data + off, n);
+    out += n;
+    len -= n;
+    off = 0;
+  }
+  return len > 0 ? -1 : 0;
+}
+
+int os_mbuf_free_chain(struct os_mbuf *om) {
+  while (om) {
+    struct os_mbuf *next = SLIST_NEXT(om, om_next);
+    free(om);
+    pthread_mutex_lock(&_state_lock);
+    _mbuf_free++;
+    pthread_mutex_unlock(&_state_lock);
+    om = next;
+  }
+  return 0;
+}
+
+struct os_mbuf *ble_hs_mbuf_att_pkt(void) { return os_msys_get_pkthdr(0, 0); }
+
+struct os_mbuf *ble_hs_mbuf_from_flat(const void *buf, uint16_t len) {
+  struct os_mbuf *om = os_msys_get_pkthdr(len, 0);
+  if (om == NULL)
+    return NULL;
+  if (os_mbuf_append(om, buf, len) != 0) {
+    os_mbuf_free_chain(om);
+    return NULL;
+  }
+  return om;
+}
+
+int ble_hs_mbuf_to_flat(const struct os_mbuf *om, void *flat, uint16_t max_len, uint16_t *out_copy_len) {
+  uint16_t len = OS_MBUF_PKTLEN(om);
+  uint16_t n = len < max_len ? len : max_len;
+  os_mbuf_copydata(om, 0, n, flat);
+  if (out_copy_len)
+    *out_copy_len = n;
+  return n < len ? BLE_HS_EMSGSIZE : 0;
+}
+
+int ble_uuid_cmp(const ble_uuid_t *uuid1, const ble_uuid_t *uuid2) {
+  if (uuid1->type != uuid2->type)
+    return (int)uuid1->type - (int)uuid2->type;
+  return memcmp(((const ble_uuid128_t *)uuid1)->value, ((const ble_uuid128_t *)uuid2)->value, 16);
+}
+
+/* connections */
+
+struct sim_stream {
+  uint16_t attr_handle;
+  uint8_t *data;
+  size_t len;
+  size_t cap;
+};
+
+struct sim_pending {
+  struct os_mbuf *om;
+  uint16_t attr_handle;
+  struct sim_pending *next;
+};
+
+struct sim_conn {
+  bool used;
+  bool terminating;
+  uint16_t handle;
+  uint8_t peer_id;
+  uint16_t mtu;
+  bool mtu_exchanged;
+  uint16_t conn_itvl;
+  uint16_t conn_latency;
+  uint16_t supervision_timeout;
+  uint8_t tx_phy;
+  uint8_t rx_phy;
+  uint16_t tx_octets;
+  ble_gap_event_fn *cb;
+  void *cb_arg;
+  struct sim_pending *pending_head;
+  struct sim_pending *pending_tail;
+  size_t pending_count;
+  struct sim_stream streams[SIM_MAX_STREAMS];
+  uint16_t *sizes;
+  size_t sizes_count;
+};
+
+static struct sim_conn _conns[CONFIG_BT_NIMBLE_MAX_CONNECTIONS];
+
+static struct sim_conn *_conn_find(uint16_t handle) {
+  for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; ++i) {
+    if (_conns[i].used && _conns[i].handle == handle)
+      return &_conns[i];
+  }
+  return NULL;
+}
+
+static int _conn_count(void) {
+  int n = 0;
+  for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; ++i)
+    n += _conns[i].used;
+  return n;
+}
+
+static void _conn_release(struct sim_conn *conn) {
+  struct sim_pending *p = conn->pending_head;
+  while (p) {
+    struct sim_pending *next = p->next;
+    pthread_mutex_unlock(&_state_lock);
+    os_mbuf_free_chain(p->om);
+    pthread_mutex_lock(&_state_lock);
+    free(p);
+    p = next;
+  }
+  for (int i = 0; i < SIM_MAX_STREAMS; ++i)
+    free(conn->streams[i].data);
+  free(conn->sizes);
+  memset(conn, 0, sizeof(*conn));
+}
+
+/* GATT registry */
+
+struct sim_chr {
+  const struct ble_gatt_chr_def *def;
+  uint16_t val_handle;
+};
+
+static struct sim_chr _chrs[SIM_MAX_CHRS];
+static int _chr_count;
+static uint16_t _next_handle = SIM_FIRST_HANDLE;
+
+static const ble_uuid128_t _nus_rx_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x02, 0x00, 0x40, 0x6e);
+static const ble_uuid128_t _nus_tx_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x03, 0x00, 0x40, 0x6e);
+
+static struct sim_chr *_chr_find_uuid(const ble_uuid_t *uuid) {
+  for (int i = 0; i < _chr_count; ++i) {
+    if (ble_uuid_cmp(_chrs[i].def->uuid, uuid) == 0)
+      return &_chrs[i];
+  }
+  return NULL;
+}
+
+int ble_gatts_count_cfg(const struct ble_gatt_svc_def *defs) { return 0; }
+
+int ble_gatts_add_svcs(const struct ble_gatt_svc_def *svcs) {
+  for (; svcs->type != BLE_GATT_SVC_TYPE_END; ++svcs) {
+    _next_handle++; // service declaration
+    for (const struct ble_gatt_chr_def *chr = svcs->characteristics; chr && chr->uuid; ++chr) {
+      if (_chr_count >= SIM_MAX_CHRS)
+        return BLE_HS_ENOMEM;
+      _next_handle++; // characteristic declaration
+      uint16_t val_handle = _next_handle++;
+      if (chr->val_handle)
+        *chr->val_handle = val_handle;
+      if (chr->flags & (BLE_GATT_CHR_F_NOTIFY | BLE_GATT_CHR_F_INDICATE))
+        _next_handle++; // CCCD
+      _chrs[_chr_count].def = chr;
+      _chrs[_chr_count].val_handle = val_handle;
+      _chr_count++;
+    }
+  }
+  return 0;
+}
+
+int ble_gatts_reset(void) {
+  _chr_count = 0;
+  _next_handle = SIM_FIRST_HANDLE;
+  return 0;
+}
+
+void ble_gatts_chr_updated(uint16_t chr_val_handle) {}
+
+/* ATT */
+
+static uint16_t _preferred_mtu = 256;
+
+uint16_t ble_att_mtu(uint16_t conn_handle) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  uint16_t mtu = conn ? conn->mtu : 0;
+  pthread_mutex_unlock(&_state_lock);
+  return mtu;
+}
+
+int ble_att_set_preferred_mtu(uint16_t mtu) {
+  if (mtu < BLE_ATT_MTU_DFLT || mtu > BLE_ATT_MTU_MAX)
+    return BLE_HS_EINVAL;
+  _preferred_mtu = mtu;
+  return 0;
+}
+
+uint16_t ble_att_preferred_mtu(void) { return _preferred_mtu; }
+
+/* deferred host events, delivered from the link thread */
+
+struct sim_event {
+  struct ble_gap_event event;
+  uint16_t conn_handle;
+  ble_gatt_mtu_fn *mtu_cb;
+  void *mtu_cb_arg;
+};
+
+static struct sim_event _events[SIM_MAX_EVENTS];
+static int _event_count;
+
+static void _defer_event(const struct ble_gap_event *event, uint16_t conn_handle) {
+  if (_event_count >= SIM_MAX_EVENTS) {
+    fprintf(stderr, "sim_link: deferred event queue overflow\n");
+    abort();
+  }
+  memset(&_events[_event_count], 0, sizeof(_events[0]));
+  _events[_event_count].event = *event;
+  _events[_event_count].conn_handle = conn_handle;
+  _event_count++;
+}
+
+/* GAP */
+
+static bool _adv_active;
+static bool _adv_directed;
+static ble_addr_t _adv_direct_addr;
+static int32_t _adv_duration_ms;
+static int64_t _adv_deadline_us;
+static struct ble_gap_adv_params _adv_params;
+static ble_gap_event_fn *_adv_cb;
+static void *_adv_cb_arg;
+static uint8_t _adv_data[BLE_HS_ADV_MAX_SZ];
+static uint8_t _adv_data_len;
+static uint8_t _rsp_data[BLE_HS_ADV_MAX_SZ];
+static uint8_t _rsp_data_len;
+
+static int _adv_put(uint8_t *dst, uint8_t *len, uint8_t max_len, uint8_t type, const void *data, uint8_t data_len) {
+  if (*len + 2 + data_len > max_len)
+    return BLE_HS_EMSGSIZE;
+  dst[(*len)++] = data_len + 1;
+  dst[(*len)++] = type;
+  memcpy(dst + *len, data, data_len);
+  *len += data_len;
+  return 0;
+}
+
+int ble_hs_adv_set_fields(const struct ble_hs_adv_fields *fields, uint8_t *dst, uint8_t *dst_len, uint8_t max_len) {
+  int rc = 0;
+  *dst_len = 0;
+  if (fields->flags)
+    rc |= _adv_put(dst, dst_len, max_len, 0x01, &fields->flags, 1);
+  if (fields->num_uuids128) {
+    uint8_t uuids[16 * 4];
+    for (int i = 0; i < fields->num_uuids128 && i < 4; ++i)
+      memcpy(uuids + 16 * i, fields->uuids128[i].value, 16);
+    rc |= _adv_put(dst, dst_len, max_len, fields->uuids128_is_complete ? 0x07 : 0x06, uuids,
+                   16 * fields->num_uuids128);
+  }
+  if (fields->name)
+    rc |= _adv_put(dst, dst_len, max_len, fields->name_is_complete ? 0x09 : 0x08, fields->name, fields->name_len);
+  if (fields->tx_pwr_lvl_is_present) {
+    int8_t lvl = fields->tx_pwr_lvl == BLE_HS_ADV_TX_PWR_LVL_AUTO ? 0 : fields->tx_pwr_lvl;
+    rc |= _adv_put(dst, dst_len, max_len, 0x0a, &lvl, 1);
+  }
+  if (fields->mfg_data)
+    rc |= _adv_put(dst, dst_len, max_len, 0xff, fields->mfg_data, fields->mfg_data_len);
+  return rc ? BLE_HS_EMSGSIZE : 0;
+}
+
+int ble_gap_adv_set_data(const uint8_t *data, int data_len) {
+  if (data_len > BLE_HS_ADV_MAX_SZ)
+    return BLE_HS_EMSGSIZE;
+  pthread_mutex_lock(&_state_lock);
+  memcpy(_adv_data, data, data_len);
+  _adv_data_len = (uint8_t)data_len;
+  _stats.adv_data_sets++;
+  pthread_mutex_unlock(&_state_lock);
+  return 0;
+}
+
+int ble_gap_adv_rsp_set_data(const uint8_t *data, int data_len) {
+  if (data_len > BLE_HS_ADV_MAX_SZ)
+    return BLE_HS_EMSGSIZE;
+  pthread_mutex_lock(&_state_lock);
+  memcpy(_rsp_data, data, data_len);
+  _rsp_data_len = (uint8_t)data_len;
+  _stats.adv_data_sets++;
+  pthread_mutex_unlock(&_state_lock);
+  return 0;
+}
+
+int ble_gap_adv_set_fields(const struct ble_hs_adv_fields *fields) {
+  uint8_t buf[BLE_HS_ADV_MAX_SZ];
+  uint8_t len;
+  int rc = ble_hs_adv_set_fields(fields, buf, &len, sizeof(buf));
+  return rc ? rc : ble_gap_adv_set_data(buf, len);
+}
+
+int ble_gap_adv_rsp_set_fields(const struct ble_hs_adv_fields *fields) {
+  uint8_t buf[BLE_HS_ADV_MAX_SZ];
+  uint8_t len;
+  int rc = ble_hs_adv_set_fields(fields, buf, &len, sizeof(buf));
+  return rc ? rc : ble_gap_adv_rsp_set_data(buf, len);
+}
+
+int ble_gap_adv_start(uint8_t own_addr_type, const ble_addr_t *direct_addr, int32_t duration_ms,
+                      const struct ble_gap_adv_params *adv_params, ble_gap_event_fn *cb, void *cb_arg) {
+  pthread_mutex_lock(&_state_lock);
+  int rc = 0;
+  if (_adv_active) {
+    rc = BLE_HS_EALREADY;
+  } else if (adv_params->conn_mode != BLE_GAP_CONN_MODE_NON && _conn_count() >= CONFIG_BT_NIMBLE_MAX_CONNECTIONS) {
+    rc = BLE_HS_ENOMEM;
+  } else {
+    _adv_active = true;
+    _adv_params = *adv_params;
+    _adv_directed = direct_addr != NULL;
+    if (direct_addr)
+      _adv_direct_addr = *direct_addr;
+    _adv_duration_ms = duration_ms;
+    _adv_deadline_us = duration_ms == BLE_HS_FOREVER ? INT64_MAX : esp_timer_get_time() + duration_ms * 1000LL;
+    _adv_cb = cb;
+    _adv_cb_arg = cb_arg;
+    _stats.adv_starts++;
+    pthread_cond_broadcast(&_state_cond);
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return rc;
+}
+
+int ble_gap_adv_stop(void) {
+  pthread_mutex_lock(&_state_lock);
+  int rc = _adv_active ? 0 : BLE_HS_EALREADY;
+  _adv_active = false;
+  pthread_mutex_unlock(&_state_lock);
+  return rc;
+}
+
+int ble_gap_adv_active(void) {
+  pthread_mutex_lock(&_state_lock);
+  int ret = _adv_active;
+  pthread_mutex_unlock(&_state_lock);
+  return ret;
+}
+
+static void _fill_desc(const struct sim_conn *conn, struct ble_gap_conn_desc *desc) {
+  memset(desc, 0, sizeof(*desc));
+  desc->conn_handle = conn->handle;
+  desc->conn_itvl = conn->conn_itvl;
+  desc->conn_latency = conn->conn_latency;
+  desc->supervision_timeout = conn->supervision_timeout;
+  desc->peer_id_addr.type = BLE_ADDR_RANDOM;
+  desc->peer_id_addr.val[0] = conn->peer_id;
+  desc->peer_id_addr.val[5] = 0xc0;
+  desc->peer_ota_addr = desc->peer_id_addr;
+}
+
+int ble_gap_conn_find(uint16_t handle, struct ble_gap_conn_desc *out_desc) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(handle);
+  if (conn && out_desc)
+    _fill_desc(conn, out_desc);
+  pthread_mutex_unlock(&_state_lock);
+  return conn ? 0 : BLE_HS_ENOTCONN;
+}
+
+int ble_gap_terminate(uint16_t conn_handle, uint8_t hci_reason) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  int rc = BLE_HS_ENOTCONN;
+  if (conn && !conn->terminating) {
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_DISCONNECT};
+    event.disconnect.reason = 0x200 + BLE_ERR_CONN_TERM_LOCAL;
+    _fill_desc(conn, &event.disconnect.conn);
+    conn->terminating = true;
+    _defer_event(&event, conn_handle);
+    rc = 0;
+  } else if (conn) {
+    rc = BLE_HS_EALREADY;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return rc;
+}
+
+// Link updates the central turns down with `reject_link_updates` fail like an unsupported feature.
+static int _link_update_status(void) { return _config.reject_link_updates ? 0x200 + BLE_ERR_UNSUPP_REM_FEATURE : 0; }
+
+int ble_gap_update_params(uint16_t conn_handle, const struct ble_gap_upd_params *params) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  if (conn) {
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_CONN_UPDATE};
+    event.conn_update.conn_handle = conn_handle;
+    event.conn_update.status = _link_update_status();
+    if (event.conn_update.status == 0) {
+      conn->conn_itvl = params->itvl_max;
+      conn->conn_latency = params->latency;
+      conn->supervision_timeout = params->supervision_timeout;
+    }
+    _defer_event(&event, conn_handle);
+    _stats.conn_param_updates++;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return conn ? 0 : BLE_HS_ENOTCONN;
+}
+
+int ble_gap_set_data_len(uint16_t conn_handle, uint16_t tx_octets, uint16_t tx_time) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  if (conn && _config.reject_link_updates) {
+    // a central without data length extension never answers
+    _stats.data_len_updates++;
+  } else if (conn && conn->tx_octets != tx_octets) {
+    // like the controller, only a change of length is reported
+    conn->tx_octets = tx_octets;
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_DATA_LEN_CHG};
+    event.data_len_chg.conn_handle = conn_handle;
+    event.data_len_chg.max_tx_octets = tx_octets;
+    event.data_len_chg.max_tx_time = tx_time;
+    event.data_len_chg.max_rx_octets = tx_octets;
+    event.data_len_chg.max_rx_time = tx_time;
+    _defer_event(&event, conn_handle);
+    _stats.data_len_updates++;
+  } else if (conn) {
+    _stats.data_len_updates++;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return conn ? 0 : BLE_HS_ENOTCONN;
+}
+
+int ble_gap_set_prefered_le_phy(uint16_t conn_handle, uint8_t tx_phys_mask, uint8_t rx_phys_mask,
+                                uint16_t phy_opts) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  if (conn) {
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_PHY_UPDATE_COMPLETE};
+    event.phy_updated.conn_handle = conn_handle;
+    event.phy_updated.status = _link_update_status();
+    if (event.phy_updated.status == 0) {
+      conn->tx_phy =
+          (tx_phys_mask & BLE_GAP_LE_PHY_2M_MASK) && _config.phy_2m ? BLE_GAP_LE_PHY_2M : BLE_GAP_LE_PHY_1M;
+      conn->rx_phy =
+          (rx_phys_mask & BLE_GAP_LE_PHY_2M_MASK) && _config.phy_2m ? BLE_GAP_LE_PHY_2M : BLE_GAP_LE_PHY_1M;
+    }
+    event.phy_updated.tx_phy = conn->tx_phy;
+    event.phy_updated.rx_phy = conn->rx_phy;
+    _defer_event(&event, conn_handle);
+    _stats.phy_updates++;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return conn ? 0 : BLE_HS_ENOTCONN;
+}
+
+int ble_gap_read_le_phy(uint16_t conn_handle, uint8_t *tx_phy, uint8_t *rx_phy) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  if (conn) {
+    *tx_phy = conn->tx_phy;
+    *rx_phy = conn->rx_phy;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return conn ? 0 : BLE_HS_ENOTCONN;
+}
+
+int ble_gattc_exchange_mtu(uint16_t conn_handle, ble_gatt_mtu_fn *cb, void *cb_arg) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  int rc = BLE_HS_ENOTCONN;
+  if (conn && conn->mtu_exchanged) {
+    rc = BLE_HS_EALREADY;
+  } else if (conn) {
+    conn->mtu_exchanged = true;
+    conn->mtu = _config.mtu < _preferred_mtu ? _config.mtu : _preferred_mtu;
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_MTU};
+    event.mtu.conn_handle = conn_handle;
+    event.mtu.channel_id = 4;
+    event.mtu.value = conn->mtu;
+    _defer_event(&event, conn_handle);
+    _events[_event_count - 1].mtu_cb = cb;
+    _events[_event_count - 1].mtu_cb_arg = cb_arg;
+    rc = 0;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return rc;
+}
+
+static void _dispatch(ble_gap_event_fn *cb, void *arg, struct ble_gap_event *event);
+
+// Like NimBLE, the notification holds its mbufs until the link sends it, so a backlog shows as an
+// empty mbuf pool, and BLE_GAP_EVENT_NOTIFY_TX is reported on the calling task before this returns.
+int ble_gattc_notify_custom(uint16_t conn_handle, uint16_t att_handle, struct os_mbuf *om) {
+  int rc = 0;
+  if (om == NULL) {
+    om = os_msys_get_pkthdr(0, 0);
+    if (om == NULL)
+      rc = BLE_HS_ENOMEM;
+  }
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  ble_gap_event_fn *cb = conn ? conn->cb : NULL;
+  void *arg = conn ? conn->cb_arg : NULL;
+  if (conn == NULL || conn->terminating) {
+    rc = BLE_HS_ENOTCONN;
+  } else if (rc == 0) {
+    struct sim_pending *p = calloc(1, sizeof(*p));
+    p->om = om;
+    p->attr_handle = att_handle;
+    if (conn->pending_tail)
+      conn->pending_tail->next = p;
+    else
+      conn->pending_head = p;
+    conn->pending_tail = p;
+    conn->pending_count++;
+    om = NULL;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  if (om)
+    os_mbuf_free_chain(om);
+  if (rc != BLE_HS_ENOTCONN) {
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_NOTIFY_TX};
+    event.notify_tx.status = rc;
+    event.notify_tx.conn_handle = conn_handle;
+    event.notify_tx.attr_handle = att_handle;
+    _dispatch(cb, arg, &event);
+  }
+  return rc;
+}
+
+int ble_hs_id_infer_auto(int privacy, uint8_t *out_addr_type) {
+  *out_addr_type = BLE_ADDR_PUBLIC;
+  return 0;
+}
+
+/* GAP service */
+
+static char _device_name[32] = "nimble";
+
+int ble_svc_gap_device_name_set(const char *name) {
+  if (strlen(name) >= sizeof(_device_name))
+    return BLE_HS_EINVAL;
+  strcpy(_device_name, name);
+  return 0;
+}
+
+const char *ble_svc_gap_device_name(void) { return _device_name; }
+void ble_svc_gap_init(void) {}
+void ble_svc_gatt_init(void) {}
+
+/* host task and link thread */
+
+static bool _initialized;
+static bool _synced;
+static bool _running;
+static bool _stop_requested;
+static bool _link_stop;
+static pthread_t _link_thread;
+static TaskHandle_t _host_task;
+static void (*_notify_handler)(uint16_t, uint16_t, const uint8_t *, size_t, void *);
+static void *_notify_handler_arg;
+
+static void _lock_init(void) {
+  pthread_mutexattr_t attr;
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+  pthread_mutex_init(&_host_lock, &attr);
+}
+
+static void _host_enter(void) {
+  pthread_once(&_lock_once, _lock_init);
+  pthread_mutex_lock(&_host_lock);
+}
+
+static void _host_exit(void) { pthread_mutex_unlock(&_host_lock); }
+
+int ble_hs_synced(void) { return _synced; }
+
+static struct sim_stream *_stream(struct sim_conn *conn, uint16_t attr_handle) {
+  for (int i = 0; i < SIM_MAX_STREAMS; ++i) {
+    if (conn->streams[i].attr_handle == attr_handle)
+      return &conn->streams[i];
+  }
+  for (int i = 0; i < SIM_MAX_STREAMS; ++i) {
+    if (conn->streams[i].attr_handle == 0) {
+      conn->streams[i].attr_handle = attr_handle;
+      return &conn->streams[i];
+    }
+  }
+  return NULL;
+}
+
+static uint16_t _nus_tx_handle(void) {
+  struct sim_chr *chr = _chr_find_uuid(&_nus_tx_uuid.u);
+  return chr ? chr->val_handle : 0;
+}
+
+static void _dispatch(ble_gap_event_fn *cb, void *arg, struct ble_gap_event *event) {
+  if (cb)
+    cb(event, arg);
+}
+
+static void _deliver_events(void) {
+  struct sim_event events[SIM_MAX_EVENTS];
+  pthread_mutex_lock(&_state_lock);
+  int count = _event_count;
+  memcpy(events, _events, sizeof(events[0]) * count);
+  _event_count = 0;
+  pthread_mutex_unlock(&_state_lock);
+
+  for (int i = 0; i < count; ++i) {
+    pthread_mutex_lock(&_state_lock);
+    struct sim_conn *conn = _conn_find(events[i].conn_handle);
+    ble_gap_event_fn *cb = conn ? conn->cb : NULL;
+    void *arg = conn ? conn->cb_arg : NULL;
+    if (conn && events[i].event.type == BLE_GAP_EVENT_DISCONNECT)
+      _conn_release(conn);
+    pthread_mutex_unlock(&_state_lock);
+    if (events[i].mtu_cb)
+      events[i].mtu_cb(events[i].conn_handle, &(struct ble_gatt_error){0}, events[i].event.mtu.value,
+                       events[i].mtu_cb_arg);
+    _dispatch(cb, arg, &events[i].event);
+  }
+}
+
+static void _deliver_notifications(void) {
+  for (int c = 0; c < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; ++c) {
+    for (int n = 0; n < _config.packets_per_event; ++n) {
+      pthread_mutex_lock(&_state_lock);
+      struct sim_conn *conn = &_conns[c];
+      struct sim_pending *p = conn->used ? conn->pending_head : NULL;
+      if (p == NULL) {
+        pthread_mutex_unlock(&_state_lock);
+        break;
+      }
+      conn->pending_head = p->next;
+      if (conn->pending_head == NULL)
+        conn->pending_tail = NULL;
+      conn->pending_count--;
+
+      uint16_t len = OS_MBUF_PKTLEN(p->om);
+      uint16_t max = conn->mtu - 3;
+      if (len > max)
+        len = max; // the ATT layer truncates oversize notifications
+      uint8_t data[BLE_ATT_MTU_MAX];
+      os_mbuf_copydata(p->om, 0, len, data);
+
+      struct sim_stream *stream = _stream(conn, p->attr_handle);
+      if (stream) {
+        if (stream->len + len > stream->cap) {
+          stream->cap = (stream->len + len) * 2;
+          stream->data = realloc(stream->data, stream->cap);
+        }
+        memcpy(stream->data + stream->len, data, len);
+        stream->len += len;
+      }
+      if (p->attr_handle == _nus_tx_handle()) {
+        if (conn->sizes == NULL)
+          conn->sizes = malloc(sizeof(uint16_t) * SIM_MAX_SIZES);
+        if (conn->sizes_count < SIM_MAX_SIZES)
+          conn->sizes[conn->sizes_count++] = len;
+      }
+      _stats.notifications++;
+      _stats.notified_bytes += len;
+      if (len > _stats.max_notification_len)
+        _stats.max_notification_len = len;
+
+      uint16_t conn_handle = conn->handle;
+      struct os_mbuf *om = p->om;
+      uint16_t attr_handle = p->attr_handle;
+      free(p);
+      pthread_cond_broadcast(&_state_cond);
+      pthread_mutex_unlock(&_state_lock);
+
+      os_mbuf_free_chain(om);
+      if (_notify_handler)
+        _notify_handler(conn_handle, attr_handle, data, len, _notify_handler_arg);
+    }
+  }
+}
+
+static void _check_adv_timeout(void) {
+  pthread_mutex_lock(&_state_lock);
+  bool expired = _adv_active && esp_timer_get_time() >= _adv_deadline_us;
+  ble_gap_event_fn *cb = _adv_cb;
+  void *arg = _adv_cb_arg;
+  if (expired)
+    _adv_active = false;
+  pthread_mutex_unlock(&_state_lock);
+  if (expired) {
+    struct ble_gap_event event = {.type = BLE_GAP_EVENT_ADV_COMPLETE};
+    event.adv_complete.reason = BLE_HS_ETIMEOUT;
+    _dispatch(cb, arg, &event);
+  }
+}
+
+// Connection events follow the shortest negotiated interval, the configured one before any connection.
+static uint32_t _link_interval_us(void) {
+  uint32_t interval_us = 0;
+  pthread_mutex_lock(&_state_lock);
+  for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; ++i) {
+    const uint32_t conn_us = _conns[i].conn_itvl * 1250u;
+    if (_conns[i].used && conn_us && (interval_us == 0 || conn_us < interval_us))
+      interval_us = conn_us;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return interval_us ? interval_us : _config.conn_interval_us;
+}
+
+static void *_link_thread_fn(void *arg) {
+  for (;;) {
+    pthread_mutex_lock(&_state_lock);
+    bool stop = _link_stop;
+    pthread_mutex_unlock(&_state_lock);
+    if (stop)
+      break;
+    if (_synced) {
+      _host_enter();
+      _deliver_events();
+      _deliver_notifications();
+      _check_adv_timeout();
+      _host_exit();
+    }
+    usleep(_link_interval_us());
+  }
+  return NULL;
+}
+
+esp_err_t nimble_port_init(void) {
+  pthread_once(&_lock_once, _lock_init);
+  pthread_mutex_lock(&_state_lock);
+  if (_initialized) {
+    pthread_mutex_unlock(&_state_lock);
+    return ESP_FAIL;
+  }
+  _config = _pending_config;
+  _mbuf_free = _config.mbuf_count;
+  _preferred_mtu = 256;
+  _adv_active = false;
+  _event_count = 0;
+  _synced = false;
+  _running = false;
+  _stop_requested = false;
+  _link_stop = false;
+  _initialized = true;
+  memset(&ble_hs_cfg, 0, sizeof(ble_hs_cfg));
+  pthread_mutex_unlock(&_state_lock);
+  ble_gatts_reset();
+  pthread_create(&_link_thread, NULL, _link_thread_fn, NULL);
+  return ESP_OK;
+}
+
+void nimble_port_run(void) {
+  _host_enter();
+  pthread_mutex_lock(&_state_lock);
+  _running = true;
+  _synced = true;
+  pthread_mutex_unlock(&_state_lock);
+  if (ble_hs_cfg.sync_cb)
+    ble_hs_cfg.sync_cb();
+  _host_exit();
+
+  pthread_mutex_lock(&_state_lock);
+  while (!_stop_requested)
+    pthread_cond_wait(&_state_cond, &_state_lock);
+  _running = false;
+  pthread_cond_broadcast(&_state_cond);
+  pthread_mutex_unlock(&_state_lock);
+}
+
+int nimble_port_stop(void) {
+  pthread_mutex_lock(&_state_lock);
+  if (!_initialized) {
+    pthread_mutex_unlock(&_state_lock);
+    return ESP_FAIL;
+  }
+  _stop_requested = true;
+  pthread_cond_broadcast(&_state_cond);
+  while (_running)
+    pthread_cond_wait(&_state_cond, &_state_lock);
+  pthread_mutex_unlock(&_state_lock);
+  return ESP_OK;
+}
+
+esp_err_t nimble_port_deinit(void) {
+  pthread_mutex_lock(&_state_lock);
+  if (!_initialized) {
+    pthread_mutex_unlock(&_state_lock);
+    return ESP_FAIL;
+  }
+  _link_stop = true;
+  pthread_mutex_unlock(&_state_lock);
+  pthread_join(_link_thread, NULL);
+
+  _host_enter();
+  pthread_mutex_lock(&_state_lock);
+  for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; ++i) {
+    if (_conns[i].used)
+      _conn_release(&_conns[i]);
+  }
+  _adv_active = false;
+  _synced = false;
+  _event_count = 0;
+  _initialized = false;
+  pthread_mutex_unlock(&_state_lock);
+  ble_gatts_reset();
+  _host_exit();
+  return ESP_OK;
+}
+
+void nimble_port_freertos_init(TaskFunction_t host_task_fn) {
+  xTaskCreate(host_task_fn, "nimble_host", 4096, NULL, 21, &_host_task);
+}
+
+void nimble_port_freertos_deinit(void) {
+  if (xTaskGetCurrentTaskHandle() == _host_task) {
+    _host_task = NULL;
+    vTaskDelete(NULL);
+  }
+}
+
+/* simulated central */
+
+void sim_link_default_config(struct sim_link_config *config) {
+  *config = (struct sim_link_config){
+      .mtu = 247,
+      .conn_interval_us = 7500,
+      .packets_per_event = 6,
+      .mbuf_count = 24,
+      .mbuf_block_size = 256,
+      .phy_2m = true,
+  };
+}
+
+void sim_link_configure(const struct sim_link_config *config) { _pending_config = *config; }
+
+bool sim_link_advertising(void) { return ble_gap_adv_active(); }
+
+bool sim_link_wait_advertising(uint32_t timeout_ms) {
+  int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+  while (!ble_gap_adv_active()) {
+    if (esp_timer_get_time() > deadline)
+      return false;
+    usleep(1000);
+  }
+  return true;
+}
+
+const struct ble_gap_adv_params *sim_link_adv_params(void) { return &_adv_params; }
+bool sim_link_adv_directed(void) { return _adv_directed; }
+int32_t sim_link_adv_duration_ms(void) { return _adv_duration_ms; }
+
+uint16_t sim_link_connect_as(uint8_t peer_id) {
+  static uint16_t next_handle = 1;
+  _host_enter();
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = NULL;
+  if (_adv_active && _adv_params.conn_mode != BLE_GAP_CONN_MODE_NON &&
+      (!_adv_directed || _adv_direct_addr.val[0] == peer_id)) {
+    for (int i = 0; i < CONFIG_BT_NIMBLE_MAX_CONNECTIONS; ++i) {
+      if (!_conns[i].used) {
+        conn = &_conns[i];
+        break;
+      }
+    }
+  }
+  if (conn == NULL) {
+    pthread_mutex_unlock(&_state_lock);
+    _host_exit();
+    return BLE_HS_CONN_HANDLE_NONE;
+  }
+  memset(conn, 0, sizeof(*conn));
+  conn->used = true;
+  conn->handle = next_handle++;
+  conn->peer_id = peer_id;
+  conn->mtu = BLE_ATT_MTU_DFLT;
+  conn->conn_itvl = (uint16_t)(_config.conn_interval_us / 1250);
+  conn->supervision_timeout = 400;
+  conn->tx_phy = BLE_GAP_LE_PHY_1M;
+  conn->tx_octets = 27;
+  conn->rx_phy = BLE_GAP_LE_PHY_1M;
+  conn->cb = _adv_cb;
+  conn->cb_arg = _adv_cb_arg;
+  _adv_active = false;
+  uint16_t handle = conn->handle;
+  pthread_mutex_unlock(&_state_lock);
+
+  struct ble_gap_event event = {.type = BLE_GAP_EVENT_CONNECT};
+  event.connect.conn_handle = handle;
+  _dispatch(conn->cb, conn->cb_arg, &event);
+
+  pthread_mutex_lock(&_state_lock);
+  bool exchange = _conn_find(handle) && !conn->mtu_exchanged && _config.mtu > BLE_ATT_MTU_DFLT;
+  if (exchange) {
+    conn->mtu_exchanged = true;
+    conn->mtu = _config.mtu < _preferred_mtu ? _config.mtu : _preferred_mtu;
+  }
+  uint16_t mtu = conn->mtu;
+  pthread_mutex_unlock(&_state_lock);
+  if (exchange) {
+    event = (struct ble_gap_event){.type = BLE_GAP_EVENT_MTU};
+    event.mtu.conn_handle = handle;
+    event.mtu.channel_id = 4;
+    event.mtu.value = mtu;
+    _dispatch(conn->cb, conn->cb_arg, &event);
+  }
+
+  event = (struct ble_gap_event){.type = BLE_GAP_EVENT_SUBSCRIBE};
+  event.subscribe.conn_handle = handle;
+  event.subscribe.attr_handle = _nus_tx_handle();
+  event.subscribe.cur_notify = 1;
+  _dispatch(conn->cb, conn->cb_arg, &event);
+  _host_exit();
+  return handle;
+}
+
+uint16_t sim_link_connect(void) { return sim_link_connect_as(0); }
+
+void sim_link_disconnect(uint16_t conn_handle) {
+  _host_enter();
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  if (conn == NULL) {
+    pthread_mutex_unlock(&_state_lock);
+    _host_exit();
+    return;
+  }
+  struct ble_gap_event event = {.type = BLE_GAP_EVENT_DISCONNECT};
+  event.disconnect.reason = 0x200 + BLE_ERR_REM_USER_CONN_TERM;
+  _fill_desc(conn, &event.disconnect.conn);
+  ble_gap_event_fn *cb = conn->cb;
+  void *arg = conn->cb_arg;
+  _conn_release(conn);
+  pthread_mutex_unlock(&_state_lock);
+  _dispatch(cb, arg, &event);
+  _host_exit();
+}
+
+bool sim_link_connected(uint16_t conn_handle) {
+  pthread_mutex_lock(&_state_lock);
+  bool ret = _conn_find(conn_handle) != NULL;
+  pthread_mutex_unlock(&_state_lock);
+  return ret;
+}
+
+uint16_t sim_link_mtu(uint16_t conn_handle) { return ble_att_mtu(conn_handle); }
+
+// Like the controller, holds a request of the central back for a while when the host has no mbufs to
+// take it, e.g. while a worker task still owns the chains of earlier writes or notifications wait
+// for the link. Called and returns with the host lock held.
+static struct os_mbuf *_mbuf_from_central(const void *data, uint16_t len) {
+  struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+  for (int waited = 0; om == NULL && waited < 10000; ++waited) {
+    _host_exit();
+    usleep(100);
+    _host_enter();
+    om = ble_hs_mbuf_from_flat(data, len);
+  }
+  return om;
+}
+
+int sim_link_write_chr(uint16_t conn_handle, const ble_uuid_t *uuid, const void *data, size_t len) {
+  if (len > BLE_ATT_ATTR_MAX_LEN)
+    return BLE_HS_EMSGSIZE;
+  _host_enter();
+  struct sim_chr *chr = _chr_find_uuid(uuid);
+  if (chr == NULL || !sim_link_connected(conn_handle)) {
+    _host_exit();
+    return BLE_HS_ENOENT;
+  }
+  struct os_mbuf *om = _mbuf_from_central(data, (uint16_t)len);
+  if (om == NULL) {
+    _host_exit();
+    return BLE_HS_ENOMEM;
+  }
+  struct ble_gatt_access_ctxt ctxt = {.op = BLE_GATT_ACCESS_OP_WRITE_CHR, .om = om, .chr = chr->def};
+  int rc = chr->def->access_cb(conn_handle, chr->val_handle, &ctxt, chr->def->arg);
+  if (ctxt.om)
+    os_mbuf_free_chain(ctxt.om);
+  _host_exit();
+  return rc;
+}
+
+int sim_link_write(uint16_t conn_handle, const void *data, size_t len) {
+  return sim_link_write_chr(conn_handle, &_nus_rx_uuid.u, data, len);
+}
+
+uint16_t sim_link_chr_handle(const ble_uuid_t *uuid) {
+  _host_enter();
+  struct sim_chr *chr = _chr_find_uuid(uuid);
+  const uint16_t handle = chr ? chr->val_handle : 0;
+  _host_exit();
+  return handle;
+}
+
+int sim_link_read_chr(uint16_t conn_handle, const ble_uuid_t *uuid, void *buf, size_t max_len, size_t *out_len) {
+  _host_enter();
+  struct sim_chr *chr = _chr_find_uuid(uuid);
+  if (chr == NULL || !sim_link_connected(conn_handle)) {
+    _host_exit();
+    return BLE_HS_ENOENT;
+  }
+  struct ble_gatt_access_ctxt ctxt = {.op = BLE_GATT_ACCESS_OP_READ_CHR, .chr = chr->def};
+  ctxt.om = _mbuf_from_central(NULL, 0);
+  if (ctxt.om == NULL) {
+    _host_exit();
+    return BLE_HS_ENOMEM;
+  }
+  int rc = chr->def->access_cb(conn_handle, chr->val_handle, &ctxt, chr->def->arg);
+  uint16_t copied = 0;
+  if (rc == 0)
+    ble_hs_mbuf_to_flat(ctxt.om, buf, (uint16_t)max_len, &copied);
+  if (out_len)
+    *out_len = copied;
+  os_mbuf_free_chain(ctxt.om);
+  _host_exit();
+  return rc;
+}
+
+static uint16_t _resolve_attr(uint16_t attr_handle) { return attr_handle ? attr_handle : _nus_tx_handle(); }
+
+size_t sim_link_received(uint16_t conn_handle, uint16_t attr_handle, void *buf, size_t max_len) {
+  attr_handle = _resolve_attr(attr_handle);
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  struct sim_stream *stream = conn ? _stream(conn, attr_handle) : NULL;
+  size_t n = 0;
+  if (stream) {
+    n = stream->len < max_len ? stream->len : max_len;
+    memcpy(buf, stream->data, n);
+    memmove(stream->data, stream->data + n, stream->len - n);
+    stream->len -= n;
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return n;
+}
+
+size_t sim_link_received_pending(uint16_t conn_handle, uint16_t attr_handle) {
+  attr_handle = _resolve_attr(attr_handle);
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  struct sim_stream *stream = conn ? _stream(conn, attr_handle) : NULL;
+  size_t n = stream ? stream->len : 0;
+  pthread_mutex_unlock(&_state_lock);
+  return n;
+}
+
+bool sim_link_wait_received(uint16_t conn_handle, uint16_t attr_handle, size_t len, uint32_t timeout_ms) {
+  int64_t deadline = esp_timer_get_time() + timeout_ms * 1000LL;
+  while (sim_link_received_pending(conn_handle, attr_handle) < len) {
+    if (esp_timer_get_time() > deadline)
+      return false;
+    usleep(200);
+  }
+  return true;
+}
+
+size_t sim_link_notification_sizes(uint16_t conn_handle, uint16_t *sizes, size_t max_count) {
+  pthread_mutex_lock(&_state_lock);
+  struct sim_conn *conn = _conn_find(conn_handle);
+  size_t n = 0;
+  if (conn) {
+    n = conn->sizes_count < max_count ? conn->sizes_count : max_count;
+    memcpy(sizes, conn->sizes, n * sizeof(uint16_t));
+  }
+  pthread_mutex_unlock(&_state_lock);
+  return n;
+}
+
+void sim_link_set_notify_handler(void (*handler)(uint16_t, uint16_t, const uint8_t *, size_t, void *), void *arg) {
+  _notify_handler = handler;
+  _notify_handler_arg = arg;
+}
+
+void sim_link_get_stats(struct sim_link_stats *stats) {
+  pthread_mutex_lock(&_state_lock);
+  *stats = _stats;
+  pthread_mutex_unlock(&_state_lock);
+}
+
+void sim_link_reset_stats(void) {
+  pthread_mutex_lock(&_state_lock);
+  memset(&_stats, 0, sizeof(_stats));
+  pthread_mutex_unlock(&_state_lock);
+}
@@ -0,0 +1,298 @@
+// Host stand-in for the ESP-IDF ring buffer. NOSPLIT buffers keep an 8 byte
+// header and 4 byte alignment per item, so free-space arithmetic matches the
+// target closely enough for overflow tests; BYTEBUF buffers are plain byte rings.
+#include <pthread.h>
+#include <stdio.h>
+
+#include "freertos/ringbuf.h"
+
+#define RB_HEADER_SIZE 8
+#define RB_ALIGN(x) (((x) + 3) & ~(size_t)3)
+#define RB_MAX_ITEMS 4096
+
+bool shim_cond_wait(pthread_cond_t *cond, pthread_mutex_t *mutex, const struct timespec *deadline);
+const struct timespec *shim_deadline(TickType_t ticks, struct timespec *ts);
+
+struct rb_item {
+  size_t offset; // payload offset within storage
+  size_t len;    // payload length
+  size_t total;  // header + aligned payload
+  bool read;
+  bool returned;
+};
+
+struct shim_ringbuf {
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  RingbufferType_t type;
+  uint8_t *storage;
+  bool static_storage;
+  size_t size;
+
+  // NOSPLIT bookkeeping
+  size_t write_pos;
+  size_t free_pos;
+  struct rb_item items[RB_MAX_ITEMS];
+  size_t item_head;
+  size_t item_count;
+
+  // BYTEBUF bookkeeping
+  size_t byte_head;
+  size_t byte_count;
+  size_t byte_acquired;
+};
+
+static RingbufHandle_t _create(size_t size, RingbufferType_t type, uint8_t *storage) {
+  if (type != RINGBUF_TYPE_NOSPLIT && type != RINGBUF_TYPE_BYTEBUF) {
+    fprintf(stderr, "ringbuf shim: unsupported type %d\n", type);
+    return NULL;
+  }
+  struct shim_ringbuf *rb = calloc(1, sizeof(*rb));
+  if (rb == NULL)
+    return NULL;
+  pthread_mutex_init(&rb->mutex, NULL);
+  pthread_cond_init(&rb->cond, NULL);
+  rb->type = type;
+  rb->size = type == RINGBUF_TYPE_NOSPLIT ? size & ~(size_t)3 : size;
+  rb->static_storage = storage != NULL;
+  rb->storage = storage ? storage : malloc(size);
+  return rb;
+}
+
+RingbufHandle_t xRingbufferCreate(size_t size, RingbufferType_t type) { return _create(size, type, NULL); }
+
+RingbufHandle_t xRingbufferCreateStatic(size_t size, RingbufferType_t type, uint8_t *storage,
+                                        StaticRingbuffer_t *buffer) {
+  // ESP-IDF asserts that the storage of an item ring buffer holds whole words
+  if (type != RINGBUF_TYPE_BYTEBUF && size % 4 != 0)
+    return NULL;
+  return _create(size, type, storage);
+}
+
+void vRingbufferDelete(RingbufHandle_t rb) {
+  if (rb == NULL)
+    return;
+  if (!rb->static_storage)
+    free(rb->storage);
+  free(rb);
+}
+
+size_t xRingbufferGetMaxItemSize(RingbufHandle_t rb) {
+  if (rb->type == RINGBUF_TYPE_BYTEBUF)
+    return rb->size;
+  return RB_ALIGN(rb->size / 2) - RB_HEADER_SIZE;
+}
+
+// offset where an item of `total` bytes would be placed, or -1
+static long _nosplit_fit(RingbufHandle_t rb, size_t total) {
+  if (rb->item_count == 0)
+    return total <= rb->size ? 0 : -1;
+  if (rb->item_count >= RB_MAX_ITEMS)
+    return -1;
+  if (rb->write_pos > rb->free_pos) {
+    if (rb->size - rb->write_pos >= total)
+      return (long)rb->write_pos;
+    if (rb->free_pos >= total)
+      return 0;
+    return -1;
+  }
+  if (rb->write_pos < rb->free_pos && rb->free_pos - rb->write_pos >= total)
+    return (long)rb->write_pos;
+  return -1;
+}
+
+static size_t _nosplit_free(RingbufHandle_t rb) {
+  size_t best = 0;
+  if (rb->item_count == 0) {
+    best = rb->size;
+  } else if (rb->write_pos > rb->free_pos) {
+    best = rb->size - rb->write_pos;
+    if (rb->free_pos > best)
+      best = rb->free_pos;
+  } else if (rb->write_pos < rb->free_pos) {
+    best = rb->free_pos - rb->write_pos;
+  }
+  best = best > RB_HEADER_SIZE ? (best - RB_HEADER_SIZE) & ~(size_t)3 : 0;
+  size_t max = xRingbufferGetMaxItemSize(rb);
+  return best < max ? best : max;
+}
+
+size_t xRingbufferGetCurFreeSize(RingbufHandle_t rb) {
+  pthread_mutex_lock(&rb->mutex);
+  size_t ret = rb->type == RINGBUF_TYPE_BYTEBUF ? rb->size - rb->byte_count : _nosplit_free(rb);
+  pthread_mutex_unlock(&rb->mutex);
+  return ret;
+}
+
+UBaseType_t xRingbufferSend(RingbufHandle_t rb, const void *data, size_t size, TickType_t ticks) {
+  struct timespec ts;
+  const struct timespec *deadline = shim_deadline(ticks, &ts);
+
+  if (size > xRingbufferGetMaxItemSize(rb))
+    return pdFALSE;
+
+  pthread_mutex_lock(&rb->mutex);
+  if (rb->type == RINGBUF_TYPE_BYTEBUF) {
+    while (rb->size - rb->byte_count < size) {
+      if (ticks == 0 || !shim_cond_wait(&rb->cond, &rb->mutex, deadline)) {
+        if (rb->size - rb->byte_count < size) {
+          pthread_mutex_unlock(&rb->mutex);
+          return pdFALSE;
+        }
+      }
+    }
+    size_t tail = (rb->byte_head + rb->byte_count) % rb->size;
+    size_t first = size < rb->size - tail ? size : rb->size - tail;
+    memcpy(rb->storage + tail, data, first);
+    memcpy(rb->storage, (const uint8_t *)data + first, size - first);
+    rb->byte_count += size;
+  } else {
+    size_t total = RB_HEADER_SIZE + RB_ALIGN(size);
+    long offset;
+    while ((offset = _nosplit_fit(rb, total)) < 0) {
+      if (ticks == 0 || !shim_cond_wait(&rb->cond, &rb->mutex, deadline)) {
+        if ((offset = _nosplit_fit(rb, total)) < 0) {
+          pthread_mutex_unlock(&rb->mutex);
+          return pdFALSE;
+        }
+        break;
+      }
+    }
+    if (rb->item_count == 0)
+      rb->free_pos = 0;
+    struct rb_item *item = &rb->items[(rb->item_head + rb->item_count) % RB_MAX_ITEMS];
+    item->offset = (size_t)offset + RB_HEADER_SIZE;
+    item->len = size;
+    item->total = total;
+    item->read = false;
+    item->returned = false;
+    memcpy(rb->storage + item->offset, data, size);
+    rb->write_pos = (size_t)offset + total;
+    rb->item_count++;
+  }
+  pthread_cond_broadcast(&rb->cond);
+  pthread_mutex_unlock(&rb->mutex);
+  return pdTRUE;
+}
+
+static struct rb_item *_first_unread(RingbufHandle_t rb) {
+  for (size_t i = 0; i < rb->item_count; ++i) {
+    struct rb_item *item = &rb->items[(rb->item_head + i) % RB_MAX_ITEMS];
+    if (!item->read)
+      return item;
+  }
+  return NULL;
+}
+
+static void *_receive(RingbufHandle_t rb, size_t *out_size, TickType_t ticks, size_t max_size) {
+  struct timespec ts;
+  const struct timespec *deadline = shim_deadline(ticks, &ts);
+  void *ret = NULL;
+
+  pthread_mutex_lock(&rb->mutex);
+  if (rb->type == RINGBUF_TYPE_BYTEBUF) {
+    while (rb->byte_count == 0 || rb->byte_acquired) {
+      if (ticks == 0 || !shim_cond_wait(&rb->cond, &rb->mutex, deadline)) {
+        if (rb->byte_count == 0 || rb->byte_acquired)
+          goto out;
+      }
+    }
+    size_t contiguous = rb->size - rb->byte_head;
+    size_t len = rb->byte_count < contiguous ? rb->byte_count : contiguous;
+    if (len > max_size)
+      len = max_size;
+    rb->byte_acquired = len;
+    *out_size = len;
+    ret = rb->storage + rb->byte_head;
+  } else {
+    struct rb_item *item;
+    while ((item = _first_unread(rb)) == NULL) {
+      if (ticks == 0 || !shim_cond_wait(&rb->cond, &rb->mutex, deadline)) {
+        if ((item = _first_unread(rb)) == NULL)
+          goto out;
+        break;
+      }
+    }
+    item->read = true;
+    *out_size = item->len;
+    ret = rb->storage + item->offset;
+  }
+out:
+  pthread_mutex_unlock(&rb->mutex);
+  return ret;
+}
+
+void *xRingbufferReceive(RingbufHandle_t rb, size_t *size, TickType_t ticks) {
+  return _receive(rb, size, ticks, (size_t)-1);
+}
+
+void *xRingbufferReceiveUpTo(RingbufHandle_t rb, size_t *size, TickType_t ticks, size_t max_size) {
+  if (rb->type != RINGBUF_TYPE_BYTEBUF)
+    return NULL;
+  return _receive(rb, size, ticks, max_size);
+}
+
+void vRingbufferReturnItem(RingbufHandle_t rb, void *data) {
+  pthread_mutex_lock(&rb->mutex);
+  if (rb->type == RINGBUF_TYPE_BYTEBUF) {
+    if (data != rb->storage + rb->byte_head || rb->byte_acquired == 0) {
+      fprintf(stderr, "ringbuf shim: returning an item that was not received\n");
+      abort();
+    }
+    rb->byte_head = (rb->byte_head + rb->byte_acquired) % rb->size;
+    rb->byte_count -= rb->byte_acquired;
+    rb->byte_acquired = 0;
+  } else {
+    size_t offset = (size_t)((uint8_t *)data - rb->storage);
+    bool found = false;
+    for (size_t i = 0; i < rb->item_count; ++i) {
+      struct rb_item *item = &rb->items[(rb->item_head + i) % RB_MAX_ITEMS];
+      if (item->offset == offset && item->read && !item->returned) {
+        item->returned = true;
+        found = true;
+        break;
+      }
+    }
+    if (!found) {
+      fprintf(stderr, "ringbuf shim: returning an item that was not received\n");
+      abort();
+    }
+    while (rb->item_count > 0 && rb->items[rb->item_head].returned) {
+      rb->item_head = (rb->item_head + 1) % RB_MAX_ITEMS;
+      rb->item_count--;
+      if (rb->item_count > 0) {
+        rb->free_pos = rb->items[rb->item_head].offset - RB_HEADER_SIZE;
+      } else {
+        rb->free_pos = 0;
+        rb->write_pos = 0;
+      }
+    }
+  }
+  pthread_cond_broadcast(&rb->cond);
+  pthread_mutex_unlock(&rb->mutex);
+}
+
+void vRingbufferGetInfo(RingbufHandle_t rb, UBaseType_t *free, UBaseType_t *read, UBaseType_t *write,
+                        UBaseType_t *acquire, UBaseType_t *items_waiting) {
+  pthread_mutex_lock(&rb->mutex);
+  if (free)
+    *free = (UBaseType_t)(rb->type == RINGBUF_TYPE_BYTEBUF ? rb->byte_head : rb->free_pos);
+  if (read)
+    *read = (UBaseType_t)rb->byte_head;
+  if (write)
+    *write = (UBaseType_t)(rb->type == RINGBUF_TYPE_BYTEBUF ? (rb->byte_head + rb->byte_count) % rb->size
+                                                            : rb->write_pos);
+  if (acquire)
+    *acquire = 0;
+  if (items_waiting) {
+    if (rb->type == RINGBUF_TYPE_BYTEBUF) {
+      *items_waiting = (UBaseType_t)rb->byte_count;
+    } else {
+      UBaseType_t waiting = 0;
+      for (size_t i = 0; i < rb->item_count; ++i)
+        waiting += !rb->items[(rb->item_head + i) % RB_MAX_ITEMS].read;
+      *items_waiting = waiting;
+    }
+  }
+  pthread_mutex_unlock(&rb->mutex);
+}
@@ -0,0 +1,72 @@
+// Test runner for the host Unity subset.
+//
+//   test_host            run every test case except [bench]
+//   test_host [buffer]   run the test cases with a tag or name containing the argument
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdlib.h>
+
+#include "unity.h"
+
+#define UNITY_MAX_TESTS 256
+
+struct unity_test {
+  const char *name;
+  const char *tags;
+  unity_test_fn fn;
+  const char *file;
+  int line;
+};
+
+static struct unity_test _tests[UNITY_MAX_TESTS];
+static int _test_count;
+static jmp_buf _abort_test;
+
+void unity_register_test(const char *name, const char *tags, unity_test_fn fn, const char *file, int line) {
+  if (_test_count == UNITY_MAX_TESTS) {
+    fprintf(stderr, "too many test cases\n");
+    abort();
+  }
+  _tests[_test_count++] = (struct unity_test){name, tags, fn, file, line};
+}
+
+void unity_fail(const char *file, int line, const char *fmt, ...) {
+  va_list ap;
+  fprintf(stderr, "%s:%d: FAIL: ", file, line);
+  va_start(ap, fmt);
+  vfprintf(stderr, fmt, ap);
+  va_end(ap);
+  fputc('\n', stderr);
+  longjmp(_abort_test, 1);
+}
+
+static bool _selected(const struct unity_test *test, int argc, char **argv) {
+  if (argc < 2)
+    return strstr(test->tags, "[bench]") == NULL;
+  for (int i = 1; i < argc; ++i) {
+    if (strstr(test->tags, argv[i]) || strstr(test->name, argv[i]))
+      return true;
+  }
+  return false;
+}
+
+int main(int argc, char **argv) {
+  setvbuf(stdout, NULL, _IOLBF, 0);
+  int run = 0;
+  int failed = 0;
+  for (int i = 0; i < _test_count; ++i) {
+    const struct unity_test *test = &_tests[i];
+    if (!_selected(test, argc, argv))
+      continue;
+    printf("Running %s %s...\n", test->name, test->tags);
+    ++run;
+    if (setjmp(_abort_test) == 0) {
+      test->fn();
+    } else {
+      ++failed;
+      printf("%s:%d:%s:FAIL\n", test->file, test->line, test->name);
+    }
+  }
+  printf("-----------------------\n%d Tests %d Failures 0 Ignored\n%s\n", run, failed, failed ? "FAIL" : "OK");
+  return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,121 @@
+// Host stand-in for the ESP-IDF VFS registry and its select() plumbing.
+#include <errno.h>
+#include <string.h>
+
+#include "esp_vfs.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+
+#define VFS_MAX_DEVICES 4
+
+struct vfs_entry {
+  char base_path[32];
+  esp_vfs_t vfs;
+};
+
+static struct vfs_entry _entries[VFS_MAX_DEVICES];
+
+static struct vfs_entry *_find(const char *path) {
+  for (int i = 0; i < VFS_MAX_DEVICES; ++i) {
+    const size_t len = strlen(_entries[i].base_path);
+    if (len && strncmp(path, _entries[i].base_path, len) == 0 && (path[len] == '\0' || path[len] == '/'))
+      return &_entries[i];
+  }
+  return NULL;
+}
+
+esp_err_t esp_vfs_register(const char *base_path, const esp_vfs_t *vfs, void *ctx) {
+  if (base_path == NULL || vfs == NULL || strlen(base_path) >= sizeof(_entries[0].base_path))
+    return ESP_ERR_INVALID_ARG;
+  if (_find(base_path))
+    return ESP_ERR_INVALID_STATE;
+  for (int i = 0; i < VFS_MAX_DEVICES; ++i) {
+    if (_entries[i].base_path[0] == '\0') {
+      strcpy(_entries[i].base_path, base_path);
+      _entries[i].vfs = *vfs;
+      return ESP_OK;
+    }
+  }
+  return ESP_ERR_NO_MEM;
+}
+
+esp_err_t esp_vfs_unregister(const char *base_path) {
+  struct vfs_entry *entry = _find(base_path);
+  if (entry == NULL || strcmp(entry->base_path, base_path) != 0)
+    return ESP_ERR_INVALID_STATE;
+  memset(entry, 0, sizeof(*entry));
+  return ESP_OK;
+}
+
+void esp_vfs_select_triggered(esp_vfs_select_sem_t sem) { //
+  xSemaphoreGive((SemaphoreHandle_t)sem.sem);
+}
+
+#define VFS_CALL(path, fn, ...)                                                                                        \
+  do {                                                                                                                 \
+    struct vfs_entry *entry = _find(path);                                                                             \
+    if (entry == NULL || entry->vfs.fn == NULL) {                                                                      \
+      errno = entry ? ENOSYS : ENOENT;                                                                                 \
+      return -1;                                                                                                       \
+    }                                                                                                                  \
+    return entry->vfs.fn(__VA_ARGS__);                                                                                 \
+  } while (0)
+
+int shim_vfs_open(const char *path, int flags) {
+  struct vfs_entry *entry = _find(path);
+  if (entry == NULL || entry->vfs.open == NULL) {
+    errno = ENOENT;
+    return -1;
+  }
+  return entry->vfs.open(path + strlen(entry->base_path), flags, 0);
+}
+
+ssize_t shim_vfs_read(const char *path, int fd, void *dst, size_t size) { VFS_CALL(path, read, fd, dst, size); }
+
+ssize_t shim_vfs_write(const char *path, int fd, const void *data, size_t size) {
+  VFS_CALL(path, write, fd, data, size);
+}
+
+int shim_vfs_close(const char *path, int fd) { VFS_CALL(path, close, fd); }
+
+int shim_vfs_fstat(const char *path, int fd, struct stat *st) { VFS_CALL(path, fstat, fd, st); }
+
+int shim_vfs_fcntl(const char *path, int fd, int cmd, int arg) { VFS_CALL(path, fcntl, fd, cmd, arg); }
+
+int shim_vfs_fsync(const char *path, int fd) { VFS_CALL(path, fsync, fd); }
+
+// Like esp_vfs_select(): hand the device local fd sets and a semaphore, wait, then collect.
+int shim_vfs_select(const char *path, int fd, bool *readable, bool *writable, uint32_t timeout_ms) {
+  struct vfs_entry *entry = _find(path);
+  if (entry == NULL || entry->vfs.start_select == NULL || entry->vfs.end_select == NULL) {
+    errno = ENOSYS;
+    return -1;
+  }
+  fd_set readfds, writefds, exceptfds;
+  FD_ZERO(&readfds);
+  FD_ZERO(&writefds);
+  FD_ZERO(&exceptfds);
+  if (readable)
+    FD_SET(fd, &readfds);
+  if (writable)
+    FD_SET(fd, &writefds);
+
+  SemaphoreHandle_t sem = xSemaphoreCreateBinary();
+  const esp_vfs_select_sem_t select_sem = {.is_sem_local = true, .sem = sem};
+  void *args = NULL;
+  if (entry->vfs.start_select(fd + 1, &readfds, &writefds, &exceptfds, select_sem, &args) != ESP_OK) {
+    vSemaphoreDelete(sem);
+    errno = EINTR;
+    return -1;
+  }
+  xSemaphoreTake(sem, pdMS_TO_TICKS(timeout_ms));
+  entry->vfs.end_select(args);
+  vSemaphoreDelete(sem);
+
+  bool any = false;
+  if (readable)
+    any |= *readable = FD_ISSET(fd, &readfds);
+  if (writable)
+    any |= *writable = FD_ISSET(fd, &writefds);
+  return any ? 1 : 0;
+}
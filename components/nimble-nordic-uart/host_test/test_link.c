@@ -0,0 +1,1567 @@
+// Host-only test cases: drive the component through the simulated central in sim_link.h.
+#include "unity.h"
+
+#include "nordic-uart-private.h"
+#include "esp_timer.h"
+#include "freertos/semphr.h"
+#include "sim_link.h"
+#ifdef CONFIG_NORDIC_UART_VFS
+#include "esp_vfs.h"
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static void start_with_link(const struct sim_link_config *config) {
+  struct sim_link_config defaults;
+  sim_link_default_config(&defaults);
+  sim_link_configure(config ? config : &defaults);
+  TEST_ESP_OK(nordic_uart_start("Nordic UART", NULL));
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+}
+
+static void stop_with_link(void) {
+  TEST_ESP_OK(nordic_uart_stop());
+  struct sim_link_config defaults;
+  sim_link_default_config(&defaults);
+  sim_link_configure(&defaults);
+}
+
+// Connect and wait until the MTU exchange the component starts on connect has been applied.
+static uint16_t connect_central(uint8_t peer_id) {
+  const uint16_t conn_handle = sim_link_connect_as(peer_id);
+  TEST_ASSERT_NOT_EQUAL(BLE_HS_CONN_HANDLE_NONE, conn_handle);
+  const uint16_t chunk = _nordic_uart_notify_payload_size(sim_link_mtu(conn_handle));
+  for (int i = 0; i < 100 && _nordic_uart_tx_chunk_size() != chunk; ++i)
+    vTaskDelay(pdMS_TO_TICKS(5));
+  vTaskDelay(pdMS_TO_TICKS(20));
+  return conn_handle;
+}
+
+static void fill_pattern(uint8_t *buf, size_t len) {
+  for (size_t i = 0; i < len; ++i)
+    buf[i] = (uint8_t)(i * 7 + i / 251);
+}
+
+TEST_CASE("lines written by the central reach the ring buffer", "[host]") {
+  size_t item_size;
+  char *str;
+
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "hel", 3));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "lo\r\nwor", 7));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "ld\n", 3));
+
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("hello", str);
+  TEST_ASSERT_EQUAL_UINT16(conn, nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("world", str);
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+
+  // the disconnect is reported as Ctrl-C
+  sim_link_disconnect(conn);
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("\003", str);
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  stop_with_link();
+}
+
+TEST_CASE("notifications are split at the negotiated MTU", "[host]") {
+  static const uint16_t mtus[] = {23, 24, 100, 185, 247, 517};
+  static uint8_t data[3000];
+  static uint8_t received[sizeof(data)];
+  static uint16_t sizes[256];
+  fill_pattern(data, sizeof(data));
+
+  for (size_t m = 0; m < sizeof(mtus) / sizeof(mtus[0]); ++m) {
+    struct sim_link_config config;
+    sim_link_default_config(&config);
+    config.mtu = mtus[m];
+    start_with_link(&config);
+    const uint16_t conn = connect_central(1);
+    const uint16_t mtu = MIN(mtus[m], CONFIG_NORDIC_UART_PREFERRED_MTU);
+    TEST_ASSERT_EQUAL_UINT16(mtu, sim_link_mtu(conn));
+    const size_t chunk = mtu - 3;
+
+    // one byte short of, exactly at, and one byte past a chunk boundary
+    const size_t lens[] = {chunk - 1, chunk, chunk + 1, sizeof(data)};
+    size_t expected_count = 0;
+    size_t total = 0;
+    for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+      TEST_ESP_OK(nordic_uart_write(data, lens[l]));
+      expected_count += (lens[l] + chunk - 1) / chunk;
+      total += lens[l];
+    }
+    TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, total, 5000));
+
+    const size_t count = sim_link_notification_sizes(conn, sizes, 256);
+    TEST_ASSERT_EQUAL(expected_count, count);
+    size_t pos = 0;
+    for (size_t l = 0, n = 0; l < sizeof(lens) / sizeof(lens[0]); ++l) {
+      for (size_t left = lens[l]; left > 0; ++n) {
+        TEST_ASSERT_EQUAL(MIN(left, chunk), sizes[n]);
+        left -= sizes[n];
+      }
+      TEST_ASSERT_EQUAL(lens[l], sim_link_received(conn, 0, received, lens[l]));
+      TEST_ASSERT_EQUAL_MEMORY(data, received, lens[l]);
+      pos += lens[l];
+    }
+    TEST_ASSERT_EQUAL(total, pos);
+    stop_with_link();
+  }
+}
+
+TEST_CASE("long lines from two centrals are joined again", "[host]") {
+  static char json[2][3000];
+  static char joined_lines[2][sizeof(json[0])];
+  struct nordic_uart_line_assembler assembler;
+  struct nordic_uart_rx_line items[16], line;
+  size_t joined_count = 0;
+  for (int c = 0; c < 2; ++c) {
+    size_t len = snprintf(json[c], sizeof(json[c]), "{\"conn\":%d,\"data\":\"", c);
+    for (; len < sizeof(json[c]) - 3; ++len)
+      json[c][len] = 'A' + (len * 7 + c) % 26;
+    memcpy(json[c] + len, "\"}", 3);
+  }
+
+  TEST_ESP_OK(nordic_uart_set_long_lines(true));
+  nordic_uart_line_assembler_init(&assembler, 4096);
+  start_with_link(NULL);
+  const uint16_t conns[2] = {connect_central(1), connect_central(2)};
+  const size_t chunk = 200;
+  // the writes of both centrals take turns, so their fragments interleave in the RX ring
+  for (size_t pos = 0; pos <= strlen(json[0]); pos += chunk) {
+    for (int c = 0; c < 2; ++c) {
+      const size_t len = MIN(chunk, strlen(json[c]) - pos);
+      TEST_ASSERT_EQUAL(0, sim_link_write(conns[c], json[c] + pos, len));
+      if (len < chunk)
+        TEST_ASSERT_EQUAL(0, sim_link_write(conns[c], "\n", 1));
+    }
+    const size_t count = nordic_uart_receive_batch(items, 16, 0, 0);
+    for (size_t i = 0; i < count; ++i) {
+      if (nordic_uart_line_assembler_feed(&assembler, &items[i], &line)) {
+        TEST_ASSERT_LESS_THAN(2, joined_count);
+        TEST_ASSERT_EQUAL(conns[joined_count], line.conn_handle);
+        memcpy(joined_lines[joined_count++], line.data, line.len + 1);
+      }
+    }
+    nordic_uart_release_batch(items, count);
+  }
+  TEST_ASSERT_EQUAL(2, joined_count);
+  TEST_ASSERT_EQUAL_STRING(json[0], joined_lines[0]);
+  TEST_ASSERT_EQUAL_STRING(json[1], joined_lines[1]);
+#ifdef CONFIG_NORDIC_UART_STATS
+  struct nordic_uart_stats stats;
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(2 * ((sizeof(json[0]) - 1) / CONFIG_NORDIC_UART_MAX_LINE_LENGTH), stats.rx_line_fragments);
+  TEST_ASSERT_EQUAL(0, stats.rx_line_overflows);
+#endif
+
+  sim_link_disconnect(conns[0]);
+  sim_link_disconnect(conns[1]);
+  stop_with_link();
+  nordic_uart_line_assembler_deinit(&assembler);
+  TEST_ESP_OK(nordic_uart_set_long_lines(false));
+}
+
+TEST_CASE("writev packs fragments across notification boundaries", "[host]") {
+  static uint8_t data[1200];
+  static uint8_t received[sizeof(data)];
+  static uint16_t sizes[32];
+  fill_pattern(data, sizeof(data));
+
+  // small mbufs so every notification is a chain
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  config.mbuf_block_size = 64;
+  start_with_link(&config);
+  const uint16_t conn = connect_central(1);
+  const size_t chunk = _nordic_uart_tx_chunk_size();
+
+  const size_t frags[] = {1, chunk - 2, 2, chunk, 0, 3, sizeof(data) - 2 * chunk - 4};
+  struct iovec iov[sizeof(frags) / sizeof(frags[0])];
+  size_t off = 0;
+  for (size_t i = 0; i < sizeof(frags) / sizeof(frags[0]); ++i) {
+    iov[i].iov_base = data + off;
+    iov[i].iov_len = frags[i];
+    off += frags[i];
+  }
+  TEST_ASSERT_EQUAL(sizeof(data), off);
+  const int mbufs_free = os_msys_num_free();
+  TEST_ESP_OK(nordic_uart_writev(iov, sizeof(frags) / sizeof(frags[0])));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, sizeof(data), 2000));
+  TEST_ASSERT_EQUAL(sizeof(data), sim_link_received(conn, 0, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY(data, received, sizeof(data));
+
+  // fragments never leave a short notification in the middle of the stream
+  const size_t count = sim_link_notification_sizes(conn, sizes, 32);
+  TEST_ASSERT_EQUAL((sizeof(data) + chunk - 1) / chunk, count);
+  for (size_t i = 0; i + 1 < count; ++i)
+    TEST_ASSERT_EQUAL(chunk, sizes[i]);
+  vTaskDelay(pdMS_TO_TICKS(50));
+  TEST_ASSERT_EQUAL(mbufs_free, os_msys_num_free());
+  stop_with_link();
+}
+
+TEST_CASE("binary frames cross the link in every framing", "[host]") {
+  static const enum nordic_uart_framing framings[] = {NORDIC_UART_FRAMING_COBS, NORDIC_UART_FRAMING_SLIP,
+                                                      NORDIC_UART_FRAMING_VARINT};
+  static uint8_t data[600];
+  static uint8_t encoded[NORDIC_UART_FRAME_ENCODED_MAX(sizeof(data))];
+  static uint8_t received[sizeof(encoded)];
+  size_t item_size;
+  uint8_t *item;
+  fill_pattern(data, sizeof(data));
+
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+  for (size_t f = 0; f < sizeof(framings) / sizeof(framings[0]); ++f) {
+    TEST_ESP_OK(nordic_uart_set_framing(framings[f]));
+
+    // central to device: a frame split over two writes, then one in a single write
+    const size_t len = nordic_uart_frame_encode(framings[f], data, 200, encoded, sizeof(encoded));
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, encoded, len / 2));
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, encoded + len / 2, len - len / 2));
+    const size_t short_len = nordic_uart_frame_encode(framings[f], "\xc0\x00\xdb", 3, encoded, sizeof(encoded));
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, encoded, short_len));
+    item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+    TEST_ASSERT_NOT_NULL(item);
+    TEST_ASSERT_EQUAL(200, nordic_uart_rx_item_len(item_size));
+    TEST_ASSERT_EQUAL_MEMORY(data, item, 200);
+    TEST_ASSERT_EQUAL_UINT16(conn, nordic_uart_rx_item_conn_handle(item, item_size));
+    nordic_uart_return_item(item);
+    item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+    TEST_ASSERT_NOT_NULL(item);
+    TEST_ASSERT_EQUAL(3, nordic_uart_rx_item_len(item_size));
+    TEST_ASSERT_EQUAL_MEMORY("\xc0\x00\xdb", item, 3);
+    nordic_uart_return_item(item);
+
+    // device to central: the central sees exactly the encoder's output
+    const size_t expected = nordic_uart_frame_encode(framings[f], data, sizeof(data), encoded, sizeof(encoded));
+    TEST_ESP_OK(nordic_uart_write_frame(data, sizeof(data)));
+    TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, expected, 2000));
+    TEST_ASSERT_EQUAL(expected, sim_link_received(conn, 0, received, sizeof(received)));
+    TEST_ASSERT_EQUAL_MEMORY(encoded, received, expected);
+  }
+
+  // a partial binary frame is dropped on disconnect, no Ctrl-C
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "\x10\x01", 2));
+  sim_link_disconnect(conn);
+  TEST_ASSERT_NULL(xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(50)));
+  TEST_ESP_OK(nordic_uart_set_framing(NORDIC_UART_FRAMING_LINE));
+  stop_with_link();
+}
+
+TEST_CASE("coalescing packs short sends into full notifications", "[host]") {
+  static char expected[2048];
+  static char received[sizeof(expected)];
+  static uint16_t sizes[64];
+
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+  const size_t chunk = _nordic_uart_tx_chunk_size();
+
+  // 200 ten byte key=value pairs make full notifications, the tail goes out after the delay
+  TEST_ESP_OK(nordic_uart_set_tx_coalescing(20));
+  size_t len = 0;
+  for (int i = 0; i < 200; ++i) {
+    len += snprintf(expected + len, sizeof(expected) - len, "key%03d=%02d;", i, i % 100);
+    TEST_ESP_OK(nordic_uart_send(expected + len - 10));
+  }
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, len, 1000));
+  TEST_ASSERT_EQUAL(len, sim_link_received(conn, 0, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY(expected, received, len);
+  const size_t count = sim_link_notification_sizes(conn, sizes, 64);
+  TEST_ASSERT_EQUAL((len + chunk - 1) / chunk, count);
+
+  // a newline or a flush sends at once, without waiting for the delay
+  TEST_ESP_OK(nordic_uart_set_tx_coalescing(1000));
+  TEST_ESP_OK(nordic_uart_send("held"));
+  vTaskDelay(pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL(0, sim_link_received_pending(conn, 0));
+  int64_t start = esp_timer_get_time();
+  TEST_ESP_OK(nordic_uart_sendln(" back"));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, 11, 500));
+  TEST_ASSERT_LESS_THAN(500000, esp_timer_get_time() - start);
+  TEST_ASSERT_EQUAL(11, sim_link_received(conn, 0, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY("held back\r\n", received, 11);
+
+  TEST_ESP_OK(nordic_uart_write_async("async", 5));
+  start = esp_timer_get_time();
+  TEST_ESP_OK(nordic_uart_flush(pdMS_TO_TICKS(500)));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, 5, 500));
+  TEST_ASSERT_LESS_THAN(500000, esp_timer_get_time() - start);
+  TEST_ASSERT_EQUAL(5, sim_link_received(conn, 0, received, sizeof(received)));
+
+  // a send to one central does not overtake data held for everyone
+  TEST_ESP_OK(nordic_uart_send("first,"));
+  TEST_ESP_OK(nordic_uart_send_to(conn, "second"));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, 12, 500));
+  TEST_ASSERT_EQUAL(12, sim_link_received(conn, 0, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY("first,second", received, 12);
+
+  TEST_ASSERT_EQUAL(ESP_FAIL, nordic_uart_set_tx_coalescing(1001));
+  TEST_ESP_OK(nordic_uart_set_tx_coalescing(0));
+  stop_with_link();
+}
+
+static char priority_dump[8000];
+
+static void priority_blocking_writer(void *arg) {
+  nordic_uart_write(priority_dump, sizeof(priority_dump));
+  xSemaphoreGive((SemaphoreHandle_t)arg);
+  vTaskDelete(NULL);
+}
+
+// Where "ALARM" landed among the dump's dots, -1 if it is missing or broken up.
+static int alarm_position(const char *received, size_t len) {
+  for (size_t i = 0; i + 5 <= len; ++i) {
+    if (memcmp(received + i, "ALARM", 5) == 0)
+      return (int)i;
+  }
+  return -1;
+}
+
+TEST_CASE("priority messages overtake queued and blocking writes", "[host]") {
+  static char received[sizeof(priority_dump) + 16];
+  struct nordic_uart_tx_lane_stats normal, high;
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  config.conn_interval_us = 20000; // one notification per 20 ms
+  config.packets_per_event = 1;
+  config.mbuf_count = 8; // the BLE host holds at most this many notifications
+  start_with_link(&config);
+  const uint16_t conn = connect_central(1);
+  memset(priority_dump, '.', sizeof(priority_dump));
+  // what is already in the BLE host cannot be overtaken: its backlog and a few more
+  const int next_slots = (config.mbuf_count + 4) * _nordic_uart_tx_chunk_size();
+
+  // behind nearly 4 KB of async data
+  TEST_ESP_OK(nordic_uart_write_async(priority_dump, 4000));
+  vTaskDelay(pdMS_TO_TICKS(50));
+  TEST_ESP_OK(nordic_uart_send_priority("ALARM"));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, 4005, 2000));
+  TEST_ASSERT_EQUAL(4005, sim_link_received(conn, 0, received, sizeof(received)));
+  int at = alarm_position(received, 4005);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, at);
+  TEST_ASSERT_LESS_THAN(next_slots, at);
+  TEST_ESP_OK(nordic_uart_get_tx_lane_stats(NORDIC_UART_TX_NORMAL, &normal));
+  TEST_ESP_OK(nordic_uart_get_tx_lane_stats(NORDIC_UART_TX_HIGH, &high));
+  TEST_ASSERT_EQUAL(1, normal.messages);
+  TEST_ASSERT_EQUAL(4000, normal.high_watermark);
+  TEST_ASSERT_EQUAL(1, high.messages);
+  TEST_ASSERT_EQUAL(0, high.depth);
+  TEST_ASSERT_EQUAL(5, high.high_watermark);
+  TEST_ASSERT_LESS_THAN(normal.latency_max_us / 2, high.latency_max_us);
+
+  // in the middle of a blocking write from another task
+  SemaphoreHandle_t done = xSemaphoreCreateBinary();
+  xTaskCreate(priority_blocking_writer, "writer", 4096, done, 5, NULL);
+  vTaskDelay(pdMS_TO_TICKS(100));
+  TEST_ESP_OK(nordic_uart_write_priority("ALARM", 5));
+  TEST_ASSERT_TRUE(xSemaphoreTake(done, pdMS_TO_TICKS(3000)));
+  vSemaphoreDelete(done);
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, sizeof(priority_dump) + 5, 1000));
+  TEST_ASSERT_EQUAL(sizeof(priority_dump) + 5, sim_link_received(conn, 0, received, sizeof(received)));
+  at = alarm_position(received, sizeof(priority_dump) + 5);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, at);
+  TEST_ASSERT_LESS_THAN(sizeof(priority_dump) / 2, at);
+
+  TEST_ASSERT_EQUAL(ESP_FAIL, nordic_uart_write_priority(priority_dump, 600));
+  TEST_ESP_ERR(ESP_ERR_INVALID_ARG, nordic_uart_get_tx_lane_stats(NORDIC_UART_TX_PRIORITIES, &high));
+  stop_with_link();
+}
+
+TEST_CASE("sync and async writes survive mbuf exhaustion", "[host]") {
+  static uint8_t data[20000];
+  static uint8_t received[2 * sizeof(data)];
+  fill_pattern(data, sizeof(data));
+
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  config.mbuf_count = 6;
+  start_with_link(&config);
+  const uint16_t conn = connect_central(1);
+
+  TEST_ESP_OK(nordic_uart_write(data, sizeof(data)));
+  for (size_t off = 0; off < sizeof(data); off += 1000) {
+    while (nordic_uart_write_async(data + off, 1000) != ESP_OK)
+      vTaskDelay(pdMS_TO_TICKS(5));
+  }
+  TEST_ESP_OK(nordic_uart_flush(pdMS_TO_TICKS(5000)));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, sizeof(received), 5000));
+  TEST_ASSERT_EQUAL(sizeof(received), sim_link_received(conn, 0, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY(data, received, sizeof(data));
+  TEST_ASSERT_EQUAL_MEMORY(data, received + sizeof(data), sizeof(data));
+
+  // the pool ran dry and every write waited for it instead of dropping data
+  struct sim_link_stats stats;
+  sim_link_get_stats(&stats);
+  TEST_ASSERT_GREATER_THAN(0, stats.notifications);
+  TEST_ASSERT_GREATER_THAN(0, stats.mbuf_enomem);
+#ifdef CONFIG_NORDIC_UART_STATS
+  struct nordic_uart_stats uart_stats;
+  TEST_ESP_OK(nordic_uart_get_stats(&uart_stats));
+  TEST_ASSERT_GREATER_THAN(0, uart_stats.tx_enomem_retries);
+  TEST_ASSERT_EQUAL(0, uart_stats.tx_failed);
+#endif
+  stop_with_link();
+}
+
+TEST_CASE("several centrals are served independently", "[host]") {
+  size_t item_size;
+  char *str;
+  char buf[64];
+
+  start_with_link(NULL);
+  uint16_t conns[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+    conns[i] = connect_central(i + 1);
+  }
+  // every slot is taken
+  vTaskDelay(pdMS_TO_TICKS(20));
+  TEST_ASSERT_FALSE(sim_link_advertising());
+  uint16_t handles[CONFIG_NORDIC_UART_MAX_CONNECTIONS + 1];
+  const size_t count = nordic_uart_connections(handles, CONFIG_NORDIC_UART_MAX_CONNECTIONS + 1);
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_MAX_CONNECTIONS, count);
+
+  // interleaved partial lines stay apart
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[0], "fir", 3));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[1], "sec", 3));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[0], "st\n", 3));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[1], "ond\n", 4));
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("first", str);
+  TEST_ASSERT_EQUAL_UINT16(conns[0], nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("second", str);
+  TEST_ASSERT_EQUAL_UINT16(conns[1], nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+
+  TEST_ESP_OK(nordic_uart_send_to(conns[1], "one;"));
+  TEST_ESP_OK(nordic_uart_send("all;"));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conns[1], 0, 8, 1000));
+  TEST_ASSERT_EQUAL(8, sim_link_received(conns[1], 0, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("one;all;", buf, 8);
+  TEST_ASSERT_TRUE(sim_link_wait_received(conns[0], 0, 4, 1000));
+  TEST_ASSERT_EQUAL(4, sim_link_received(conns[0], 0, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("all;", buf, 4);
+
+  // a freed slot is offered again
+  sim_link_disconnect(conns[0]);
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  TEST_ESP_ERR(ESP_FAIL, nordic_uart_send_to(conns[0], "gone"));
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("\003", str);
+  TEST_ASSERT_EQUAL_UINT16(conns[0], nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+
+  // stopping with centrals still connected
+  stop_with_link();
+}
+
+TEST_CASE("stream mode hands over mbufs and gets them back", "[host]") {
+  static uint8_t data[400];
+  static uint8_t copy[sizeof(data)];
+  fill_pattern(data, sizeof(data));
+
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  config.mbuf_block_size = 64;
+  start_with_link(&config);
+  const uint16_t conn = connect_central(1);
+  TEST_ESP_OK(nordic_uart_set_rx_mode(NORDIC_UART_RX_MODE_STREAM));
+
+  const int mbufs_free = os_msys_num_free();
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, data, sizeof(data)));
+  uint16_t from = BLE_HS_CONN_HANDLE_NONE;
+  struct os_mbuf *om = nordic_uart_receive_block_from(&from, pdMS_TO_TICKS(100));
+  TEST_ASSERT_NOT_NULL(om);
+  TEST_ASSERT_EQUAL_UINT16(conn, from);
+  TEST_ASSERT_EQUAL(sizeof(data), OS_MBUF_PKTLEN(om));
+  TEST_ASSERT_EQUAL(0, os_mbuf_copydata(om, 0, sizeof(copy), copy));
+  TEST_ASSERT_EQUAL_MEMORY(data, copy, sizeof(data));
+  TEST_ASSERT_LESS_THAN(mbufs_free, os_msys_num_free());
+  nordic_uart_release_block(om);
+  vTaskDelay(pdMS_TO_TICKS(50)); // a credit grant may still be on its way to the central
+  TEST_ASSERT_EQUAL(mbufs_free, os_msys_num_free());
+
+  // a full queue pushes back on the central instead of dropping data
+  for (int i = 0; i < CONFIG_NORDIC_UART_RX_BLOCK_QUEUE_LENGTH; ++i)
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, "x", 1));
+  TEST_ASSERT_EQUAL(BLE_ATT_ERR_INSUFFICIENT_RES, sim_link_write(conn, "x", 1));
+
+  // blocks still queued at stop go back to the pool
+  TEST_ESP_OK(nordic_uart_set_rx_mode(NORDIC_UART_RX_MODE_LINE));
+  stop_with_link();
+}
+
+static volatile int link_updates;
+
+static void count_link_updates(enum nordic_uart_callback_type callback_type) {
+  if (callback_type == NORDIC_UART_LINK_UPDATED)
+    link_updates++;
+}
+
+static void wait_link_updates(int count) {
+  for (int i = 0; i < 100 && link_updates < count; ++i)
+    vTaskDelay(pdMS_TO_TICKS(5));
+  TEST_ASSERT_EQUAL(count, link_updates);
+}
+
+TEST_CASE("link profiles request parameters and report the outcome", "[host]") {
+  struct nordic_uart_link_info info;
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  config.conn_interval_us = 50000;
+  sim_link_configure(&config);
+  link_updates = 0;
+  TEST_ESP_OK(nordic_uart_start("Nordic UART", count_link_updates));
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+
+  // the default profile leaves the central's choice alone and stays quiet
+  const uint16_t conn = connect_central(1);
+  TEST_ESP_OK(nordic_uart_get_link_info(conn, &info));
+  TEST_ASSERT_EQUAL(NORDIC_UART_LINK_PROFILE_DEFAULT, info.profile);
+  TEST_ASSERT_EQUAL(40, info.conn_itvl);
+  TEST_ASSERT_EQUAL(BLE_GAP_LE_PHY_1M, info.tx_phy);
+  TEST_ASSERT_EQUAL(27, info.tx_octets);
+  TEST_ASSERT_EQUAL(NORDIC_UART_LINK_NOT_REQUESTED, info.params_status);
+  TEST_ASSERT_EQUAL(0, link_updates);
+
+  // switching applies to the connected central: interval, data length and PHY
+  TEST_ESP_OK(nordic_uart_set_link_profile(NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT));
+  wait_link_updates(3);
+  TEST_ESP_OK(nordic_uart_get_link_info(conn, &info));
+  TEST_ASSERT_EQUAL(NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT, info.profile);
+  TEST_ASSERT_LESS_OR_EQUAL(12, info.conn_itvl);
+  TEST_ASSERT_EQUAL(0, info.conn_latency);
+  TEST_ASSERT_EQUAL(BLE_GAP_LE_PHY_2M, info.tx_phy);
+  TEST_ASSERT_EQUAL(BLE_GAP_LE_PHY_2M, info.rx_phy);
+  TEST_ASSERT_EQUAL(251, info.tx_octets);
+  TEST_ASSERT_EQUAL(0, info.params_status);
+  TEST_ASSERT_EQUAL(0, info.data_len_status);
+  TEST_ASSERT_EQUAL(0, info.phy_status);
+
+  link_updates = 0;
+  TEST_ESP_OK(nordic_uart_set_link_profile(NORDIC_UART_LINK_PROFILE_LOW_POWER));
+  wait_link_updates(3);
+  TEST_ESP_OK(nordic_uart_get_link_info(conn, &info));
+  TEST_ASSERT_GREATER_OR_EQUAL(80, info.conn_itvl);
+  TEST_ASSERT_EQUAL(4, info.conn_latency);
+  TEST_ASSERT_EQUAL(BLE_GAP_LE_PHY_1M, info.tx_phy);
+  TEST_ASSERT_EQUAL(27, info.tx_octets);
+
+  // the data length already in effect completes at once, as the controller reports no change
+  link_updates = 0;
+  TEST_ESP_OK(nordic_uart_set_link_profile(NORDIC_UART_LINK_PROFILE_LOW_POWER));
+  TEST_ESP_OK(nordic_uart_get_link_info(conn, &info));
+  TEST_ASSERT_EQUAL(0, info.data_len_status);
+  wait_link_updates(2);
+  sim_link_disconnect(conn);
+  TEST_ESP_ERR(ESP_FAIL, nordic_uart_get_link_info(conn, &info));
+  TEST_ESP_OK(nordic_uart_stop());
+
+  // a central that turns the requests down: the refusal is reported, data length stays pending
+  config.reject_link_updates = true;
+  sim_link_configure(&config);
+  link_updates = 0;
+  TEST_ESP_OK(nordic_uart_set_link_profile(NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT));
+  TEST_ESP_OK(nordic_uart_start("Nordic UART", count_link_updates));
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  const uint16_t rejecting = connect_central(2);
+  wait_link_updates(2);
+  TEST_ESP_OK(nordic_uart_get_link_info(rejecting, &info));
+  TEST_ASSERT_EQUAL(40, info.conn_itvl);
+  TEST_ASSERT_EQUAL(BLE_GAP_LE_PHY_1M, info.tx_phy);
+  TEST_ASSERT_EQUAL(27, info.tx_octets);
+  TEST_ASSERT_NOT_EQUAL(0, info.params_status);
+  TEST_ASSERT_NOT_EQUAL(0, info.phy_status);
+  TEST_ASSERT_EQUAL(NORDIC_UART_LINK_PENDING, info.data_len_status);
+
+  TEST_ESP_OK(nordic_uart_set_link_profile(NORDIC_UART_LINK_PROFILE_DEFAULT));
+  stop_with_link();
+}
+
+TEST_CASE("advertising data is set once and fast reconnect waits for the last central", "[host]") {
+  struct sim_link_stats stats;
+  start_with_link(NULL);
+  sim_link_reset_stats();
+
+  // reconnecting only restarts advertising, the payloads stay in place
+  for (int i = 0; i < 3; ++i) {
+    sim_link_disconnect(connect_central(1));
+    TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  }
+  sim_link_get_stats(&stats);
+  TEST_ASSERT_EQUAL(0, stats.adv_data_sets);
+  TEST_ASSERT_GREATER_OR_EQUAL(3, stats.adv_starts);
+
+  // a new interval restarts general advertising with it
+  TEST_ESP_ERR(ESP_ERR_INVALID_ARG, nordic_uart_set_adv_interval(10, 100));
+  TEST_ESP_ERR(ESP_ERR_INVALID_ARG, nordic_uart_set_adv_interval(200, 100));
+  TEST_ESP_OK(nordic_uart_set_adv_interval(100, 150));
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  TEST_ASSERT_EQUAL(BLE_GAP_ADV_ITVL_MS(100), sim_link_adv_params()->itvl_min);
+  TEST_ASSERT_EQUAL(BLE_GAP_ADV_ITVL_MS(150), sim_link_adv_params()->itvl_max);
+
+  // for the window only the central that left can come back, then anyone can
+  TEST_ESP_ERR(ESP_ERR_INVALID_ARG, nordic_uart_set_fast_reconnect(60001));
+  TEST_ESP_OK(nordic_uart_set_fast_reconnect(300));
+  sim_link_disconnect(connect_central(5));
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  TEST_ASSERT_TRUE(sim_link_adv_directed());
+  TEST_ASSERT_EQUAL(BLE_GAP_CONN_MODE_DIR, sim_link_adv_params()->conn_mode);
+  TEST_ASSERT_EQUAL(1, sim_link_adv_params()->high_duty_cycle);
+  TEST_ASSERT_EQUAL(300, sim_link_adv_duration_ms());
+  TEST_ASSERT_EQUAL(BLE_HS_CONN_HANDLE_NONE, sim_link_connect_as(6));
+  const uint16_t back = connect_central(5);
+  sim_link_disconnect(back);
+  TEST_ASSERT_TRUE(sim_link_adv_directed());
+  for (int i = 0; i < 100 && sim_link_adv_directed(); ++i)
+    vTaskDelay(pdMS_TO_TICKS(10));
+  TEST_ASSERT_FALSE(sim_link_adv_directed());
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  TEST_ASSERT_EQUAL(BLE_GAP_ADV_ITVL_MS(100), sim_link_adv_params()->itvl_min);
+  sim_link_disconnect(connect_central(6));
+
+  // longer windows advertise at a low duty cycle
+  TEST_ESP_OK(nordic_uart_set_fast_reconnect(2000));
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  sim_link_disconnect(connect_central(6));
+  TEST_ASSERT_TRUE(sim_link_adv_directed());
+  TEST_ASSERT_EQUAL(0, sim_link_adv_params()->high_duty_cycle);
+  TEST_ASSERT_EQUAL(BLE_GAP_ADV_ITVL_MS(20), sim_link_adv_params()->itvl_min);
+
+  TEST_ESP_OK(nordic_uart_set_fast_reconnect(0));
+  TEST_ESP_OK(nordic_uart_set_adv_interval(0, 0));
+  stop_with_link();
+}
+
+TEST_CASE("suspend drops the centrals and resume advertises without a restart", "[host]") {
+  struct sim_link_stats stats;
+  size_t item_size;
+  char *str;
+
+  TEST_ESP_ERR(ESP_ERR_INVALID_STATE, nordic_uart_suspend(0));
+  start_with_link(NULL);
+  TEST_ESP_ERR(ESP_ERR_INVALID_STATE, nordic_uart_resume());
+  const uint16_t conn = connect_central(1);
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "before\n", 7));
+  const RingbufHandle_t rx_buf = nordic_uart_rx_buf_handle;
+  sim_link_reset_stats();
+
+  // the central is dropped like on any disconnect, and no one can connect
+  TEST_ESP_OK(nordic_uart_suspend(pdMS_TO_TICKS(1000)));
+  TEST_ESP_ERR(ESP_ERR_INVALID_STATE, nordic_uart_suspend(0));
+  TEST_ASSERT_FALSE(sim_link_connected(conn));
+  TEST_ASSERT_FALSE(sim_link_advertising());
+  TEST_ASSERT_EQUAL(0, nordic_uart_connections(NULL, 0));
+  vTaskDelay(pdMS_TO_TICKS(50));
+  TEST_ASSERT_FALSE(sim_link_advertising());
+  TEST_ASSERT_EQUAL(BLE_HS_CONN_HANDLE_NONE, sim_link_connect_as(2));
+
+  // the buffers and what they hold stay
+  TEST_ASSERT_TRUE(rx_buf == nordic_uart_rx_buf_handle);
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("before", str);
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("\003", str);
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+
+  // advertising comes back with the payloads already in place
+  TEST_ESP_OK(nordic_uart_resume());
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  sim_link_get_stats(&stats);
+  TEST_ASSERT_EQUAL(0, stats.adv_data_sets);
+  TEST_ASSERT_EQUAL(1, stats.adv_starts);
+  const uint16_t again = connect_central(2);
+  TEST_ASSERT_EQUAL(0, sim_link_write(again, "after\n", 6));
+  str = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("after", str);
+  TEST_ASSERT_EQUAL_UINT16(again, nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+
+  // stopping while suspended works, and the next start advertises
+  TEST_ESP_OK(nordic_uart_suspend(pdMS_TO_TICKS(1000)));
+  stop_with_link();
+  start_with_link(NULL);
+  stop_with_link();
+}
+
+#if defined(CONFIG_NORDIC_UART_FLOW_CONTROL) && defined(CONFIG_NORDIC_UART_STATS)
+static const ble_uuid128_t credits_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x04, 0x00, 0x40, 0x6e);
+
+static uint32_t read_credits(uint16_t conn) {
+  uint8_t value[4];
+  size_t len = 0;
+  TEST_ASSERT_EQUAL(0, sim_link_read_chr(conn, &credits_uuid.u, value, sizeof(value), &len));
+  TEST_ASSERT_EQUAL(4, len);
+  return value[0] | value[1] << 8 | value[2] << 16 | (uint32_t)value[3] << 24;
+}
+
+TEST_CASE("flow control credits keep the central within the RX buffer", "[host]") {
+  static const char line[] = "0123456789abcdef0123456789abcde\n";
+  const size_t line_len = sizeof(line) - 1;
+  const size_t line_cost = line_len + NORDIC_UART_FLOW_LINE_COST;
+  struct nordic_uart_stats stats;
+  size_t item_size;
+  void *item;
+
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+  const uint32_t initial = read_credits(conn);
+  TEST_ASSERT_GREATER_THAN(line_cost, initial);
+
+  // a central that honours its credits fills the buffer without losing a line
+  uint32_t sent = 0;
+  size_t lines = 0;
+  while (read_credits(conn) - sent >= line_cost) {
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, line, line_len));
+    sent += line_cost;
+    lines++;
+  }
+  TEST_ASSERT_GREATER_THAN(initial / line_cost, lines);
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(lines, stats.rx_lines);
+  TEST_ASSERT_EQUAL(0, stats.rx_lines_dropped);
+
+  // returning the items grants the room again
+  for (size_t i = 0; i < lines; ++i) {
+    item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0);
+    TEST_ASSERT_NOT_NULL(item);
+    nordic_uart_return_item(item);
+  }
+  TEST_ASSERT_GREATER_OR_EQUAL(sent + initial / 2, read_credits(conn));
+
+  // one that ignores them loses lines, but the host task is never held up
+  const int64_t start = esp_timer_get_time();
+  for (int i = 0; i < CONFIG_NORDIC_UART_RX_BUFFER_SIZE / line_len * 2; ++i)
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, line, line_len));
+  TEST_ASSERT_LESS_THAN(50000, esp_timer_get_time() - start);
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_GREATER_THAN(0, stats.rx_lines_dropped);
+  while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL)
+    nordic_uart_return_item(item);
+  stop_with_link();
+}
+
+TEST_CASE("flow control credits cover the ring buffer items of short lines", "[host]") {
+  // one character lines take far more ring buffer than their bytes
+  char lines[16];
+  for (size_t i = 0; i < sizeof(lines); i += 2)
+    memcpy(&lines[i], "a\n", 2);
+  const uint32_t write_cost = sizeof(lines) + sizeof(lines) / 2 * NORDIC_UART_FLOW_LINE_COST;
+  struct nordic_uart_stats stats;
+  size_t item_size;
+  void *item;
+
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+  const uint32_t initial = read_credits(conn);
+  TEST_ASSERT_GREATER_THAN(write_cost, initial);
+
+  // a central that honours its credits fills the buffer without losing a line
+  uint32_t sent = 0;
+  size_t writes = 0;
+  while (read_credits(conn) - sent >= write_cost) {
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, lines, sizeof(lines)));
+    sent += write_cost;
+    writes++;
+  }
+  TEST_ASSERT_GREATER_THAN(initial / write_cost, writes);
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(writes * sizeof(lines) / 2, stats.rx_lines);
+  TEST_ASSERT_EQUAL(0, stats.rx_lines_dropped);
+  while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL)
+    nordic_uart_return_item(item);
+  stop_with_link();
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+static const ble_uuid128_t caps_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x05, 0x00, 0x40, 0x6e);
+
+// Collect a compressed stream from the central's side until `len` bytes have been expanded.
+// Returns the compressed size.
+static size_t receive_decompressed(uint16_t conn, struct nordic_uart_lz_dec *dec, uint8_t *out, size_t len) {
+  static uint8_t packed[1024];
+  size_t out_len = 0;
+  size_t packed_len = 0;
+  bool error = false;
+  const int64_t deadline = esp_timer_get_time() + 2000000;
+  while (out_len < len && esp_timer_get_time() < deadline) {
+    const uint8_t *in = packed;
+    size_t in_len = sim_link_received(conn, 0, packed, sizeof(packed));
+    packed_len += in_len;
+    if (in_len == 0)
+      vTaskDelay(1);
+    while (in_len)
+      out_len += _nordic_uart_lz_decompress(dec, &in, &in_len, out + out_len, len - out_len, &error);
+  }
+  TEST_ASSERT_FALSE(error);
+  TEST_ASSERT_EQUAL(len, out_len);
+  return packed_len;
+}
+
+TEST_CASE("compression is negotiated per connection", "[host]") {
+  static struct nordic_uart_lz_dec dec;
+  static struct nordic_uart_lz_enc enc;
+  static char data[3000];
+  static uint8_t received[sizeof(data)];
+  uint8_t value[3];
+  size_t len = 0;
+  size_t item_size;
+  char *item;
+
+  size_t data_len = 0;
+  for (int i = 0; data_len + 40 < sizeof(data); ++i)
+    data_len += snprintf(data + data_len, sizeof(data) - data_len, "I (%d) sensor: reading %d\r\n", i * 10, i % 7);
+
+  start_with_link(NULL);
+  const uint16_t packed_conn = connect_central(1);
+  const uint16_t plain_conn = connect_central(2);
+  TEST_ASSERT_EQUAL(BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN, sim_link_write_chr(packed_conn, &caps_uuid.u, "\x03\x00", 2));
+  TEST_ASSERT_EQUAL(0, sim_link_write_chr(packed_conn, &caps_uuid.u, "\xff", 1));
+  TEST_ASSERT_EQUAL(0, sim_link_read_chr(packed_conn, &caps_uuid.u, value, sizeof(value), &len));
+  TEST_ASSERT_EQUAL(3, len);
+  TEST_ASSERT_EQUAL_MEMORY("\x03\x03", value, 2);
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_COMPRESSION_WINDOW_BITS, value[2]);
+  TEST_ASSERT_EQUAL(0, sim_link_read_chr(plain_conn, &caps_uuid.u, value, sizeof(value), &len));
+  TEST_ASSERT_EQUAL_MEMORY("\x03\x00", value, 2);
+  TEST_ASSERT_EQUAL(NORDIC_UART_CAP_COMPRESS_TX | NORDIC_UART_CAP_COMPRESS_RX, nordic_uart_capabilities(packed_conn));
+  TEST_ASSERT_EQUAL(0, nordic_uart_capabilities(plain_conn));
+
+  // one broadcast: compressed for the central that asked, as is for the other
+  nordic_uart_reset_stats();
+  _nordic_uart_lz_dec_reset(&dec);
+  TEST_ESP_OK(nordic_uart_write(data, data_len));
+  receive_decompressed(packed_conn, &dec, received, data_len);
+  TEST_ASSERT_EQUAL_MEMORY(data, received, data_len);
+  TEST_ASSERT_TRUE(sim_link_wait_received(plain_conn, 0, data_len, 2000));
+  TEST_ASSERT_EQUAL(data_len, sim_link_received(plain_conn, 0, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY(data, received, data_len);
+#ifdef CONFIG_NORDIC_UART_STATS
+  struct nordic_uart_stats stats;
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(data_len, stats.tx_uncompressed);
+  TEST_ASSERT_LESS_THAN(data_len * 2 * 3 / 4, stats.tx_bytes);
+#endif
+
+  // the stream carries on through the async sender and refers back to earlier sends
+  TEST_ESP_OK(nordic_uart_send_async("I (0) sensor: reading 0\r\n"));
+  TEST_ESP_OK(nordic_uart_flush(pdMS_TO_TICKS(1000)));
+  TEST_ASSERT_LESS_THAN(25, receive_decompressed(packed_conn, &dec, received, 25));
+  TEST_ASSERT_EQUAL_MEMORY("I (0) sensor: reading 0\r\n", received, 25);
+  sim_link_received(plain_conn, 0, received, sizeof(received));
+
+  // compressed writes are expanded before the line framer
+  _nordic_uart_lz_enc_reset(&enc);
+  uint8_t packed[_NORDIC_UART_LZ_BOUND(64)];
+  for (int i = 0; i < 3; ++i) {
+    size_t packed_len = _nordic_uart_lz_compress(&enc, (const uint8_t *)"hello hello\n", 12, packed);
+    packed_len += _nordic_uart_lz_flush(&enc, packed + packed_len);
+    TEST_ASSERT_LESS_THAN(i ? 9 : 12, packed_len);
+    TEST_ASSERT_EQUAL(0, sim_link_write(packed_conn, packed, packed_len));
+    item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+    TEST_ASSERT_EQUAL_STRING("hello hello", item);
+    TEST_ASSERT_EQUAL_UINT16(packed_conn, nordic_uart_rx_item_conn_handle(item, item_size));
+    vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+  }
+  TEST_ASSERT_EQUAL(0, sim_link_write(plain_conn, "plain\n", 6));
+  item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(100));
+  TEST_ASSERT_EQUAL_STRING("plain", item);
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+
+  // switching it off again goes back to plain data
+  TEST_ASSERT_EQUAL(0, sim_link_write_chr(packed_conn, &caps_uuid.u, "\x00", 1));
+  TEST_ESP_OK(nordic_uart_write_to(packed_conn, "raw", 3));
+  TEST_ASSERT_TRUE(sim_link_wait_received(packed_conn, 0, 3, 2000));
+  TEST_ASSERT_EQUAL(3, sim_link_received(packed_conn, 0, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY("raw", received, 3);
+  stop_with_link();
+}
+
+TEST_CASE("a priority message waits for a compressed blocking write", "[host]") {
+  static struct nordic_uart_lz_dec dec;
+  static uint8_t received[sizeof(priority_dump) + 5];
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  config.conn_interval_us = 20000; // one notification per 20 ms
+  config.packets_per_event = 1;
+  start_with_link(&config);
+  const uint16_t conn = connect_central(1);
+  TEST_ASSERT_EQUAL(0, sim_link_write_chr(conn, &caps_uuid.u, "\x01", 1));
+  // data that does not compress keeps the write going for a while
+  uint32_t seed = 1;
+  for (size_t i = 0; i < sizeof(priority_dump); ++i) {
+    seed = seed * 1103515245 + 12345;
+    priority_dump[i] = (char)(seed >> 16);
+  }
+
+  // the stream cannot take another message half way, so the alarm follows the write instead of deadlocking it
+  SemaphoreHandle_t done = xSemaphoreCreateBinary();
+  xTaskCreate(priority_blocking_writer, "writer", 4096, done, 5, NULL);
+  vTaskDelay(pdMS_TO_TICKS(100));
+  TEST_ESP_OK(nordic_uart_write_priority("ALARM", 5));
+  TEST_ASSERT_TRUE(xSemaphoreTake(done, pdMS_TO_TICKS(3000)));
+  vSemaphoreDelete(done);
+  _nordic_uart_lz_dec_reset(&dec);
+  receive_decompressed(conn, &dec, received, sizeof(received));
+  TEST_ASSERT_EQUAL_MEMORY(priority_dump, received, sizeof(priority_dump));
+  TEST_ASSERT_EQUAL_MEMORY("ALARM", received + sizeof(priority_dump), 5);
+  stop_with_link();
+}
+#endif
+
+#if defined(CONFIG_NORDIC_UART_STATS) && defined(CONFIG_NORDIC_UART_TRACE)
+static volatile int trace_counts[NORDIC_UART_TRACE_RECEIVE_END + 1];
+static volatile size_t trace_last_len[NORDIC_UART_TRACE_RECEIVE_END + 1];
+
+static void count_traces(enum nordic_uart_trace_event event, uint16_t conn_handle, size_t len) {
+  trace_counts[event]++;
+  trace_last_len[event] = len;
+}
+
+TEST_CASE("statistics and trace hook follow the traffic", "[host]") {
+  static uint8_t data[1000];
+  static char line[CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 10];
+  struct nordic_uart_stats stats;
+  size_t item_size;
+  void *item;
+  fill_pattern(data, sizeof(data));
+
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+  memset((void *)trace_counts, 0, sizeof(trace_counts));
+  TEST_ESP_OK(nordic_uart_set_trace_hook(count_traces));
+
+  // TX: bytes, notification count and one latency sample per blocking send
+  const size_t chunk = _nordic_uart_tx_chunk_size();
+  TEST_ESP_OK(nordic_uart_write(data, sizeof(data)));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, sizeof(data), 2000));
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(sizeof(data), stats.tx_bytes);
+  TEST_ASSERT_EQUAL((sizeof(data) + chunk - 1) / chunk, stats.tx_notifications);
+  TEST_ASSERT_EQUAL(0, stats.tx_failed);
+  uint32_t samples = 0;
+  for (int i = 0; i < NORDIC_UART_STATS_LATENCY_BUCKETS; ++i)
+    samples += stats.send_latency[i];
+  TEST_ASSERT_EQUAL(1, samples);
+  TEST_ASSERT_EQUAL(1, trace_counts[NORDIC_UART_TRACE_SEND_START]);
+  TEST_ASSERT_EQUAL(1, trace_counts[NORDIC_UART_TRACE_SEND_END]);
+  TEST_ASSERT_EQUAL(sizeof(data), trace_last_len[NORDIC_UART_TRACE_SEND_END]);
+
+  // RX: a good line, then one cut at the maximum length
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "hello\n", 6));
+  memset(line, 'x', sizeof(line) - 1);
+  line[sizeof(line) - 1] = '\n';
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, line, sizeof(line)));
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(6 + sizeof(line), stats.rx_bytes);
+  TEST_ASSERT_EQUAL(2, stats.rx_lines);
+  TEST_ASSERT_EQUAL(1, stats.rx_line_overflows);
+  TEST_ASSERT_GREATER_OR_EQUAL(CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 6, stats.rx_buf_max_used);
+  TEST_ASSERT_EQUAL(2, trace_counts[NORDIC_UART_TRACE_RECEIVE_START]);
+  TEST_ASSERT_EQUAL(2, trace_counts[NORDIC_UART_TRACE_RECEIVE_END]);
+  TEST_ASSERT_EQUAL(sizeof(line), trace_last_len[NORDIC_UART_TRACE_RECEIVE_END]);
+  while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL)
+    vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+
+  // a full stream queue counts as a rejected write
+  TEST_ESP_OK(nordic_uart_set_rx_mode(NORDIC_UART_RX_MODE_STREAM));
+  for (int i = 0; i < CONFIG_NORDIC_UART_RX_BLOCK_QUEUE_LENGTH; ++i)
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, "x", 1));
+  TEST_ASSERT_EQUAL(BLE_ATT_ERR_INSUFFICIENT_RES, sim_link_write(conn, "x", 1));
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(1, stats.rx_buf_full);
+  TEST_ASSERT_EQUAL(1, stats.rx_writes_rejected);
+  TEST_ESP_OK(nordic_uart_set_rx_mode(NORDIC_UART_RX_MODE_LINE));
+
+  nordic_uart_reset_stats();
+  TEST_ESP_OK(nordic_uart_get_stats(&stats));
+  TEST_ASSERT_EQUAL(0, stats.tx_bytes);
+  TEST_ASSERT_EQUAL(0, stats.rx_lines);
+  TEST_ESP_OK(nordic_uart_set_trace_hook(NULL));
+  stop_with_link();
+}
+#endif
+
+static TaskHandle_t callback_task;
+static volatile int callback_count;
+static char deferred_data[16];
+static volatile size_t deferred_len;
+
+// A handler slow enough to stall the link if it ran on the host task.
+static void slow_callback(enum nordic_uart_callback_type callback_type) {
+  callback_task = xTaskGetCurrentTaskHandle();
+  vTaskDelay(pdMS_TO_TICKS(200));
+  callback_count++;
+}
+
+static void deferred_receive(struct ble_gatt_access_ctxt *ctxt) {
+  uint16_t len;
+  ble_hs_mbuf_to_flat(ctxt->om, deferred_data, sizeof(deferred_data), &len);
+  deferred_len = len;
+}
+
+TEST_CASE("events wake the registered task and event group", "[host]") {
+  const EventGroupHandle_t group = xEventGroupCreate();
+  uint32_t events;
+  size_t item_size;
+  void *item;
+
+  TEST_ASSERT_EQUAL(ESP_FAIL, nordic_uart_notify_task(xTaskGetCurrentTaskHandle(), 0x100));
+  TEST_ESP_OK(nordic_uart_notify_task(xTaskGetCurrentTaskHandle(), NORDIC_UART_EVENT_RX | NORDIC_UART_EVENT_CONNECTED));
+  TEST_ESP_OK(nordic_uart_notify_event_group(group, NORDIC_UART_EVENT_ALL));
+  xTaskNotifyWait(0, UINT32_MAX, &events, 0);
+  start_with_link(NULL);
+
+  const uint16_t conn = connect_central(1);
+  TEST_ASSERT_EQUAL(pdTRUE, xTaskNotifyWait(0, UINT32_MAX, &events, pdMS_TO_TICKS(100)));
+  TEST_ASSERT_EQUAL(NORDIC_UART_EVENT_CONNECTED, events);
+  TEST_ASSERT_EQUAL(NORDIC_UART_EVENT_CONNECTED, xEventGroupGetBits(group));
+  xEventGroupClearBits(group, NORDIC_UART_EVENT_ALL);
+
+  // a partial line wakes nobody, a write that ends three lines wakes the reader once
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "a", 1));
+  TEST_ASSERT_EQUAL(pdFALSE, xTaskNotifyWait(0, UINT32_MAX, &events, 0));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "\nb\nc\n", 5));
+  TEST_ASSERT_EQUAL(pdTRUE, xTaskNotifyWait(0, UINT32_MAX, &events, 0));
+  TEST_ASSERT_EQUAL(NORDIC_UART_EVENT_RX, events);
+  TEST_ASSERT_EQUAL(NORDIC_UART_EVENT_RX, xEventGroupGetBits(group));
+  for (int i = 0; i < 3; ++i) {
+    item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0);
+    TEST_ASSERT_NOT_NULL(item);
+    nordic_uart_return_item(item);
+  }
+
+  // the event group also hears of the disconnect and its Ctrl-C; the task asked for neither
+  sim_link_disconnect(conn);
+  TEST_ASSERT_EQUAL(NORDIC_UART_EVENT_RX | NORDIC_UART_EVENT_DISCONNECTED,
+                    xEventGroupWaitBits(group, NORDIC_UART_EVENT_DISCONNECTED, pdTRUE, pdFALSE, pdMS_TO_TICKS(100)) &
+                        NORDIC_UART_EVENT_ALL);
+  TEST_ASSERT_EQUAL(pdTRUE, xTaskNotifyWait(0, UINT32_MAX, &events, 0));
+  TEST_ASSERT_EQUAL(NORDIC_UART_EVENT_RX, events);
+  item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0);
+  TEST_ASSERT_EQUAL_STRING("\003", item);
+  nordic_uart_return_item(item);
+
+  TEST_ESP_OK(nordic_uart_notify_task(NULL, NORDIC_UART_EVENT_ALL));
+  TEST_ESP_OK(nordic_uart_notify_event_group(NULL, 0));
+  stop_with_link();
+  vEventGroupDelete(group);
+}
+
+#ifdef CONFIG_NORDIC_UART_DEFERRED_CALLBACKS
+TEST_CASE("deferred callbacks run on a worker task", "[host]") {
+  callback_task = NULL;
+  callback_count = 0;
+  deferred_len = 0;
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  sim_link_configure(&config);
+  TEST_ESP_OK(nordic_uart_start("Nordic UART", slow_callback));
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+
+  // connecting does not wait for the slow handler
+  const int64_t start = esp_timer_get_time();
+  const uint16_t conn = sim_link_connect_as(1);
+  TEST_ASSERT_LESS_THAN(100000, esp_timer_get_time() - start);
+  for (int i = 0; i < 100 && callback_count < 1; ++i)
+    vTaskDelay(pdMS_TO_TICKS(5));
+  TEST_ASSERT_EQUAL(1, callback_count);
+  TEST_ASSERT_NOT_NULL(callback_task);
+  TEST_ASSERT_TRUE(callback_task != xTaskGetCurrentTaskHandle());
+
+  // writes for the receive callback keep their mbufs until it has run
+  const int free_before = os_msys_num_free();
+  TEST_ESP_OK(nordic_uart_yield(deferred_receive));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "raw data", 8));
+  for (int i = 0; i < 100 && deferred_len == 0; ++i)
+    vTaskDelay(pdMS_TO_TICKS(5));
+  TEST_ASSERT_EQUAL(8, deferred_len);
+  TEST_ASSERT_EQUAL_MEMORY("raw data", deferred_data, 8);
+  TEST_ASSERT_EQUAL(free_before, os_msys_num_free());
+
+  // stopping frees the writes still waiting behind a slow handler
+  deferred_len = 0;
+  const uint16_t conn2 = sim_link_connect_as(2);
+  for (int i = 0; i < 3; ++i)
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn2, "x", 1));
+  TEST_ASSERT_LESS_THAN(free_before, os_msys_num_free());
+  TEST_ESP_OK(nordic_uart_yield(NULL));
+  stop_with_link();
+  TEST_ASSERT_EQUAL(2, callback_count);
+  TEST_ASSERT_EQUAL(0, deferred_len);
+  TEST_ASSERT_EQUAL(config.mbuf_count, os_msys_num_free());
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_VFS
+static uint16_t vfs_writer_conn;
+
+static void vfs_late_writer(void *arg) {
+  vTaskDelay(pdMS_TO_TICKS(50));
+  sim_link_write(vfs_writer_conn, "late\n", 5);
+  vTaskDelete(NULL);
+}
+
+TEST_CASE("the VFS device reads lines and writes to the central", "[host]") {
+  const char *path = NORDIC_UART_VFS_PATH;
+  char buf[32];
+  bool readable, writable;
+  struct stat st;
+
+  TEST_ESP_OK(nordic_uart_vfs_register());
+  TEST_ASSERT_EQUAL(ESP_FAIL, nordic_uart_vfs_register());
+  start_with_link(NULL);
+  const int fd = shim_vfs_open(path, O_RDWR);
+  TEST_ASSERT_GREATER_OR_EQUAL(0, fd);
+  TEST_ASSERT_EQUAL(0, shim_vfs_fstat(path, fd, &st));
+  TEST_ASSERT_TRUE(S_ISCHR(st.st_mode));
+
+  // output with nobody connected is discarded
+  TEST_ASSERT_EQUAL(3, shim_vfs_write(path, fd, "abc", 3));
+
+  // lines come back with their '\n', and a short read keeps the rest for the next one
+  const uint16_t conn = connect_central(1);
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "hello\r\nworld\n", 13));
+  TEST_ASSERT_EQUAL(4, shim_vfs_read(path, fd, buf, 4));
+  TEST_ASSERT_EQUAL_MEMORY("hell", buf, 4);
+  TEST_ASSERT_EQUAL(8, shim_vfs_read(path, fd, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("o\nworld\n", buf, 8);
+
+  // non-blocking reads return EAGAIN, select() waits for the next line
+  TEST_ASSERT_EQUAL(0, shim_vfs_fcntl(path, fd, F_SETFL, O_RDWR | O_NONBLOCK));
+  TEST_ASSERT_EQUAL(O_NONBLOCK, shim_vfs_fcntl(path, fd, F_GETFL, 0) & O_NONBLOCK);
+  errno = 0;
+  TEST_ASSERT_EQUAL(-1, shim_vfs_read(path, fd, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL(EAGAIN, errno);
+  TEST_ASSERT_EQUAL(0, shim_vfs_select(path, fd, &readable, NULL, 20));
+  TEST_ASSERT_EQUAL(1, shim_vfs_select(path, fd, NULL, &writable, 20));
+  TEST_ASSERT_TRUE(writable);
+  vfs_writer_conn = conn;
+  xTaskCreate(vfs_late_writer, "vfs_writer", 4096, NULL, 5, NULL);
+  const int64_t start = esp_timer_get_time();
+  TEST_ASSERT_EQUAL(1, shim_vfs_select(path, fd, &readable, NULL, 1000));
+  TEST_ASSERT_LESS_THAN(500000, esp_timer_get_time() - start);
+  TEST_ASSERT_TRUE(readable);
+  TEST_ASSERT_EQUAL(5, shim_vfs_read(path, fd, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("late\n", buf, 5);
+
+  // writes reach the central, blocking or not
+  TEST_ASSERT_EQUAL(6, shim_vfs_write(path, fd, "dev:1\n", 6));
+  TEST_ASSERT_EQUAL(0, shim_vfs_fcntl(path, fd, F_SETFL, O_RDWR));
+  TEST_ASSERT_EQUAL(6, shim_vfs_write(path, fd, "dev:2\n", 6));
+  TEST_ASSERT_EQUAL(0, shim_vfs_fsync(path, fd));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, 0, 12, 1000));
+  TEST_ASSERT_EQUAL(12, sim_link_received(conn, 0, buf, sizeof(buf)));
+  TEST_ASSERT_EQUAL_MEMORY("dev:1\ndev:2\n", buf, 12);
+
+  // a line left half read goes back to the ring buffer on stop
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "unread\n", 7));
+  TEST_ASSERT_EQUAL(2, shim_vfs_read(path, fd, buf, 2));
+  TEST_ASSERT_EQUAL(0, shim_vfs_close(path, fd));
+  TEST_ASSERT_EQUAL(-1, shim_vfs_read(path, fd, buf, 2));
+  TEST_ASSERT_EQUAL(EBADF, errno);
+  sim_link_disconnect(conn);
+  stop_with_link();
+  TEST_ESP_OK(nordic_uart_vfs_unregister());
+  TEST_ASSERT_EQUAL(-1, shim_vfs_open(path, O_RDWR));
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_BULK
+static const ble_uuid128_t bulk_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x06, 0x00, 0x40, 0x6e);
+static const ble_uuid128_t bulk_control_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x07, 0x00, 0x40, 0x6e);
+
+struct bulk_receiver {
+  uint8_t *sink;
+  size_t size;
+  size_t received;
+  volatile esp_err_t result;
+  SemaphoreHandle_t done;
+};
+
+static void bulk_receiver_task(void *arg) {
+  struct bulk_receiver *receiver = arg;
+  receiver->result = nordic_uart_bulk_receive(receiver->sink, receiver->size, &receiver->received, pdMS_TO_TICKS(2000));
+  xSemaphoreGive(receiver->done);
+  vTaskDelete(NULL);
+}
+
+static void bulk_receive_in_background(struct bulk_receiver *receiver) {
+  receiver->result = ESP_ERR_TIMEOUT;
+  xTaskCreate(bulk_receiver_task, "bulk_rx", 4096, receiver, 5, NULL);
+  vTaskDelay(pdMS_TO_TICKS(20)); // let it start waiting
+}
+
+static void bulk_start(uint16_t conn, uint32_t len) {
+  const uint8_t msg[5] = {NORDIC_UART_BULK_START, len, len >> 8, len >> 16, len >> 24};
+  TEST_ASSERT_EQUAL(0, sim_link_write_chr(conn, &bulk_control_uuid.u, msg, sizeof(msg)));
+}
+
+// Write one block the way a central does: sequence number, payload, CRC-32 of both.
+static void bulk_write_block(uint16_t conn, uint16_t seq, const uint8_t *data, size_t len, bool corrupt) {
+  uint8_t block[BLE_ATT_MTU_MAX];
+  block[0] = seq;
+  block[1] = seq >> 8;
+  memcpy(block + 2, data, len);
+  const uint32_t crc = _nordic_uart_crc32(0, block, len + 2);
+  for (int i = 0; i < 4; ++i)
+    block[len + 2 + i] = crc >> (8 * i);
+  if (corrupt)
+    block[2] ^= 0x10;
+  sim_link_write_chr(conn, &bulk_uuid.u, block, len + NORDIC_UART_BULK_OVERHEAD);
+}
+
+// Take the next control message the device sent.
+static size_t bulk_control_message(uint16_t conn, uint8_t *msg, size_t expected_len) {
+  const uint16_t handle = sim_link_chr_handle(&bulk_control_uuid.u);
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, handle, expected_len, 1000));
+  return sim_link_received(conn, handle, msg, expected_len);
+}
+
+TEST_CASE("bulk uploads land in the receive buffer intact", "[host]") {
+  static uint8_t data[3000], sink[4096];
+  uint8_t msg[8];
+  struct bulk_receiver receiver = {.sink = sink, .size = sizeof(sink), .done = xSemaphoreCreateBinary()};
+
+  TEST_ASSERT_EQUAL_HEX32(0xcbf43926, _nordic_uart_crc32(0, "123456789", 9));
+  TEST_ASSERT_EQUAL_HEX32(0xcbf43926, _nordic_uart_crc32(_nordic_uart_crc32(0, "1234", 4), "56789", 5));
+  fill_pattern(data, sizeof(data));
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+
+  // nobody is waiting yet
+  bulk_start(conn, sizeof(data));
+  TEST_ASSERT_EQUAL(4, bulk_control_message(conn, msg, 4));
+  TEST_ASSERT_EQUAL_MEMORY("\x04\x01\x00\x00", msg, 4);
+
+  // more than the receiver holds, then a transfer that fits
+  bulk_receive_in_background(&receiver);
+  bulk_start(conn, sizeof(sink) + 1);
+  TEST_ASSERT_EQUAL(4, bulk_control_message(conn, msg, 4));
+  TEST_ASSERT_EQUAL_MEMORY("\x04\x02\x00\x00", msg, 4);
+  bulk_start(conn, sizeof(data));
+  TEST_ASSERT_EQUAL(3, bulk_control_message(conn, msg, 3));
+  TEST_ASSERT_EQUAL(NORDIC_UART_BULK_READY, msg[0]);
+  const size_t payload = msg[1] | msg[2] << 8;
+  TEST_ASSERT_EQUAL(_nordic_uart_notify_payload_size(sim_link_mtu(conn)) - NORDIC_UART_BULK_OVERHEAD, payload);
+  // line mode writes on the RX characteristic go on as before
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "console\n", 8));
+  uint16_t seq = 0;
+  for (size_t off = 0; off < sizeof(data); off += payload)
+    bulk_write_block(conn, seq++, data + off, MIN(payload, sizeof(data) - off), false);
+  TEST_ASSERT_EQUAL(5, bulk_control_message(conn, msg, 5));
+  TEST_ASSERT_EQUAL_MEMORY("\x03\xb8\x0b\x00\x00", msg, 5);
+  TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(receiver.done, pdMS_TO_TICKS(1000)));
+  TEST_ESP_OK(receiver.result);
+  TEST_ASSERT_EQUAL(sizeof(data), receiver.received);
+  TEST_ASSERT_EQUAL_MEMORY(data, sink, sizeof(data));
+  size_t item_size;
+  char *item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0);
+  TEST_ASSERT_EQUAL_STRING("console", item);
+  nordic_uart_return_item(item);
+
+  // a corrupt block ends the transfer and is reported with its sequence number
+  bulk_receive_in_background(&receiver);
+  bulk_start(conn, sizeof(data));
+  TEST_ASSERT_EQUAL(3, bulk_control_message(conn, msg, 3));
+  bulk_write_block(conn, 0, data, payload, false);
+  bulk_write_block(conn, 1, data + payload, payload, true);
+  TEST_ASSERT_EQUAL(4, bulk_control_message(conn, msg, 4));
+  TEST_ASSERT_EQUAL_MEMORY("\x04\x04\x01\x00", msg, 4);
+  TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(receiver.done, pdMS_TO_TICKS(1000)));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, receiver.result);
+  TEST_ASSERT_EQUAL(payload, receiver.received);
+
+  // so does a missing one, and a disconnect
+  bulk_receive_in_background(&receiver);
+  bulk_start(conn, sizeof(data));
+  TEST_ASSERT_EQUAL(3, bulk_control_message(conn, msg, 3));
+  bulk_write_block(conn, 1, data, payload, false);
+  TEST_ASSERT_EQUAL(4, bulk_control_message(conn, msg, 4));
+  TEST_ASSERT_EQUAL_MEMORY("\x04\x03\x00\x00", msg, 4);
+  TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(receiver.done, pdMS_TO_TICKS(1000)));
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_CRC, receiver.result);
+  bulk_receive_in_background(&receiver);
+  bulk_start(conn, sizeof(data));
+  sim_link_disconnect(conn);
+  TEST_ASSERT_EQUAL(pdTRUE, xSemaphoreTake(receiver.done, pdMS_TO_TICKS(1000)));
+  TEST_ASSERT_EQUAL(ESP_FAIL, receiver.result);
+
+  stop_with_link();
+  vSemaphoreDelete(receiver.done);
+}
+
+TEST_CASE("bulk downloads arrive as checked blocks", "[host]") {
+  static uint8_t data[20000], received[sizeof(data) + 1024];
+  uint8_t msg[5];
+  fill_pattern(data, sizeof(data));
+  start_with_link(NULL);
+  const uint16_t conn = connect_central(1);
+  const uint16_t handle = sim_link_chr_handle(&bulk_uuid.u);
+
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_ARG, nordic_uart_bulk_send(NORDIC_UART_BROADCAST, data, sizeof(data)));
+  TEST_ESP_OK(nordic_uart_bulk_send(conn, data, sizeof(data)));
+  TEST_ASSERT_EQUAL(5, bulk_control_message(conn, msg, 5));
+  TEST_ASSERT_EQUAL_MEMORY("\x01\x20\x4e\x00\x00", msg, 5);
+  TEST_ASSERT_EQUAL(5, bulk_control_message(conn, msg, 5));
+  TEST_ASSERT_EQUAL_MEMORY("\x03\x20\x4e\x00\x00", msg, 5);
+
+  // every block but the last is full; check their numbers and CRCs
+  const size_t payload = _nordic_uart_notify_payload_size(sim_link_mtu(conn)) - NORDIC_UART_BULK_OVERHEAD;
+  const size_t blocks = (sizeof(data) + payload - 1) / payload;
+  const size_t len = sizeof(data) + blocks * NORDIC_UART_BULK_OVERHEAD;
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, handle, len, 5000));
+  TEST_ASSERT_EQUAL(len, sim_link_received(conn, handle, received, sizeof(received)));
+  const uint8_t *block = received;
+  for (size_t i = 0; i < blocks; ++i) {
+    const size_t n = MIN(payload, sizeof(data) - i * payload);
+    TEST_ASSERT_EQUAL(i & 0xffff, block[0] | block[1] << 8);
+    TEST_ASSERT_EQUAL_MEMORY(data + i * payload, block + 2, n);
+    const uint32_t crc = block[n + 2] | block[n + 3] << 8 | block[n + 4] << 16 | (uint32_t)block[n + 5] << 24;
+    TEST_ASSERT_EQUAL_HEX32(_nordic_uart_crc32(0, block, n + 2), crc);
+    block += n + NORDIC_UART_BULK_OVERHEAD;
+  }
+  sim_link_disconnect(conn);
+  stop_with_link();
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_LATENCY
+static const ble_uuid128_t tx_uuid =
+    BLE_UUID128_INIT(0x9e, 0xca, 0xdc, 0x24, 0x0e, 0xe5, 0xa9, 0xe0, 0x93, 0xf3, 0xa3, 0xb5, 0x03, 0x00, 0x40, 0x6e);
+
+TEST_CASE("latency mode echoes lines and reports each stage over the link", "[host]") {
+  char line[16], received[512], expected[512];
+  struct nordic_uart_latency_stats stats;
+  TEST_ESP_OK(nordic_uart_set_latency_mode(true));
+  start_with_link(NULL);
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, nordic_uart_set_latency_mode(false));
+  const uint16_t conn = connect_central(1);
+  const uint16_t tx = sim_link_chr_handle(&tx_uuid.u);
+
+  for (int i = 0; i < 20; ++i) {
+    const int len = snprintf(line, sizeof(line), "line %02d\r\n", i);
+    TEST_ASSERT_EQUAL(0, sim_link_write(conn, line, len));
+  }
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, tx, 20 * 9, 2000));
+  TEST_ASSERT_EQUAL(20 * 9, sim_link_received(conn, tx, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY("line 00\r\nline 01\r\n", received, 18);
+  TEST_ASSERT_EQUAL_MEMORY("line 19\r\n", received + 19 * 9, 9);
+
+  // the echo is sent before its line is timed
+  for (int i = 0; i < 100 && (nordic_uart_get_latency(NORDIC_UART_LATENCY_TOTAL, &stats), stats.count < 20); ++i)
+    vTaskDelay(pdMS_TO_TICKS(5));
+  TEST_ESP_OK(nordic_uart_get_latency(NORDIC_UART_LATENCY_TOTAL, &stats));
+  TEST_ASSERT_EQUAL(20, stats.count);
+  TEST_ASSERT_LESS_OR_EQUAL(stats.max_us, stats.p50_us);
+  TEST_ASSERT_LESS_OR_EQUAL(stats.p99_us, stats.p50_us);
+  TEST_ASSERT_GREATER_OR_EQUAL(stats.p99_us, stats.max_us);
+  for (int stage = 0; stage < NORDIC_UART_LATENCY_TOTAL; ++stage) {
+    struct nordic_uart_latency_stats stage_stats;
+    TEST_ESP_OK(nordic_uart_get_latency(stage, &stage_stats));
+    TEST_ASSERT_EQUAL(20, stage_stats.count);
+    TEST_ASSERT_LESS_OR_EQUAL(stats.max_us, stage_stats.max_us);
+  }
+  TEST_ASSERT_EQUAL(ESP_FAIL, nordic_uart_get_latency(NORDIC_UART_LATENCY_STAGES, &stats));
+
+  // the central reads the same report
+  const size_t len = nordic_uart_format_latency(expected, sizeof(expected));
+  TEST_ASSERT_LESS_THAN(sizeof(expected), len);
+  TEST_ASSERT_EQUAL_MEMORY("latency lines 20 unstamped 0\r\n", expected, 30);
+  TEST_ASSERT_NOT_NULL(strstr(expected, "total    p50 "));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "#latency\n", 9));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, tx, len, 2000));
+  TEST_ASSERT_EQUAL(len, sim_link_received(conn, tx, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY(expected, received, len);
+
+  TEST_ASSERT_EQUAL(0, sim_link_write(conn, "#latency reset\n", 15));
+  TEST_ASSERT_TRUE(sim_link_wait_received(conn, tx, 15, 2000));
+  TEST_ASSERT_EQUAL(15, sim_link_received(conn, tx, received, sizeof(received)));
+  TEST_ASSERT_EQUAL_MEMORY("latency reset\r\n", received, 15);
+  TEST_ESP_OK(nordic_uart_get_latency(NORDIC_UART_LATENCY_TOTAL, &stats));
+  TEST_ASSERT_EQUAL(0, stats.count);
+
+  sim_link_disconnect(conn);
+  // the echo task is woken to stop rather than noticing on its own
+  const int64_t stop_start = esp_timer_get_time();
+  _nordic_uart_latency_stop();
+  TEST_ASSERT_LESS_THAN(20000, esp_timer_get_time() - stop_start);
+  TEST_ASSERT_NULL(xTaskGetHandle("nordic_uart_lat"));
+  stop_with_link();
+  TEST_ESP_OK(nordic_uart_set_latency_mode(false));
+}
+#endif
+
+TEST_CASE("tasks run on the configured cores and priorities", "[host]") {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  TEST_ESP_OK(nordic_uart_set_rx_worker(true));
+#endif
+  start_with_link(NULL);
+  const TaskHandle_t tx_task = xTaskGetHandle("nordic_uart_tx");
+  TEST_ASSERT_NOT_NULL(tx_task);
+  TEST_ASSERT_EQUAL(_NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_TX_TASK_CORE), xTaskGetAffinity(tx_task));
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_TX_TASK_PRIORITY, uxTaskPriorityGet(tx_task));
+#ifdef CONFIG_NORDIC_UART_HOST_TASK_CUSTOM
+  const TaskHandle_t host_task = xTaskGetHandle("nimble_host");
+  TEST_ASSERT_NOT_NULL(host_task);
+  TEST_ASSERT_EQUAL(_NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_HOST_TASK_CORE), xTaskGetAffinity(host_task));
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_HOST_TASK_PRIORITY, uxTaskPriorityGet(host_task));
+#endif
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_STATE, nordic_uart_set_rx_worker(false));
+  const TaskHandle_t rx_task = xTaskGetHandle("nordic_uart_rx");
+  TEST_ASSERT_NOT_NULL(rx_task);
+  TEST_ASSERT_EQUAL(_NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_RX_WORKER_CORE), xTaskGetAffinity(rx_task));
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_RX_WORKER_PRIORITY, uxTaskPriorityGet(rx_task));
+#endif
+#ifdef CONFIG_NORDIC_UART_DEFERRED_CALLBACKS
+  const TaskHandle_t callback_task = xTaskGetHandle("nordic_uart_cb");
+  TEST_ASSERT_NOT_NULL(callback_task);
+  TEST_ASSERT_EQUAL(_NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_CALLBACK_TASK_CORE), xTaskGetAffinity(callback_task));
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_CALLBACK_TASK_PRIORITY, uxTaskPriorityGet(callback_task));
+#endif
+  stop_with_link();
+  // the tasks are gone with the service
+  for (int i = 0; i < 100 && (xTaskGetHandle("nordic_uart_tx") || xTaskGetHandle("nimble_host")); ++i)
+    vTaskDelay(pdMS_TO_TICKS(5));
+  TEST_ASSERT_NULL(xTaskGetHandle("nordic_uart_tx"));
+  TEST_ASSERT_NULL(xTaskGetHandle("nimble_host"));
+  TEST_ASSERT_NULL(xTaskGetHandle("nordic_uart_rx"));
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  TEST_ESP_OK(nordic_uart_set_rx_worker(false));
+#endif
+}
+
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+static char *receive_line(uint16_t *conn_handle) {
+  size_t item_size;
+  char *item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, pdMS_TO_TICKS(1000));
+  TEST_ASSERT_NOT_NULL(item);
+  *conn_handle = nordic_uart_rx_item_conn_handle(item, item_size);
+  return item;
+}
+
+TEST_CASE("the RX worker frames the lines of every central in order", "[host]") {
+  struct sim_link_config config;
+  sim_link_default_config(&config);
+  uint16_t from;
+  char *item;
+
+  TEST_ESP_OK(nordic_uart_set_rx_worker(true));
+  start_with_link(&config);
+  const uint16_t conns[2] = {connect_central(1), connect_central(2)};
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[0], "hel", 3));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[1], "one\ntw", 6));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[0], "lo\nworld\n", 9));
+  TEST_ASSERT_EQUAL(0, sim_link_write(conns[1], "o\n", 2));
+
+  item = receive_line(&from);
+  TEST_ASSERT_EQUAL_STRING("one", item);
+  TEST_ASSERT_EQUAL(conns[1], from);
+  nordic_uart_return_item(item);
+  item = receive_line(&from);
+  TEST_ASSERT_EQUAL_STRING("hello", item);
+  TEST_ASSERT_EQUAL(conns[0], from);
+  nordic_uart_return_item(item);
+  item = receive_line(&from);
+  TEST_ASSERT_EQUAL_STRING("world", item);
+  nordic_uart_return_item(item);
+  item = receive_line(&from);
+  TEST_ASSERT_EQUAL_STRING("two", item);
+  TEST_ASSERT_EQUAL(conns[1], from);
+  nordic_uart_return_item(item);
+
+  // the hangup waits for the lines the worker still has
+  for (int i = 0; i < 10; ++i)
+    TEST_ASSERT_EQUAL(0, sim_link_write(conns[0], "line\n", 5));
+  sim_link_disconnect(conns[0]);
+  for (int i = 0; i < 10; ++i) {
+    item = receive_line(&from);
+    TEST_ASSERT_EQUAL_STRING("line", item);
+    nordic_uart_return_item(item);
+  }
+  item = receive_line(&from);
+  TEST_ASSERT_EQUAL_STRING("\003", item);
+  TEST_ASSERT_EQUAL(conns[0], from);
+  nordic_uart_return_item(item);
+
+  // every chain is back in the pool once the service has stopped
+  for (int i = 0; i < 5; ++i)
+    TEST_ASSERT_EQUAL(0, sim_link_write(conns[1], "x", 1));
+  sim_link_disconnect(conns[1]);
+  stop_with_link();
+  TEST_ASSERT_EQUAL(config.mbuf_count, os_msys_num_free());
+  TEST_ESP_OK(nordic_uart_set_rx_worker(false));
+}
+
+TEST_CASE("a stalled RX worker still releases the line buffer of every central", "[host]") {
+  uint16_t conns[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  uint16_t from;
+  char *item;
+
+  TEST_ESP_OK(nordic_uart_set_rx_worker(true));
+  start_with_link(NULL);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    conns[i] = connect_central(i + 1);
+    TEST_ASSERT_EQUAL(0, sim_link_write(conns[i], "partial", 7));
+  }
+
+  // every central hangs up while the worker's queue is full of writes
+  const TaskHandle_t worker = xTaskGetHandle("nordic_uart_rx");
+  TEST_ASSERT_NOT_NULL(worker);
+  vTaskDelay(pdMS_TO_TICKS(20));
+  vTaskSuspend(worker);
+  int queued = 0;
+  while (sim_link_write(conns[0], "line\n", 5) == 0)
+    queued++;
+  TEST_ASSERT_GREATER_THAN(0, queued);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i)
+    sim_link_disconnect(conns[i]);
+  vTaskResume(worker);
+
+  // the lines, then a Ctrl-C for each central
+  for (int i = 0; i < queued; ++i) {
+    item = receive_line(&from);
+    TEST_ASSERT_EQUAL_STRING(i == 0 ? "partialline" : "line", item);
+    nordic_uart_return_item(item);
+  }
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    item = receive_line(&from);
+    TEST_ASSERT_EQUAL_STRING("\003", item);
+    nordic_uart_return_item(item);
+  }
+
+  // and the next centrals find their line buffers free
+  TEST_ASSERT_TRUE(sim_link_wait_advertising(1000));
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    conns[i] = connect_central(i + 1);
+    TEST_ASSERT_EQUAL(0, sim_link_write(conns[i], "again\n", 6));
+    item = receive_line(&from);
+    TEST_ASSERT_EQUAL_STRING("again", item);
+    TEST_ASSERT_EQUAL(conns[i], from);
+    nordic_uart_return_item(item);
+  }
+  stop_with_link();
+  TEST_ESP_OK(nordic_uart_set_rx_worker(false));
+}
+#endif
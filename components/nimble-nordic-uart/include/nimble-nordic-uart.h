@@ -1,21 +1,204 @@
 #pragma once
 
 #include <stdint.h>
+#include <sys/uio.h>
 
 #include <esp_log.h>
 #include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
 #include <freertos/ringbuf.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
 #include <host/ble_hs.h>
 
 // Handle for the Nordic UART RX ring buffer
+// Each item is a NUL terminated line or frame; use nordic_uart_rx_item_conn_handle() to see who sent it
+// and nordic_uart_rx_item_len() for the length of binary frames. NULL with CONFIG_NORDIC_UART_RX_SPSC.
 extern RingbufHandle_t nordic_uart_rx_buf_handle;
 
+// Connection handle that addresses every connected central
+#define NORDIC_UART_BROADCAST BLE_HS_CONN_HANDLE_NONE
+
+// Path registered by nordic_uart_vfs_register()
+#define NORDIC_UART_VFS_PATH "/dev/nus"
+
 // Enum for Nordic UART callback types
 enum nordic_uart_callback_type {
   NORDIC_UART_DISCONNECTED, // Callback type when disconnected
   NORDIC_UART_CONNECTED,    // Callback type when connected
+  NORDIC_UART_LINK_UPDATED, // Callback type when a link profile request completed, see nordic_uart_get_link_info()
+};
+
+// Events reported to the task or event group registered with nordic_uart_notify_task() or
+// nordic_uart_notify_event_group()
+#define NORDIC_UART_EVENT_RX (1 << 0)           // lines, frames or stream blocks are waiting to be taken
+#define NORDIC_UART_EVENT_CONNECTED (1 << 1)    // a central connected
+#define NORDIC_UART_EVENT_DISCONNECTED (1 << 2) // a central disconnected
+#define NORDIC_UART_EVENT_LINK_UPDATED (1 << 3) // a link profile request completed
+#define NORDIC_UART_EVENT_ALL 0x0f
+
+// Connection parameters, data length and PHY requested from each central after it connects
+enum nordic_uart_link_profile {
+  NORDIC_UART_LINK_PROFILE_DEFAULT,         // keep whatever the central chose (default)
+  NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT, // 7.5-15 ms interval, 251 byte data length, 2M PHY
+  NORDIC_UART_LINK_PROFILE_LOW_POWER,       // 100-200 ms interval with slave latency 4, 27 byte data length, 1M PHY
+};
+
+// Outcome of a link request: 0 on success, a NimBLE error code, or one of these
+#define NORDIC_UART_LINK_NOT_REQUESTED (-1)
+#define NORDIC_UART_LINK_PENDING (-2)
+
+// Active link parameters of one connection
+struct nordic_uart_link_info {
+  uint16_t conn_handle;
+  enum nordic_uart_link_profile profile;
+  uint16_t mtu;
+  uint16_t conn_itvl;           // 1.25 ms units
+  uint16_t conn_latency;        // connection events
+  uint16_t supervision_timeout; // 10 ms units
+  uint8_t tx_phy;               // BLE_GAP_LE_PHY_1M, BLE_GAP_LE_PHY_2M or BLE_GAP_LE_PHY_CODED
+  uint8_t rx_phy;
+  uint16_t tx_octets; // link layer payload, 27 without data length extension
+  int params_status;
+  int data_len_status;
+  int phy_status;
+};
+
+// One item taken from nordic_uart_rx_buf_handle by nordic_uart_receive_batch()
+struct nordic_uart_rx_line {
+  char *data;           // NUL terminated line or frame, valid until nordic_uart_release_batch()
+  size_t len;           // payload length; binary frames may contain NUL
+  uint16_t conn_handle; // central that sent it
+  bool continued;       // a fragment of a long line, the next item from the same central goes on with it
+};
+
+// A line being joined by a struct nordic_uart_line_assembler
+struct nordic_uart_line_assembly {
+  uint16_t conn_handle;
+  bool pending; // fragments of a line from conn_handle are held
+  bool cut;     // the line reached max_len, the rest is dropped
+  char *buf;    // allocated at the first fragment and grown as needed
+  size_t len;
+  size_t size;
+};
+
+// Joins the fragments of long lines back together, see nordic_uart_line_assembler_feed()
+struct nordic_uart_line_assembler {
+  size_t max_len; // longer lines are cut here
+  struct nordic_uart_line_assembly conns[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+};
+
+// How received data is delivered when no nordic_uart_yield() callback is set
+enum nordic_uart_rx_mode {
+  NORDIC_UART_RX_MODE_LINE,   // split into frames and copied to nordic_uart_rx_buf_handle (default)
+  NORDIC_UART_RX_MODE_STREAM, // each write's mbuf chain handed over untouched via nordic_uart_receive_block()
+};
+
+// How NORDIC_UART_RX_MODE_LINE splits received data into frames, and how nordic_uart_write_frame() encodes them
+enum nordic_uart_framing {
+  NORDIC_UART_FRAMING_LINE,   // text lines ending in \r*\n or NUL, a Ctrl-C is passed on by itself (default)
+  NORDIC_UART_FRAMING_COBS,   // COBS encoded frames, each followed by a 0x00 delimiter
+  NORDIC_UART_FRAMING_SLIP,   // SLIP (RFC 1055) frames ending in 0xC0
+  NORDIC_UART_FRAMING_VARINT, // frames prefixed with their length as an unsigned LEB128 varint
+};
+
+// Room nordic_uart_frame_encode() needs for len bytes in any framing
+#define NORDIC_UART_FRAME_ENCODED_MAX(len) (2 * (len) + 5)
+
+// Credits a written byte that ends a line or frame costs on top of its own, see CONFIG_NORDIC_UART_FLOW_CONTROL.
+// It covers the ring buffer item header, NUL, connection tag and alignment of the line.
+#define NORDIC_UART_FLOW_LINE_COST 16
+
+// Capabilities a central switches on by writing them to the capability characteristic, see
+// CONFIG_NORDIC_UART_COMPRESSION
+#define NORDIC_UART_CAP_COMPRESS_TX 0x01 // notifications to the central carry a compressed stream
+#define NORDIC_UART_CAP_COMPRESS_RX 0x02 // writes from the central carry a compressed stream
+
+// Bulk transfer control messages on the bulk control characteristic, see CONFIG_NORDIC_UART_BULK.
+// Values are little endian.
+#define NORDIC_UART_BULK_START 0x01 // + u32 length: the sender is about to send that many bytes
+#define NORDIC_UART_BULK_READY 0x02 // + u16 payload: the device takes upload blocks of up to that many bytes
+#define NORDIC_UART_BULK_DONE 0x03  // + u32 length: every block arrived intact
+#define NORDIC_UART_BULK_ERROR 0x04 // + u8 NORDIC_UART_BULK_ERR_*, u16 block: the transfer is over
+
+#define NORDIC_UART_BULK_ERR_NOT_READY 1 // no nordic_uart_bulk_receive() waiting, or it is taken
+#define NORDIC_UART_BULK_ERR_TOO_LARGE 2 // more than the receiver's buffer holds
+#define NORDIC_UART_BULK_ERR_SEQUENCE 3  // a block is missing or out of order
+#define NORDIC_UART_BULK_ERR_CRC 4       // a block is corrupt
+#define NORDIC_UART_BULK_ERR_ABORTED 5   // the other side gave up
+
+// Bytes a bulk block adds around its payload: u16 sequence number before, u32 CRC-32 of both after
+#define NORDIC_UART_BULK_OVERHEAD 6
+
+// TX priority lanes, see nordic_uart_write_priority()
+enum nordic_uart_tx_priority {
+  NORDIC_UART_TX_NORMAL, // nordic_uart_send_async(), nordic_uart_write_async() and coalesced sends
+  NORDIC_UART_TX_HIGH,   // nordic_uart_send_priority(), nordic_uart_write_priority()
+  NORDIC_UART_TX_PRIORITIES,
+};
+
+// One TX lane since nordic_uart_start(), see nordic_uart_get_tx_lane_stats()
+struct nordic_uart_tx_lane_stats {
+  uint32_t depth;          // bytes queued now
+  uint32_t high_watermark; // highest depth in bytes
+  uint32_t messages;       // writes timed until their last byte was handed to the BLE host
+  uint32_t latency_avg_us; // average time those writes spent queued
+  uint32_t latency_max_us; // longest time one of them spent queued
+};
+
+// Buckets of nordic_uart_stats.send_latency: bucket i counts sends that took less than
+// 125 << i microseconds (125 us ... 128 ms), the last one counts every slower send.
+#define NORDIC_UART_STATS_LATENCY_BUCKETS 12
+
+// Counters since nordic_uart_start() or nordic_uart_reset_stats(), see CONFIG_NORDIC_UART_STATS
+struct nordic_uart_stats {
+  uint32_t tx_bytes;           // payload bytes handed to the BLE host, per connection
+  uint32_t tx_notifications;   // notifications handed to the BLE host
+  uint32_t tx_enomem_retries;  // notifications retried for lack of mbufs
+  uint32_t tx_failed;          // notifications given up on
+  uint32_t tx_uncompressed;    // bytes fed to the compressor for centrals with NORDIC_UART_CAP_COMPRESS_TX
+  uint32_t rx_bytes;           // bytes written by centrals
+  uint32_t rx_lines;           // lines put in nordic_uart_rx_buf_handle
+  uint32_t rx_lines_dropped;   // lines lost because nordic_uart_rx_buf_handle stayed full
+  uint32_t rx_line_overflows;  // lines cut, or binary frames dropped, at CONFIG_NORDIC_UART_MAX_LINE_LENGTH
+  uint32_t rx_line_fragments;  // pieces of long lines queued before their end, see nordic_uart_set_long_lines()
+  uint32_t rx_frame_errors;    // binary frames dropped for a broken encoding
+  uint32_t rx_uncompressed;    // bytes expanded from writes of centrals with NORDIC_UART_CAP_COMPRESS_RX
+  uint32_t rx_compress_errors; // references outside the window in compressed writes
+  uint32_t rx_buf_full;        // times the RX ring buffer, stream block queue or RX worker queue had no room
+  uint32_t rx_writes_rejected; // writes refused with BLE_ATT_ERR_INSUFFICIENT_RES
+  uint32_t rx_buf_max_used;    // highest nordic_uart_rx_buf_handle occupancy in bytes
+  uint32_t send_latency[NORDIC_UART_STATS_LATENCY_BUCKETS]; // time spent in blocking sends
+};
+
+// Stages of a line timed by the latency measurement mode, see nordic_uart_set_latency_mode()
+enum nordic_uart_latency_stage {
+  NORDIC_UART_LATENCY_ENQUEUE, // the write arrived from the central -> its line is in the RX ring
+  NORDIC_UART_LATENCY_DEQUEUE, // in the RX ring -> taken by the echo task
+  NORDIC_UART_LATENCY_SUBMIT,  // taken -> its echo handed to the BLE host
+  NORDIC_UART_LATENCY_TOTAL,   // the write arrived -> its echo handed to the BLE host
+  NORDIC_UART_LATENCY_STAGES,
+};
+
+// One stage since the latency mode was enabled or reset, see nordic_uart_get_latency()
+struct nordic_uart_latency_stats {
+  uint32_t count;  // lines timed
+  uint32_t p50_us; // percentiles from a histogram with 8 buckets per power of two
+  uint32_t p99_us;
+  uint32_t max_us;
+};
+
+// Points traced by the hook set with nordic_uart_set_trace_hook()
+enum nordic_uart_trace_event {
+  NORDIC_UART_TRACE_SEND_START,    // a blocking send begins, len is the payload size
+  NORDIC_UART_TRACE_SEND_END,      // the blocking send returns
+  NORDIC_UART_TRACE_RECEIVE_START, // the host delivers a write from a central
+  NORDIC_UART_TRACE_RECEIVE_END,   // the write has been handled
 };
 
+// Type definition for the trace hook; called on the sending task or the NimBLE host task, keep it short
+typedef void (*nordic_uart_trace_hook_t)(enum nordic_uart_trace_event event, uint16_t conn_handle, size_t len);
+
 // Type definition for UART receive callback function
 typedef void (*uart_receive_callback_t)(struct ble_gatt_access_ctxt *ctxt);
 
@@ -27,18 +210,326 @@ esp_err_t nordic_uart_start(const char *device_name, void (*callback)(enum nordi
 // Function to stop the Nordic UART service
 esp_err_t nordic_uart_stop(void);
 
-// Function to send a message over Nordic UART
+// Function to take the service off the air without stopping it: advertising stops and every central is
+// disconnected, while the BLE host, the GATT table, the buffers and the tasks stay up for nordic_uart_resume().
+// Queued sends are not waited for, call nordic_uart_flush() first. Don't call it from the callbacks.
+// - ticks_to_wait: Maximum time to wait for the disconnects, ESP_ERR_TIMEOUT when they are still pending
+esp_err_t nordic_uart_suspend(TickType_t ticks_to_wait);
+
+// Function to advertise again after nordic_uart_suspend()
+esp_err_t nordic_uart_resume(void);
+
+// Function to send a message over Nordic UART to every connected central
 // - message: String message to be sent
 esp_err_t nordic_uart_send(const char *message);
 
+// Function to send a message over Nordic UART to one central
+// - conn_handle: Connection handle, or NORDIC_UART_BROADCAST for all of them
+// - message: String message to be sent
+esp_err_t nordic_uart_send_to(uint16_t conn_handle, const char *message);
+
 // Function to send a message with a newline over Nordic UART
 // - message: String message to be sent
 esp_err_t nordic_uart_sendln(const char *message);
 
+// Function to send binary data over Nordic UART
+// - data: Bytes to be sent, may contain NUL
+// - len: Number of bytes
+esp_err_t nordic_uart_write(const void *data, size_t len);
+
+// Function to send binary data over Nordic UART to one central
+// - conn_handle: Connection handle, or NORDIC_UART_BROADCAST for all of them
+// - data: Bytes to be sent, may contain NUL
+// - len: Number of bytes
+esp_err_t nordic_uart_write_to(uint16_t conn_handle, const void *data, size_t len);
+
+// Function to send several fragments as one stream over Nordic UART
+// - iov: Fragments to be sent in order
+// - iovcnt: Number of fragments
+// Fragments are packed into each notification without an intermediate copy.
+esp_err_t nordic_uart_writev(const struct iovec *iov, int iovcnt);
+
+// Function to send several fragments as one stream to one central
+// - conn_handle: Connection handle, or NORDIC_UART_BROADCAST for all of them
+// - iov: Fragments to be sent in order
+// - iovcnt: Number of fragments
+esp_err_t nordic_uart_writev_to(uint16_t conn_handle, const struct iovec *iov, int iovcnt);
+
+// Function to send one frame encoded with the framing selected by nordic_uart_set_framing()
+// - data: Frame payload, may contain NUL
+// - len: Number of bytes
+esp_err_t nordic_uart_write_frame(const void *data, size_t len);
+
+// Function to send one encoded frame to one central
+// - conn_handle: Connection handle, or NORDIC_UART_BROADCAST for all of them
+// - data: Frame payload, may contain NUL
+// - len: Number of bytes
+esp_err_t nordic_uart_write_frame_to(uint16_t conn_handle, const void *data, size_t len);
+
+// Function to encode one frame without sending it
+// - framing: Encoding to use
+// - data: Frame payload
+// - len: Number of bytes
+// - out: Receives the encoded frame, NORDIC_UART_FRAME_ENCODED_MAX(len) bytes always suffice
+// - out_size: Size of out
+// Returns the encoded length, or 0 if out is too small.
+size_t nordic_uart_frame_encode(enum nordic_uart_framing framing, const void *data, size_t len, uint8_t *out,
+                                size_t out_size);
+
+// Function to list the connected centrals
+// - handles: Receives up to max_count connection handles
+// - max_count: Size of handles
+// Returns the number of handles copied.
+size_t nordic_uart_connections(uint16_t *handles, size_t max_count);
+
+// Function to select the link profile requested from centrals
+// - profile: NORDIC_UART_LINK_PROFILE_DEFAULT, _HIGH_THROUGHPUT or _LOW_POWER
+// Applies to centrals already connected and to every later connection. The central may refuse
+// or adjust each request; NORDIC_UART_LINK_UPDATED reports every outcome.
+esp_err_t nordic_uart_set_link_profile(enum nordic_uart_link_profile profile);
+
+// Function to get the active link parameters of a connection
+// - conn_handle: Connection handle from nordic_uart_connections()
+// - info: Receives the parameters and the outcome of each request
+esp_err_t nordic_uart_get_link_info(uint16_t conn_handle, struct nordic_uart_link_info *info);
+
+// Function to set the advertising interval
+// - min_ms, max_ms: 20-10240 ms, min_ms <= max_ms; both 0 for the NimBLE default
+// General advertising restarts with the new interval; returns ESP_ERR_INVALID_ARG otherwise.
+esp_err_t nordic_uart_set_adv_interval(uint16_t min_ms, uint16_t max_ms);
+
+// Function to set the fast reconnect window
+// - window_ms: How long to advertise directed to a central after it disconnects, up to 60000; 0 turns it off
+esp_err_t nordic_uart_set_fast_reconnect(uint32_t window_ms);
+
+// Function to get the capabilities a central has switched on
+// - conn_handle: Connection handle from nordic_uart_connections()
+// Returns NORDIC_UART_CAP_* bits, 0 for plain Nordic UART clients.
+uint8_t nordic_uart_capabilities(uint16_t conn_handle);
+
+// Function to get the connection a nordic_uart_rx_buf_handle item came from
+// - item: Item from xRingbufferReceive()
+// - item_size: Size reported by xRingbufferReceive()
+// Returns BLE_HS_CONN_HANDLE_NONE if the item carries no connection.
+uint16_t nordic_uart_rx_item_conn_handle(const void *item, size_t item_size);
+
+// Function to get the payload length of a nordic_uart_rx_buf_handle item
+// - item_size: Size reported by xRingbufferReceive()
+// Binary frames may contain NUL, so use this rather than strlen().
+size_t nordic_uart_rx_item_len(size_t item_size);
+
+// Function to tell whether a nordic_uart_rx_buf_handle item is a fragment of a long line
+// - item: Item from xRingbufferReceive()
+// - item_size: Size reported by xRingbufferReceive()
+// Returns true when the next item from the same central goes on with the line, see nordic_uart_set_long_lines().
+bool nordic_uart_rx_item_continued(const void *item, size_t item_size);
+
+// Function to give a nordic_uart_rx_buf_handle item back
+// - item: Item from xRingbufferReceive()
+// Same as vRingbufferReturnItem(), but with CONFIG_NORDIC_UART_FLOW_CONTROL the freed room is
+// granted to the centrals right away instead of at the next periodic check.
+void nordic_uart_return_item(void *item);
+
+// Function to take several nordic_uart_rx_buf_handle items in one call
+// - lines: Receives up to max_lines items
+// - max_lines: Size of lines
+// - max_bytes: Stop once the items taken hold this many payload bytes, 0 for no limit
+// - ticks_to_wait: Maximum time to wait for the first item
+// Returns the number of items taken. Only the first one is waited for; the rest are what was already
+// queued, so a burst of short lines costs the reader one wakeup. Give them back with nordic_uart_release_batch().
+size_t nordic_uart_receive_batch(struct nordic_uart_rx_line *lines, size_t max_lines, size_t max_bytes,
+                                 TickType_t ticks_to_wait);
+
+// Function to give items from nordic_uart_receive_batch() back
+// - lines: Items to give back
+// - count: Number of items, as returned by nordic_uart_receive_batch()
+// With CONFIG_NORDIC_UART_FLOW_CONTROL the freed room is granted once for the whole batch.
+void nordic_uart_release_batch(struct nordic_uart_rx_line *lines, size_t count);
+
+// Function to queue a message for sending without blocking
+// - message: String message to be sent
+// Returns ESP_FAIL when the TX queue (CONFIG_NORDIC_UART_TX_BUFFER_SIZE bytes) is full.
+// Queued messages go out in order on a sender task; use nordic_uart_flush() before
+// mixing them with nordic_uart_send() if ordering matters.
+esp_err_t nordic_uart_send_async(const char *message);
+
+// Function to queue binary data for sending without blocking
+// - data: Bytes to be sent, may contain NUL
+// - len: Number of bytes
+esp_err_t nordic_uart_write_async(const void *data, size_t len);
+
+// Function to wait until every queued message has been handed to the BLE host
+// - ticks_to_wait: Maximum time to wait, portMAX_DELAY to wait forever
+esp_err_t nordic_uart_flush(TickType_t ticks_to_wait);
+
+// Function to hold short sends back so they share notifications
+// - delay_ms: Longest a notification that is not full waits for more data, 0 to send at once (default
+//   CONFIG_NORDIC_UART_TX_COALESCE_MS)
+// While set, sends to every central return once queued for the sender task. A notification goes out
+// when it reaches (MTU - 3) bytes, when the delay has passed, on a newline, or on nordic_uart_flush().
+esp_err_t nordic_uart_set_tx_coalescing(uint32_t delay_ms);
+
+// Function to get the number of bytes waiting in the TX queue
+size_t nordic_uart_tx_queue_depth(void);
+
+// Function to get the highest TX queue depth (bytes) seen since nordic_uart_start()
+size_t nordic_uart_tx_queue_high_watermark(void);
+
+// Function to queue a short, urgent message ahead of everything else
+// - message: String message to be sent
+// Returns ESP_FAIL when the high priority lane (CONFIG_NORDIC_UART_TX_PRIORITY_BUFFER_SIZE bytes)
+// is full. It goes to every central in the next free notification slot, between two notifications
+// of a longer write that is under way.
+esp_err_t nordic_uart_send_priority(const char *message);
+
+// Function to queue urgent binary data ahead of everything else
+// - data: Bytes to be sent, may contain NUL
+// - len: Number of bytes
+esp_err_t nordic_uart_write_priority(const void *data, size_t len);
+
+// Function to get the depth and latency of a TX lane
+// - priority: NORDIC_UART_TX_NORMAL or NORDIC_UART_TX_HIGH
+// - stats: Receives a snapshot
+esp_err_t nordic_uart_get_tx_lane_stats(enum nordic_uart_tx_priority priority, struct nordic_uart_tx_lane_stats *stats);
+
+// Function to read the statistics counters
+// - stats: Receives a snapshot of the counters
+// Returns ESP_ERR_NOT_SUPPORTED unless CONFIG_NORDIC_UART_STATS is enabled.
+esp_err_t nordic_uart_get_stats(struct nordic_uart_stats *stats);
+
+// Function to clear the statistics counters
+void nordic_uart_reset_stats(void);
+
+// Function to turn the latency measurement mode on or off
+// - enable: true to echo every received line back to its sender and time it on the way
+// A task of the component takes the lines, so the application must not read them. A central that
+// sends "#latency" gets the report of nordic_uart_format_latency() back, "#latency reset" clears it.
+// Call before nordic_uart_start(). Returns ESP_ERR_NOT_SUPPORTED unless CONFIG_NORDIC_UART_LATENCY is enabled.
+esp_err_t nordic_uart_set_latency_mode(bool enable);
+
+// Function to read the latency of one stage
+// - stage: Stage to read
+// - stats: Receives a snapshot
+esp_err_t nordic_uart_get_latency(enum nordic_uart_latency_stage stage, struct nordic_uart_latency_stats *stats);
+
+// Function to clear the latency histograms
+void nordic_uart_reset_latency(void);
+
+// Function to write the latency report as text, a line per stage ending in "\r\n"
+// - out: Receives the NUL terminated report
+// - size: Size of out
+// Returns the length of the whole report, like snprintf().
+size_t nordic_uart_format_latency(char *out, size_t size);
+
+// Function to wake a task when something happens
+// - task: Task to notify, NULL to stop notifying
+// - events: NORDIC_UART_EVENT_* bits to report
+// The bits are ORed into the task's notification value (eSetBits), so wait with xTaskNotifyWait() and
+// handle every bit set; several writes or lines may be behind one NORDIC_UART_EVENT_RX. Can be called
+// before nordic_uart_start().
+esp_err_t nordic_uart_notify_task(TaskHandle_t task, uint32_t events);
+
+// Function to set event group bits when something happens
+// - group: Event group to set NORDIC_UART_EVENT_* bits in, NULL to stop
+// - events: NORDIC_UART_EVENT_* bits to report
+esp_err_t nordic_uart_notify_event_group(EventGroupHandle_t group, EventBits_t events);
+
+// Function to receive one bulk upload from a central into a buffer
+// - sink: Buffer the blocks are copied into as they arrive
+// - size: Size of sink; a central announcing more is turned away
+// - received: Bytes received, also when the transfer failed, may be NULL
+// - ticks_to_wait: Time to wait for the whole transfer
+// Returns ESP_OK when every block arrived intact, ESP_ERR_INVALID_CRC for a corrupt or missing block,
+// ESP_ERR_INVALID_SIZE for a block past the announced length, ESP_FAIL when the central aborted or
+// disconnected and ESP_ERR_TIMEOUT otherwise. Call after nordic_uart_start(), from one task at a time.
+// Returns ESP_ERR_NOT_SUPPORTED unless CONFIG_NORDIC_UART_BULK is enabled.
+esp_err_t nordic_uart_bulk_receive(void *sink, size_t size, size_t *received, TickType_t ticks_to_wait);
+
+// Function to send data to one central as a bulk download
+// - conn_handle: Connection to send to
+// - data: Data to send
+// - len: Length of data
+// Blocks until every block has been handed to the host. Returns ESP_FAIL when the central aborted.
+esp_err_t nordic_uart_bulk_send(uint16_t conn_handle, const void *data, size_t len);
+
+// Function to register NORDIC_UART_VFS_PATH as a character device
+// open(), read(), write(), select() and fcntl(O_NONBLOCK) then work on the RX ring buffer and the TX
+// path, so the device can back stdin/stdout or a console. read() gives lines back ending in '\n' and
+// competes with nordic_uart_rx_buf_handle readers for them. Can be called before nordic_uart_start().
+// Returns ESP_ERR_NOT_SUPPORTED unless CONFIG_NORDIC_UART_VFS is enabled.
+esp_err_t nordic_uart_vfs_register(void);
+
+// Function to unregister NORDIC_UART_VFS_PATH
+esp_err_t nordic_uart_vfs_unregister(void);
+
+// Function to set the trace hook
+// - hook: Called at the start and end of every blocking send and received write, NULL to remove
+// Returns ESP_ERR_NOT_SUPPORTED unless CONFIG_NORDIC_UART_TRACE is enabled.
+esp_err_t nordic_uart_set_trace_hook(nordic_uart_trace_hook_t hook);
+
 // Function to yield for UART receive callback
 // - uart_receive_callback: Callback function for UART receive
+// Runs on the NimBLE host task, or with CONFIG_NORDIC_UART_DEFERRED_CALLBACKS on a worker task with a copy of
+// the context whose os_mbuf chain is freed after the callback returns unless it sets ctxt->om to NULL.
 esp_err_t nordic_uart_yield(uart_receive_callback_t uart_receive_callback);
 
+// Function to select how received data is delivered
+// - mode: NORDIC_UART_RX_MODE_LINE or NORDIC_UART_RX_MODE_STREAM
+esp_err_t nordic_uart_set_rx_mode(enum nordic_uart_rx_mode mode);
+
+// Function to select how NORDIC_UART_RX_MODE_LINE splits received data and how nordic_uart_write_frame() encodes
+// - framing: NORDIC_UART_FRAMING_LINE, _COBS, _SLIP or _VARINT
+// Partial frames still in the line buffers are discarded, so select it before centrals start writing.
+esp_err_t nordic_uart_set_framing(enum nordic_uart_framing framing);
+
+// Function to deliver lines longer than CONFIG_NORDIC_UART_MAX_LINE_LENGTH in fragments
+// - enable: true to queue a full line buffer as a fragment and go on, false to cut long lines (default)
+// Fragments are flagged as continued, the last piece of the line is not. Readers that need whole lines
+// join them with nordic_uart_line_assembler_feed(). Binary frames are still dropped at the maximum length.
+esp_err_t nordic_uart_set_long_lines(bool enable);
+
+// Function to frame received lines on the RX worker task instead of the NimBLE host task
+// - enable: true to have the host task only queue each write, false to frame it at once (default)
+// The worker runs on CONFIG_NORDIC_UART_RX_WORKER_CORE, so a host task on the other core is free for the radio
+// while lines are split, expanded and put in the RX ring; a full ring blocks the worker, not the host task.
+// Lines then reach the reader a little after the write has been acknowledged.
+// Call before nordic_uart_start(). Returns ESP_ERR_NOT_SUPPORTED unless CONFIG_NORDIC_UART_RX_WORKER is enabled.
+esp_err_t nordic_uart_set_rx_worker(bool enable);
+
+// Function to prepare a line assembler
+// - assembler: Assembler to set up
+// - max_len: Longest line to put together; longer ones are cut
+// Memory is only taken once a fragment arrives.
+void nordic_uart_line_assembler_init(struct nordic_uart_line_assembler *assembler, size_t max_len);
+
+// Function to free what a line assembler holds
+void nordic_uart_line_assembler_deinit(struct nordic_uart_line_assembler *assembler);
+
+// Function to pass a received item through a line assembler
+// - assembler: Assembler from nordic_uart_line_assembler_init()
+// - item: Item from nordic_uart_receive_batch()
+// - line: Receives the whole line once item completes it
+// Returns true when line is filled. A line that came in one piece is item itself, with no copy; a joined line
+// is valid until the next call. Either way the item is still given back with nordic_uart_release_batch().
+// A Ctrl-C ends the line it interrupts, which is dropped.
+bool nordic_uart_line_assembler_feed(struct nordic_uart_line_assembler *assembler,
+                                     const struct nordic_uart_rx_line *item, struct nordic_uart_rx_line *line);
+
+// Function to take the next received write in NORDIC_UART_RX_MODE_STREAM
+// - ticks_to_wait: Maximum time to wait for data
+// Returns the write's os_mbuf chain (walk it with SLIST_NEXT(om, om_next)), or NULL on timeout.
+// The chain comes from the NimBLE mbuf pool: release it promptly, and before nordic_uart_stop().
+struct os_mbuf *nordic_uart_receive_block(TickType_t ticks_to_wait);
+
+// Function to take the next received write in NORDIC_UART_RX_MODE_STREAM with its sender
+// - conn_handle: Receives the connection the write came from
+// - ticks_to_wait: Maximum time to wait for data
+struct os_mbuf *nordic_uart_receive_block_from(uint16_t *conn_handle, TickType_t ticks_to_wait);
+
+// Function to give a block from nordic_uart_receive_block() back to the host
+// - om: Block to be released
+void nordic_uart_release_block(struct os_mbuf *om);
+
 // private funcs for testing.
 esp_err_t _nordic_uart_buf_deinit();
 esp_err_t _nordic_uart_buf_init();
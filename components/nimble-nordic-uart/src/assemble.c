@@ -0,0 +1,110 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <string.h>
+
+static const char *_TAG = "NORDIC UART";
+
+// Joins long line fragments (see _nordic_uart_set_long_lines() in buffer.c) per central. Lines that arrive
+// whole are passed through untouched, so a reader only pays for the lines that were split.
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static char _empty_line[1];
+
+// The slot holding a line from conn_handle, or a free one to start it in.
+static int _assembler_slot(struct nordic_uart_line_assembler *assembler, uint16_t conn_handle) {
+  int free_slot = -1;
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (assembler->conns[i].pending && assembler->conns[i].conn_handle == conn_handle)
+      return i;
+    if (free_slot < 0 && !assembler->conns[i].pending)
+      free_slot = i;
+  }
+  return free_slot;
+}
+
+// Append to the slot, growing its buffer by doubling; cut at max_len or when no memory is left.
+static void _assembler_append(struct nordic_uart_line_assembler *assembler, int slot, const char *data,
+                              size_t len) {
+  struct nordic_uart_line_assembly *conn = &assembler->conns[slot];
+  if (conn->cut)
+    return;
+  if (len > assembler->max_len - conn->len) {
+    len = assembler->max_len - conn->len;
+    conn->cut = true;
+  }
+  if (conn->len + len + 1 > conn->size) {
+    size_t size = conn->size ? conn->size : CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1;
+    while (size < conn->len + len + 1)
+      size *= 2;
+    size = MIN(size, assembler->max_len + 1);
+    char *buf = _nordic_uart_buf_alloc(size);
+    if (buf == NULL) {
+      ESP_LOGE(_TAG, "No memory to join a %u byte line", (unsigned)(conn->len + len));
+      len = conn->size > conn->len ? MIN(len, conn->size - conn->len - 1) : 0;
+      conn->cut = true;
+    } else {
+      if (conn->buf)
+        memcpy(buf, conn->buf, conn->len);
+      _nordic_uart_buf_free(conn->buf);
+      conn->buf = buf;
+      conn->size = size;
+    }
+  }
+  if (len)
+    memcpy(conn->buf + conn->len, data, len);
+  conn->len += len;
+}
+
+void _nordic_uart_line_assembler_init(struct nordic_uart_line_assembler *assembler, size_t max_len) {
+  memset(assembler, 0, sizeof(*assembler));
+  assembler->max_len = max_len;
+}
+
+void _nordic_uart_line_assembler_deinit(struct nordic_uart_line_assembler *assembler) {
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i)
+    _nordic_uart_buf_free(assembler->conns[i].buf);
+  memset(assembler->conns, 0, sizeof(assembler->conns));
+}
+
+bool _nordic_uart_line_assembler_feed(struct nordic_uart_line_assembler *assembler,
+                                      const struct nordic_uart_rx_line *item, struct nordic_uart_rx_line *line) {
+  const int slot = _assembler_slot(assembler, item->conn_handle);
+  const bool pending = slot >= 0 && assembler->conns[slot].pending;
+  if (!pending && !item->continued) {
+    *line = *item;
+    return true;
+  }
+  if (slot < 0) {
+    // more centrals with a line under way than there are slots; should not happen
+    ESP_LOGE(_TAG, "No slot to join a line from connection %d", item->conn_handle);
+    return false;
+  }
+
+  struct nordic_uart_line_assembly *conn = &assembler->conns[slot];
+  if (!pending) {
+    conn->conn_handle = item->conn_handle;
+    conn->pending = true;
+    conn->cut = false;
+    conn->len = 0;
+  }
+  // the central hung up or broke off in the middle of the line
+  if (item->len == 1 && item->data[0] == '\003' && !item->continued) {
+    conn->pending = false;
+    *line = *item;
+    return true;
+  }
+  _assembler_append(assembler, slot, item->data, item->len);
+  if (item->continued)
+    return false;
+
+  conn->pending = false;
+  if (conn->buf)
+    conn->buf[conn->len] = '\0';
+  line->data = conn->buf ? conn->buf : _empty_line;
+  line->len = conn->len;
+  line->conn_handle = conn->conn_handle;
+  line->continued = false;
+  return true;
+}
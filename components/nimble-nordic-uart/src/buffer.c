@@ -1,32 +1,307 @@
-#include "nimble-nordic-uart.h"
+#include "nordic-uart-private.h"
 
+#include "esp_attr.h"
+#include "esp_heap_caps.h"
 #include "esp_log.h"
 #include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
 #include <freertos/ringbuf.h>
 
 static const char *_TAG = "NORDIC UART";
 
-// the ringbuffer is an interface with external
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// the ringbuffer is an interface with external; it stays NULL with CONFIG_NORDIC_UART_RX_SPSC
 RingbufHandle_t nordic_uart_rx_buf_handle;
 
-static char *_nordic_uart_rx_line_buf = NULL;
-static size_t _nordic_uart_rx_line_buf_pos = 0;
+// Every item in nordic_uart_rx_buf_handle is the NUL terminated line followed by the
+// connection handle it came from, so readers that treat items as C strings are unaffected.
+#define RX_ITEM_TAG_SIZE sizeof(uint16_t)
+// Toggled in the tag of a long line's fragments: the next item from the same central continues the line.
+// Connection handles take 12 bits, so the toggled tag never collides with one, nor with
+// BLE_HS_CONN_HANDLE_NONE, which becomes 0x7fff.
+#define RX_ITEM_CONTINUED 0x8000
+
+// With flow control the central keeps within the free space, so a full ring buffer drops the
+// line at once instead of stalling the NimBLE host task.
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+#define RX_SEND_TIMEOUT 0
+#else
+#define RX_SEND_TIMEOUT pdMS_TO_TICKS(100)
+#endif
+// nor does it stall the host task when it waits for the RX worker, see _nordic_uart_rx_worker_flush()
+#define RX_SEND_TICKS (_nordic_uart_rx_worker_draining() ? 0 : RX_SEND_TIMEOUT)
+
+// One line buffer per connection so lines from different centrals never interleave.
+// Binary framings decode into the same buffer and keep their state next to it.
+struct nordic_uart_linebuf {
+  uint16_t conn_handle; // BLE_HS_CONN_HANDLE_NONE while unclaimed
+  char *buf;
+  size_t pos;
+  bool overflowed;      // the current line has been cut, counted once in the stats
+  uint8_t frame_state;  // FRAME_* flags of the binary decoders
+  uint8_t frame_shift;  // varint: bits of the length read so far
+  uint32_t frame_left;  // COBS: bytes left in the current block, varint: length or bytes left of the frame
+};
+static struct nordic_uart_linebuf _linebufs[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+static struct nordic_uart_linebuf *_linebuf = &_linebufs[0]; // target of the append functions
+static size_t _frame_ends; // line and frame ends in the block being framed, charged as NORDIC_UART_FLOW_LINE_COST
+
+// received mbuf chains handed over as-is in NORDIC_UART_RX_MODE_STREAM
+struct nordic_uart_rx_block {
+  struct os_mbuf *om;
+  uint16_t conn_handle;
+};
+static QueueHandle_t _nordic_uart_rx_block_queue = NULL;
+
+static volatile enum nordic_uart_framing _framing = NORDIC_UART_FRAMING_LINE;
+#ifdef CONFIG_NORDIC_UART_LONG_LINES
+static volatile bool _long_lines = true;
+#else
+static volatile bool _long_lines = false;
+#endif
 
-esp_err_t _nordic_uart_send_line_buf_to_ring_buf() {
-  _nordic_uart_rx_line_buf[_nordic_uart_rx_line_buf_pos] = '\0';
-  UBaseType_t res = xRingbufferSend(nordic_uart_rx_buf_handle, _nordic_uart_rx_line_buf,
-                                    _nordic_uart_rx_line_buf_pos + 1, pdMS_TO_TICKS(100));
-  _nordic_uart_rx_line_buf_pos = 0;
+// Line buffers and RX ring buffer storage come from CONFIG_NORDIC_UART_BUFFER_MEMORY on every
+// start, or are reserved at link time with CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC. The small
+// control structures and the stream mode queue are always static.
+#define LINEBUF_SIZE (CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1 + RX_ITEM_TAG_SIZE)
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+static struct nordic_uart_spsc _rx_ring;
+#else
+static StaticRingbuffer_t _rx_ring;
+#endif
+static StaticQueue_t _rx_block_queue;
+static uint8_t _rx_block_storage[CONFIG_NORDIC_UART_RX_BLOCK_QUEUE_LENGTH * sizeof(struct nordic_uart_rx_block)];
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+static _NORDIC_UART_BUF_ATTR uint8_t _linebuf_storage[CONFIG_NORDIC_UART_MAX_CONNECTIONS][LINEBUF_SIZE];
+static _NORDIC_UART_BUF_ATTR WORD_ALIGNED_ATTR uint8_t _rx_ring_storage[_NORDIC_UART_RX_RING_SIZE];
+#else
+static uint8_t *_rx_ring_storage = NULL;
+#endif
 
-  return res == pdTRUE ? ESP_OK : ESP_FAIL;
+static inline bool _rx_ring_ready(void) {
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  return _rx_ring.buf != NULL;
+#else
+  return nordic_uart_rx_buf_handle != NULL;
+#endif
+}
+
+static void _linebuf_clear(struct nordic_uart_linebuf *linebuf) {
+  linebuf->pos = 0;
+  linebuf->overflowed = false;
+  linebuf->frame_state = 0;
+  linebuf->frame_shift = 0;
+  linebuf->frame_left = 0;
+}
+
+void *_nordic_uart_buf_alloc(size_t size) { //
+  return heap_caps_malloc(size, _NORDIC_UART_BUF_CAPS);
+}
+
+void _nordic_uart_buf_free(void *ptr) { //
+  heap_caps_free(ptr);
+}
+
+esp_err_t _nordic_uart_linebuf_select(uint16_t conn_handle) {
+  struct nordic_uart_linebuf *free_linebuf = NULL;
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_linebufs[i].conn_handle == conn_handle) {
+      _linebuf = &_linebufs[i];
+      return ESP_OK;
+    }
+    if (free_linebuf == NULL && _linebufs[i].conn_handle == BLE_HS_CONN_HANDLE_NONE)
+      free_linebuf = &_linebufs[i];
+  }
+  if (free_linebuf == NULL) {
+    ESP_LOGE(_TAG, "No line buffer for connection %d", conn_handle);
+    return ESP_FAIL;
+  }
+  free_linebuf->conn_handle = conn_handle;
+  _linebuf_clear(free_linebuf);
+  _linebuf = free_linebuf;
+  return ESP_OK;
+}
+
+void _nordic_uart_linebuf_release(uint16_t conn_handle) {
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_linebufs[i].conn_handle == conn_handle) {
+      _linebufs[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+      _linebuf_clear(&_linebufs[i]);
+    }
+  }
+}
+
+static inline bool _rx_tag_continued(uint16_t tag) {
+  return tag == (BLE_HS_CONN_HANDLE_NONE ^ RX_ITEM_CONTINUED) ||
+         (tag != BLE_HS_CONN_HANDLE_NONE && (tag & RX_ITEM_CONTINUED));
+}
+
+static inline uint16_t _rx_tag_conn_handle(uint16_t tag) { //
+  return _rx_tag_continued(tag) ? tag ^ RX_ITEM_CONTINUED : tag;
+}
+
+static uint16_t _rx_item_tag(const void *item, size_t item_size) {
+  uint16_t tag;
+  if (item == NULL || item_size < 1 + RX_ITEM_TAG_SIZE)
+    return BLE_HS_CONN_HANDLE_NONE;
+  memcpy(&tag, (const uint8_t *)item + item_size - RX_ITEM_TAG_SIZE, RX_ITEM_TAG_SIZE);
+  return tag;
+}
+
+uint16_t _nordic_uart_rx_item_conn_handle(const void *item, size_t item_size) { //
+  return _rx_tag_conn_handle(_rx_item_tag(item, item_size));
+}
+
+bool _nordic_uart_rx_item_continued(const void *item, size_t item_size) { //
+  return _rx_tag_continued(_rx_item_tag(item, item_size));
+}
+
+size_t _nordic_uart_rx_item_len(size_t item_size) { //
+  return item_size < 1 + RX_ITEM_TAG_SIZE ? 0 : item_size - 1 - RX_ITEM_TAG_SIZE;
+}
+
+// Only the first item may block; the others are taken while they are already there, so a reader
+// woken by a burst empties it before it sleeps again.
+size_t _nordic_uart_rx_receive_batch(struct nordic_uart_rx_line *lines, size_t max_lines, size_t max_bytes,
+                                     TickType_t ticks_to_wait) {
+  size_t count = 0;
+  size_t bytes = 0;
+  if (!_rx_ring_ready() || lines == NULL)
+    return 0;
+
+  // a ring buffer item cannot be put back, so the byte budget is checked before taking the next one
+  while (count < max_lines && (max_bytes == 0 || bytes < max_bytes)) {
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+    uint16_t tag;
+    char *item = _nordic_uart_spsc_receive(&_rx_ring, &lines[count].len, &tag, count ? 0 : ticks_to_wait);
+    if (item == NULL)
+      break;
+    lines[count].data = item;
+    lines[count].conn_handle = _rx_tag_conn_handle(tag);
+    lines[count].continued = _rx_tag_continued(tag);
+#else
+    size_t item_size;
+    char *item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, count ? 0 : ticks_to_wait);
+    if (item == NULL)
+      break;
+    lines[count].data = item;
+    lines[count].len = _nordic_uart_rx_item_len(item_size);
+    const uint16_t tag = _rx_item_tag(item, item_size);
+    lines[count].conn_handle = _rx_tag_conn_handle(tag);
+    lines[count].continued = _rx_tag_continued(tag);
+#endif
+    bytes += lines[count].len;
+    ++count;
+  }
+  return count;
+}
+
+void _nordic_uart_rx_release_batch(struct nordic_uart_rx_line *lines, size_t count) {
+  if (!_rx_ring_ready() || lines == NULL || count == 0)
+    return;
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  // records are given back in order, so the last one frees the whole batch
+  _nordic_uart_spsc_release(&_rx_ring, lines[count - 1].data);
+#else
+  for (size_t i = 0; i < count; ++i)
+    vRingbufferReturnItem(nordic_uart_rx_buf_handle, lines[i].data);
+#endif
+}
+
+void _nordic_uart_rx_return_item(void *item) {
+  if (!_rx_ring_ready() || item == NULL)
+    return;
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  _nordic_uart_spsc_release(&_rx_ring, item);
+#else
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+#endif
+}
+
+// Longest line the RX ring could take right now.
+size_t _nordic_uart_rx_free_size(void) {
+  if (!_rx_ring_ready())
+    return 0;
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  return _nordic_uart_spsc_free_size(&_rx_ring);
+#else
+  return xRingbufferGetCurFreeSize(nordic_uart_rx_buf_handle);
+#endif
+}
+
+bool _nordic_uart_rx_pending(void) {
+  if (!_rx_ring_ready())
+    return false;
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  return _nordic_uart_spsc_pending(&_rx_ring);
+#else
+  UBaseType_t waiting = 0;
+  vRingbufferGetInfo(nordic_uart_rx_buf_handle, NULL, NULL, NULL, NULL, &waiting);
+  return waiting > 0;
+#endif
+}
+
+static esp_err_t _linebuf_push(bool continued) {
+  const uint16_t tag = continued ? _linebuf->conn_handle ^ RX_ITEM_CONTINUED : _linebuf->conn_handle;
+  // stamped first, the reader may take the line as soon as it is in
+  _nordic_uart_latency_enqueue();
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  const bool sent = _nordic_uart_spsc_push(&_rx_ring, _linebuf->buf, _linebuf->pos, tag, RX_SEND_TICKS) == ESP_OK;
+#else
+  _linebuf->buf[_linebuf->pos] = '\0';
+  memcpy(&_linebuf->buf[_linebuf->pos + 1], &tag, RX_ITEM_TAG_SIZE);
+  const bool sent = xRingbufferSend(nordic_uart_rx_buf_handle, _linebuf->buf, _linebuf->pos + 1 + RX_ITEM_TAG_SIZE,
+                                    RX_SEND_TICKS) == pdTRUE;
+#endif
+  _linebuf->pos = 0;
+  _linebuf->overflowed = false;
+
+  if (!sent) {
+    _nordic_uart_latency_dropped();
+    _NORDIC_UART_STAT_ADD(rx_buf_full, 1);
+    _NORDIC_UART_STAT_ADD(rx_lines_dropped, 1);
+    return ESP_FAIL;
+  }
+  if (continued)
+    _NORDIC_UART_STAT_ADD(rx_line_fragments, 1);
+  else
+    _NORDIC_UART_STAT_ADD(rx_lines, 1);
+  _nordic_uart_stats_rx_buf_used();
+  _nordic_uart_events_rx_queued();
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_send_line_buf_to_ring_buf() { //
+  return _linebuf_push(false);
+}
+
+static inline void _linebuf_overflow(void) {
+  if (!_linebuf->overflowed)
+    _NORDIC_UART_STAT_ADD(rx_line_overflows, 1);
+  _linebuf->overflowed = true;
+}
+
+// The line buffer is full and the line goes on: with long lines on, queue what it holds as a fragment
+// and start over. Returns false when the byte has to be dropped instead; if the fragment found no room,
+// the rest of the line is dropped too so the reader never joins pieces with a gap between them.
+static bool _linebuf_fragment(void) {
+  if (!_long_lines || _linebuf->overflowed)
+    return false;
+  if (_linebuf_push(true) != ESP_OK) {
+    _linebuf_overflow();
+    return false;
+  }
+  return true;
 }
 
 esp_err_t _nordic_uart_linebuf_append(char c) {
   switch (c) {
   // break \003 == Ctrl-c
   case '\003':
-    _nordic_uart_rx_line_buf[0] = '\003';
-    _nordic_uart_rx_line_buf_pos = 1;
+    _frame_ends++;
+    _linebuf->buf[0] = '\003';
+    _linebuf->pos = 1;
     if (_nordic_uart_send_line_buf_to_ring_buf() != ESP_OK) {
       ESP_LOGE(_TAG, "Failed to send item");
       return ESP_FAIL;
@@ -40,6 +315,7 @@ esp_err_t _nordic_uart_linebuf_append(char c) {
   // send a line buffer to ring buffer
   case '\n':
   case '\0':
+    _frame_ends++;
     if (_nordic_uart_send_line_buf_to_ring_buf() != ESP_OK) {
       ESP_LOGE(_TAG, "Failed to send item");
       return ESP_FAIL;
@@ -48,45 +324,413 @@ esp_err_t _nordic_uart_linebuf_append(char c) {
 
   // push char to local line buffer
   default:
-    if (_nordic_uart_rx_line_buf_pos < CONFIG_NORDIC_UART_MAX_LINE_LENGTH) {
-      _nordic_uart_rx_line_buf[_nordic_uart_rx_line_buf_pos++] = c;
-    } else {
+    if ((_linebuf->pos == CONFIG_NORDIC_UART_MAX_LINE_LENGTH || _linebuf->overflowed) && !_linebuf_fragment()) {
+      _linebuf_overflow();
       ESP_LOGE(_TAG, "line buffer overflow");
       return ESP_FAIL;
     }
+    _linebuf->buf[_linebuf->pos++] = c;
     break;
   }
   return ESP_OK;
 }
 
-esp_err_t _nordic_uart_buf_deinit() {
-  if (!_nordic_uart_linebuf_initialized())
+// Word-at-a-time scan: flags every word containing a byte below 0x0e, which covers
+// all four control characters ('\0', '\003', '\n', '\r'); candidates are then checked bytewise.
+typedef size_t linebuf_word_t;
+#define LINEBUF_ONES ((linebuf_word_t)-1 / 0xff)
+#define LINEBUF_HAS_LESS(x, n) (((x) - LINEBUF_ONES * (n)) & ~(x) & (LINEBUF_ONES * 0x80))
+
+static inline bool _linebuf_is_special(uint8_t c) { //
+  return c == '\n' || c == '\r' || c == '\0' || c == '\003';
+}
+
+static const uint8_t *_linebuf_find_special(const uint8_t *p, const uint8_t *end) {
+  // bytewise up to word alignment
+  while (p < end && ((uintptr_t)p % sizeof(linebuf_word_t)) != 0) {
+    if (_linebuf_is_special(*p))
+      return p;
+    ++p;
+  }
+  while (end - p >= (ptrdiff_t)sizeof(linebuf_word_t)) {
+    linebuf_word_t w;
+    memcpy(&w, p, sizeof(w)); // aligned, compiles to a single load
+    if (LINEBUF_HAS_LESS(w, 0x0e)) {
+      for (size_t i = 0; i < sizeof(linebuf_word_t); ++i) {
+        if (_linebuf_is_special(p[i]))
+          return p + i;
+      }
+    }
+    p += sizeof(linebuf_word_t);
+  }
+  while (p < end && !_linebuf_is_special(*p))
+    ++p;
+  return p;
+}
+
+// Same result as calling _nordic_uart_linebuf_append() for every byte, but plain text runs
+// are located with a word-at-a-time scan and copied into the line buffer with one memcpy.
+// Returns ESP_FAIL if any byte would have failed, after processing the whole block.
+esp_err_t _nordic_uart_linebuf_append_block(const uint8_t *data, size_t len) {
+  esp_err_t ret = ESP_OK;
+  const uint8_t *p = data;
+  const uint8_t *const end = data + len;
+
+  while (p < end) {
+    const uint8_t *special = _linebuf_find_special(p, end);
+    // a run longer than the room left goes out in fragments, or is cut
+    while (p < special) {
+      if ((_linebuf->pos == CONFIG_NORDIC_UART_MAX_LINE_LENGTH || _linebuf->overflowed) && !_linebuf_fragment()) {
+        _linebuf_overflow();
+        ESP_LOGE(_TAG, "line buffer overflow");
+        ret = ESP_FAIL;
+        break;
+      }
+      const size_t n = MIN((size_t)(special - p), CONFIG_NORDIC_UART_MAX_LINE_LENGTH - _linebuf->pos);
+      memcpy(&_linebuf->buf[_linebuf->pos], p, n);
+      _linebuf->pos += n;
+      p += n;
+    }
+
+    if (special == end)
+      break;
+    if (_nordic_uart_linebuf_append(*special) != ESP_OK)
+      ret = ESP_FAIL;
+    p = special + 1;
+  }
+  return ret;
+}
+
+/* Binary framings. Each decoder turns its encoding back into the payload in the line buffer and
+ * hands the finished frame to the ring buffer in one piece, with the same trailing NUL and
+ * connection tag as a line. Frames longer than CONFIG_NORDIC_UART_MAX_LINE_LENGTH are dropped
+ * rather than cut, and a frame with a broken encoding is dropped when its end is seen. */
+
+#define FRAME_STARTED 0x01      // bytes of the current frame have arrived
+#define FRAME_ERROR 0x02        // the current frame is broken and is dropped at its end
+#define FRAME_COBS_ZERO 0x04    // COBS: the current block is followed by a zero
+#define FRAME_SLIP_ESCAPE 0x04  // SLIP: the previous byte was FRAME_SLIP_ESC
+#define FRAME_VARINT_BODY 0x04  // varint: the length is complete, frame_left bytes of payload follow
+
+#define FRAME_SLIP_END 0xc0
+#define FRAME_SLIP_ESC 0xdb
+#define FRAME_SLIP_ESC_END 0xdc
+#define FRAME_SLIP_ESC_ESC 0xdd
+
+static inline void _frame_store(const uint8_t *data, size_t len) {
+  if (_linebuf->overflowed)
+    return;
+  if (len > CONFIG_NORDIC_UART_MAX_LINE_LENGTH - _linebuf->pos) {
+    _linebuf_overflow();
+    return;
+  }
+  memcpy(&_linebuf->buf[_linebuf->pos], data, len);
+  _linebuf->pos += len;
+}
+
+// Push the decoded frame unless it was cut or broken, and start over.
+static esp_err_t _frame_end(void) {
+  esp_err_t ret = ESP_OK;
+  if (_linebuf->overflowed) {
+    ESP_LOGE(_TAG, "frame too long, dropped");
+    ret = ESP_FAIL;
+  } else if (_linebuf->frame_state & FRAME_ERROR) {
+    _NORDIC_UART_STAT_ADD(rx_frame_errors, 1);
+    ESP_LOGE(_TAG, "broken frame, dropped");
+    ret = ESP_FAIL;
+  } else if (_nordic_uart_send_line_buf_to_ring_buf() != ESP_OK) {
+    ESP_LOGE(_TAG, "Failed to send item");
+    ret = ESP_FAIL;
+  }
+  _linebuf_clear(_linebuf);
+  return ret;
+}
+
+// COBS: a code byte n is followed by n - 1 payload bytes and stands for a zero after them,
+// unless n is 0xff. A 0x00 ends the frame.
+static esp_err_t _cobs_append_block(const uint8_t *data, size_t len) {
+  esp_err_t ret = ESP_OK;
+  const uint8_t *p = data;
+  const uint8_t *const end = data + len;
+
+  while (p < end) {
+    if (*p == 0) {
+      _frame_ends++;
+      if (_linebuf->frame_left)
+        _linebuf->frame_state |= FRAME_ERROR; // the block was cut short
+      if ((_linebuf->frame_state & FRAME_STARTED) && _frame_end() != ESP_OK)
+        ret = ESP_FAIL;
+      _linebuf_clear(_linebuf);
+      ++p;
+    } else if (_linebuf->frame_left == 0) {
+      if (_linebuf->frame_state & FRAME_COBS_ZERO)
+        _frame_store((const uint8_t *)"", 1);
+      _linebuf->frame_state = (_linebuf->frame_state & ~FRAME_COBS_ZERO) | FRAME_STARTED;
+      if (*p != 0xff)
+        _linebuf->frame_state |= FRAME_COBS_ZERO;
+      _linebuf->frame_left = *p - 1;
+      ++p;
+    } else {
+      // the block's payload in one go; a zero inside it is a delimiter handled above
+      const size_t avail = MIN((size_t)(end - p), _linebuf->frame_left);
+      const uint8_t *zero = memchr(p, 0, avail);
+      const size_t run = zero ? (size_t)(zero - p) : avail;
+      _frame_store(p, run);
+      _linebuf->frame_left -= run;
+      p += run;
+    }
+  }
+  return ret;
+}
+
+static inline bool _slip_is_special(uint8_t c) { //
+  return c == FRAME_SLIP_END || c == FRAME_SLIP_ESC;
+}
+
+// SLIP: 0xc0 ends the frame, 0xdb 0xdc and 0xdb 0xdd stand for 0xc0 and 0xdb. Empty frames,
+// such as the 0xc0 many senders put in front of every frame, are skipped.
+static esp_err_t _slip_append_block(const uint8_t *data, size_t len) {
+  esp_err_t ret = ESP_OK;
+  const uint8_t *p = data;
+  const uint8_t *const end = data + len;
+
+  while (p < end) {
+    if (_linebuf->frame_state & FRAME_SLIP_ESCAPE) {
+      // RFC 1055 keeps the byte after a stray escape as it is
+      const uint8_t c = *p == FRAME_SLIP_ESC_END ? FRAME_SLIP_END : (*p == FRAME_SLIP_ESC_ESC ? FRAME_SLIP_ESC : *p);
+      _frame_store(&c, 1);
+      _linebuf->frame_state &= ~FRAME_SLIP_ESCAPE;
+      ++p;
+      continue;
+    }
+    const uint8_t *special = p;
+    while (special < end && !_slip_is_special(*special))
+      ++special;
+    if (special > p) {
+      _frame_store(p, special - p);
+      _linebuf->frame_state |= FRAME_STARTED;
+    }
+    p = special;
+    if (p == end)
+      break;
+    if (*p == FRAME_SLIP_END) {
+      _frame_ends++;
+      if ((_linebuf->frame_state & FRAME_STARTED) && _frame_end() != ESP_OK)
+        ret = ESP_FAIL;
+      _linebuf_clear(_linebuf);
+    } else {
+      _linebuf->frame_state |= FRAME_STARTED | FRAME_SLIP_ESCAPE;
+    }
+    ++p;
+  }
+  return ret;
+}
+
+// Varint: the payload length as unsigned LEB128 (7 bits per byte, low bits first, the top bit
+// set on every byte but the last), then the payload. A length of more than 32 bits cannot be
+// resynchronised from, so the decoder drops it and reads the next byte as a new length.
+static esp_err_t _varint_append_block(const uint8_t *data, size_t len) {
+  esp_err_t ret = ESP_OK;
+  const uint8_t *p = data;
+  const uint8_t *const end = data + len;
+
+  while (p < end) {
+    if (!(_linebuf->frame_state & FRAME_VARINT_BODY)) {
+      const uint8_t c = *p++;
+      if (_linebuf->frame_shift > 28 || (_linebuf->frame_shift == 28 && (c & 0x70))) {
+        _NORDIC_UART_STAT_ADD(rx_frame_errors, 1);
+        ESP_LOGE(_TAG, "frame length out of range");
+        _linebuf_clear(_linebuf);
+        ret = ESP_FAIL;
+        continue;
+      }
+      _linebuf->frame_left |= (uint32_t)(c & 0x7f) << _linebuf->frame_shift;
+      _linebuf->frame_shift += 7;
+      _linebuf->frame_state |= FRAME_STARTED;
+      if (c & 0x80)
+        continue;
+      _linebuf->frame_state |= FRAME_VARINT_BODY;
+      if (_linebuf->frame_left > CONFIG_NORDIC_UART_MAX_LINE_LENGTH)
+        _linebuf_overflow();
+    } else {
+      const size_t run = MIN((size_t)(end - p), _linebuf->frame_left);
+      _frame_store(p, run);
+      _linebuf->frame_left -= run;
+      p += run;
+    }
+    if ((_linebuf->frame_state & FRAME_VARINT_BODY) && _linebuf->frame_left == 0) {
+      _frame_ends++;
+      if (_frame_end() != ESP_OK)
+        ret = ESP_FAIL;
+    }
+  }
+  return ret;
+}
+
+typedef esp_err_t (*nordic_uart_framer_t)(const uint8_t *data, size_t len);
+static const nordic_uart_framer_t _framers[] = {
+    [NORDIC_UART_FRAMING_LINE] = _nordic_uart_linebuf_append_block,
+    [NORDIC_UART_FRAMING_COBS] = _cobs_append_block,
+    [NORDIC_UART_FRAMING_SLIP] = _slip_append_block,
+    [NORDIC_UART_FRAMING_VARINT] = _varint_append_block,
+};
+
+// Feed received bytes to the selected framer for the line buffer picked by _nordic_uart_linebuf_select(),
+// and charge them to its central as the ring buffer room they may take.
+esp_err_t _nordic_uart_frame_append_block(const uint8_t *data, size_t len) {
+  _frame_ends = 0;
+  const esp_err_t ret = _framers[_framing](data, len);
+  _nordic_uart_flow_received(_linebuf->conn_handle, len + _frame_ends * NORDIC_UART_FLOW_LINE_COST);
+  return ret;
+}
+
+esp_err_t _nordic_uart_set_framing(enum nordic_uart_framing framing) {
+  if ((unsigned)framing >= sizeof(_framers) / sizeof(_framers[0])) {
+    ESP_LOGE(_TAG, "Unknown framing %d", framing);
     return ESP_FAIL;
+  }
+  _framing = framing;
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    _linebuf_clear(&_linebufs[i]);
+  }
+  return ESP_OK;
+}
 
-  free(_nordic_uart_rx_line_buf);
-  _nordic_uart_rx_line_buf = NULL;
-  _nordic_uart_rx_line_buf_pos = 0;
+enum nordic_uart_framing _nordic_uart_get_framing(void) { //
+  return _framing;
+}
 
-  vRingbufferDelete(nordic_uart_rx_buf_handle);
-  nordic_uart_rx_buf_handle = NULL;
+esp_err_t _nordic_uart_set_long_lines(bool enable) {
+  _long_lines = enable;
+  return ESP_OK;
+}
+
+// The central has gone: line framing passes a Ctrl-C on, a partial binary frame is discarded.
+esp_err_t _nordic_uart_linebuf_hangup(void) {
+  if (_framing == NORDIC_UART_FRAMING_LINE)
+    return _nordic_uart_linebuf_append('\003');
+  _linebuf_clear(_linebuf);
+  return ESP_OK;
+}
 
+esp_err_t _nordic_uart_rx_block_push(uint16_t conn_handle, struct os_mbuf *om) {
+  const struct nordic_uart_rx_block block = {.om = om, .conn_handle = conn_handle};
+  if (_nordic_uart_rx_block_queue == NULL || xQueueSend(_nordic_uart_rx_block_queue, &block, 0) != pdTRUE) {
+    _NORDIC_UART_STAT_ADD(rx_buf_full, 1);
+    ESP_LOGE(_TAG, "Failed to queue RX block");
+    return ESP_FAIL;
+  }
+  _nordic_uart_events_rx_queued();
   return ESP_OK;
 }
 
+struct os_mbuf *_nordic_uart_rx_block_receive(TickType_t ticks_to_wait, uint16_t *conn_handle) {
+  struct nordic_uart_rx_block block;
+  if (_nordic_uart_rx_block_queue == NULL)
+    return NULL;
+  if (xQueueReceive(_nordic_uart_rx_block_queue, &block, ticks_to_wait) != pdTRUE)
+    return NULL;
+  if (conn_handle)
+    *conn_handle = block.conn_handle;
+  return block.om;
+}
+
+void _nordic_uart_rx_block_drain() {
+  struct nordic_uart_rx_block block;
+  if (_nordic_uart_rx_block_queue == NULL)
+    return;
+  while (xQueueReceive(_nordic_uart_rx_block_queue, &block, 0) == pdTRUE)
+    os_mbuf_free_chain(block.om);
+}
+
+esp_err_t _nordic_uart_buf_deinit() {
+  const bool initialized = _nordic_uart_linebuf_initialized();
+
+  if (_nordic_uart_rx_block_queue) {
+    _nordic_uart_rx_block_drain();
+    vQueueDelete(_nordic_uart_rx_block_queue);
+    _nordic_uart_rx_block_queue = NULL;
+  }
+
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+#ifndef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+    _nordic_uart_buf_free(_linebufs[i].buf);
+#endif
+    _linebufs[i].buf = NULL;
+    _linebufs[i].pos = 0;
+  }
+  _linebuf = &_linebufs[0];
+
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  _nordic_uart_spsc_deinit(&_rx_ring);
+#else
+  if (nordic_uart_rx_buf_handle)
+    vRingbufferDelete(nordic_uart_rx_buf_handle);
+  nordic_uart_rx_buf_handle = NULL;
+#endif
+#ifndef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  _nordic_uart_buf_free(_rx_ring_storage);
+  _rx_ring_storage = NULL;
+#endif
+
+  return initialized ? ESP_OK : ESP_FAIL;
+}
+
 esp_err_t _nordic_uart_buf_init() {
   _nordic_uart_buf_deinit();
 
-  // Buffer for receive BLE and split it with /\r*\n/
-  _nordic_uart_rx_line_buf = malloc(CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1);
-  _nordic_uart_rx_line_buf_pos = 0;
-  nordic_uart_rx_buf_handle = xRingbufferCreate(CONFIG_NORDIC_UART_RX_BUFFER_SIZE, RINGBUF_TYPE_NOSPLIT);
+  // Buffers for receive BLE and split it with /\r*\n/, with room for the terminator and tag
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    _linebufs[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+    _linebufs[i].buf = (char *)_linebuf_storage[i];
+#else
+    _linebufs[i].buf = _nordic_uart_buf_alloc(LINEBUF_SIZE);
+    if (_linebufs[i].buf == NULL) {
+      ESP_LOGE(_TAG, "Failed to allocate line buffer");
+      _nordic_uart_buf_deinit();
+      return ESP_FAIL;
+    }
+#endif
+    _linebuf_clear(&_linebufs[i]);
+  }
+  _linebuf = &_linebufs[0];
+
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  uint8_t *const ring_storage = _rx_ring_storage;
+#else
+  uint8_t *const ring_storage = _rx_ring_storage = _nordic_uart_buf_alloc(_NORDIC_UART_RX_RING_SIZE);
+#endif
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+  if (_nordic_uart_spsc_init(&_rx_ring, ring_storage, _NORDIC_UART_RX_RING_SIZE) != ESP_OK) {
+#else
+  nordic_uart_rx_buf_handle =
+      ring_storage ? xRingbufferCreateStatic(_NORDIC_UART_RX_RING_SIZE, RINGBUF_TYPE_NOSPLIT, ring_storage,
+                                             &_rx_ring)
+                   : NULL;
   if (nordic_uart_rx_buf_handle == NULL) {
+#endif
     ESP_LOGE(_TAG, "Failed to create ring buffer");
+    _nordic_uart_buf_deinit();
+    return ESP_FAIL;
+  }
+  _nordic_uart_rx_block_queue = xQueueCreateStatic(CONFIG_NORDIC_UART_RX_BLOCK_QUEUE_LENGTH,
+                                                   sizeof(struct nordic_uart_rx_block), _rx_block_storage,
+                                                   &_rx_block_queue);
+  if (_nordic_uart_rx_block_queue == NULL) {
+    ESP_LOGE(_TAG, "Failed to create RX block queue");
+    _nordic_uart_buf_deinit();
     return ESP_FAIL;
   }
   return ESP_OK;
 }
 
+// Bytes reserved by _nordic_uart_buf_init(), whichever way they are allocated.
+size_t _nordic_uart_buf_footprint(void) {
+  return sizeof(_linebufs) + CONFIG_NORDIC_UART_MAX_CONNECTIONS * LINEBUF_SIZE + _NORDIC_UART_RX_RING_SIZE +
+         sizeof(_rx_ring) + sizeof(_rx_block_storage) + sizeof(_rx_block_queue);
+}
+
 bool _nordic_uart_linebuf_initialized() { //
-  return _nordic_uart_rx_line_buf != NULL;
-}
\ No newline at end of file
+  return _linebufs[0].buf != NULL;
+}
@@ -0,0 +1,319 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <string.h>
+
+// CRC-32 as in zlib and Ethernet (reflected 0x04C11DB7), four bits at a time so the table stays small.
+static const uint32_t _crc32_nibble[16] = {
+    0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac, 0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+    0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c, 0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c,
+};
+
+// Start with crc = 0; pass the result back in to continue over more data.
+uint32_t _nordic_uart_crc32(uint32_t crc, const void *data, size_t len) {
+  const uint8_t *p = data;
+  crc = ~crc;
+  while (len--) {
+    crc ^= *p++;
+    crc = (crc >> 4) ^ _crc32_nibble[crc & 0x0f];
+    crc = (crc >> 4) ^ _crc32_nibble[crc & 0x0f];
+  }
+  return ~crc;
+}
+
+#ifdef CONFIG_NORDIC_UART_BULK
+static const char *_TAG = "NORDIC UART";
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+// like the blocking send path: give up after this many waits for a notification to go out
+#define BULK_SEND_RETRIES 10
+
+#define PUT16(p, x) ((p)[0] = (x) & 0xff, (p)[1] = ((x) >> 8) & 0xff)
+#define PUT32(p, x) (PUT16(p, x), PUT16((p) + 2, (x) >> 16))
+#define GET16(p) ((uint16_t)((p)[0] | (p)[1] << 8))
+#define GET32(p) ((uint32_t)GET16(p) | (uint32_t)GET16((p) + 2) << 16)
+
+// One upload at a time, written by the host task straight into the buffer of the task waiting in
+// nordic_uart_bulk_receive(). _rx_lock is only ever held for one block.
+struct nordic_uart_bulk_rx {
+  bool waiting;         // a task is in nordic_uart_bulk_receive()
+  uint8_t *sink;
+  size_t size;
+  uint16_t conn_handle; // central sending, BLE_HS_CONN_HANDLE_NONE until its START
+  size_t expected;      // bytes announced by START
+  size_t received;
+  uint16_t seq;         // sequence number of the next block
+  esp_err_t result;     // ESP_ERR_TIMEOUT while the transfer is open
+};
+static struct nordic_uart_bulk_rx _rx = {.conn_handle = BLE_HS_CONN_HANDLE_NONE};
+static SemaphoreHandle_t _rx_lock = NULL;
+static SemaphoreHandle_t _rx_done = NULL;
+static StaticSemaphore_t _rx_sems[2];
+
+// One download at a time; the central may abort it.
+static uint16_t _tx_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+static volatile bool _tx_aborted = false;
+static portMUX_TYPE _tx_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// The host task sends control messages once, other tasks wait for room.
+static int _control_send(uint16_t conn_handle, const uint8_t *msg, uint16_t len, bool wait) {
+  int rc;
+  int retries = 0;
+  while ((rc = _nordic_uart_notify_bulk_control(conn_handle, msg, len)) == BLE_HS_ENOMEM && wait &&
+         retries++ < BULK_SEND_RETRIES)
+    _nordic_uart_tx_wait_mbufs(pdMS_TO_TICKS(100));
+  if (rc)
+    ESP_LOGW(_TAG, "Bulk control message 0x%02x to %d lost: %d", msg[0], conn_handle, rc);
+  return rc;
+}
+
+static int _control_value(uint16_t conn_handle, uint8_t op, uint32_t value, bool wait) {
+  uint8_t msg[5] = {op};
+  PUT32(msg + 1, value);
+  return _control_send(conn_handle, msg, op == NORDIC_UART_BULK_READY ? 3 : 5, wait);
+}
+
+static void _control_error(uint16_t conn_handle, uint8_t error, uint16_t seq, bool wait) {
+  uint8_t msg[4] = {NORDIC_UART_BULK_ERROR, error};
+  PUT16(msg + 2, seq);
+  _control_send(conn_handle, msg, sizeof(msg), wait);
+}
+
+// call with _rx_lock held
+static void _rx_finish(esp_err_t result) {
+  _rx.result = result;
+  xSemaphoreGive(_rx_done);
+}
+#endif
+
+// A write to the bulk control characteristic. Returns 0 or the ATT error for the central.
+int _nordic_uart_bulk_control(uint16_t conn_handle, const uint8_t *msg, size_t len) {
+#ifdef CONFIG_NORDIC_UART_BULK
+  if (len == 0)
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+  if (msg[0] == NORDIC_UART_BULK_ERROR) {
+    // the central gives up on whichever transfer it is part of
+    xSemaphoreTake(_rx_lock, portMAX_DELAY);
+    if (_rx.waiting && _rx.conn_handle == conn_handle && _rx.result == ESP_ERR_TIMEOUT)
+      _rx_finish(ESP_FAIL);
+    xSemaphoreGive(_rx_lock);
+    portENTER_CRITICAL(&_tx_mux);
+    if (_tx_conn_handle == conn_handle)
+      _tx_aborted = true;
+    portEXIT_CRITICAL(&_tx_mux);
+    return 0;
+  }
+  if (msg[0] != NORDIC_UART_BULK_START)
+    return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+  if (len != 5)
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+
+  const uint32_t length = GET32(msg + 1);
+  uint8_t error = 0;
+  xSemaphoreTake(_rx_lock, portMAX_DELAY);
+  if (!_rx.waiting || _rx.conn_handle != BLE_HS_CONN_HANDLE_NONE) {
+    error = NORDIC_UART_BULK_ERR_NOT_READY;
+  } else if (length > _rx.size) {
+    error = NORDIC_UART_BULK_ERR_TOO_LARGE;
+  } else {
+    _rx.conn_handle = conn_handle;
+    _rx.expected = length;
+    _rx.received = 0;
+    _rx.seq = 0;
+    if (length == 0)
+      _rx_finish(ESP_OK);
+  }
+  xSemaphoreGive(_rx_lock);
+
+  if (error) {
+    _control_error(conn_handle, error, 0, false);
+  } else if (length == 0) {
+    _control_value(conn_handle, NORDIC_UART_BULK_DONE, 0, false);
+  } else {
+    const size_t chunk = _nordic_uart_conn_chunk_size(conn_handle);
+    _control_value(conn_handle, NORDIC_UART_BULK_READY, chunk - NORDIC_UART_BULK_OVERHEAD, false);
+  }
+  return 0;
+#else
+  return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+#endif
+}
+
+// A block written to the bulk characteristic: u16 sequence number, payload, u32 CRC-32 of both.
+// The payload is copied from the mbuf chain straight into the sink and checked there.
+int _nordic_uart_bulk_data(uint16_t conn_handle, const struct os_mbuf *om) {
+#ifdef CONFIG_NORDIC_UART_BULK
+  const size_t len = OS_MBUF_PKTLEN(om);
+  uint8_t hdr[2], tail[4];
+  uint8_t error = 0;
+  bool done = false;
+
+  xSemaphoreTake(_rx_lock, portMAX_DELAY);
+  if (!_rx.waiting || _rx.conn_handle != conn_handle || _rx.result != ESP_ERR_TIMEOUT) {
+    xSemaphoreGive(_rx_lock);
+    return BLE_ATT_ERR_UNLIKELY;
+  }
+  const uint16_t seq = _rx.seq;
+  const size_t payload_len = len > NORDIC_UART_BULK_OVERHEAD ? len - NORDIC_UART_BULK_OVERHEAD : 0;
+  uint8_t *dst = _rx.sink + _rx.received;
+  if (payload_len == 0 || payload_len > _rx.expected - _rx.received) {
+    error = NORDIC_UART_BULK_ERR_TOO_LARGE;
+  } else if (os_mbuf_copydata(om, 0, sizeof(hdr), hdr) != 0 || GET16(hdr) != seq) {
+    error = NORDIC_UART_BULK_ERR_SEQUENCE;
+  } else if (os_mbuf_copydata(om, sizeof(hdr), payload_len, dst) != 0 ||
+             os_mbuf_copydata(om, sizeof(hdr) + payload_len, sizeof(tail), tail) != 0 ||
+             _nordic_uart_crc32(_nordic_uart_crc32(0, hdr, sizeof(hdr)), dst, payload_len) != GET32(tail)) {
+    error = NORDIC_UART_BULK_ERR_CRC;
+  } else {
+    _rx.received += payload_len;
+    _rx.seq++;
+    done = _rx.received == _rx.expected;
+  }
+  if (error)
+    _rx_finish(error == NORDIC_UART_BULK_ERR_TOO_LARGE ? ESP_ERR_INVALID_SIZE : ESP_ERR_INVALID_CRC);
+  else if (done)
+    _rx_finish(ESP_OK);
+  const size_t expected = _rx.expected;
+  xSemaphoreGive(_rx_lock);
+
+  if (error) {
+    ESP_LOGW(_TAG, "Bulk block %u from %d rejected: %d", seq, conn_handle, error);
+    _control_error(conn_handle, error, seq, false);
+  } else if (done) {
+    _control_value(conn_handle, NORDIC_UART_BULK_DONE, expected, false);
+  }
+  return 0;
+#else
+  return BLE_ATT_ERR_REQ_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t _nordic_uart_bulk_receive(void *sink, size_t size, size_t *received, TickType_t ticks_to_wait) {
+#ifdef CONFIG_NORDIC_UART_BULK
+  if (received)
+    *received = 0;
+  if (sink == NULL && size)
+    return ESP_ERR_INVALID_ARG;
+  if (_rx_lock == NULL)
+    return ESP_ERR_INVALID_STATE;
+  xSemaphoreTake(_rx_lock, portMAX_DELAY);
+  if (_rx.waiting) {
+    xSemaphoreGive(_rx_lock);
+    return ESP_ERR_INVALID_STATE;
+  }
+  _rx.waiting = true;
+  _rx.sink = sink;
+  _rx.size = size;
+  _rx.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  _rx.received = 0;
+  _rx.result = ESP_ERR_TIMEOUT;
+  xSemaphoreTake(_rx_done, 0);
+  xSemaphoreGive(_rx_lock);
+
+  xSemaphoreTake(_rx_done, ticks_to_wait);
+
+  xSemaphoreTake(_rx_lock, portMAX_DELAY);
+  const esp_err_t result = _rx.result;
+  const uint16_t conn_handle = _rx.conn_handle;
+  const uint16_t seq = _rx.seq;
+  if (received)
+    *received = _rx.received;
+  _rx.waiting = false;
+  _rx.sink = NULL;
+  _rx.conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  xSemaphoreGive(_rx_lock);
+  // the central is still sending; tell it to stop
+  if (result == ESP_ERR_TIMEOUT && conn_handle != BLE_HS_CONN_HANDLE_NONE)
+    _control_error(conn_handle, NORDIC_UART_BULK_ERR_ABORTED, seq, true);
+  return result;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// Blocks go out as fast as the BLE host takes them, so no block waits for the one before it to be
+// acknowledged.
+esp_err_t _nordic_uart_bulk_send(uint16_t conn_handle, const void *data, size_t len) {
+#ifdef CONFIG_NORDIC_UART_BULK
+  const size_t chunk = _nordic_uart_conn_chunk_size(conn_handle);
+  if (conn_handle == NORDIC_UART_BROADCAST || chunk == 0)
+    return ESP_ERR_INVALID_ARG;
+  portENTER_CRITICAL(&_tx_mux);
+  const bool busy = _tx_conn_handle != BLE_HS_CONN_HANDLE_NONE;
+  if (!busy) {
+    _tx_conn_handle = conn_handle;
+    _tx_aborted = false;
+  }
+  portEXIT_CRITICAL(&_tx_mux);
+  if (busy)
+    return ESP_ERR_INVALID_STATE;
+
+  esp_err_t ret = ESP_OK;
+  if (_control_value(conn_handle, NORDIC_UART_BULK_START, len, true) != 0) {
+    ret = ESP_FAIL;
+    goto out;
+  }
+  const size_t payload = chunk - NORDIC_UART_BULK_OVERHEAD;
+  uint16_t seq = 0;
+  for (size_t off = 0; off < len; off += payload, ++seq) {
+    const size_t n = MIN(payload, len - off);
+    uint8_t hdr[2], tail[4];
+    PUT16(hdr, seq);
+    const uint32_t crc = _nordic_uart_crc32(_nordic_uart_crc32(0, hdr, sizeof(hdr)), (const uint8_t *)data + off, n);
+    PUT32(tail, crc);
+    const struct iovec iov[3] = {
+        {.iov_base = hdr, .iov_len = sizeof(hdr)},
+        {.iov_base = (uint8_t *)data + off, .iov_len = n},
+        {.iov_base = tail, .iov_len = sizeof(tail)},
+    };
+    int rc;
+    int retries = 0;
+    while ((rc = _nordic_uart_notify_bulk(conn_handle, iov, 3)) == BLE_HS_ENOMEM && !_tx_aborted &&
+           retries++ < BULK_SEND_RETRIES)
+      _nordic_uart_tx_wait_mbufs(pdMS_TO_TICKS(100));
+    if (rc || _tx_aborted) {
+      ESP_LOGW(_TAG, "Bulk send to %d stopped at block %u: %s", conn_handle, seq, _tx_aborted ? "aborted" : "failed");
+      if (!_tx_aborted && rc != BLE_HS_ENOTCONN)
+        _control_error(conn_handle, NORDIC_UART_BULK_ERR_ABORTED, seq, true);
+      ret = ESP_FAIL;
+      goto out;
+    }
+  }
+  if (_control_value(conn_handle, NORDIC_UART_BULK_DONE, len, true) != 0)
+    ret = ESP_FAIL;
+
+out:
+  portENTER_CRITICAL(&_tx_mux);
+  _tx_conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  portEXIT_CRITICAL(&_tx_mux);
+  return ret;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void _nordic_uart_bulk_disconnected(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_BULK
+  xSemaphoreTake(_rx_lock, portMAX_DELAY);
+  if (_rx.waiting && _rx.conn_handle == conn_handle && _rx.result == ESP_ERR_TIMEOUT)
+    _rx_finish(ESP_FAIL);
+  xSemaphoreGive(_rx_lock);
+#endif
+}
+
+// Fail an open upload; call while the host task is not running.
+void _nordic_uart_bulk_reset(void) {
+#ifdef CONFIG_NORDIC_UART_BULK
+  if (_rx_lock == NULL) {
+    _rx_lock = xSemaphoreCreateMutexStatic(&_rx_sems[0]);
+    _rx_done = xSemaphoreCreateBinaryStatic(&_rx_sems[1]);
+  }
+  xSemaphoreTake(_rx_lock, portMAX_DELAY);
+  if (_rx.waiting && _rx.result == ESP_ERR_TIMEOUT && _rx.conn_handle != BLE_HS_CONN_HANDLE_NONE)
+    _rx_finish(ESP_FAIL);
+  xSemaphoreGive(_rx_lock);
+#endif
+}
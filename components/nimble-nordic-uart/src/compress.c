@@ -0,0 +1,368 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+static const char *_TAG = "NORDIC UART";
+
+// A byte aligned LZ77 stream in the format of liblzf, so each send ends on a whole token and
+// the central can show it at once. Every token starts with a control byte:
+//   000LLLLL                      a run of L + 1 literal bytes follows
+//   LLLDDDDD [EEEEEEEE] DDDDDDDD  copy L + 2 bytes (L = 7: 9 + E bytes) from D + 1 bytes back
+// References reach at most _NORDIC_UART_LZ_WINDOW bytes back, which the decoder keeps.
+
+#define LZ_MIN_MATCH 3
+#define LZ_MAX_MATCH (7 + 255 + 2)
+#define LZ_WINDOW_MASK (_NORDIC_UART_LZ_WINDOW - 1)
+
+enum nordic_uart_lz_state { LZ_CTRL, LZ_LITERAL, LZ_LENGTH, LZ_OFFSET, LZ_MATCH };
+
+static inline uint32_t _lz_hash(const uint8_t *p) {
+  const uint32_t v = (uint32_t)p[0] << 16 | (uint32_t)p[1] << 8 | p[2];
+  return (v * 2654435761u) >> 24; // _NORDIC_UART_LZ_HASH_SIZE entries
+}
+
+void _nordic_uart_lz_enc_reset(struct nordic_uart_lz_enc *enc) {
+  memset(enc->head, 0, sizeof(enc->head));
+  enc->pos = 0;
+  enc->lit_len = 0;
+}
+
+static size_t _lz_emit_literals(struct nordic_uart_lz_enc *enc, uint8_t *out) {
+  if (enc->lit_len == 0)
+    return 0;
+  out[0] = enc->lit_len - 1;
+  memcpy(out + 1, enc->lit, enc->lit_len);
+  const size_t len = enc->lit_len + 1;
+  enc->lit_len = 0;
+  return len;
+}
+
+static size_t _lz_emit_match(size_t len, uint32_t dist, uint8_t *out) {
+  const uint32_t off = dist - 1;
+  const size_t l = len - 2;
+  size_t pos = 0;
+  if (l < 7) {
+    out[pos++] = l << 5 | off >> 8;
+  } else {
+    out[pos++] = 7 << 5 | off >> 8;
+    out[pos++] = l - 7;
+  }
+  out[pos++] = off & 0xff;
+  return pos;
+}
+
+// Compress len more bytes of the stream into out, which needs _NORDIC_UART_LZ_BOUND(len) bytes.
+// A literal run may be held back for the next call; _nordic_uart_lz_flush() writes it out.
+size_t _nordic_uart_lz_compress(struct nordic_uart_lz_enc *enc, const uint8_t *in, size_t len, uint8_t *out) {
+  size_t out_len = 0;
+  size_t i = 0;
+  while (i < len) {
+    size_t match_len = 0;
+    uint32_t dist = 0;
+    if (len - i >= LZ_MIN_MATCH) {
+      const uint32_t h = _lz_hash(in + i);
+      dist = (uint16_t)((uint16_t)enc->pos - enc->head[h]);
+      enc->head[h] = (uint16_t)enc->pos;
+      // a stale or colliding entry only costs the comparison
+      if (dist >= 1 && dist <= _NORDIC_UART_LZ_WINDOW && dist <= enc->pos) {
+        const size_t max_len = MIN(len - i, LZ_MAX_MATCH);
+        while (match_len < max_len) {
+          // a match may run on into the bytes it copies
+          const uint8_t b = match_len < dist ? enc->window[(enc->pos - dist + match_len) & LZ_WINDOW_MASK]
+                                             : in[i + match_len - dist];
+          if (b != in[i + match_len])
+            break;
+          ++match_len;
+        }
+      }
+    }
+
+    if (match_len >= LZ_MIN_MATCH) {
+      out_len += _lz_emit_literals(enc, out + out_len);
+      out_len += _lz_emit_match(match_len, dist, out + out_len);
+      for (size_t k = 0; k < match_len; ++k, ++i) {
+        if (k && len - i >= LZ_MIN_MATCH)
+          enc->head[_lz_hash(in + i)] = (uint16_t)enc->pos;
+        enc->window[enc->pos++ & LZ_WINDOW_MASK] = in[i];
+      }
+    } else {
+      enc->lit[enc->lit_len++] = in[i];
+      enc->window[enc->pos++ & LZ_WINDOW_MASK] = in[i++];
+      if (enc->lit_len == _NORDIC_UART_LZ_MAX_LITERALS)
+        out_len += _lz_emit_literals(enc, out + out_len);
+    }
+  }
+  return out_len;
+}
+
+// Write out the literals held back, at most _NORDIC_UART_LZ_MAX_LITERALS + 1 bytes.
+size_t _nordic_uart_lz_flush(struct nordic_uart_lz_enc *enc, uint8_t *out) { //
+  return _lz_emit_literals(enc, out);
+}
+
+void _nordic_uart_lz_dec_reset(struct nordic_uart_lz_dec *dec) {
+  dec->pos = 0;
+  dec->state = LZ_CTRL;
+}
+
+// Expand the compressed bytes at *in until they run out or out is full, advancing *in and
+// *in_len past what was used. Tokens may be split anywhere between calls. A reference outside
+// the window sets *error and is skipped.
+size_t _nordic_uart_lz_decompress(struct nordic_uart_lz_dec *dec, const uint8_t **in, size_t *in_len, uint8_t *out,
+                                  size_t out_size, bool *error) {
+  const uint8_t *p = *in;
+  const uint8_t *const end = p + *in_len;
+  size_t n = 0;
+  while (n < out_size) {
+    if (dec->state == LZ_MATCH) {
+      const uint8_t b = dec->window[(dec->pos - dec->dist) & LZ_WINDOW_MASK];
+      dec->window[dec->pos++ & LZ_WINDOW_MASK] = b;
+      out[n++] = b;
+      if (--dec->left == 0)
+        dec->state = LZ_CTRL;
+      continue;
+    }
+    if (p == end)
+      break;
+    const uint8_t c = *p++;
+    switch (dec->state) {
+    case LZ_CTRL:
+      dec->ctrl = c;
+      if (c < 32) {
+        dec->left = c + 1;
+        dec->state = LZ_LITERAL;
+      } else if (c >> 5 == 7) {
+        dec->state = LZ_LENGTH;
+      } else {
+        dec->left = (c >> 5) + 2;
+        dec->state = LZ_OFFSET;
+      }
+      break;
+    case LZ_LITERAL:
+      dec->window[dec->pos++ & LZ_WINDOW_MASK] = c;
+      out[n++] = c;
+      if (--dec->left == 0)
+        dec->state = LZ_CTRL;
+      break;
+    case LZ_LENGTH:
+      dec->left = c + 9;
+      dec->state = LZ_OFFSET;
+      break;
+    case LZ_OFFSET:
+      dec->dist = ((dec->ctrl & 0x1f) << 8 | c) + 1;
+      if (dec->dist > _NORDIC_UART_LZ_WINDOW || dec->dist > dec->pos) {
+        *error = true;
+        dec->state = LZ_CTRL;
+      } else {
+        dec->state = LZ_MATCH;
+      }
+      break;
+    }
+  }
+  *in_len -= p - *in;
+  *in = p;
+  return n;
+}
+
+// Per connection streams. The encoders are only touched by senders holding _compress_tx_lock, the
+// decoders only by the NimBLE host task; the table itself is guarded by _compress_mux.
+struct nordic_uart_compress {
+  uint16_t conn_handle; // BLE_HS_CONN_HANDLE_NONE when the slot is free
+  uint8_t caps;         // NORDIC_UART_CAP_* switched on by the central
+  bool tx_reset;        // the encoder starts over before the next send
+  struct nordic_uart_lz_enc enc;
+  struct nordic_uart_lz_dec dec;
+};
+
+static struct nordic_uart_compress _compress[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+static portMUX_TYPE _compress_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Compressed sends are taken one at a time, so a single output buffer serves every connection.
+// The input goes in slices of COMPRESS_SLICE bytes and full notifications are sent as they fill.
+#define COMPRESS_SLICE 128
+static SemaphoreHandle_t _compress_tx_lock = NULL; // created once, kept across stop and start
+static StaticSemaphore_t _compress_tx_lock_buf;
+static uint8_t _compress_out[BLE_ATT_ATTR_MAX_LEN + _NORDIC_UART_LZ_BOUND(COMPRESS_SLICE)];
+
+// call with _compress_mux held
+static struct nordic_uart_compress *_compress_find(uint16_t conn_handle) {
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_compress[i].conn_handle == conn_handle)
+      return &_compress[i];
+  }
+  return NULL;
+}
+
+// The central cannot make sense of anything after a gap in the stream, so a send that fails
+// half way ends the connection; the central negotiates afresh when it reconnects. Called with
+// _compress_tx_lock held, so the send does not yield to priority data: the sender task would
+// wait for the lock, and the stream cannot take another message half way through anyway.
+static esp_err_t _compress_send(struct nordic_uart_compress *comp, uint16_t conn_handle, const struct iovec *iov,
+                                int iovcnt) {
+  const size_t chunk = _nordic_uart_conn_chunk_size(conn_handle);
+  if (chunk == 0)
+    return ESP_FAIL;
+
+  size_t out_len = 0;
+  for (int i = 0; i < iovcnt; ++i) {
+    const uint8_t *data = iov[i].iov_base;
+    for (size_t off = 0; off < iov[i].iov_len;) {
+      const size_t len = MIN(iov[i].iov_len - off, COMPRESS_SLICE);
+      out_len += _nordic_uart_lz_compress(&comp->enc, data + off, len, _compress_out + out_len);
+      _NORDIC_UART_STAT_ADD(tx_uncompressed, len);
+      off += len;
+      if (out_len < chunk)
+        continue;
+      const struct iovec full = {.iov_base = _compress_out, .iov_len = out_len - out_len % chunk};
+      if (_nordic_uart_writev_conn(conn_handle, &full, 1, false) != ESP_OK)
+        goto broken;
+      out_len -= full.iov_len;
+      memmove(_compress_out, _compress_out + full.iov_len, out_len);
+    }
+  }
+  out_len += _nordic_uart_lz_flush(&comp->enc, _compress_out + out_len);
+  const struct iovec rest = {.iov_base = _compress_out, .iov_len = out_len};
+  if (out_len && _nordic_uart_writev_conn(conn_handle, &rest, 1, false) != ESP_OK)
+    goto broken;
+  return ESP_OK;
+
+broken:
+  ESP_LOGE(_TAG, "Compressed stream to %d broken, disconnecting", conn_handle);
+  ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+  return ESP_FAIL;
+}
+#endif
+
+void _nordic_uart_compress_reset(void) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  if (_compress_tx_lock == NULL)
+    _compress_tx_lock = xSemaphoreCreateMutexStatic(&_compress_tx_lock_buf);
+  portENTER_CRITICAL(&_compress_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    _compress[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  }
+  portEXIT_CRITICAL(&_compress_mux);
+#endif
+}
+
+void _nordic_uart_compress_connected(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  portENTER_CRITICAL(&_compress_mux);
+  struct nordic_uart_compress *comp = _compress_find(BLE_HS_CONN_HANDLE_NONE);
+  if (comp) {
+    comp->conn_handle = conn_handle;
+    comp->caps = 0;
+  }
+  portEXIT_CRITICAL(&_compress_mux);
+#endif
+}
+
+void _nordic_uart_compress_disconnected(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  portENTER_CRITICAL(&_compress_mux);
+  struct nordic_uart_compress *comp = _compress_find(conn_handle);
+  if (comp)
+    comp->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  portEXIT_CRITICAL(&_compress_mux);
+#endif
+}
+
+uint8_t _nordic_uart_supported_capabilities(void) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  return NORDIC_UART_CAP_COMPRESS_TX | NORDIC_UART_CAP_COMPRESS_RX;
+#else
+  return 0;
+#endif
+}
+
+uint8_t _nordic_uart_capabilities(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  portENTER_CRITICAL(&_compress_mux);
+  const struct nordic_uart_compress *comp = _compress_find(conn_handle);
+  const uint8_t caps = comp ? comp->caps : 0;
+  portEXIT_CRITICAL(&_compress_mux);
+  return caps;
+#else
+  return 0;
+#endif
+}
+
+// Called from the capability characteristic. Every write starts both streams over; bits the
+// device does not support are left off, and the central reads back what it got.
+esp_err_t _nordic_uart_set_capabilities(uint16_t conn_handle, uint8_t caps) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  portENTER_CRITICAL(&_compress_mux);
+  struct nordic_uart_compress *comp = _compress_find(conn_handle);
+  if (comp) {
+    comp->caps = caps & _nordic_uart_supported_capabilities();
+    comp->tx_reset = true;
+    _nordic_uart_lz_dec_reset(&comp->dec);
+  }
+  portEXIT_CRITICAL(&_compress_mux);
+  return comp ? ESP_OK : ESP_FAIL;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// Send to one connection, compressed when its central asked for it.
+esp_err_t _nordic_uart_compress_writev(uint16_t conn_handle, const struct iovec *iov, int iovcnt) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  if ((_nordic_uart_capabilities(conn_handle) & NORDIC_UART_CAP_COMPRESS_TX) && _compress_tx_lock) {
+    xSemaphoreTake(_compress_tx_lock, portMAX_DELAY);
+    // the central may have renegotiated, or gone, while this sender waited
+    portENTER_CRITICAL(&_compress_mux);
+    struct nordic_uart_compress *comp = _compress_find(conn_handle);
+    const bool compressed = comp && (comp->caps & NORDIC_UART_CAP_COMPRESS_TX);
+    const bool reset = compressed && comp->tx_reset;
+    if (reset)
+      comp->tx_reset = false;
+    portEXIT_CRITICAL(&_compress_mux);
+    esp_err_t ret = ESP_OK;
+    if (reset)
+      _nordic_uart_lz_enc_reset(&comp->enc);
+    if (compressed)
+      ret = _compress_send(comp, conn_handle, iov, iovcnt);
+    xSemaphoreGive(_compress_tx_lock);
+    if (compressed)
+      return ret;
+  }
+#endif
+  return _nordic_uart_writev_conn(conn_handle, iov, iovcnt, true);
+}
+
+// Hand a received block to the framer, expanded first when the central writes compressed.
+esp_err_t _nordic_uart_rx_append_block(uint16_t conn_handle, const uint8_t *data, size_t len) {
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+  portENTER_CRITICAL(&_compress_mux);
+  struct nordic_uart_compress *comp = _compress_find(conn_handle);
+  if (comp && !(comp->caps & NORDIC_UART_CAP_COMPRESS_RX))
+    comp = NULL;
+  portEXIT_CRITICAL(&_compress_mux);
+  if (comp) {
+    uint8_t out[COMPRESS_SLICE];
+    esp_err_t ret = ESP_OK;
+    size_t n;
+    do {
+      bool error = false;
+      n = _nordic_uart_lz_decompress(&comp->dec, &data, &len, out, sizeof(out), &error);
+      if (error) {
+        _NORDIC_UART_STAT_ADD(rx_compress_errors, 1);
+        ret = ESP_FAIL;
+      }
+      _NORDIC_UART_STAT_ADD(rx_uncompressed, n);
+      if (n && _nordic_uart_frame_append_block(out, n) != ESP_OK)
+        ret = ESP_FAIL;
+    } while (n == sizeof(out));
+    return ret;
+  }
+#endif
+  return _nordic_uart_frame_append_block(data, len);
+}
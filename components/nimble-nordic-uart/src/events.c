@@ -0,0 +1,216 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/event_groups.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// Listeners woken by NORDIC_UART_EVENT_* bits, kept across stop and start like the
+// nordic_uart_yield() callback.
+static TaskHandle_t _event_task = NULL;
+static uint32_t _event_task_events = 0;
+static EventGroupHandle_t _event_group = NULL;
+static EventBits_t _event_group_events = 0;
+static portMUX_TYPE _events_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Set while the host task queues lines, so a write that ends many lines wakes the reader once.
+static bool _rx_pending = false;
+
+esp_err_t _nordic_uart_notify_task(TaskHandle_t task, uint32_t events) {
+  if (events & ~NORDIC_UART_EVENT_ALL)
+    return ESP_FAIL;
+  portENTER_CRITICAL(&_events_mux);
+  _event_task = task;
+  _event_task_events = task ? events : 0;
+  portEXIT_CRITICAL(&_events_mux);
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_notify_event_group(EventGroupHandle_t group, EventBits_t events) {
+  if (events & ~NORDIC_UART_EVENT_ALL)
+    return ESP_FAIL;
+  portENTER_CRITICAL(&_events_mux);
+  _event_group = group;
+  _event_group_events = group ? events : 0;
+  portEXIT_CRITICAL(&_events_mux);
+  return ESP_OK;
+}
+
+void _nordic_uart_events_rx_queued(void) { //
+  _rx_pending = true;
+}
+
+void _nordic_uart_events_post(uint32_t events) {
+  if (_rx_pending) {
+    _rx_pending = false;
+    events |= NORDIC_UART_EVENT_RX;
+  }
+  if (events == 0)
+    return;
+  if (events & NORDIC_UART_EVENT_RX) {
+    _nordic_uart_vfs_rx_ready();
+    _nordic_uart_latency_rx_ready();
+  }
+
+  portENTER_CRITICAL(&_events_mux);
+  const TaskHandle_t task = _event_task;
+  const uint32_t task_events = events & _event_task_events;
+  const EventGroupHandle_t group = _event_group;
+  const EventBits_t group_events = events & _event_group_events;
+  portEXIT_CRITICAL(&_events_mux);
+
+  if (task && task_events)
+    xTaskNotify(task, task_events, eSetBits);
+  if (group && group_events)
+    xEventGroupSetBits(group, group_events);
+}
+
+#ifdef CONFIG_NORDIC_UART_DEFERRED_CALLBACKS
+static const char *_TAG = "NORDIC UART";
+
+#define CALLBACK_TASK_STACK_SIZE CONFIG_NORDIC_UART_CALLBACK_TASK_STACK_SIZE
+#define CALLBACK_TASK_PRIORITY CONFIG_NORDIC_UART_CALLBACK_TASK_PRIORITY
+#define CALLBACK_TASK_CORE _NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_CALLBACK_TASK_CORE)
+
+enum nordic_uart_deferred_kind {
+  DEFERRED_CALLBACK, // connection callback given to nordic_uart_start()
+  DEFERRED_RECEIVE,  // nordic_uart_yield() callback with the write's mbuf chain
+  DEFERRED_STOP,
+};
+
+struct nordic_uart_deferred {
+  enum nordic_uart_deferred_kind kind;
+  enum nordic_uart_callback_type callback_type;
+  void (*callback)(enum nordic_uart_callback_type callback_type);
+  uart_receive_callback_t receive_callback;
+  struct ble_gatt_access_ctxt ctxt; // owns ctxt.om until the handler has run
+};
+
+// One slot more than the host task may fill, so the stop request always fits.
+#define CALLBACK_QUEUE_SLOTS (CONFIG_NORDIC_UART_CALLBACK_QUEUE_LENGTH + 1)
+
+static QueueHandle_t _deferred_queue = NULL;
+static StaticQueue_t _deferred_queue_buf;
+static uint8_t _deferred_storage[CALLBACK_QUEUE_SLOTS * sizeof(struct nordic_uart_deferred)];
+static SemaphoreHandle_t _deferred_stopped_sem = NULL;
+static StaticSemaphore_t _deferred_stopped_sem_buf;
+static TaskHandle_t _deferred_task_handle = NULL;
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+static StackType_t _deferred_task_stack[CALLBACK_TASK_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t _deferred_task_tcb;
+#endif
+
+static void _deferred_task(void *arg) {
+  struct nordic_uart_deferred item;
+  for (;;) {
+    if (xQueueReceive(_deferred_queue, &item, portMAX_DELAY) != pdTRUE)
+      continue;
+    if (item.kind == DEFERRED_STOP)
+      break;
+    if (item.kind == DEFERRED_CALLBACK) {
+      item.callback(item.callback_type);
+    } else {
+      item.receive_callback(&item.ctxt);
+      // the handler may keep the chain by setting ctxt->om to NULL
+      os_mbuf_free_chain(item.ctxt.om);
+    }
+  }
+  xSemaphoreGive(_deferred_stopped_sem);
+  vTaskSuspend(NULL); // deleted by _nordic_uart_events_stop()
+}
+
+// call on the host task only, the single producer
+static bool _deferred_post(const struct nordic_uart_deferred *item) {
+  if (_deferred_queue == NULL || uxQueueSpacesAvailable(_deferred_queue) <= 1 ||
+      xQueueSend(_deferred_queue, item, 0) != pdTRUE) {
+    ESP_LOGW(_TAG, "Callback queue full");
+    return false;
+  }
+  return true;
+}
+#endif
+
+void _nordic_uart_callback_dispatch(void (*callback)(enum nordic_uart_callback_type callback_type),
+                                    enum nordic_uart_callback_type callback_type) {
+  if (callback == NULL)
+    return;
+#ifdef CONFIG_NORDIC_UART_DEFERRED_CALLBACKS
+  const struct nordic_uart_deferred item = {
+      .kind = DEFERRED_CALLBACK, .callback_type = callback_type, .callback = callback};
+  _deferred_post(&item);
+#else
+  callback(callback_type);
+#endif
+}
+
+// Returns 0 or the ATT error for the central when the write cannot be queued.
+int _nordic_uart_receive_dispatch(uart_receive_callback_t receive_callback, struct ble_gatt_access_ctxt *ctxt) {
+#ifdef CONFIG_NORDIC_UART_DEFERRED_CALLBACKS
+  const struct nordic_uart_deferred item = {
+      .kind = DEFERRED_RECEIVE, .receive_callback = receive_callback, .ctxt = *ctxt};
+  if (!_deferred_post(&item))
+    return BLE_ATT_ERR_INSUFFICIENT_RES;
+  // the host treats a NULL ctxt->om as consumed
+  ctxt->om = NULL;
+#else
+  receive_callback(ctxt);
+#endif
+  return 0;
+}
+
+// Stop the worker and free the chains it has not handled; call once the host task has stopped
+// and before the mbuf pool goes away.
+void _nordic_uart_events_stop(void) {
+#ifdef CONFIG_NORDIC_UART_DEFERRED_CALLBACKS
+  struct nordic_uart_deferred item = {.kind = DEFERRED_STOP};
+  if (_deferred_task_handle) {
+    xQueueSendToFront(_deferred_queue, &item, portMAX_DELAY);
+    xSemaphoreTake(_deferred_stopped_sem, portMAX_DELAY);
+    _nordic_uart_task_reap(_deferred_task_handle);
+    _deferred_task_handle = NULL;
+  }
+  if (_deferred_queue) {
+    while (xQueueReceive(_deferred_queue, &item, 0) == pdTRUE) {
+      if (item.kind == DEFERRED_RECEIVE)
+        os_mbuf_free_chain(item.ctxt.om);
+    }
+    vQueueDelete(_deferred_queue);
+    _deferred_queue = NULL;
+  }
+  if (_deferred_stopped_sem)
+    vSemaphoreDelete(_deferred_stopped_sem);
+  _deferred_stopped_sem = NULL;
+#endif
+  _rx_pending = false;
+}
+
+esp_err_t _nordic_uart_events_start(void) {
+  _nordic_uart_events_stop();
+#ifdef CONFIG_NORDIC_UART_DEFERRED_CALLBACKS
+  _deferred_queue = xQueueCreateStatic(CALLBACK_QUEUE_SLOTS, sizeof(struct nordic_uart_deferred), _deferred_storage,
+                                       &_deferred_queue_buf);
+  _deferred_stopped_sem = xSemaphoreCreateBinaryStatic(&_deferred_stopped_sem_buf);
+  if (_deferred_queue == NULL || _deferred_stopped_sem == NULL) {
+    ESP_LOGE(_TAG, "Failed to create callback queue");
+    _nordic_uart_events_stop();
+    return ESP_FAIL;
+  }
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  _deferred_task_handle = xTaskCreateStaticPinnedToCore(_deferred_task, "nordic_uart_cb", CALLBACK_TASK_STACK_SIZE,
+                                                        NULL, CALLBACK_TASK_PRIORITY, _deferred_task_stack,
+                                                        &_deferred_task_tcb, CALLBACK_TASK_CORE);
+  if (_deferred_task_handle == NULL) {
+#else
+  if (xTaskCreatePinnedToCore(_deferred_task, "nordic_uart_cb", CALLBACK_TASK_STACK_SIZE, NULL, CALLBACK_TASK_PRIORITY,
+                              &_deferred_task_handle, CALLBACK_TASK_CORE) != pdPASS) {
+#endif
+    ESP_LOGE(_TAG, "Failed to create callback task");
+    _deferred_task_handle = NULL;
+    _nordic_uart_events_stop();
+    return ESP_FAIL;
+  }
+#endif
+  return ESP_OK;
+}
@@ -0,0 +1,151 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <freertos/FreeRTOS.h>
+
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+static const char *_TAG = "NORDIC UART";
+
+// Each central may write as many credits as the device has granted it. A credit is a byte of RX
+// ring buffer: written bytes cost one each after decompression, and each byte that ends a line or
+// frame NORDIC_UART_FLOW_LINE_COST more, so many short lines cannot outrun the ring buffer.
+// Grants are cumulative (mod 2^32) so a lost or reordered notification never takes credit back;
+// the central compares its own running count against the highest grant it has seen.
+struct nordic_uart_flow {
+  uint16_t conn_handle; // BLE_HS_CONN_HANDLE_NONE when the slot is free
+  uint32_t granted;     // credits the central may have spent in total
+  uint32_t received;    // credits it has spent in total
+};
+
+static struct nordic_uart_flow _flows[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+static portMUX_TYPE _flows_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// call with _flows_mux held
+static struct nordic_uart_flow *_flow_find(uint16_t conn_handle) {
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_flows[i].conn_handle == conn_handle)
+      return &_flows[i];
+  }
+  return NULL;
+}
+
+// Credits each central may have in flight. One full line per connection is held back for the
+// partial lines still in the line buffers, and only half of the rest is handed out, which leaves
+// room for the headers of the fragments long lines are cut into.
+static uint32_t _flow_window(void) {
+  const size_t free = _nordic_uart_rx_free_size();
+  const size_t reserve =
+      CONFIG_NORDIC_UART_MAX_CONNECTIONS * (CONFIG_NORDIC_UART_MAX_LINE_LENGTH + NORDIC_UART_FLOW_LINE_COST);
+  return free > reserve ? (free - reserve) / 2 / CONFIG_NORDIC_UART_MAX_CONNECTIONS : 0;
+}
+
+// Raise the grant of one connection when the central has used up half its window.
+// Returns true with the new grant in *granted when the central should be told.
+static bool _flow_grant(struct nordic_uart_flow *flow, uint32_t window, bool force, uint32_t *granted) {
+  const uint32_t target = flow->received + window;
+  const int32_t raise = (int32_t)(target - flow->granted);
+  if (raise <= 0)
+    return false;
+  if (!force && (uint32_t)raise < window / 2)
+    return false;
+  flow->granted = target;
+  *granted = target;
+  return true;
+}
+
+static void _flow_refresh(uint16_t only_conn_handle, bool force) {
+  const uint32_t window = _flow_window();
+  uint16_t handles[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  uint32_t grants[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  size_t count = 0;
+
+  portENTER_CRITICAL(&_flows_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    struct nordic_uart_flow *flow = &_flows[i];
+    if (flow->conn_handle == BLE_HS_CONN_HANDLE_NONE)
+      continue;
+    if (only_conn_handle != BLE_HS_CONN_HANDLE_NONE && flow->conn_handle != only_conn_handle)
+      continue;
+    if (_flow_grant(flow, window, force, &grants[count]))
+      handles[count++] = flow->conn_handle;
+  }
+  portEXIT_CRITICAL(&_flows_mux);
+
+  // a notification lost to ENOMEM is made up by the next one; the grant stays readable meanwhile
+  for (size_t i = 0; i < count; ++i) {
+    const int rc = _nordic_uart_notify_credits(handles[i], grants[i]);
+    if (rc)
+      ESP_LOGD(_TAG, "credit notify to %d failed, err %d", handles[i], rc);
+  }
+}
+#endif
+
+void _nordic_uart_flow_reset(void) {
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+  portENTER_CRITICAL(&_flows_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    _flows[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  }
+  portEXIT_CRITICAL(&_flows_mux);
+#endif
+}
+
+void _nordic_uart_flow_connected(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+  portENTER_CRITICAL(&_flows_mux);
+  struct nordic_uart_flow *flow = _flow_find(BLE_HS_CONN_HANDLE_NONE);
+  if (flow) {
+    flow->conn_handle = conn_handle;
+    flow->granted = 0;
+    flow->received = 0;
+  }
+  portEXIT_CRITICAL(&_flows_mux);
+  if (flow)
+    _flow_refresh(conn_handle, true);
+#endif
+}
+
+void _nordic_uart_flow_disconnected(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+  portENTER_CRITICAL(&_flows_mux);
+  struct nordic_uart_flow *flow = _flow_find(conn_handle);
+  if (flow)
+    flow->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  portEXIT_CRITICAL(&_flows_mux);
+#endif
+}
+
+// Charge credits to a connection. A central that ignores its credits is not refused;
+// lines that no longer fit are dropped without blocking the host task.
+void _nordic_uart_flow_received(uint16_t conn_handle, size_t len) {
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+  portENTER_CRITICAL(&_flows_mux);
+  struct nordic_uart_flow *flow = _flow_find(conn_handle);
+  if (flow) {
+    flow->received += len;
+    // never grant below what has already arrived
+    if ((int32_t)(flow->received - flow->granted) > 0)
+      flow->granted = flow->received;
+  }
+  portEXIT_CRITICAL(&_flows_mux);
+  _flow_refresh(conn_handle, false);
+#endif
+}
+
+void _nordic_uart_flow_refresh(void) {
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+  _flow_refresh(BLE_HS_CONN_HANDLE_NONE, false);
+#endif
+}
+
+uint32_t _nordic_uart_flow_granted(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+  portENTER_CRITICAL(&_flows_mux);
+  const struct nordic_uart_flow *flow = _flow_find(conn_handle);
+  const uint32_t granted = flow ? flow->granted : 0;
+  portEXIT_CRITICAL(&_flows_mux);
+  return granted;
+#else
+  return 0;
+#endif
+}
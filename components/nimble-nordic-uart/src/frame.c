@@ -0,0 +1,156 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <stdlib.h>
+#include <string.h>
+
+static const char *_TAG = "NORDIC UART";
+
+// Encoders matching the RX framers in buffer.c.
+
+#define FRAME_SLIP_END 0xc0
+#define FRAME_SLIP_ESC 0xdb
+#define FRAME_SLIP_ESC_END 0xdc
+#define FRAME_SLIP_ESC_ESC 0xdd
+
+// COBS and SLIP frames up to this size are encoded on the stack, longer ones on the heap.
+#define FRAME_STACK_SIZE 128
+
+static size_t _varint_encode(uint32_t value, uint8_t *out) {
+  size_t len = 0;
+  do {
+    out[len] = value & 0x7f;
+    value >>= 7;
+    if (value)
+      out[len] |= 0x80;
+    ++len;
+  } while (value);
+  return len;
+}
+
+static size_t _encoded_size(enum nordic_uart_framing framing, const uint8_t *data, size_t len) {
+  switch (framing) {
+  case NORDIC_UART_FRAMING_LINE:
+    return len + 2;
+  case NORDIC_UART_FRAMING_COBS:
+    return len + len / 254 + 2;
+  case NORDIC_UART_FRAMING_SLIP: {
+    size_t size = len + 1;
+    for (size_t i = 0; i < len; ++i) {
+      if (data[i] == FRAME_SLIP_END || data[i] == FRAME_SLIP_ESC)
+        ++size;
+    }
+    return size;
+  }
+  case NORDIC_UART_FRAMING_VARINT: {
+    uint8_t header[5];
+    return _varint_encode(len, header) + len;
+  }
+  }
+  return 0;
+}
+
+static size_t _cobs_encode(const uint8_t *data, size_t len, uint8_t *out) {
+  size_t code_pos = 0;
+  size_t pos = 1;
+  uint8_t code = 1;
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i] == 0) {
+      out[code_pos] = code;
+      code_pos = pos++;
+      code = 1;
+      continue;
+    }
+    out[pos++] = data[i];
+    if (++code == 0xff) {
+      out[code_pos] = code;
+      code_pos = pos++;
+      code = 1;
+    }
+  }
+  out[code_pos] = code;
+  out[pos++] = 0;
+  return pos;
+}
+
+static size_t _slip_encode(const uint8_t *data, size_t len, uint8_t *out) {
+  size_t pos = 0;
+  for (size_t i = 0; i < len; ++i) {
+    if (data[i] == FRAME_SLIP_END) {
+      out[pos++] = FRAME_SLIP_ESC;
+      out[pos++] = FRAME_SLIP_ESC_END;
+    } else if (data[i] == FRAME_SLIP_ESC) {
+      out[pos++] = FRAME_SLIP_ESC;
+      out[pos++] = FRAME_SLIP_ESC_ESC;
+    } else {
+      out[pos++] = data[i];
+    }
+  }
+  out[pos++] = FRAME_SLIP_END;
+  return pos;
+}
+
+size_t _nordic_uart_frame_encode(enum nordic_uart_framing framing, const void *data, size_t len, uint8_t *out,
+                                 size_t out_size) {
+  const uint8_t *bytes = data;
+  if (len > UINT32_MAX || (len && data == NULL) || out == NULL)
+    return 0;
+  const size_t size = _encoded_size(framing, bytes, len);
+  if (size == 0 || size > out_size)
+    return 0;
+
+  switch (framing) {
+  case NORDIC_UART_FRAMING_LINE:
+    memcpy(out, bytes, len);
+    memcpy(out + len, "\r\n", 2);
+    return size;
+  case NORDIC_UART_FRAMING_COBS:
+    return _cobs_encode(bytes, len, out);
+  case NORDIC_UART_FRAMING_SLIP:
+    return _slip_encode(bytes, len, out);
+  case NORDIC_UART_FRAMING_VARINT: {
+    const size_t header_len = _varint_encode(len, out);
+    memcpy(out + header_len, bytes, len);
+    return size;
+  }
+  }
+  return 0;
+}
+
+// Line and varint frames are the payload with something around it, so they go out as fragments
+// without a copy; COBS and SLIP change the payload itself and are encoded first.
+esp_err_t _nordic_uart_write_frame_to(uint16_t conn_handle, const void *data, size_t len) {
+  const enum nordic_uart_framing framing = _nordic_uart_get_framing();
+  uint8_t header[5];
+  struct iovec iov[2] = {{.iov_base = (void *)data, .iov_len = len}};
+
+  switch (framing) {
+  case NORDIC_UART_FRAMING_LINE:
+    iov[1].iov_base = "\r\n";
+    iov[1].iov_len = 2;
+    return _nordic_uart_writev_to(conn_handle, iov, 2);
+  case NORDIC_UART_FRAMING_VARINT:
+    if (len > UINT32_MAX)
+      return ESP_FAIL;
+    iov[1] = iov[0];
+    iov[0].iov_base = header;
+    iov[0].iov_len = _varint_encode(len, header);
+    return _nordic_uart_writev_to(conn_handle, iov, 2);
+  default:
+    break;
+  }
+
+  uint8_t stack_buf[FRAME_STACK_SIZE];
+  const size_t size = _encoded_size(framing, data, len);
+  uint8_t *buf = size <= sizeof(stack_buf) ? stack_buf : malloc(size);
+  if (buf == NULL) {
+    ESP_LOGE(_TAG, "Failed to allocate %u bytes for a frame", (unsigned)size);
+    return ESP_FAIL;
+  }
+  iov[0].iov_base = buf;
+  iov[0].iov_len = _nordic_uart_frame_encode(framing, data, len, buf, size);
+  const esp_err_t ret = iov[0].iov_len ? _nordic_uart_writev_to(conn_handle, iov, 1) : ESP_FAIL;
+  if (buf != stack_buf)
+    free(buf);
+  return ret;
+}
@@ -0,0 +1,342 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef CONFIG_NORDIC_UART_LATENCY
+static const char *_TAG = "NORDIC UART";
+
+#define LATENCY_TASK_STACK_SIZE 4096
+// like the callback worker, below the sender task so echoes never hold notifications back
+#define LATENCY_TASK_PRIORITY 4
+#define LATENCY_BATCH 16
+#define LATENCY_REPORT_SIZE 320
+
+// Log-linear histogram: values below 8 us have a bucket each, every power of two above has 8, up to ~262 ms.
+#define LATENCY_SUB_BUCKETS 8
+#define LATENCY_BUCKETS 128
+
+struct latency_histogram {
+  uint32_t count;
+  uint32_t max_us;
+  uint32_t buckets[LATENCY_BUCKETS];
+};
+
+// Arrival and enqueue times of the lines in the RX ring, in ring order. seq numbers every line
+// enqueued, so lines without a stamp (the FIFO was full, or a Ctrl-C on disconnect) are told apart.
+#define LATENCY_STAMPS 64
+struct latency_stamp {
+  uint32_t seq;
+  int64_t arrival_us;
+  int64_t enqueue_us;
+};
+
+static volatile bool _latency_mode = false;
+static struct latency_histogram _histograms[NORDIC_UART_LATENCY_STAGES];
+static uint32_t _unstamped;
+static portMUX_TYPE _latency_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static struct latency_stamp _stamps[LATENCY_STAMPS];
+static uint32_t _stamps_head, _stamps_tail; // guarded by _latency_mux
+static int64_t _arrival_us;                 // framing task: the write being delivered, 0 outside one
+static uint32_t _enqueued;                  // framing task: lines put in the RX ring
+static uint32_t _dequeued;                  // latency task: lines taken from it
+
+static volatile bool _latency_stopping = false;
+// Given when lines arrive and on stop. Created once and kept, so the framing task can always give it.
+static SemaphoreHandle_t _latency_wake_sem = NULL;
+static StaticSemaphore_t _latency_wake_sem_buf;
+static SemaphoreHandle_t _latency_stopped_sem = NULL;
+static StaticSemaphore_t _latency_stopped_sem_buf;
+static TaskHandle_t _latency_task_handle = NULL;
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+static StackType_t _latency_task_stack[LATENCY_TASK_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t _latency_task_tcb;
+#endif
+
+static int _latency_bucket(uint32_t us) {
+  if (us < LATENCY_SUB_BUCKETS)
+    return us;
+  const int msb = 31 - __builtin_clz(us);
+  const int bucket = LATENCY_SUB_BUCKETS * (msb - 2) + ((us >> (msb - 3)) & (LATENCY_SUB_BUCKETS - 1));
+  return bucket < LATENCY_BUCKETS ? bucket : LATENCY_BUCKETS - 1;
+}
+
+// Largest value that falls into the bucket.
+static uint32_t _latency_bucket_top(int bucket) {
+  if (bucket < LATENCY_SUB_BUCKETS)
+    return bucket;
+  const int shift = bucket / LATENCY_SUB_BUCKETS - 1;
+  return ((uint32_t)(LATENCY_SUB_BUCKETS + bucket % LATENCY_SUB_BUCKETS + 1) << shift) - 1;
+}
+
+// call with _latency_mux held
+static uint32_t _latency_percentile(const struct latency_histogram *histogram, uint32_t percent) {
+  const uint32_t rank = (uint32_t)(((uint64_t)histogram->count * percent + 99) / 100);
+  uint32_t seen = 0;
+  for (int i = 0; i < LATENCY_BUCKETS; ++i) {
+    seen += histogram->buckets[i];
+    if (seen >= rank && seen > 0) {
+      const uint32_t top = _latency_bucket_top(i);
+      return top < histogram->max_us ? top : histogram->max_us;
+    }
+  }
+  return histogram->max_us;
+}
+
+static void _latency_record(const int64_t us[NORDIC_UART_LATENCY_STAGES]) {
+  portENTER_CRITICAL(&_latency_mux);
+  for (int stage = 0; stage < NORDIC_UART_LATENCY_STAGES; ++stage) {
+    const uint32_t value = us[stage] < 0 ? 0 : us[stage] > UINT32_MAX ? UINT32_MAX : (uint32_t)us[stage];
+    struct latency_histogram *histogram = &_histograms[stage];
+    histogram->count++;
+    histogram->buckets[_latency_bucket(value)]++;
+    if (value > histogram->max_us)
+      histogram->max_us = value;
+  }
+  portEXIT_CRITICAL(&_latency_mux);
+}
+
+void _nordic_uart_latency_arrival(int64_t us) {
+  if (_latency_mode)
+    _arrival_us = us;
+}
+
+// Called just before a line goes into the RX ring, and _nordic_uart_latency_dropped() when it does not fit.
+void _nordic_uart_latency_enqueue(void) {
+  if (!_latency_mode)
+    return;
+  const struct latency_stamp stamp = {
+      .seq = ++_enqueued, .arrival_us = _arrival_us, .enqueue_us = esp_timer_get_time()};
+  if (stamp.arrival_us == 0)
+    return;
+  portENTER_CRITICAL(&_latency_mux);
+  if (_stamps_head - _stamps_tail < LATENCY_STAMPS)
+    _stamps[_stamps_head++ % LATENCY_STAMPS] = stamp;
+  portEXIT_CRITICAL(&_latency_mux);
+}
+
+// Called on the framing task once a write has queued lines, to wake the echo task.
+void _nordic_uart_latency_rx_ready(void) {
+  if (_latency_mode && _latency_wake_sem)
+    xSemaphoreGive(_latency_wake_sem);
+}
+
+// The reader never sees the line, so its stamp is still the newest.
+void _nordic_uart_latency_dropped(void) {
+  if (!_latency_mode)
+    return;
+  portENTER_CRITICAL(&_latency_mux);
+  if (_stamps_head != _stamps_tail && _stamps[(_stamps_head - 1) % LATENCY_STAMPS].seq == _enqueued)
+    _stamps_head--;
+  portEXIT_CRITICAL(&_latency_mux);
+  _enqueued--;
+}
+
+// The stamp of line seq, skipping those of lines already gone.
+static bool _latency_pop(uint32_t seq, struct latency_stamp *stamp) {
+  bool found = false;
+  portENTER_CRITICAL(&_latency_mux);
+  while (_stamps_tail != _stamps_head) {
+    const struct latency_stamp *front = &_stamps[_stamps_tail % LATENCY_STAMPS];
+    if ((int32_t)(front->seq - seq) > 0)
+      break;
+    found = front->seq == seq;
+    if (found)
+      *stamp = *front;
+    _stamps_tail++;
+    if (found)
+      break;
+  }
+  if (!found)
+    _unstamped++;
+  portEXIT_CRITICAL(&_latency_mux);
+  return found;
+}
+
+// Send text back the way the central sends: as a line, or as one frame in a binary framing.
+static void _latency_reply(uint16_t conn_handle, const char *data, size_t len, bool line) {
+  if (_nordic_uart_get_framing() != NORDIC_UART_FRAMING_LINE) {
+    _nordic_uart_write_frame_to(conn_handle, data, len);
+    return;
+  }
+  const struct iovec iov[] = {{.iov_base = (void *)data, .iov_len = len}, {.iov_base = "\r\n", .iov_len = 2}};
+  _nordic_uart_writev_to(conn_handle, iov, line ? 2 : 1);
+}
+
+// "#latency" and "#latency reset" from the central; true when the line was one of them.
+static bool _latency_command(const struct nordic_uart_rx_line *line) {
+  if (strcmp(line->data, "#latency") == 0) {
+    static char report[LATENCY_REPORT_SIZE];
+    const size_t len = _nordic_uart_format_latency(report, sizeof(report));
+    _latency_reply(line->conn_handle, report, len < sizeof(report) ? len : sizeof(report) - 1, false);
+    return true;
+  }
+  if (strcmp(line->data, "#latency reset") == 0) {
+    _nordic_uart_reset_latency();
+    _latency_reply(line->conn_handle, "latency reset", 13, true);
+    return true;
+  }
+  return false;
+}
+
+// Stands in for the application's reader: echoes each line to its sender, like the example does.
+static void _latency_task(void *arg) {
+  struct nordic_uart_rx_line lines[LATENCY_BATCH];
+  size_t count = 0;
+  while (!_latency_stopping) {
+    if (count == 0)
+      xSemaphoreTake(_latency_wake_sem, portMAX_DELAY);
+    count = _nordic_uart_rx_receive_batch(lines, LATENCY_BATCH, 0, 0);
+    const int64_t dequeue_us = esp_timer_get_time();
+    for (size_t i = 0; i < count; ++i) {
+      struct latency_stamp stamp;
+      const bool stamped = _latency_pop(++_dequeued, &stamp);
+      if (_latency_command(&lines[i]))
+        continue;
+      // the Ctrl-C line of a disconnect has nobody to go back to
+      if (lines[i].len == 1 && lines[i].data[0] == '\003')
+        continue;
+      // a fragment of a long line goes back without a line ending, like it came
+      _latency_reply(lines[i].conn_handle, lines[i].data, lines[i].len, !lines[i].continued);
+      if (stamped) {
+        const int64_t submit_us = esp_timer_get_time();
+        const int64_t us[NORDIC_UART_LATENCY_STAGES] = {
+            [NORDIC_UART_LATENCY_ENQUEUE] = stamp.enqueue_us - stamp.arrival_us,
+            [NORDIC_UART_LATENCY_DEQUEUE] = dequeue_us - stamp.enqueue_us,
+            [NORDIC_UART_LATENCY_SUBMIT] = submit_us - dequeue_us,
+            [NORDIC_UART_LATENCY_TOTAL] = submit_us - stamp.arrival_us,
+        };
+        _latency_record(us);
+      }
+    }
+    if (count) {
+      _nordic_uart_rx_release_batch(lines, count);
+      _nordic_uart_flow_refresh();
+    }
+  }
+  xSemaphoreGive(_latency_stopped_sem);
+  vTaskSuspend(NULL); // deleted by _nordic_uart_latency_stop()
+}
+#endif
+
+esp_err_t _nordic_uart_set_latency_mode(bool enable) {
+#ifdef CONFIG_NORDIC_UART_LATENCY
+  if (_nordic_uart_linebuf_initialized())
+    return ESP_ERR_INVALID_STATE;
+  _latency_mode = enable;
+  _nordic_uart_reset_latency();
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t _nordic_uart_get_latency(enum nordic_uart_latency_stage stage, struct nordic_uart_latency_stats *stats) {
+#ifdef CONFIG_NORDIC_UART_LATENCY
+  if ((unsigned)stage >= NORDIC_UART_LATENCY_STAGES || stats == NULL)
+    return ESP_FAIL;
+  portENTER_CRITICAL(&_latency_mux);
+  const struct latency_histogram *histogram = &_histograms[stage];
+  stats->count = histogram->count;
+  stats->p50_us = _latency_percentile(histogram, 50);
+  stats->p99_us = _latency_percentile(histogram, 99);
+  stats->max_us = histogram->max_us;
+  portEXIT_CRITICAL(&_latency_mux);
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void _nordic_uart_reset_latency(void) {
+#ifdef CONFIG_NORDIC_UART_LATENCY
+  portENTER_CRITICAL(&_latency_mux);
+  memset(_histograms, 0, sizeof(_histograms));
+  _unstamped = 0;
+  portEXIT_CRITICAL(&_latency_mux);
+#endif
+}
+
+size_t _nordic_uart_format_latency(char *out, size_t size) {
+#ifdef CONFIG_NORDIC_UART_LATENCY
+  static const char *const names[NORDIC_UART_LATENCY_STAGES] = {"enqueue", "dequeue", "submit", "total"};
+  struct nordic_uart_latency_stats stats[NORDIC_UART_LATENCY_STAGES];
+  for (int stage = 0; stage < NORDIC_UART_LATENCY_STAGES; ++stage)
+    _nordic_uart_get_latency(stage, &stats[stage]);
+  portENTER_CRITICAL(&_latency_mux);
+  const uint32_t unstamped = _unstamped;
+  portEXIT_CRITICAL(&_latency_mux);
+
+  size_t len = snprintf(out, size, "latency lines %u unstamped %u\r\n",
+                        (unsigned)stats[NORDIC_UART_LATENCY_TOTAL].count, (unsigned)unstamped);
+  for (int stage = 0; stage < NORDIC_UART_LATENCY_STAGES; ++stage) {
+    len += snprintf(len < size ? out + len : NULL, len < size ? size - len : 0, "%-8s p50 %u p99 %u max %u us\r\n",
+                    names[stage], (unsigned)stats[stage].p50_us, (unsigned)stats[stage].p99_us,
+                    (unsigned)stats[stage].max_us);
+  }
+  return len;
+#else
+  if (size)
+    out[0] = '\0';
+  return 0;
+#endif
+}
+
+void _nordic_uart_latency_stop(void) {
+#ifdef CONFIG_NORDIC_UART_LATENCY
+  if (_latency_task_handle) {
+    _latency_stopping = true;
+    xSemaphoreGive(_latency_wake_sem);
+    xSemaphoreTake(_latency_stopped_sem, portMAX_DELAY);
+    _nordic_uart_task_reap(_latency_task_handle);
+    _latency_task_handle = NULL;
+  }
+  if (_latency_stopped_sem)
+    vSemaphoreDelete(_latency_stopped_sem);
+  _latency_stopped_sem = NULL;
+  _latency_stopping = false;
+#endif
+}
+
+// Start the echo task when the mode is on; call once the RX ring exists.
+esp_err_t _nordic_uart_latency_start(void) {
+#ifdef CONFIG_NORDIC_UART_LATENCY
+  _nordic_uart_latency_stop();
+  portENTER_CRITICAL(&_latency_mux);
+  _stamps_head = _stamps_tail = 0;
+  portEXIT_CRITICAL(&_latency_mux);
+  _arrival_us = 0;
+  _enqueued = _dequeued = 0;
+  if (!_latency_mode)
+    return ESP_OK;
+
+  if (_latency_wake_sem == NULL)
+    _latency_wake_sem = xSemaphoreCreateBinaryStatic(&_latency_wake_sem_buf);
+  xSemaphoreTake(_latency_wake_sem, 0);
+  _latency_stopped_sem = xSemaphoreCreateBinaryStatic(&_latency_stopped_sem_buf);
+  if (_latency_wake_sem == NULL || _latency_stopped_sem == NULL) {
+    ESP_LOGE(_TAG, "Failed to create latency semaphore");
+    return ESP_FAIL;
+  }
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  _latency_task_handle = xTaskCreateStatic(_latency_task, "nordic_uart_lat", LATENCY_TASK_STACK_SIZE, NULL,
+                                           LATENCY_TASK_PRIORITY, _latency_task_stack, &_latency_task_tcb);
+  if (_latency_task_handle == NULL) {
+#else
+  if (xTaskCreate(_latency_task, "nordic_uart_lat", LATENCY_TASK_STACK_SIZE, NULL, LATENCY_TASK_PRIORITY,
+                  &_latency_task_handle) != pdPASS) {
+#endif
+    ESP_LOGE(_TAG, "Failed to create latency task");
+    _latency_task_handle = NULL;
+    _nordic_uart_latency_stop();
+    return ESP_FAIL;
+  }
+#endif
+  return ESP_OK;
+}
@@ -0,0 +1,217 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include "host/ble_hs.h"
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+
+static const char *_TAG = "NORDIC UART";
+
+struct nordic_uart_link_params {
+  struct ble_gap_upd_params conn;
+  uint16_t tx_octets; // LL payload for data length extension
+  uint16_t tx_time;   // us
+  uint8_t phys_mask;
+};
+
+// 7.5-15 ms interval, 251 byte LL PDUs and the LE 2M PHY: several full notifications per event
+static const struct nordic_uart_link_params _high_throughput = {
+    .conn = {.itvl_min = 6, .itvl_max = 12, .latency = 0, .supervision_timeout = 400},
+    .tx_octets = 251,
+    .tx_time = 2120,
+    .phys_mask = BLE_GAP_LE_PHY_2M_MASK,
+};
+
+// 100-200 ms interval and skip up to 4 events while idle, default 27 byte PDUs on the 1M PHY
+static const struct nordic_uart_link_params _low_power = {
+    .conn = {.itvl_min = 80, .itvl_max = 160, .latency = 4, .supervision_timeout = 600},
+    .tx_octets = 27,
+    .tx_time = 328,
+    .phys_mask = BLE_GAP_LE_PHY_1M_MASK,
+};
+
+enum nordic_uart_link_request { LINK_PARAMS, LINK_DATA_LEN, LINK_PHY, LINK_REQUESTS };
+
+struct nordic_uart_link {
+  uint16_t conn_handle; // BLE_HS_CONN_HANDLE_NONE when the slot is free
+  uint16_t tx_octets;
+  int status[LINK_REQUESTS];
+};
+
+static struct nordic_uart_link _links[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+static portMUX_TYPE _links_mux = portMUX_INITIALIZER_UNLOCKED;
+
+#if defined(CONFIG_NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT)
+#define LINK_PROFILE_DEFAULT NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT
+#elif defined(CONFIG_NORDIC_UART_LINK_PROFILE_LOW_POWER)
+#define LINK_PROFILE_DEFAULT NORDIC_UART_LINK_PROFILE_LOW_POWER
+#else
+#define LINK_PROFILE_DEFAULT NORDIC_UART_LINK_PROFILE_DEFAULT
+#endif
+static volatile enum nordic_uart_link_profile _link_profile = LINK_PROFILE_DEFAULT;
+
+static const struct nordic_uart_link_params *_profile_params(enum nordic_uart_link_profile profile) {
+  switch (profile) {
+  case NORDIC_UART_LINK_PROFILE_HIGH_THROUGHPUT:
+    return &_high_throughput;
+  case NORDIC_UART_LINK_PROFILE_LOW_POWER:
+    return &_low_power;
+  default:
+    return NULL;
+  }
+}
+
+// call with _links_mux held
+static struct nordic_uart_link *_link_find(uint16_t conn_handle) {
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_links[i].conn_handle == conn_handle)
+      return &_links[i];
+  }
+  return NULL;
+}
+
+static void _link_set_status(uint16_t conn_handle, enum nordic_uart_link_request request, int status) {
+  portENTER_CRITICAL(&_links_mux);
+  struct nordic_uart_link *link = _link_find(conn_handle);
+  if (link)
+    link->status[request] = status;
+  portEXIT_CRITICAL(&_links_mux);
+}
+
+// Ask the central for the profile's parameters. Each request completes with a GAP event;
+// a request the host refuses right away keeps its error code as the outcome.
+static void _link_request(uint16_t conn_handle, enum nordic_uart_link_profile profile) {
+  const struct nordic_uart_link_params *params = _profile_params(profile);
+  if (params == NULL)
+    return;
+
+  int rc = ble_gap_update_params(conn_handle, &params->conn);
+  _link_set_status(conn_handle, LINK_PARAMS, rc ? rc : NORDIC_UART_LINK_PENDING);
+  if (rc)
+    ESP_LOGW(_TAG, "ble_gap_update_params, err %d", rc);
+
+  rc = ble_gap_set_data_len(conn_handle, params->tx_octets, params->tx_time);
+  portENTER_CRITICAL(&_links_mux);
+  struct nordic_uart_link *link = _link_find(conn_handle);
+  // the controller reports no BLE_GAP_EVENT_DATA_LEN_CHG for the length already in effect
+  if (link)
+    link->status[LINK_DATA_LEN] = rc ? rc : (link->tx_octets == params->tx_octets ? 0 : NORDIC_UART_LINK_PENDING);
+  portEXIT_CRITICAL(&_links_mux);
+  if (rc)
+    ESP_LOGW(_TAG, "ble_gap_set_data_len, err %d", rc);
+
+  rc = ble_gap_set_prefered_le_phy(conn_handle, params->phys_mask, params->phys_mask, BLE_GAP_LE_PHY_CODED_ANY);
+  _link_set_status(conn_handle, LINK_PHY, rc ? rc : NORDIC_UART_LINK_PENDING);
+  if (rc)
+    ESP_LOGW(_TAG, "ble_gap_set_prefered_le_phy, err %d", rc);
+}
+
+void _nordic_uart_link_reset(void) {
+  portENTER_CRITICAL(&_links_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    _links[i].conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  }
+  portEXIT_CRITICAL(&_links_mux);
+}
+
+void _nordic_uart_link_connected(uint16_t conn_handle) {
+  portENTER_CRITICAL(&_links_mux);
+  struct nordic_uart_link *link = _link_find(BLE_HS_CONN_HANDLE_NONE);
+  if (link) {
+    link->conn_handle = conn_handle;
+    link->tx_octets = 27; // until data length extension says otherwise
+    for (int i = 0; i < LINK_REQUESTS; ++i)
+      link->status[i] = NORDIC_UART_LINK_NOT_REQUESTED;
+  }
+  portEXIT_CRITICAL(&_links_mux);
+  if (link)
+    _link_request(conn_handle, _link_profile);
+}
+
+void _nordic_uart_link_disconnected(uint16_t conn_handle) {
+  portENTER_CRITICAL(&_links_mux);
+  struct nordic_uart_link *link = _link_find(conn_handle);
+  if (link)
+    link->conn_handle = BLE_HS_CONN_HANDLE_NONE;
+  portEXIT_CRITICAL(&_links_mux);
+}
+
+// Record the outcome of a link update. Returns true when the application should hear about it.
+bool _nordic_uart_link_event(const struct ble_gap_event *event) {
+  switch (event->type) {
+  case BLE_GAP_EVENT_CONN_UPDATE:
+    ESP_LOGI(_TAG, "BLE_GAP_EVENT_CONN_UPDATE status %d", event->conn_update.status);
+    _link_set_status(event->conn_update.conn_handle, LINK_PARAMS, event->conn_update.status);
+    break;
+  case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+    ESP_LOGI(_TAG, "BLE_GAP_EVENT_PHY_UPDATE_COMPLETE status %d, tx %d, rx %d", event->phy_updated.status,
+             event->phy_updated.tx_phy, event->phy_updated.rx_phy);
+    _link_set_status(event->phy_updated.conn_handle, LINK_PHY, event->phy_updated.status);
+    break;
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+  case BLE_GAP_EVENT_DATA_LEN_CHG: {
+    ESP_LOGI(_TAG, "BLE_GAP_EVENT_DATA_LEN_CHG tx %d octets", event->data_len_chg.max_tx_octets);
+    portENTER_CRITICAL(&_links_mux);
+    struct nordic_uart_link *link = _link_find(event->data_len_chg.conn_handle);
+    if (link) {
+      link->tx_octets = event->data_len_chg.max_tx_octets;
+      link->status[LINK_DATA_LEN] = 0;
+    }
+    portEXIT_CRITICAL(&_links_mux);
+    break;
+  }
+#endif
+  default:
+    return false;
+  }
+  return _link_profile != NORDIC_UART_LINK_PROFILE_DEFAULT;
+}
+
+esp_err_t _nordic_uart_set_link_profile(enum nordic_uart_link_profile profile) {
+  if (profile != NORDIC_UART_LINK_PROFILE_DEFAULT && _profile_params(profile) == NULL)
+    return ESP_FAIL;
+  _link_profile = profile;
+
+  // apply to the centrals already connected
+  uint16_t handles[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  size_t count = 0;
+  portENTER_CRITICAL(&_links_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_links[i].conn_handle != BLE_HS_CONN_HANDLE_NONE)
+      handles[count++] = _links[i].conn_handle;
+  }
+  portEXIT_CRITICAL(&_links_mux);
+  for (size_t i = 0; i < count; ++i) {
+    _link_request(handles[i], profile);
+  }
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_get_link_info(uint16_t conn_handle, struct nordic_uart_link_info *info) {
+  struct ble_gap_conn_desc desc;
+  if (info == NULL || ble_gap_conn_find(conn_handle, &desc) != 0)
+    return ESP_FAIL;
+
+  portENTER_CRITICAL(&_links_mux);
+  const struct nordic_uart_link *link = _link_find(conn_handle);
+  const struct nordic_uart_link copy = link ? *link : (struct nordic_uart_link){0};
+  portEXIT_CRITICAL(&_links_mux);
+  if (link == NULL)
+    return ESP_FAIL;
+
+  memset(info, 0, sizeof(*info));
+  info->conn_handle = conn_handle;
+  info->profile = _link_profile;
+  info->mtu = ble_att_mtu(conn_handle);
+  info->conn_itvl = desc.conn_itvl;
+  info->conn_latency = desc.conn_latency;
+  info->supervision_timeout = desc.supervision_timeout;
+  info->tx_phy = BLE_GAP_LE_PHY_1M;
+  info->rx_phy = BLE_GAP_LE_PHY_1M;
+  ble_gap_read_le_phy(conn_handle, &info->tx_phy, &info->rx_phy);
+  info->tx_octets = copy.tx_octets;
+  info->params_status = copy.status[LINK_PARAMS];
+  info->data_len_status = copy.status[LINK_DATA_LEN];
+  info->phy_status = copy.status[LINK_PHY];
+  return ESP_OK;
+}
@@ -1,4 +1,4 @@
-#include "nimble-nordic-uart.h"
+#include "nordic-uart-private.h"
 
 #include <esp_log.h>
 #include <esp_nimble_hci.h>
@@ -13,17 +13,233 @@ static const char *_TAG = "NORDIC UART";
 // #define CONFIG_NORDIC_UART_MAX_LINE_LENGTH 256
 // #define CONFIG_NORDIC_UART_RX_BUFFER_SIZE 4096
 
-// Split the message in BLE_SEND_MTU and send it.
+// Split the message in (negotiated MTU - 3) byte notifications and send it.
 esp_err_t nordic_uart_send(const char *message) { //
   return _nordic_uart_send(message);
 }
 
+esp_err_t nordic_uart_send_to(uint16_t conn_handle, const char *message) { //
+  return nordic_uart_write_to(conn_handle, message, strlen(message));
+}
+
+// The message and its line ending go out as one write, so short lines take one notification.
 esp_err_t nordic_uart_sendln(const char *message) {
-  if (nordic_uart_send(message) != ESP_OK)
-    return ESP_FAIL;
-  if (nordic_uart_send("\r\n") != ESP_OK)
-    return ESP_FAIL;
-  return ESP_OK;
+  const struct iovec iov[] = {
+      {.iov_base = (void *)message, .iov_len = strlen(message)},
+      {.iov_base = "\r\n", .iov_len = 2},
+  };
+  return nordic_uart_writev(iov, 2);
+}
+
+esp_err_t nordic_uart_write(const void *data, size_t len) { //
+  return _nordic_uart_write(data, len);
+}
+
+esp_err_t nordic_uart_write_to(uint16_t conn_handle, const void *data, size_t len) {
+  const struct iovec iov = {.iov_base = (void *)data, .iov_len = len};
+  return _nordic_uart_writev_to(conn_handle, &iov, 1);
+}
+
+esp_err_t nordic_uart_writev(const struct iovec *iov, int iovcnt) { //
+  return _nordic_uart_writev(iov, iovcnt);
+}
+
+esp_err_t nordic_uart_writev_to(uint16_t conn_handle, const struct iovec *iov, int iovcnt) { //
+  return _nordic_uart_writev_to(conn_handle, iov, iovcnt);
+}
+
+esp_err_t nordic_uart_write_frame(const void *data, size_t len) { //
+  return _nordic_uart_write_frame_to(NORDIC_UART_BROADCAST, data, len);
+}
+
+esp_err_t nordic_uart_write_frame_to(uint16_t conn_handle, const void *data, size_t len) { //
+  return _nordic_uart_write_frame_to(conn_handle, data, len);
+}
+
+size_t nordic_uart_frame_encode(enum nordic_uart_framing framing, const void *data, size_t len, uint8_t *out,
+                                size_t out_size) {
+  return _nordic_uart_frame_encode(framing, data, len, out, out_size);
+}
+
+size_t nordic_uart_connections(uint16_t *handles, size_t max_count) { //
+  return _nordic_uart_conn_handles(handles, max_count);
+}
+
+esp_err_t nordic_uart_set_link_profile(enum nordic_uart_link_profile profile) { //
+  return _nordic_uart_set_link_profile(profile);
+}
+
+esp_err_t nordic_uart_get_link_info(uint16_t conn_handle, struct nordic_uart_link_info *info) { //
+  return _nordic_uart_get_link_info(conn_handle, info);
+}
+
+esp_err_t nordic_uart_set_adv_interval(uint16_t min_ms, uint16_t max_ms) { //
+  return _nordic_uart_set_adv_interval(min_ms, max_ms);
+}
+
+esp_err_t nordic_uart_set_fast_reconnect(uint32_t window_ms) { //
+  return _nordic_uart_set_fast_reconnect(window_ms);
+}
+
+uint8_t nordic_uart_capabilities(uint16_t conn_handle) { //
+  return _nordic_uart_capabilities(conn_handle);
+}
+
+uint16_t nordic_uart_rx_item_conn_handle(const void *item, size_t item_size) { //
+  return _nordic_uart_rx_item_conn_handle(item, item_size);
+}
+
+size_t nordic_uart_rx_item_len(size_t item_size) { //
+  return _nordic_uart_rx_item_len(item_size);
+}
+
+bool nordic_uart_rx_item_continued(const void *item, size_t item_size) { //
+  return _nordic_uart_rx_item_continued(item, item_size);
+}
+
+void nordic_uart_return_item(void *item) {
+  _nordic_uart_rx_return_item(item);
+  _nordic_uart_flow_refresh();
+}
+
+size_t nordic_uart_receive_batch(struct nordic_uart_rx_line *lines, size_t max_lines, size_t max_bytes,
+                                 TickType_t ticks_to_wait) {
+  return _nordic_uart_rx_receive_batch(lines, max_lines, max_bytes, ticks_to_wait);
+}
+
+void nordic_uart_release_batch(struct nordic_uart_rx_line *lines, size_t count) {
+  _nordic_uart_rx_release_batch(lines, count);
+  _nordic_uart_flow_refresh();
+}
+
+esp_err_t nordic_uart_send_async(const char *message) { //
+  return _nordic_uart_tx_enqueue(message, strlen(message));
+}
+
+esp_err_t nordic_uart_write_async(const void *data, size_t len) { //
+  return _nordic_uart_tx_enqueue(data, len);
+}
+
+esp_err_t nordic_uart_flush(TickType_t ticks_to_wait) { //
+  return _nordic_uart_tx_flush(ticks_to_wait);
+}
+
+esp_err_t nordic_uart_set_tx_coalescing(uint32_t delay_ms) { //
+  return _nordic_uart_set_tx_coalescing(delay_ms);
+}
+
+size_t nordic_uart_tx_queue_depth(void) { //
+  return _nordic_uart_tx_queue_depth();
+}
+
+size_t nordic_uart_tx_queue_high_watermark(void) { //
+  return _nordic_uart_tx_queue_high_watermark();
+}
+
+esp_err_t nordic_uart_send_priority(const char *message) { //
+  return _nordic_uart_tx_enqueue_priority(NORDIC_UART_TX_HIGH, message, strlen(message));
+}
+
+esp_err_t nordic_uart_write_priority(const void *data, size_t len) { //
+  return _nordic_uart_tx_enqueue_priority(NORDIC_UART_TX_HIGH, data, len);
+}
+
+esp_err_t nordic_uart_get_tx_lane_stats(enum nordic_uart_tx_priority priority,
+                                        struct nordic_uart_tx_lane_stats *stats) {
+  return _nordic_uart_get_tx_lane_stats(priority, stats);
+}
+
+esp_err_t nordic_uart_get_stats(struct nordic_uart_stats *stats) { //
+  return _nordic_uart_get_stats(stats);
+}
+
+void nordic_uart_reset_stats(void) { //
+  _nordic_uart_reset_stats();
+}
+
+esp_err_t nordic_uart_set_latency_mode(bool enable) { //
+  return _nordic_uart_set_latency_mode(enable);
+}
+
+esp_err_t nordic_uart_get_latency(enum nordic_uart_latency_stage stage, struct nordic_uart_latency_stats *stats) { //
+  return _nordic_uart_get_latency(stage, stats);
+}
+
+void nordic_uart_reset_latency(void) { //
+  _nordic_uart_reset_latency();
+}
+
+size_t nordic_uart_format_latency(char *out, size_t size) { //
+  return _nordic_uart_format_latency(out, size);
+}
+
+esp_err_t nordic_uart_notify_task(TaskHandle_t task, uint32_t events) { //
+  return _nordic_uart_notify_task(task, events);
+}
+
+esp_err_t nordic_uart_notify_event_group(EventGroupHandle_t group, EventBits_t events) { //
+  return _nordic_uart_notify_event_group(group, events);
+}
+
+esp_err_t nordic_uart_bulk_receive(void *sink, size_t size, size_t *received, TickType_t ticks_to_wait) { //
+  return _nordic_uart_bulk_receive(sink, size, received, ticks_to_wait);
+}
+
+esp_err_t nordic_uart_bulk_send(uint16_t conn_handle, const void *data, size_t len) { //
+  return _nordic_uart_bulk_send(conn_handle, data, len);
+}
+
+esp_err_t nordic_uart_vfs_register(void) { //
+  return _nordic_uart_vfs_register();
+}
+
+esp_err_t nordic_uart_vfs_unregister(void) { //
+  return _nordic_uart_vfs_unregister();
+}
+
+esp_err_t nordic_uart_set_trace_hook(nordic_uart_trace_hook_t hook) { //
+  return _nordic_uart_set_trace_hook(hook);
+}
+
+esp_err_t nordic_uart_set_rx_mode(enum nordic_uart_rx_mode mode) { //
+  return _nordic_uart_set_rx_mode(mode);
+}
+
+esp_err_t nordic_uart_set_framing(enum nordic_uart_framing framing) { //
+  return _nordic_uart_set_framing(framing);
+}
+
+esp_err_t nordic_uart_set_long_lines(bool enable) { //
+  return _nordic_uart_set_long_lines(enable);
+}
+
+esp_err_t nordic_uart_set_rx_worker(bool enable) { //
+  return _nordic_uart_set_rx_worker(enable);
+}
+
+void nordic_uart_line_assembler_init(struct nordic_uart_line_assembler *assembler, size_t max_len) { //
+  _nordic_uart_line_assembler_init(assembler, max_len);
+}
+
+void nordic_uart_line_assembler_deinit(struct nordic_uart_line_assembler *assembler) { //
+  _nordic_uart_line_assembler_deinit(assembler);
+}
+
+bool nordic_uart_line_assembler_feed(struct nordic_uart_line_assembler *assembler,
+                                     const struct nordic_uart_rx_line *item, struct nordic_uart_rx_line *line) {
+  return _nordic_uart_line_assembler_feed(assembler, item, line);
+}
+
+struct os_mbuf *nordic_uart_receive_block(TickType_t ticks_to_wait) { //
+  return _nordic_uart_rx_block_receive(ticks_to_wait, NULL);
+}
+
+struct os_mbuf *nordic_uart_receive_block_from(uint16_t *conn_handle, TickType_t ticks_to_wait) { //
+  return _nordic_uart_rx_block_receive(ticks_to_wait, conn_handle);
+}
+
+void nordic_uart_release_block(struct os_mbuf *om) { //
+  os_mbuf_free_chain(om);
 }
 
 esp_err_t nordic_uart_start(const char *device_name, void (*callback)(enum nordic_uart_callback_type callback_type)) {
@@ -33,3 +249,11 @@ esp_err_t nordic_uart_start(const char *device_name, void (*callback)(enum nordi
 esp_err_t nordic_uart_stop(void) { //
   return _nordic_uart_stop();
 }
+
+esp_err_t nordic_uart_suspend(TickType_t ticks_to_wait) { //
+  return _nordic_uart_suspend(ticks_to_wait);
+}
+
+esp_err_t nordic_uart_resume(void) { //
+  return _nordic_uart_resume();
+}
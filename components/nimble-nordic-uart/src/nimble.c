@@ -1,7 +1,8 @@
-#include "nimble-nordic-uart.h"
+#include "nordic-uart-private.h"
 
 #include "esp_log.h"
 #include "esp_nimble_hci.h"
+#include "esp_timer.h"
 #include "host/ble_hs.h"
 #include "nimble/nimble_port.h"
 #include "nimble/nimble_port_freertos.h"
@@ -14,7 +15,6 @@ static const char *_TAG = "NORDIC UART";
 
 // #define CONFIG_NORDIC_UART_MAX_LINE_LENGTH 256
 // #define CONFIG_NORDIC_UART_RX_BUFFER_SIZE 4096
-#define BLE_SEND_MTU 128
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 #define B0(x) ((x) & 0xFF)
@@ -36,32 +36,210 @@ static const char *_TAG = "NORDIC UART";
 static const ble_uuid128_t SERVICE_UUID = UUID128_CONST(0x6E400001, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E);
 static const ble_uuid128_t CHAR_UUID_RX = UUID128_CONST(0x6E400002, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E);
 static const ble_uuid128_t CHAR_UUID_TX = UUID128_CONST(0x6E400003, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E);
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+static const ble_uuid128_t CHAR_UUID_CREDITS = UUID128_CONST(0x6E400004, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E);
+#endif
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+static const ble_uuid128_t CHAR_UUID_CAPS = UUID128_CONST(0x6E400005, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E);
+#endif
+#ifdef CONFIG_NORDIC_UART_BULK
+static const ble_uuid128_t CHAR_UUID_BULK = UUID128_CONST(0x6E400006, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E);
+static const ble_uuid128_t CHAR_UUID_BULK_CONTROL = UUID128_CONST(0x6E400007, 0xB5A3, 0xF393, 0xE0A9, 0xE50E24DCCA9E);
+#endif
 
 static uint8_t ble_addr_type;
 
-static uint16_t ble_conn_hdl;
 static uint16_t notify_char_attr_hdl;
+static uint16_t credits_char_attr_hdl;
+static uint16_t bulk_char_attr_hdl;
+static uint16_t bulk_control_char_attr_hdl;
+
+// connected centrals, written by the host task and read by senders
+struct nordic_uart_conn {
+  uint16_t handle; // BLE_HS_CONN_HANDLE_NONE when the slot is free
+  uint16_t mtu;
+};
+static struct nordic_uart_conn _conns[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+static portMUX_TYPE _conns_mux = portMUX_INITIALIZER_UNLOCKED;
 
 static void (*_nordic_uart_callback)(enum nordic_uart_callback_type callback_type) = NULL;
 static uart_receive_callback_t _uart_receive_callback = NULL;
+static volatile enum nordic_uart_rx_mode _rx_mode = NORDIC_UART_RX_MODE_LINE;
 
 esp_err_t nordic_uart_yield(uart_receive_callback_t uart_receive_callback) {
   _uart_receive_callback = uart_receive_callback;
   return ESP_OK;
 }
 
-static int _uart_receive(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
-  if (_uart_receive_callback) {
-    _uart_receive_callback(ctxt);
-  } else {
-    for (int i = 0; i < ctxt->om->om_len; ++i) {
-      const char c = ctxt->om->om_data[i];
-      _nordic_uart_linebuf_append(c);
-    }
+esp_err_t _nordic_uart_set_rx_mode(enum nordic_uart_rx_mode mode) {
+  if (mode != NORDIC_UART_RX_MODE_LINE && mode != NORDIC_UART_RX_MODE_STREAM)
+    return ESP_FAIL;
+  _rx_mode = mode;
+  return ESP_OK;
+}
+
+static void _conns_reset(void) {
+  portENTER_CRITICAL(&_conns_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    _conns[i].handle = BLE_HS_CONN_HANDLE_NONE;
+  }
+  portEXIT_CRITICAL(&_conns_mux);
+}
+
+// call with _conns_mux held
+static struct nordic_uart_conn *_conn_find(uint16_t conn_handle) {
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_conns[i].handle == conn_handle)
+      return &_conns[i];
+  }
+  return NULL;
+}
+
+static esp_err_t _conn_add(uint16_t conn_handle) {
+  portENTER_CRITICAL(&_conns_mux);
+  struct nordic_uart_conn *conn = _conn_find(BLE_HS_CONN_HANDLE_NONE);
+  if (conn) {
+    conn->handle = conn_handle;
+    conn->mtu = BLE_ATT_MTU_DFLT;
+  }
+  portEXIT_CRITICAL(&_conns_mux);
+  return conn ? ESP_OK : ESP_FAIL;
+}
+
+static void _conn_remove(uint16_t conn_handle) {
+  portENTER_CRITICAL(&_conns_mux);
+  struct nordic_uart_conn *conn = _conn_find(conn_handle);
+  if (conn)
+    conn->handle = BLE_HS_CONN_HANDLE_NONE;
+  portEXIT_CRITICAL(&_conns_mux);
+}
+
+static void _conn_set_mtu(uint16_t conn_handle, uint16_t mtu) {
+  portENTER_CRITICAL(&_conns_mux);
+  struct nordic_uart_conn *conn = _conn_find(conn_handle);
+  if (conn)
+    conn->mtu = mtu;
+  portEXIT_CRITICAL(&_conns_mux);
+}
+
+// Returns 0 when `conn_handle` is not connected.
+static uint16_t _conn_chunk_size(uint16_t conn_handle) {
+  portENTER_CRITICAL(&_conns_mux);
+  const struct nordic_uart_conn *conn = _conn_find(conn_handle);
+  const uint16_t mtu = conn ? conn->mtu : 0;
+  portEXIT_CRITICAL(&_conns_mux);
+  return conn ? _nordic_uart_notify_payload_size(mtu) : 0;
+}
+
+uint16_t _nordic_uart_conn_chunk_size(uint16_t conn_handle) { //
+  return _conn_chunk_size(conn_handle);
+}
+
+size_t _nordic_uart_conn_handles(uint16_t *handles, size_t max_count) {
+  size_t count = 0;
+  portENTER_CRITICAL(&_conns_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS && count < max_count; ++i) {
+    if (_conns[i].handle != BLE_HS_CONN_HANDLE_NONE)
+      handles[count++] = _conns[i].handle;
+  }
+  portEXIT_CRITICAL(&_conns_mux);
+  return count;
+}
+
+// Tell the application about a connection event, by callback and by NORDIC_UART_EVENT_* bits.
+static void _report(enum nordic_uart_callback_type callback_type, uint32_t events) {
+  _nordic_uart_events_post(events);
+  _nordic_uart_callback_dispatch(_nordic_uart_callback, callback_type);
+}
+
+// Sets *framed when the write goes to the framer, which charges its flow control credits itself.
+static int _uart_deliver(uint16_t conn_handle, struct ble_gatt_access_ctxt *ctxt, int64_t arrival_us, bool *framed) {
+  const uart_receive_callback_t receive_callback = _uart_receive_callback;
+  *framed = false;
+  if (receive_callback) {
+    return _nordic_uart_receive_dispatch(receive_callback, ctxt);
+  } else if (_rx_mode == NORDIC_UART_RX_MODE_STREAM) {
+    // keep the whole chain; the host treats a NULL ctxt->om as consumed
+    if (_nordic_uart_rx_block_push(conn_handle, ctxt->om) != ESP_OK)
+      return BLE_ATT_ERR_INSUFFICIENT_RES;
+    ctxt->om = NULL;
+    return 0;
+  }
+  *framed = true;
+  if (_nordic_uart_rx_worker_active()) {
+    // framed on the RX worker, which frees the chain
+    if (_nordic_uart_rx_worker_post(conn_handle, ctxt->om, arrival_us) != ESP_OK)
+      return BLE_ATT_ERR_INSUFFICIENT_RES;
+    ctxt->om = NULL;
+  } else if (_nordic_uart_rx_frame_write(conn_handle, ctxt->om, arrival_us) != ESP_OK) {
+    return BLE_ATT_ERR_INSUFFICIENT_RES;
   }
   return 0;
 }
 
+static int _uart_receive(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  const size_t len = ctxt->om ? OS_MBUF_PKTLEN(ctxt->om) : 0;
+  _NORDIC_UART_TRACE(NORDIC_UART_TRACE_RECEIVE_START, conn_handle, len);
+  bool framed;
+  const int rc = _uart_deliver(conn_handle, ctxt, esp_timer_get_time(), &framed);
+  if (rc)
+    _NORDIC_UART_STAT_ADD(rx_writes_rejected, 1);
+  else
+    _NORDIC_UART_STAT_ADD(rx_bytes, len);
+  _nordic_uart_flow_received(conn_handle, rc || framed ? 0 : len);
+  // one wakeup for every line this write completed
+  _nordic_uart_events_post(0);
+  _NORDIC_UART_TRACE(NORDIC_UART_TRACE_RECEIVE_END, conn_handle, len);
+  return rc;
+}
+
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+// The credit characteristic reads as the connection's cumulative grant, little endian.
+static int _uart_credits(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  const uint32_t granted = _nordic_uart_flow_granted(conn_handle);
+  const uint8_t value[4] = {B0(granted), B1(granted), B2(granted), B3(granted)};
+  return os_mbuf_append(ctxt->om, value, sizeof(value)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+// The capability characteristic reads as {supported NORDIC_UART_CAP_* bits, bits switched on for this
+// connection, log2 of the compression window}; writing one byte of bits switches them on.
+static int _uart_caps(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  if (ctxt->op == BLE_GATT_ACCESS_OP_WRITE_CHR) {
+    uint8_t caps;
+    if (OS_MBUF_PKTLEN(ctxt->om) != 1 || os_mbuf_copydata(ctxt->om, 0, 1, &caps) != 0)
+      return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+    // earlier writes are expanded with the capabilities they were sent under; the central retries when busy
+    if (_nordic_uart_rx_worker_flush() != ESP_OK)
+      return BLE_ATT_ERR_INSUFFICIENT_RES;
+    if (_nordic_uart_set_capabilities(conn_handle, caps) != ESP_OK)
+      return BLE_ATT_ERR_UNLIKELY;
+    ESP_LOGI(_TAG, "Capabilities of %d: 0x%02x", conn_handle, _nordic_uart_capabilities(conn_handle));
+    return 0;
+  }
+  const uint8_t value[3] = {_nordic_uart_supported_capabilities(), _nordic_uart_capabilities(conn_handle),
+                            CONFIG_NORDIC_UART_COMPRESSION_WINDOW_BITS};
+  return os_mbuf_append(ctxt->om, value, sizeof(value)) == 0 ? 0 : BLE_ATT_ERR_INSUFFICIENT_RES;
+}
+#endif
+
+#ifdef CONFIG_NORDIC_UART_BULK
+// Upload blocks, written without response, and download blocks notified back.
+static int _uart_bulk(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
+  return _nordic_uart_bulk_data(conn_handle, ctxt->om);
+}
+
+static int _uart_bulk_control(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt,
+                              void *arg) {
+  uint8_t msg[8];
+  const uint16_t len = OS_MBUF_PKTLEN(ctxt->om);
+  if (len > sizeof(msg) || os_mbuf_copydata(ctxt->om, 0, len, msg) != 0)
+    return BLE_ATT_ERR_INVALID_ATTR_VALUE_LEN;
+  return _nordic_uart_bulk_control(conn_handle, msg, len);
+}
+#endif
+
 // notify GATT callback is no operation.
 static int _uart_noop(uint16_t conn_handle, uint16_t attr_handle, struct ble_gatt_access_ctxt *ctxt, void *arg) {
   return 0;
@@ -79,13 +257,42 @@ static const struct ble_gatt_svc_def gat_svcs[] = {
               .flags = BLE_GATT_CHR_F_NOTIFY,
               .val_handle = &notify_char_attr_hdl,
               .access_cb = _uart_noop},
+#ifdef CONFIG_NORDIC_UART_FLOW_CONTROL
+             {.uuid = (ble_uuid_t *)&CHAR_UUID_CREDITS,
+              .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_NOTIFY,
+              .val_handle = &credits_char_attr_hdl,
+              .access_cb = _uart_credits},
+#endif
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+             {.uuid = (ble_uuid_t *)&CHAR_UUID_CAPS,
+              .flags = BLE_GATT_CHR_F_READ | BLE_GATT_CHR_F_WRITE,
+              .access_cb = _uart_caps},
+#endif
+#ifdef CONFIG_NORDIC_UART_BULK
+             {.uuid = (ble_uuid_t *)&CHAR_UUID_BULK,
+              .flags = BLE_GATT_CHR_F_WRITE_NO_RSP | BLE_GATT_CHR_F_NOTIFY,
+              .val_handle = &bulk_char_attr_hdl,
+              .access_cb = _uart_bulk},
+             {.uuid = (ble_uuid_t *)&CHAR_UUID_BULK_CONTROL,
+              .flags = BLE_GATT_CHR_F_WRITE | BLE_GATT_CHR_F_NOTIFY,
+              .val_handle = &bulk_control_char_attr_hdl,
+              .access_cb = _uart_bulk_control},
+#endif
              {0},
          }},
     {0}};
 
 static int ble_gap_event_cb(struct ble_gap_event *event, void *arg);
 
-static void ble_app_advertise(void) {
+static volatile uint16_t _adv_itvl_min_ms = CONFIG_NORDIC_UART_ADV_ITVL_MIN_MS;
+static volatile uint16_t _adv_itvl_max_ms = CONFIG_NORDIC_UART_ADV_ITVL_MAX_MS;
+static volatile uint32_t _fast_reconnect_ms = CONFIG_NORDIC_UART_FAST_RECONNECT_MS;
+static volatile bool _adv_directed = false;
+// Set by nordic_uart_suspend(): no advertising and no centrals until nordic_uart_resume().
+static volatile bool _suspended = false;
+
+// The payloads stay in the controller across advertising starts, so they are encoded once per sync.
+static void ble_app_set_adv_data(void) {
   struct ble_hs_adv_fields fields, fields_ext;
   memset(&fields, 0, sizeof(fields));
 
@@ -95,74 +302,158 @@ static void ble_app_advertise(void) {
   fields.tx_pwr_lvl_is_present = 1;
   fields.tx_pwr_lvl = BLE_HS_ADV_TX_PWR_LVL_AUTO;
 
-  char short_name[6]; // 5 plus zero byte
   const char *name = ble_svc_gap_device_name();
-  strncpy(short_name, name, sizeof(short_name));
-  short_name[sizeof(short_name) - 1] = '\0';
-  fields.name = (uint8_t *)short_name;
-  fields.name_len = strlen(short_name);
-  if (strlen(name) <= sizeof(short_name) - 1) {
-    fields.name_is_complete = 1;
-  } else {
-    fields.name_is_complete = 0;
-  }
+  const size_t name_len = strlen(name);
+  fields.name = (const uint8_t *)name;
+  fields.name_len = name_len < 5 ? name_len : 5; // short name
+  fields.name_is_complete = name_len <= 5;
 
   fields.uuids128_is_complete = 1;
   fields.uuids128 = &SERVICE_UUID;
   fields.num_uuids128 = 1;
 
-  int err = ble_gap_adv_set_fields(&fields);
+  uint8_t data[BLE_HS_ADV_MAX_SZ];
+  uint8_t data_len;
+  int err = ble_hs_adv_set_fields(&fields, data, &data_len, sizeof(data));
+  if (err == 0)
+    err = ble_gap_adv_set_data(data, data_len);
   if (err) {
-    ESP_LOGE(_TAG, "ble_gap_adv_set_fields, err %d", err);
+    ESP_LOGE(_TAG, "ble_gap_adv_set_data, err %d", err);
   }
 
   memset(&fields_ext, 0, sizeof(fields_ext));
   fields_ext.flags = fields.flags;
-  fields_ext.name = (uint8_t *)name;
-  fields_ext.name_len = strlen(name);
+  fields_ext.name = (const uint8_t *)name;
+  fields_ext.name_len = name_len;
   fields_ext.name_is_complete = 1;
-  err = ble_gap_adv_rsp_set_fields(&fields_ext);
+  err = ble_hs_adv_set_fields(&fields_ext, data, &data_len, sizeof(data));
+  if (err == 0)
+    err = ble_gap_adv_rsp_set_data(data, data_len);
   if (err) {
-    ESP_LOGE(_TAG, "ble_gap_adv_rsp_set_fields fields_ext, name might be too long, err %d", err);
+    ESP_LOGE(_TAG, "ble_gap_adv_rsp_set_data fields_ext, name might be too long, err %d", err);
   }
+}
 
+static void ble_app_advertise(void) {
   struct ble_gap_adv_params adv_params;
   memset(&adv_params, 0, sizeof(adv_params));
   adv_params.conn_mode = BLE_GAP_CONN_MODE_UND;
   adv_params.disc_mode = BLE_GAP_DISC_MODE_GEN;
+  // 0 leaves the NimBLE default
+  adv_params.itvl_min = BLE_GAP_ADV_ITVL_MS(_adv_itvl_min_ms);
+  adv_params.itvl_max = BLE_GAP_ADV_ITVL_MS(_adv_itvl_max_ms);
 
-  err = ble_gap_adv_start(ble_addr_type, NULL, BLE_HS_FOREVER, &adv_params, ble_gap_event_cb, NULL);
+  _adv_directed = false;
+  int err = ble_gap_adv_start(ble_addr_type, NULL, BLE_HS_FOREVER, &adv_params, ble_gap_event_cb, NULL);
   if (err) {
     ESP_LOGE(_TAG, "Advertising start failed: err %d", err);
   }
 }
 
+// Keep accepting centrals while there is a free slot in the connection table.
+static void ble_app_advertise_if_free(void) {
+  uint16_t handles[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  if (!_suspended &&
+      _nordic_uart_conn_handles(handles, CONFIG_NORDIC_UART_MAX_CONNECTIONS) < CONFIG_NORDIC_UART_MAX_CONNECTIONS &&
+      !ble_gap_adv_active()) {
+    ble_app_advertise();
+  }
+}
+
+// After a disconnect, advertise to the central that left for the fast reconnect window; general
+// advertising resumes on BLE_GAP_EVENT_ADV_COMPLETE.
+static void ble_app_advertise_reconnect(const ble_addr_t *peer) {
+  const uint32_t window_ms = _fast_reconnect_ms;
+  if (window_ms == 0 || _suspended) {
+    ble_app_advertise_if_free();
+    return;
+  }
+
+  struct ble_gap_adv_params adv_params;
+  memset(&adv_params, 0, sizeof(adv_params));
+  adv_params.conn_mode = BLE_GAP_CONN_MODE_DIR;
+  adv_params.disc_mode = BLE_GAP_DISC_MODE_NON;
+  if (window_ms <= 1280) {
+    adv_params.high_duty_cycle = 1; // every 3.75 ms, which the controller keeps up for 1.28 s at most
+  } else {
+    adv_params.itvl_min = BLE_GAP_ADV_ITVL_MS(20);
+    adv_params.itvl_max = BLE_GAP_ADV_ITVL_MS(30);
+  }
+
+  ble_gap_adv_stop(); // general advertising for the other slots waits for the window
+  _adv_directed = true;
+  int err = ble_gap_adv_start(ble_addr_type, peer, (int32_t)window_ms, &adv_params, ble_gap_event_cb, NULL);
+  if (err) {
+    ESP_LOGE(_TAG, "Directed advertising start failed: err %d", err);
+    ble_app_advertise_if_free();
+  }
+}
+
 static int ble_gap_event_cb(struct ble_gap_event *event, void *arg) {
   switch (event->type) {
   case BLE_GAP_EVENT_CONNECT:
     ESP_LOGI(_TAG, "BLE_GAP_EVENT_CONNECT %s", event->connect.status == 0 ? "OK" : "Failed");
     if (event->connect.status == 0) {
-      ble_conn_hdl = event->connect.conn_handle;
-      if (_nordic_uart_callback)
-        _nordic_uart_callback(NORDIC_UART_CONNECTED);
-    } else {
-      ble_app_advertise();
+      const uint16_t conn_handle = event->connect.conn_handle;
+      if (_suspended) {
+        // connected while nordic_uart_suspend() stopped advertising
+        ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        break;
+      }
+      if (_conn_add(conn_handle) != ESP_OK) {
+        ESP_LOGW(_TAG, "No free connection slot, dropping %d", conn_handle);
+        ble_gap_terminate(conn_handle, BLE_ERR_REM_USER_CONN_TERM);
+        break;
+      }
+      _conn_set_mtu(conn_handle, ble_att_mtu(conn_handle));
+      // ask for CONFIG_NORDIC_UART_PREFERRED_MTU; EALREADY when the central started the exchange
+      int rc = ble_gattc_exchange_mtu(conn_handle, NULL, NULL);
+      if (rc && rc != BLE_HS_EALREADY) {
+        ESP_LOGD(_TAG, "ble_gattc_exchange_mtu, err %d", rc);
+      }
+      _nordic_uart_link_connected(conn_handle);
+      _nordic_uart_flow_connected(conn_handle);
+      _nordic_uart_compress_connected(conn_handle);
+      _report(NORDIC_UART_CONNECTED, NORDIC_UART_EVENT_CONNECTED);
     }
+    ble_app_advertise_if_free();
     break;
-  case BLE_GAP_EVENT_DISCONNECT:
-    _nordic_uart_linebuf_append('\003'); // send Ctrl-C
+  case BLE_GAP_EVENT_DISCONNECT: {
+    const uint16_t conn_handle = event->disconnect.conn.conn_handle;
     ESP_LOGI(_TAG, "BLE_GAP_EVENT_DISCONNECT");
-    if (_nordic_uart_callback)
-      _nordic_uart_callback(NORDIC_UART_DISCONNECTED);
-    ble_app_advertise();
+    // the Ctrl-C goes after the lines of writes the RX worker still has
+    if (_nordic_uart_rx_worker_flush() == ESP_OK)
+      _nordic_uart_rx_hangup(conn_handle);
+    else
+      _nordic_uart_rx_worker_hangup(conn_handle);
+    _conn_remove(conn_handle);
+    _nordic_uart_link_disconnected(conn_handle);
+    _nordic_uart_flow_disconnected(conn_handle);
+    _nordic_uart_bulk_disconnected(conn_handle);
+    // the Ctrl-C of the hangup is waiting too
+    _report(NORDIC_UART_DISCONNECTED, NORDIC_UART_EVENT_DISCONNECTED);
+    ble_app_advertise_reconnect(&event->disconnect.conn.peer_id_addr);
     break;
+  }
   case BLE_GAP_EVENT_ADV_COMPLETE:
     ESP_LOGI(_TAG, "BLE_GAP_EVENT_ADV_COMPLETE");
-    ble_app_advertise();
+    ble_app_advertise_if_free();
     break;
   case BLE_GAP_EVENT_SUBSCRIBE:
     ESP_LOGI(_TAG, "BLE_GAP_EVENT_SUBSCRIBE");
     break;
+  case BLE_GAP_EVENT_MTU:
+    ESP_LOGI(_TAG, "BLE_GAP_EVENT_MTU %d", event->mtu.value);
+    _conn_set_mtu(event->mtu.conn_handle, event->mtu.value);
+    break;
+  case BLE_GAP_EVENT_CONN_UPDATE:
+  case BLE_GAP_EVENT_PHY_UPDATE_COMPLETE:
+#ifdef BLE_GAP_EVENT_DATA_LEN_CHG
+  case BLE_GAP_EVENT_DATA_LEN_CHG:
+#endif
+    if (_nordic_uart_link_event(event))
+      _report(NORDIC_UART_LINK_UPDATED, NORDIC_UART_EVENT_LINK_UPDATED);
+    break;
   default:
     break;
   }
@@ -174,39 +465,319 @@ static void ble_app_on_sync_cb(void) {
   if (ret != 0) {
     ESP_LOGE(_TAG, "Error ble_hs_id_infer_auto: %d", ret);
   }
-  ble_app_advertise();
+  ble_app_set_adv_data();
+  if (!_suspended)
+    ble_app_advertise();
 }
 
+// Delete a task that has signalled its exit and suspended itself. A task still running on the other core, or
+// deleting itself, would be cleaned up later by the idle task, and a static TCB and stack must not be reused
+// for the next start before that; a suspended one is removed at once.
+void _nordic_uart_task_reap(TaskHandle_t task) {
+  while (eTaskGetState(task) != eSuspended)
+    vTaskDelay(1);
+  vTaskDelete(task);
+}
+
+#ifdef CONFIG_NORDIC_UART_HOST_TASK_CUSTOM
+static TaskHandle_t _host_task_handle = NULL;
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+static StackType_t _host_task_stack[CONFIG_NORDIC_UART_HOST_TASK_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t _host_task_tcb;
+#endif
+#endif
+
 // https://docs.espressif.com/projects/esp-idf/en/latest/esp32/api-reference/bluetooth/nimble/index.html#_CPPv434esp_nimble_hci_and_controller_initv
 static void ble_host_task(void *param) {
   nimble_port_run(); // This function will return only when nimble_port_stop() is executed.
+#ifdef CONFIG_NORDIC_UART_HOST_TASK_CUSTOM
+  vTaskSuspend(NULL); // deleted by ble_host_task_stop()
+#else
   nimble_port_freertos_deinit();
-  _nordic_uart_buf_deinit();
+#endif
 }
 
-// Split the message in BLE_SEND_MTU and send it.
-esp_err_t _nordic_uart_send(const char *message) {
-  const int len = strlen(message);
-  if (len == 0)
-    return ESP_OK;
-  // Split the message in BLE_SEND_MTU and send it.
-  for (int i = 0; i < len; i += BLE_SEND_MTU) {
+// Create the NimBLE host task, on the core and with the priority and stack of CONFIG_NORDIC_UART_HOST_TASK_*
+// or with NimBLE's own settings.
+static esp_err_t ble_host_task_start(void) {
+#ifdef CONFIG_NORDIC_UART_HOST_TASK_CUSTOM
+  const BaseType_t core = _NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_HOST_TASK_CORE);
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  _host_task_handle =
+      xTaskCreateStaticPinnedToCore(ble_host_task, "nimble_host", CONFIG_NORDIC_UART_HOST_TASK_STACK_SIZE, NULL,
+                                    CONFIG_NORDIC_UART_HOST_TASK_PRIORITY, _host_task_stack, &_host_task_tcb, core);
+  if (_host_task_handle == NULL) {
+#else
+  if (xTaskCreatePinnedToCore(ble_host_task, "nimble_host", CONFIG_NORDIC_UART_HOST_TASK_STACK_SIZE, NULL,
+                              CONFIG_NORDIC_UART_HOST_TASK_PRIORITY, &_host_task_handle, core) != pdPASS) {
+#endif
+    ESP_LOGE(_TAG, "Failed to create NimBLE host task");
+    _host_task_handle = NULL;
+    return ESP_FAIL;
+  }
+#else
+  nimble_port_freertos_init(ble_host_task);
+#endif
+  return ESP_OK;
+}
+
+// Wait for the custom host task to be gone once nimble_port_run() has returned, so a restart can reuse it.
+static void ble_host_task_stop(void) {
+#ifdef CONFIG_NORDIC_UART_HOST_TASK_CUSTOM
+  if (_host_task_handle)
+    _nordic_uart_task_reap(_host_task_handle);
+  _host_task_handle = NULL;
+#endif
+}
+
+// A notification carries at most ATT_MTU - 3 bytes, and never more than an attribute value.
+uint16_t _nordic_uart_notify_payload_size(uint16_t mtu) {
+  if (mtu < BLE_ATT_MTU_DFLT)
+    mtu = BLE_ATT_MTU_DFLT;
+  return MIN(mtu - 3, BLE_ATT_ATTR_MAX_LEN);
+}
+
+// The async sender shares each chunk between all connections, so it uses the smallest MTU.
+uint16_t _nordic_uart_tx_chunk_size(void) {
+  uint16_t chunk = 0;
+  portENTER_CRITICAL(&_conns_mux);
+  for (int i = 0; i < CONFIG_NORDIC_UART_MAX_CONNECTIONS; ++i) {
+    if (_conns[i].handle == BLE_HS_CONN_HANDLE_NONE)
+      continue;
+    const uint16_t size = _nordic_uart_notify_payload_size(_conns[i].mtu);
+    if (chunk == 0 || size < chunk)
+      chunk = size;
+  }
+  portEXIT_CRITICAL(&_conns_mux);
+  return chunk ? chunk : _nordic_uart_notify_payload_size(BLE_ATT_MTU_DFLT);
+}
+
+// Send one notification, consuming `om` on every path, and count it once the host took it.
+static int _conn_notify(uint16_t conn_handle, uint16_t attr_handle, struct os_mbuf *om) {
+  const uint16_t len = OS_MBUF_PKTLEN(om);
+  const int rc = ble_gattc_notify_custom(conn_handle, attr_handle, om);
+  if (rc)
+    return rc;
+  _NORDIC_UART_STAT_ADD(tx_notifications, 1);
+  _NORDIC_UART_STAT_ADD(tx_bytes, len);
+  return 0;
+}
+
+// Send one notification. Returns the NimBLE error, BLE_HS_ENOMEM when out of mbufs.
+int _nordic_uart_notify(uint16_t conn_handle, const void *data, uint16_t len) {
+  struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+  if (om == NULL)
+    return BLE_HS_ENOMEM;
+  return _conn_notify(conn_handle, notify_char_attr_hdl, om);
+}
+
+// Tell a central its new RX grant.
+int _nordic_uart_notify_credits(uint16_t conn_handle, uint32_t granted) {
+  const uint8_t value[4] = {B0(granted), B1(granted), B2(granted), B3(granted)};
+  struct os_mbuf *om = ble_hs_mbuf_from_flat(value, sizeof(value));
+  if (om == NULL)
+    return BLE_HS_ENOMEM;
+  return ble_gattc_notify_custom(conn_handle, credits_char_attr_hdl, om);
+}
+
+// Send one bulk block, counted like the data it shares the link with.
+int _nordic_uart_notify_bulk(uint16_t conn_handle, const struct iovec *iov, int iovcnt) {
+  struct os_mbuf *om = ble_hs_mbuf_att_pkt();
+  if (om == NULL)
+    return BLE_HS_ENOMEM;
+  for (int i = 0; i < iovcnt; ++i) {
+    if (os_mbuf_append(om, iov[i].iov_base, iov[i].iov_len) != 0) {
+      os_mbuf_free_chain(om);
+      return BLE_HS_ENOMEM;
+    }
+  }
+  return _conn_notify(conn_handle, bulk_char_attr_hdl, om);
+}
+
+// Send a bulk control message.
+int _nordic_uart_notify_bulk_control(uint16_t conn_handle, const void *data, uint16_t len) {
+  struct os_mbuf *om = ble_hs_mbuf_from_flat(data, len);
+  if (om == NULL)
+    return BLE_HS_ENOMEM;
+  return ble_gattc_notify_custom(conn_handle, bulk_control_char_attr_hdl, om);
+}
+
+// Pack up to `chunk` bytes from the fragments at cursor (*idx, *off) into one mbuf chain.
+static struct os_mbuf *_iov_to_mbuf(const struct iovec *iov, int iovcnt, int *idx, size_t *off, size_t chunk) {
+  struct os_mbuf *om = ble_hs_mbuf_att_pkt();
+  if (om == NULL)
+    return NULL;
+  while (*idx < iovcnt && OS_MBUF_PKTLEN(om) < chunk) {
+    const size_t len = MIN(iov[*idx].iov_len - *off, chunk - OS_MBUF_PKTLEN(om));
+    if (os_mbuf_append(om, (const uint8_t *)iov[*idx].iov_base + *off, len) != 0) {
+      os_mbuf_free_chain(om);
+      return NULL;
+    }
+    *off += len;
+    if (*off == iov[*idx].iov_len) {
+      (*idx)++;
+      *off = 0;
+    }
+  }
+  return om;
+}
+
+// Split the fragments in (negotiated MTU - 3) byte notifications and send them.
+// Fragments are appended straight into each notification's mbuf chain. With yield, queued high priority
+// data goes out between two notifications; callers holding a lock the sender task needs pass false.
+esp_err_t _nordic_uart_writev_conn(uint16_t conn_handle, const struct iovec *iov, int iovcnt, bool yield) {
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    len += iov[i].iov_len;
+
+  const size_t chunk = _conn_chunk_size(conn_handle);
+  if (chunk == 0)
+    return ESP_FAIL;
+  int idx = 0;
+  size_t off = 0;
+  for (size_t sent = 0; sent < len;) {
+    if (yield)
+      _nordic_uart_tx_yield(); // queued high priority data takes the next slot
+    const int start_idx = idx;
+    const size_t start_off = off;
     int err;
-    struct os_mbuf *om;
     int err_count = 0;
   do_notify:
-    om = ble_hs_mbuf_from_flat(&message[i], MIN(BLE_SEND_MTU, len - i));
-    err = ble_gattc_notify_custom(ble_conn_hdl, notify_char_attr_hdl, om);
+    idx = start_idx;
+    off = start_off;
+    struct os_mbuf *om = _iov_to_mbuf(iov, iovcnt, &idx, &off, chunk);
+    const uint16_t om_len = om ? OS_MBUF_PKTLEN(om) : 0;
+    err = om ? _conn_notify(conn_handle, notify_char_attr_hdl, om) : BLE_HS_ENOMEM;
     if (err == BLE_HS_ENOMEM && err_count++ < 10) {
-      vTaskDelay(100 / portTICK_PERIOD_MS);
+      // retry once the host frees an mbuf instead of sleeping blindly
+      _NORDIC_UART_STAT_ADD(tx_enomem_retries, 1);
+      _nordic_uart_tx_wait_mbufs(pdMS_TO_TICKS(100));
       goto do_notify;
     }
-    if (err)
+    if (err) {
+      _NORDIC_UART_STAT_ADD(tx_failed, 1);
       return ESP_FAIL;
+    }
+    sent += om_len;
+  }
+  return ESP_OK;
+}
+
+static esp_err_t _writev_to(uint16_t conn_handle, const struct iovec *iov, int iovcnt) {
+  // while coalescing, sends to everyone share the sender task's queue; a send to one central
+  // waits for that queue first so it cannot overtake what was sent before
+  const bool coalescing = _nordic_uart_tx_coalescing();
+  if (coalescing && conn_handle != NORDIC_UART_BROADCAST)
+    _nordic_uart_tx_flush(portMAX_DELAY);
+  if (conn_handle != NORDIC_UART_BROADCAST)
+    return _nordic_uart_compress_writev(conn_handle, iov, iovcnt);
+
+  uint16_t handles[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  const size_t count = _nordic_uart_conn_handles(handles, CONFIG_NORDIC_UART_MAX_CONNECTIONS);
+  if (count == 0)
+    return ESP_FAIL;
+  if (coalescing)
+    return _nordic_uart_tx_enqueue_iov(iov, iovcnt);
+  esp_err_t ret = ESP_OK;
+  for (size_t i = 0; i < count; ++i) {
+    if (_nordic_uart_compress_writev(handles[i], iov, iovcnt) != ESP_OK)
+      ret = ESP_FAIL;
+  }
+  return ret;
+}
+
+// Every blocking send goes through here: trace it and record how long it took.
+esp_err_t _nordic_uart_writev_to(uint16_t conn_handle, const struct iovec *iov, int iovcnt) {
+#if defined(CONFIG_NORDIC_UART_STATS) || defined(CONFIG_NORDIC_UART_TRACE)
+  size_t len = 0;
+  for (int i = 0; i < iovcnt; ++i)
+    len += iov[i].iov_len;
+  _NORDIC_UART_TRACE(NORDIC_UART_TRACE_SEND_START, conn_handle, len);
+  const int64_t start = esp_timer_get_time();
+  const esp_err_t ret = _writev_to(conn_handle, iov, iovcnt);
+  _nordic_uart_stats_send_latency(esp_timer_get_time() - start);
+  _NORDIC_UART_TRACE(NORDIC_UART_TRACE_SEND_END, conn_handle, len);
+  return ret;
+#else
+  return _writev_to(conn_handle, iov, iovcnt);
+#endif
+}
+
+esp_err_t _nordic_uart_writev(const struct iovec *iov, int iovcnt) { //
+  return _nordic_uart_writev_to(NORDIC_UART_BROADCAST, iov, iovcnt);
+}
+
+esp_err_t _nordic_uart_write(const void *data, size_t len) {
+  const struct iovec iov = {.iov_base = (void *)data, .iov_len = len};
+  return _nordic_uart_writev(&iov, 1);
+}
+
+esp_err_t _nordic_uart_send(const char *message) { //
+  return _nordic_uart_write(message, strlen(message));
+}
+
+esp_err_t _nordic_uart_set_adv_interval(uint16_t min_ms, uint16_t max_ms) {
+  if ((min_ms || max_ms) && (min_ms < 20 || min_ms > max_ms || max_ms > 10240))
+    return ESP_ERR_INVALID_ARG;
+  _adv_itvl_min_ms = min_ms;
+  _adv_itvl_max_ms = max_ms;
+  // general advertising picks the new interval up at once, a fast reconnect window when it ends
+  if (_nordic_uart_linebuf_initialized() && !_adv_directed && ble_gap_adv_stop() == 0)
+    ble_app_advertise_if_free();
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_set_fast_reconnect(uint32_t window_ms) {
+  if (window_ms > 60000)
+    return ESP_ERR_INVALID_ARG;
+  _fast_reconnect_ms = window_ms;
+  return ESP_OK;
+}
+
+// Take the service off the air but keep the host, the GATT table, the buffers and the tasks: advertising stops
+// and every central is disconnected, with the usual Ctrl-C and callbacks. Not from the host task, which
+// delivers the disconnects waited for here.
+esp_err_t _nordic_uart_suspend(TickType_t ticks_to_wait) {
+  if (!_nordic_uart_linebuf_initialized() || _suspended)
+    return ESP_ERR_INVALID_STATE;
+  _suspended = true;
+  ble_gap_adv_stop();
+
+  uint16_t handles[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  size_t count = _nordic_uart_conn_handles(handles, CONFIG_NORDIC_UART_MAX_CONNECTIONS);
+  for (size_t i = 0; i < count; ++i)
+    ble_gap_terminate(handles[i], BLE_ERR_REM_USER_CONN_TERM);
+
+  const TickType_t start = xTaskGetTickCount();
+  while (_nordic_uart_conn_handles(handles, CONFIG_NORDIC_UART_MAX_CONNECTIONS) != 0) {
+    const TickType_t elapsed = xTaskGetTickCount() - start;
+    if (ticks_to_wait != portMAX_DELAY && elapsed >= ticks_to_wait)
+      return ESP_ERR_TIMEOUT;
+    vTaskDelay(1);
   }
   return ESP_OK;
 }
 
+// Advertise again with the payloads the controller still holds from the last sync.
+esp_err_t _nordic_uart_resume(void) {
+  if (!_nordic_uart_linebuf_initialized() || !_suspended)
+    return ESP_ERR_INVALID_STATE;
+  _suspended = false;
+  if (ble_hs_synced())
+    ble_app_advertise_if_free();
+  return ESP_OK;
+}
+
+// Undo the part of _nordic_uart_start() that got done.
+static void _start_failed(void) {
+  _nordic_uart_latency_stop();
+  _nordic_uart_rx_worker_stop();
+  _nordic_uart_buf_deinit();
+  _nordic_uart_tx_deinit();
+  _nordic_uart_events_stop();
+  _nordic_uart_callback = NULL;
+}
+
 /***
  *
  * Note:
@@ -225,7 +796,24 @@ esp_err_t _nordic_uart_start(const char *device_name, void (*callback)(enum nord
   }
 
   _nordic_uart_callback = callback;
-  _nordic_uart_buf_init();
+  _nordic_uart_reset_stats();
+  _conns_reset();
+  _nordic_uart_link_reset();
+  _nordic_uart_flow_reset();
+  _nordic_uart_compress_reset();
+  _nordic_uart_bulk_reset();
+  if (_nordic_uart_buf_init() != ESP_OK || _nordic_uart_tx_init() != ESP_OK || _nordic_uart_events_start() != ESP_OK ||
+      _nordic_uart_rx_worker_start() != ESP_OK || _nordic_uart_latency_start() != ESP_OK) {
+    _start_failed();
+    return ESP_FAIL;
+  }
+  ESP_LOGI(_TAG, "Buffers %s: %u bytes RX, %u bytes TX",
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+           "static",
+#else
+           "on heap",
+#endif
+           (unsigned)_nordic_uart_buf_footprint(), (unsigned)_nordic_uart_tx_footprint());
 
   // Initialize NimBLE
   esp_err_t ret = nimble_port_init();
@@ -233,6 +821,11 @@ esp_err_t _nordic_uart_start(const char *device_name, void (*callback)(enum nord
     ESP_LOGE(_TAG, "nimble_port_init() failed with error: %d", ret);
   }
   
+  ret = ble_att_set_preferred_mtu(CONFIG_NORDIC_UART_PREFERRED_MTU);
+  if (ret != 0) {
+    ESP_LOGE(_TAG, "ble_att_set_preferred_mtu(%d) failed with error: %d", CONFIG_NORDIC_UART_PREFERRED_MTU, ret);
+  }
+
   // Initialize the NimBLE Host configuration
   // Bluetooth device name for advertisement
   ble_svc_gap_device_name_set(device_name);
@@ -245,21 +838,34 @@ esp_err_t _nordic_uart_start(const char *device_name, void (*callback)(enum nord
   ble_hs_cfg.sync_cb = ble_app_on_sync_cb;
 
   // Create NimBLE thread
-  nimble_port_freertos_init(ble_host_task);
+  if (ble_host_task_start() != ESP_OK) {
+    nimble_port_deinit();
+    _start_failed();
+    return ESP_FAIL;
+  }
 
   return ESP_OK;
 }
 
 esp_err_t _nordic_uart_stop(void) {
+  if (!_nordic_uart_linebuf_initialized())
+    return ESP_FAIL;
+  // the echo task reads the RX ring and writes to the link, stop it while both are still there
+  _nordic_uart_latency_stop();
+
   esp_err_t rc = ble_gap_adv_stop();
   if (rc) {
-    // if already stoped BLE, some error is raised. but no problem.
+    // not advertising while every connection slot is taken; no problem.
     ESP_LOGD(_TAG, "Error in stopping advertisement with err code = %d", rc);
-    return ESP_FAIL;
-
   }
 
   int ret = nimble_port_stop();
+  if (ret == ESP_OK)
+    ble_host_task_stop();
+  // stream blocks and deferred writes belong to the host's mbuf pool, give them back before it goes away
+  _nordic_uart_rx_block_drain();
+  _nordic_uart_rx_worker_stop();
+  _nordic_uart_events_stop();
   if (ret == ESP_OK) {
     ret = nimble_port_deinit();
     if (ret != ESP_OK) {
@@ -267,9 +873,17 @@ esp_err_t _nordic_uart_stop(void) {
       return ESP_FAIL;
     }
   }
+  _nordic_uart_vfs_reset();
   _nordic_uart_buf_deinit();
+  _nordic_uart_tx_deinit();
+  _conns_reset();
+  _nordic_uart_link_reset();
+  _nordic_uart_flow_reset();
+  _nordic_uart_compress_reset();
+  _nordic_uart_bulk_reset();
 
   _nordic_uart_callback = NULL;
-  
+  _suspended = false;
+
   return ESP_OK;
 }
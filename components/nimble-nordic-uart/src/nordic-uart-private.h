@@ -0,0 +1,250 @@
+#pragma once
+
+#include "nimble-nordic-uart.h"
+
+// Internals shared by the sources in src/ and the tests; not part of the public API, see nimble-nordic-uart.h.
+
+esp_err_t _nordic_uart_linebuf_append_block(const uint8_t *data, size_t len);
+esp_err_t _nordic_uart_linebuf_hangup(void);
+esp_err_t _nordic_uart_set_framing(enum nordic_uart_framing framing);
+enum nordic_uart_framing _nordic_uart_get_framing(void);
+esp_err_t _nordic_uart_set_long_lines(bool enable);
+void _nordic_uart_line_assembler_init(struct nordic_uart_line_assembler *assembler, size_t max_len);
+void _nordic_uart_line_assembler_deinit(struct nordic_uart_line_assembler *assembler);
+bool _nordic_uart_line_assembler_feed(struct nordic_uart_line_assembler *assembler,
+                                      const struct nordic_uart_rx_line *item, struct nordic_uart_rx_line *line);
+esp_err_t _nordic_uart_frame_append_block(const uint8_t *data, size_t len);
+size_t _nordic_uart_frame_encode(enum nordic_uart_framing framing, const void *data, size_t len, uint8_t *out,
+                                 size_t out_size);
+esp_err_t _nordic_uart_write_frame_to(uint16_t conn_handle, const void *data, size_t len);
+esp_err_t _nordic_uart_linebuf_select(uint16_t conn_handle);
+void _nordic_uart_linebuf_release(uint16_t conn_handle);
+uint16_t _nordic_uart_rx_item_conn_handle(const void *item, size_t item_size);
+size_t _nordic_uart_rx_item_len(size_t item_size);
+bool _nordic_uart_rx_item_continued(const void *item, size_t item_size);
+size_t _nordic_uart_rx_receive_batch(struct nordic_uart_rx_line *lines, size_t max_lines, size_t max_bytes,
+                                     TickType_t ticks_to_wait);
+void _nordic_uart_rx_release_batch(struct nordic_uart_rx_line *lines, size_t count);
+esp_err_t _nordic_uart_rx_block_push(uint16_t conn_handle, struct os_mbuf *om);
+struct os_mbuf *_nordic_uart_rx_block_receive(TickType_t ticks_to_wait, uint16_t *conn_handle);
+void _nordic_uart_rx_block_drain();
+esp_err_t _nordic_uart_set_rx_mode(enum nordic_uart_rx_mode mode);
+void _nordic_uart_rx_return_item(void *item);
+size_t _nordic_uart_rx_free_size(void);
+bool _nordic_uart_rx_pending(void);
+
+// Lock-free ring of records from one producer task to one consumer task, see spsc.c. The producer's
+// and the consumer's indices sit in cache lines of their own, so neither side writes a line the other polls.
+#define _NORDIC_UART_CACHE_LINE 64
+struct nordic_uart_spsc {
+  uint32_t head __attribute__((aligned(_NORDIC_UART_CACHE_LINE))); // producer: offset of the next record
+  uint32_t consumer_waiting;                                         // consumer sleeps on data_sem
+  uint32_t tail __attribute__((aligned(_NORDIC_UART_CACHE_LINE))); // consumer: records before it are released
+  uint32_t read;                                                     // consumer: next record to hand out
+  uint32_t producer_waiting;                                         // producer sleeps on space_sem
+  uint8_t *buf __attribute__((aligned(_NORDIC_UART_CACHE_LINE)));
+  uint32_t size;
+  SemaphoreHandle_t data_sem;
+  SemaphoreHandle_t space_sem;
+  StaticSemaphore_t sem_storage[2];
+};
+esp_err_t _nordic_uart_spsc_init(struct nordic_uart_spsc *ring, uint8_t *storage, size_t size);
+void _nordic_uart_spsc_deinit(struct nordic_uart_spsc *ring);
+esp_err_t _nordic_uart_spsc_push(struct nordic_uart_spsc *ring, const void *data, size_t len, uint16_t tag,
+                                 TickType_t ticks_to_wait);
+char *_nordic_uart_spsc_receive(struct nordic_uart_spsc *ring, size_t *len, uint16_t *tag, TickType_t ticks_to_wait);
+void _nordic_uart_spsc_release(struct nordic_uart_spsc *ring, const void *data);
+size_t _nordic_uart_spsc_free_size(struct nordic_uart_spsc *ring);
+bool _nordic_uart_spsc_pending(struct nordic_uart_spsc *ring);
+
+esp_err_t _nordic_uart_suspend(TickType_t ticks_to_wait);
+esp_err_t _nordic_uart_resume(void);
+esp_err_t _nordic_uart_write(const void *data, size_t len);
+esp_err_t _nordic_uart_writev(const struct iovec *iov, int iovcnt);
+esp_err_t _nordic_uart_writev_to(uint16_t conn_handle, const struct iovec *iov, int iovcnt);
+size_t _nordic_uart_conn_handles(uint16_t *handles, size_t max_count);
+uint16_t _nordic_uart_notify_payload_size(uint16_t mtu);
+uint16_t _nordic_uart_tx_chunk_size(void);
+int _nordic_uart_notify(uint16_t conn_handle, const void *data, uint16_t len);
+esp_err_t _nordic_uart_writev_conn(uint16_t conn_handle, const struct iovec *iov, int iovcnt, bool yield);
+uint16_t _nordic_uart_conn_chunk_size(uint16_t conn_handle);
+
+void _nordic_uart_link_reset(void);
+void _nordic_uart_link_connected(uint16_t conn_handle);
+void _nordic_uart_link_disconnected(uint16_t conn_handle);
+bool _nordic_uart_link_event(const struct ble_gap_event *event);
+esp_err_t _nordic_uart_set_link_profile(enum nordic_uart_link_profile profile);
+esp_err_t _nordic_uart_get_link_info(uint16_t conn_handle, struct nordic_uart_link_info *info);
+esp_err_t _nordic_uart_set_adv_interval(uint16_t min_ms, uint16_t max_ms);
+esp_err_t _nordic_uart_set_fast_reconnect(uint32_t window_ms);
+
+esp_err_t _nordic_uart_get_stats(struct nordic_uart_stats *stats);
+void _nordic_uart_reset_stats(void);
+esp_err_t _nordic_uart_set_trace_hook(nordic_uart_trace_hook_t hook);
+esp_err_t _nordic_uart_set_latency_mode(bool enable);
+esp_err_t _nordic_uart_get_latency(enum nordic_uart_latency_stage stage, struct nordic_uart_latency_stats *stats);
+void _nordic_uart_reset_latency(void);
+size_t _nordic_uart_format_latency(char *out, size_t size);
+esp_err_t _nordic_uart_latency_start(void);
+void _nordic_uart_latency_stop(void);
+esp_err_t _nordic_uart_rx_frame_write(uint16_t conn_handle, const struct os_mbuf *om, int64_t arrival_us);
+void _nordic_uart_rx_hangup(uint16_t conn_handle);
+bool _nordic_uart_rx_worker_active(void);
+bool _nordic_uart_rx_worker_draining(void);
+esp_err_t _nordic_uart_rx_worker_post(uint16_t conn_handle, struct os_mbuf *om, int64_t arrival_us);
+esp_err_t _nordic_uart_rx_worker_flush(void);
+esp_err_t _nordic_uart_rx_worker_hangup(uint16_t conn_handle);
+esp_err_t _nordic_uart_rx_worker_start(void);
+void _nordic_uart_rx_worker_stop(void);
+esp_err_t _nordic_uart_set_rx_worker(bool enable);
+
+// Task core options are -1 for no affinity, see CONFIG_NORDIC_UART_*_CORE
+#define _NORDIC_UART_TASK_CORE(core) ((core) < 0 ? tskNO_AFFINITY : (core))
+void _nordic_uart_task_reap(TaskHandle_t task);
+
+// Counters compile to nothing unless CONFIG_NORDIC_UART_STATS is set, the hook unless CONFIG_NORDIC_UART_TRACE is.
+#ifdef CONFIG_NORDIC_UART_STATS
+extern struct nordic_uart_stats _nordic_uart_stats;
+extern portMUX_TYPE _nordic_uart_stats_mux;
+void _nordic_uart_stats_rx_buf_used(void);
+void _nordic_uart_stats_send_latency(int64_t us);
+#define _NORDIC_UART_STAT_ADD(field, n)                                                                                \
+  do {                                                                                                                 \
+    portENTER_CRITICAL(&_nordic_uart_stats_mux);                                                                       \
+    _nordic_uart_stats.field += (n);                                                                                   \
+    portEXIT_CRITICAL(&_nordic_uart_stats_mux);                                                                        \
+  } while (0)
+#else
+#define _NORDIC_UART_STAT_ADD(field, n) ((void)(n))
+#define _nordic_uart_stats_rx_buf_used() ((void)0)
+#define _nordic_uart_stats_send_latency(us) ((void)0)
+#endif
+
+#ifdef CONFIG_NORDIC_UART_TRACE
+extern volatile nordic_uart_trace_hook_t _nordic_uart_trace_hook;
+#define _NORDIC_UART_TRACE(event, conn_handle, len)                                                                    \
+  do {                                                                                                                 \
+    const nordic_uart_trace_hook_t _hook = _nordic_uart_trace_hook;                                                    \
+    if (_hook)                                                                                                         \
+      _hook((event), (conn_handle), (len));                                                                            \
+  } while (0)
+#else
+#define _NORDIC_UART_TRACE(event, conn_handle, len) ((void)0)
+#endif
+
+// Latency mode timestamps, compiled out unless CONFIG_NORDIC_UART_LATENCY is set; call on the task framing lines.
+#ifdef CONFIG_NORDIC_UART_LATENCY
+void _nordic_uart_latency_arrival(int64_t us);
+void _nordic_uart_latency_enqueue(void);
+void _nordic_uart_latency_dropped(void);
+void _nordic_uart_latency_rx_ready(void);
+#else
+#define _nordic_uart_latency_arrival(us) ((void)0)
+#define _nordic_uart_latency_enqueue() ((void)0)
+#define _nordic_uart_latency_dropped() ((void)0)
+#define _nordic_uart_latency_rx_ready() ((void)0)
+#endif
+
+// Buffer placement, see CONFIG_NORDIC_UART_BUFFER_ALLOC and CONFIG_NORDIC_UART_BUFFER_MEMORY
+#if defined(CONFIG_NORDIC_UART_BUFFER_MEMORY_SPIRAM)
+#define _NORDIC_UART_BUF_CAPS (MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+#define _NORDIC_UART_BUF_ATTR EXT_RAM_BSS_ATTR
+#elif defined(CONFIG_NORDIC_UART_BUFFER_MEMORY_INTERNAL)
+#define _NORDIC_UART_BUF_CAPS (MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT)
+#define _NORDIC_UART_BUF_ATTR
+#else
+#define _NORDIC_UART_BUF_CAPS MALLOC_CAP_DEFAULT
+#define _NORDIC_UART_BUF_ATTR
+#endif
+// A NOSPLIT ring buffer must be a multiple of 4 bytes long, so CONFIG_NORDIC_UART_RX_BUFFER_SIZE is rounded up
+#define _NORDIC_UART_RX_RING_SIZE ((CONFIG_NORDIC_UART_RX_BUFFER_SIZE + 3) & ~3)
+void *_nordic_uart_buf_alloc(size_t size);
+void _nordic_uart_buf_free(void *ptr);
+size_t _nordic_uart_buf_footprint(void);
+size_t _nordic_uart_tx_footprint(void);
+
+void _nordic_uart_flow_reset(void);
+void _nordic_uart_flow_connected(uint16_t conn_handle);
+void _nordic_uart_flow_disconnected(uint16_t conn_handle);
+void _nordic_uart_flow_received(uint16_t conn_handle, size_t len);
+void _nordic_uart_flow_refresh(void);
+uint32_t _nordic_uart_flow_granted(uint16_t conn_handle);
+int _nordic_uart_notify_credits(uint16_t conn_handle, uint32_t granted);
+
+// Streaming LZ codec behind NORDIC_UART_CAP_COMPRESS_*, see compress.c
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+#define _NORDIC_UART_LZ_WINDOW (1 << CONFIG_NORDIC_UART_COMPRESSION_WINDOW_BITS)
+#define _NORDIC_UART_LZ_HASH_SIZE 256
+#define _NORDIC_UART_LZ_MAX_LITERALS 32
+// Output room _nordic_uart_lz_compress() needs for len bytes, literals held back by earlier calls included
+#define _NORDIC_UART_LZ_BOUND(len) ((len) + (len) / 32 + 34)
+struct nordic_uart_lz_enc {
+  uint8_t window[_NORDIC_UART_LZ_WINDOW];    // last bytes compressed, indexed by position
+  uint16_t head[_NORDIC_UART_LZ_HASH_SIZE];  // low bits of the last position of each 3 byte hash
+  uint32_t pos;                              // bytes compressed since the reset
+  uint8_t lit[_NORDIC_UART_LZ_MAX_LITERALS]; // literal run not written out yet
+  uint8_t lit_len;
+};
+struct nordic_uart_lz_dec {
+  uint8_t window[_NORDIC_UART_LZ_WINDOW];
+  uint32_t pos;  // bytes decompressed since the reset
+  uint16_t dist; // of the match being copied
+  uint16_t left; // literals or match bytes still to come
+  uint8_t state; // where the last call stopped inside a token
+  uint8_t ctrl;
+};
+void _nordic_uart_lz_enc_reset(struct nordic_uart_lz_enc *enc);
+size_t _nordic_uart_lz_compress(struct nordic_uart_lz_enc *enc, const uint8_t *in, size_t len, uint8_t *out);
+size_t _nordic_uart_lz_flush(struct nordic_uart_lz_enc *enc, uint8_t *out);
+void _nordic_uart_lz_dec_reset(struct nordic_uart_lz_dec *dec);
+size_t _nordic_uart_lz_decompress(struct nordic_uart_lz_dec *dec, const uint8_t **in, size_t *in_len, uint8_t *out,
+                                  size_t out_size, bool *error);
+#endif
+void _nordic_uart_compress_reset(void);
+void _nordic_uart_compress_connected(uint16_t conn_handle);
+void _nordic_uart_compress_disconnected(uint16_t conn_handle);
+uint8_t _nordic_uart_supported_capabilities(void);
+uint8_t _nordic_uart_capabilities(uint16_t conn_handle);
+esp_err_t _nordic_uart_set_capabilities(uint16_t conn_handle, uint8_t caps);
+esp_err_t _nordic_uart_compress_writev(uint16_t conn_handle, const struct iovec *iov, int iovcnt);
+esp_err_t _nordic_uart_rx_append_block(uint16_t conn_handle, const uint8_t *data, size_t len);
+
+esp_err_t _nordic_uart_notify_task(TaskHandle_t task, uint32_t events);
+esp_err_t _nordic_uart_notify_event_group(EventGroupHandle_t group, EventBits_t events);
+void _nordic_uart_events_rx_queued(void);
+void _nordic_uart_events_post(uint32_t events);
+void _nordic_uart_callback_dispatch(void (*callback)(enum nordic_uart_callback_type callback_type),
+                                    enum nordic_uart_callback_type callback_type);
+int _nordic_uart_receive_dispatch(uart_receive_callback_t receive_callback, struct ble_gatt_access_ctxt *ctxt);
+esp_err_t _nordic_uart_events_start(void);
+void _nordic_uart_events_stop(void);
+
+uint32_t _nordic_uart_crc32(uint32_t crc, const void *data, size_t len);
+int _nordic_uart_bulk_control(uint16_t conn_handle, const uint8_t *msg, size_t len);
+int _nordic_uart_bulk_data(uint16_t conn_handle, const struct os_mbuf *om);
+esp_err_t _nordic_uart_bulk_receive(void *sink, size_t size, size_t *received, TickType_t ticks_to_wait);
+esp_err_t _nordic_uart_bulk_send(uint16_t conn_handle, const void *data, size_t len);
+void _nordic_uart_bulk_disconnected(uint16_t conn_handle);
+void _nordic_uart_bulk_reset(void);
+int _nordic_uart_notify_bulk(uint16_t conn_handle, const struct iovec *iov, int iovcnt);
+int _nordic_uart_notify_bulk_control(uint16_t conn_handle, const void *data, uint16_t len);
+
+esp_err_t _nordic_uart_vfs_register(void);
+esp_err_t _nordic_uart_vfs_unregister(void);
+void _nordic_uart_vfs_rx_ready(void);
+void _nordic_uart_vfs_reset(void);
+
+esp_err_t _nordic_uart_tx_init(void);
+esp_err_t _nordic_uart_tx_deinit(void);
+esp_err_t _nordic_uart_tx_enqueue(const void *data, size_t len);
+esp_err_t _nordic_uart_tx_enqueue_priority(enum nordic_uart_tx_priority priority, const void *data, size_t len);
+void _nordic_uart_tx_yield(void);
+esp_err_t _nordic_uart_get_tx_lane_stats(enum nordic_uart_tx_priority priority,
+                                         struct nordic_uart_tx_lane_stats *stats);
+esp_err_t _nordic_uart_tx_enqueue_iov(const struct iovec *iov, int iovcnt);
+esp_err_t _nordic_uart_set_tx_coalescing(uint32_t delay_ms);
+bool _nordic_uart_tx_coalescing(void);
+esp_err_t _nordic_uart_tx_flush(TickType_t ticks_to_wait);
+size_t _nordic_uart_tx_queue_depth(void);
+size_t _nordic_uart_tx_queue_high_watermark(void);
+bool _nordic_uart_tx_wait_mbufs(TickType_t ticks_to_wait);
@@ -0,0 +1,178 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+#include <string.h>
+
+/* Single producer, single consumer ring of variable length records. Each record is a 4 byte header
+ * (payload length, tag), the payload and a NUL, padded to a multiple of 4 bytes, so the consumer reads
+ * it where it lies. A record that does not fit before the end of the storage goes to the start and
+ * leaves a wrap marker behind. The producer only writes head, the consumer only read and tail, so
+ * neither side takes a lock; the semaphores are only touched by a side that has to sleep. */
+
+static const char *_TAG = "NORDIC UART";
+
+#define SPSC_WORD 4
+#define SPSC_HEADER_SIZE 4
+#define SPSC_WRAP 0xffff     // header length of the wrap marker
+#define SPSC_FULL UINT32_MAX // no room for the record yet
+
+static inline uint32_t _spsc_record_size(size_t len) { //
+  return (SPSC_HEADER_SIZE + len + 1 + SPSC_WORD - 1) & ~(uint32_t)(SPSC_WORD - 1);
+}
+
+// Offset for a record of need bytes, or SPSC_FULL. head == tail only ever means empty, so a word is
+// always left between the producer and the consumer.
+static uint32_t _spsc_place(const struct nordic_uart_spsc *ring, uint32_t head, uint32_t tail, uint32_t need) {
+  if (head < tail)
+    return need <= tail - head - SPSC_WORD ? head : SPSC_FULL;
+  if (need <= ring->size - head - (tail == 0 ? SPSC_WORD : 0))
+    return head;
+  return need + SPSC_WORD <= tail ? 0 : SPSC_FULL;
+}
+
+static TickType_t _spsc_ticks_left(TickType_t start, TickType_t ticks_to_wait) {
+  if (ticks_to_wait == portMAX_DELAY)
+    return portMAX_DELAY;
+  const TickType_t elapsed = xTaskGetTickCount() - start;
+  return elapsed < ticks_to_wait ? ticks_to_wait - elapsed : 0;
+}
+
+// Called after publishing head or tail. The fence pairs with the one in the sleeping side: either it
+// sees the new index before it sleeps, or this sees its flag and gives the semaphore.
+static inline void _spsc_wake(uint32_t *waiting, SemaphoreHandle_t sem) {
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  if (__atomic_load_n(waiting, __ATOMIC_RELAXED) && __atomic_exchange_n(waiting, 0, __ATOMIC_ACQ_REL))
+    xSemaphoreGive(sem);
+}
+
+static inline void _spsc_announce_wait(uint32_t *waiting) {
+  __atomic_store_n(waiting, 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+esp_err_t _nordic_uart_spsc_init(struct nordic_uart_spsc *ring, uint8_t *storage, size_t size) {
+  memset(ring, 0, sizeof(*ring));
+  size &= ~(size_t)(SPSC_WORD - 1);
+  if (storage == NULL || size < 4 * SPSC_WORD || size > UINT32_MAX / 2)
+    return ESP_ERR_INVALID_ARG;
+  ring->data_sem = xSemaphoreCreateBinaryStatic(&ring->sem_storage[0]);
+  ring->space_sem = xSemaphoreCreateBinaryStatic(&ring->sem_storage[1]);
+  if (ring->data_sem == NULL || ring->space_sem == NULL) {
+    ESP_LOGE(_TAG, "Failed to create ring semaphores");
+    _nordic_uart_spsc_deinit(ring);
+    return ESP_FAIL;
+  }
+  ring->buf = storage;
+  ring->size = size;
+  return ESP_OK;
+}
+
+void _nordic_uart_spsc_deinit(struct nordic_uart_spsc *ring) {
+  if (ring->data_sem)
+    vSemaphoreDelete(ring->data_sem);
+  if (ring->space_sem)
+    vSemaphoreDelete(ring->space_sem);
+  memset(ring, 0, sizeof(*ring));
+}
+
+// Producer side. Copies the payload in behind a header and publishes it with one store to head.
+esp_err_t _nordic_uart_spsc_push(struct nordic_uart_spsc *ring, const void *data, size_t len, uint16_t tag,
+                                 TickType_t ticks_to_wait) {
+  const uint32_t need = _spsc_record_size(len);
+  if (ring->buf == NULL || len >= SPSC_WRAP || need >= ring->size)
+    return ESP_ERR_INVALID_SIZE;
+
+  const uint32_t head = ring->head;
+  const TickType_t start = xTaskGetTickCount();
+  uint32_t pos;
+  while ((pos = _spsc_place(ring, head, __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE), need)) == SPSC_FULL) {
+    const TickType_t left = _spsc_ticks_left(start, ticks_to_wait);
+    if (left == 0)
+      return ESP_ERR_TIMEOUT;
+    _spsc_announce_wait(&ring->producer_waiting);
+    if (_spsc_place(ring, head, __atomic_load_n(&ring->tail, __ATOMIC_RELAXED), need) == SPSC_FULL)
+      xSemaphoreTake(ring->space_sem, left);
+  }
+
+  if (pos != head) {
+    const uint16_t marker[2] = {SPSC_WRAP, 0};
+    memcpy(ring->buf + head, marker, SPSC_HEADER_SIZE);
+  }
+  const uint16_t header[2] = {(uint16_t)len, tag};
+  memcpy(ring->buf + pos, header, SPSC_HEADER_SIZE);
+  memcpy(ring->buf + pos + SPSC_HEADER_SIZE, data, len);
+  ring->buf[pos + SPSC_HEADER_SIZE + len] = '\0';
+
+  const uint32_t next = pos + need;
+  __atomic_store_n(&ring->head, next == ring->size ? 0 : next, __ATOMIC_RELEASE);
+  _spsc_wake(&ring->consumer_waiting, ring->data_sem);
+  return ESP_OK;
+}
+
+// Consumer side. Returns the NUL terminated payload in place; it stays valid until it, or a record
+// taken after it, is given to _nordic_uart_spsc_release().
+char *_nordic_uart_spsc_receive(struct nordic_uart_spsc *ring, size_t *len, uint16_t *tag, TickType_t ticks_to_wait) {
+  if (ring->buf == NULL)
+    return NULL;
+  const uint32_t read = ring->read;
+  const TickType_t start = xTaskGetTickCount();
+  while (read == __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE)) {
+    const TickType_t left = _spsc_ticks_left(start, ticks_to_wait);
+    if (left == 0)
+      return NULL;
+    _spsc_announce_wait(&ring->consumer_waiting);
+    if (read == __atomic_load_n(&ring->head, __ATOMIC_RELAXED))
+      xSemaphoreTake(ring->data_sem, left);
+  }
+
+  uint32_t pos = read;
+  uint16_t header[2];
+  memcpy(header, ring->buf + pos, SPSC_HEADER_SIZE);
+  if (header[0] == SPSC_WRAP) {
+    pos = 0;
+    memcpy(header, ring->buf, SPSC_HEADER_SIZE);
+  }
+  const uint32_t next = pos + _spsc_record_size(header[0]);
+  __atomic_store_n(&ring->read, next == ring->size ? 0 : next, __ATOMIC_RELAXED);
+  if (len)
+    *len = header[0];
+  if (tag)
+    *tag = header[1];
+  return (char *)ring->buf + pos + SPSC_HEADER_SIZE;
+}
+
+// Gives the record back together with every record received before it.
+void _nordic_uart_spsc_release(struct nordic_uart_spsc *ring, const void *data) {
+  const uint8_t *record = (const uint8_t *)data - SPSC_HEADER_SIZE;
+  uint16_t len;
+  memcpy(&len, record, sizeof(len));
+  const uint32_t end = (uint32_t)(record - ring->buf) + _spsc_record_size(len);
+  __atomic_store_n(&ring->tail, end == ring->size ? 0 : end, __ATOMIC_RELEASE);
+  _spsc_wake(&ring->producer_waiting, ring->space_sem);
+}
+
+// Longest payload a push could take right now, like xRingbufferGetCurFreeSize() of a NOSPLIT ring buffer.
+size_t _nordic_uart_spsc_free_size(struct nordic_uart_spsc *ring) {
+  if (ring->buf == NULL)
+    return 0;
+  const uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+  const uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  uint32_t room;
+  if (head < tail) {
+    room = tail - head - SPSC_WORD;
+  } else {
+    const uint32_t end_room = ring->size - head - (tail == 0 ? SPSC_WORD : 0);
+    const uint32_t start_room = tail >= SPSC_WORD ? tail - SPSC_WORD : 0;
+    room = end_room > start_room ? end_room : start_room;
+  }
+  return room > SPSC_HEADER_SIZE + 1 ? room - SPSC_HEADER_SIZE - 1 : 0;
+}
+
+// Whether records are waiting to be received.
+bool _nordic_uart_spsc_pending(struct nordic_uart_spsc *ring) {
+  return ring->buf != NULL &&
+         __atomic_load_n(&ring->read, __ATOMIC_RELAXED) != __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+}
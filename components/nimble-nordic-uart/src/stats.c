@@ -0,0 +1,62 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <freertos/FreeRTOS.h>
+#include <string.h>
+
+#ifdef CONFIG_NORDIC_UART_STATS
+struct nordic_uart_stats _nordic_uart_stats;
+portMUX_TYPE _nordic_uart_stats_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// Called after a line went into the ring buffer; the free size is the longest line it could still take.
+void _nordic_uart_stats_rx_buf_used(void) {
+  if (!_nordic_uart_linebuf_initialized())
+    return;
+  const uint32_t used = _NORDIC_UART_RX_RING_SIZE - _nordic_uart_rx_free_size();
+  portENTER_CRITICAL(&_nordic_uart_stats_mux);
+  if (used > _nordic_uart_stats.rx_buf_max_used)
+    _nordic_uart_stats.rx_buf_max_used = used;
+  portEXIT_CRITICAL(&_nordic_uart_stats_mux);
+}
+
+void _nordic_uart_stats_send_latency(int64_t us) {
+  int bucket = 0;
+  while (bucket < NORDIC_UART_STATS_LATENCY_BUCKETS - 1 && us >= (125LL << bucket))
+    ++bucket;
+  _NORDIC_UART_STAT_ADD(send_latency[bucket], 1);
+}
+#endif
+
+esp_err_t _nordic_uart_get_stats(struct nordic_uart_stats *stats) {
+#ifdef CONFIG_NORDIC_UART_STATS
+  if (stats == NULL)
+    return ESP_FAIL;
+  portENTER_CRITICAL(&_nordic_uart_stats_mux);
+  *stats = _nordic_uart_stats;
+  portEXIT_CRITICAL(&_nordic_uart_stats_mux);
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+void _nordic_uart_reset_stats(void) {
+#ifdef CONFIG_NORDIC_UART_STATS
+  portENTER_CRITICAL(&_nordic_uart_stats_mux);
+  memset(&_nordic_uart_stats, 0, sizeof(_nordic_uart_stats));
+  portEXIT_CRITICAL(&_nordic_uart_stats_mux);
+#endif
+}
+
+#ifdef CONFIG_NORDIC_UART_TRACE
+volatile nordic_uart_trace_hook_t _nordic_uart_trace_hook = NULL;
+#endif
+
+esp_err_t _nordic_uart_set_trace_hook(nordic_uart_trace_hook_t hook) {
+#ifdef CONFIG_NORDIC_UART_TRACE
+  _nordic_uart_trace_hook = hook;
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
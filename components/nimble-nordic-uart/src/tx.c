@@ -0,0 +1,522 @@
+#include "nordic-uart-private.h"
+
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/ringbuf.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+static const char *_TAG = "NORDIC UART";
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define TX_TASK_STACK_SIZE CONFIG_NORDIC_UART_TX_TASK_STACK_SIZE
+#define TX_TASK_PRIORITY CONFIG_NORDIC_UART_TX_TASK_PRIORITY
+#define TX_TASK_CORE _NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_TX_TASK_CORE)
+// how long a sender waits for the BLE host to free an mbuf before retrying anyway
+#define TX_MBUF_TIMEOUT pdMS_TO_TICKS(100)
+// waits for mbufs before the sender drops a chunk for a connection, as blocking sends do
+#define TX_ENOMEM_RETRIES 10
+// how long a blocking send waits for the high priority lane to drain before checking again
+#define TX_YIELD_TIMEOUT pdMS_TO_TICKS(100)
+// the sender polls its stop flag at this interval while the queue is empty
+#define TX_IDLE_TIMEOUT pdMS_TO_TICKS(100)
+// writes per lane whose latency is tracked while they wait
+#define TX_LANE_TIMED 16
+
+// One queue per priority. The sender serves the high priority lane first, one notification at a
+// time, so its data goes out in the next slot even while the normal lane holds a long write.
+struct tx_lane {
+  RingbufHandle_t buf;
+  size_t depth; // bytes queued or being sent
+  size_t high_watermark;
+  uint32_t queued;   // bytes ever queued, wraps
+  uint32_t consumed; // bytes ever handed to the BLE host, wraps
+  struct {
+    uint32_t end; // `queued` after the write
+    int64_t at;
+  } timed[TX_LANE_TIMED];
+  uint8_t timed_head;
+  uint8_t timed_count;
+  uint32_t messages;
+  uint32_t latency_max_us;
+  uint64_t latency_total_us;
+};
+
+static struct tx_lane _tx_lanes[NORDIC_UART_TX_PRIORITIES];
+static TaskHandle_t _tx_task_handle = NULL;
+static SemaphoreHandle_t _tx_idle_sem = NULL;     // given when the queue drains
+static SemaphoreHandle_t _tx_stopped_sem = NULL;  // given by the sender task on exit
+static SemaphoreHandle_t _tx_priority_sem = NULL; // given when the high priority lane drains
+static volatile bool _tx_running = false;
+
+// With coalescing the sender holds a notification that is not full back for up to this long.
+static volatile uint32_t _tx_coalesce_ms = CONFIG_NORDIC_UART_TX_COALESCE_MS;
+static volatile bool _tx_push = false; // a newline or flush wants the queue out without waiting
+static esp_timer_handle_t _tx_coalesce_timer = NULL; // created once, kept across stop and start
+
+// Queue storage follows CONFIG_NORDIC_UART_BUFFER_ALLOC like the RX buffers; with static
+// allocation the sender task's stack is reserved at link time too.
+static StaticRingbuffer_t _tx_rings[NORDIC_UART_TX_PRIORITIES];
+static StaticSemaphore_t _tx_sems[3];
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+static _NORDIC_UART_BUF_ATTR uint8_t _tx_ring_storage[CONFIG_NORDIC_UART_TX_BUFFER_SIZE];
+static _NORDIC_UART_BUF_ATTR uint8_t _tx_priority_ring_storage[CONFIG_NORDIC_UART_TX_PRIORITY_BUFFER_SIZE];
+static StackType_t _tx_task_stack[TX_TASK_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t _tx_task_tcb;
+#else
+static uint8_t *_tx_ring_storage = NULL;
+static uint8_t *_tx_priority_ring_storage = NULL;
+#endif
+
+static portMUX_TYPE _tx_mux = portMUX_INITIALIZER_UNLOCKED;
+static size_t _tx_depth = 0; // bytes queued or being sent, every lane
+static size_t _tx_high_watermark = 0;
+
+// call with _tx_mux held
+static void _tx_lane_record(struct tx_lane *lane, int64_t at, int64_t now) {
+  const uint32_t latency_us = (uint32_t)(now - at);
+  lane->messages++;
+  lane->latency_total_us += latency_us;
+  if (latency_us > lane->latency_max_us)
+    lane->latency_max_us = latency_us;
+}
+
+static void _tx_consumed(enum nordic_uart_tx_priority priority, size_t len) {
+  struct tx_lane *lane = &_tx_lanes[priority];
+  const int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&_tx_mux);
+  _tx_depth -= len;
+  lane->depth -= len;
+  lane->consumed += len;
+  // every write whose last byte is out now has its latency
+  while (lane->timed_count && (int32_t)(lane->consumed - lane->timed[lane->timed_head].end) >= 0) {
+    _tx_lane_record(lane, lane->timed[lane->timed_head].at, now);
+    lane->timed_head = (lane->timed_head + 1) % TX_LANE_TIMED;
+    lane->timed_count--;
+  }
+  const bool idle = _tx_depth == 0;
+  const bool lane_idle = lane->depth == 0;
+  portEXIT_CRITICAL(&_tx_mux);
+  if (idle)
+    xSemaphoreGive(_tx_idle_sem);
+  if (lane_idle && priority == NORDIC_UART_TX_HIGH)
+    xSemaphoreGive(_tx_priority_sem);
+}
+
+static size_t _tx_lane_depth(enum nordic_uart_tx_priority priority) {
+  portENTER_CRITICAL(&_tx_mux);
+  const size_t depth = _tx_lanes[priority].depth;
+  portEXIT_CRITICAL(&_tx_mux);
+  return depth;
+}
+
+// Fill `chunk` with up to `max_len` queued bytes; a wrapped byte buffer takes two receives.
+static size_t _tx_fill_chunk(enum nordic_uart_tx_priority priority, uint8_t *chunk, size_t max_len) {
+  RingbufHandle_t buf = _tx_lanes[priority].buf;
+  size_t filled = 0;
+  while (filled < max_len) {
+    size_t len;
+    uint8_t *data = xRingbufferReceiveUpTo(buf, &len, 0, max_len - filled);
+    if (data == NULL)
+      break;
+    memcpy(chunk + filled, data, len);
+    vRingbufferReturnItem(buf, data);
+    filled += len;
+  }
+  return filled;
+}
+
+static void _tx_broadcast(const uint8_t *chunk, size_t len, enum nordic_uart_tx_priority priority);
+
+// Send one notification's worth of the high priority lane to every central; false when it is empty.
+static bool _tx_send_priority(void) {
+  static uint8_t chunk[BLE_ATT_ATTR_MAX_LEN];
+  const size_t len = _tx_fill_chunk(NORDIC_UART_TX_HIGH, chunk, _nordic_uart_tx_chunk_size());
+  if (len == 0)
+    return false;
+  _tx_broadcast(chunk, len, NORDIC_UART_TX_HIGH);
+  _tx_consumed(NORDIC_UART_TX_HIGH, len);
+  return true;
+}
+
+// Hand one chunk to a connection's BLE host queue. BLE_HS_ENOMEM is left to the caller to retry.
+static int _tx_send_chunk(uint16_t conn_handle, const uint8_t *chunk, size_t len) {
+  // a compressed stream goes through its encoder, which retries on its own
+  if (_nordic_uart_capabilities(conn_handle) & NORDIC_UART_CAP_COMPRESS_TX) {
+    const struct iovec iov = {.iov_base = (void *)chunk, .iov_len = len};
+    if (_nordic_uart_compress_writev(conn_handle, &iov, 1) != ESP_OK)
+      ESP_LOGD(_TAG, "async compressed send of %d bytes failed", (int)len);
+    return 0;
+  }
+  const int rc = _nordic_uart_notify(conn_handle, chunk, len);
+  if (rc != 0 && rc != BLE_HS_ENOMEM) {
+    _NORDIC_UART_STAT_ADD(tx_failed, 1);
+    ESP_LOGD(_TAG, "async notify dropped %d bytes, err %d", (int)len, rc);
+  }
+  return rc;
+}
+
+// Deliver one chunk to every central, retrying the ones out of mbufs after the rest are served so
+// nothing is sent twice. A central still out of mbufs after TX_ENOMEM_RETRIES waits misses the
+// chunk, so one that stopped listening cannot hold up the others. High priority data takes the
+// slot a waiting normal chunk would have had.
+static void _tx_broadcast(const uint8_t *chunk, size_t len, enum nordic_uart_tx_priority priority) {
+  uint16_t handles[CONFIG_NORDIC_UART_MAX_CONNECTIONS];
+  size_t count = _nordic_uart_conn_handles(handles, CONFIG_NORDIC_UART_MAX_CONNECTIONS);
+  int waits = 0;
+  while (count) {
+    size_t pending = 0;
+    for (size_t i = 0; i < count; ++i) {
+      if (_tx_send_chunk(handles[i], chunk, len) == BLE_HS_ENOMEM)
+        handles[pending++] = handles[i];
+    }
+    count = pending;
+    if (count == 0 || (priority == NORDIC_UART_TX_NORMAL && _tx_send_priority()))
+      continue;
+    if (waits++ == TX_ENOMEM_RETRIES || !_tx_running) {
+      _NORDIC_UART_STAT_ADD(tx_failed, count);
+      ESP_LOGD(_TAG, "async notify dropped %d bytes for %d centrals out of mbufs", (int)len, (int)count);
+      return;
+    }
+    _NORDIC_UART_STAT_ADD(tx_enomem_retries, count);
+    _nordic_uart_tx_wait_mbufs(TX_MBUF_TIMEOUT);
+  }
+}
+
+static void _tx_coalesce_timeout(void *arg) {
+  if (_tx_task_handle)
+    xTaskNotifyGive(_tx_task_handle);
+}
+
+// Hold a partial chunk back until it is full, the coalescing delay has passed since its first
+// byte, or a newline or nordic_uart_flush() pushes the queue out. Every enqueue and the timer
+// wake the sender, so the delay is kept to the microsecond rather than the tick. High priority
+// data cuts the wait short.
+static size_t _tx_coalesce(uint8_t *chunk, size_t filled, size_t max_len) {
+  const uint32_t delay_ms = _tx_coalesce_ms;
+  if (delay_ms == 0)
+    return filled;
+  const int64_t deadline = esp_timer_get_time() + delay_ms * 1000LL;
+  esp_timer_start_once(_tx_coalesce_timer, delay_ms * 1000ULL);
+  while (filled < max_len && !_tx_push && _tx_running && esp_timer_get_time() < deadline &&
+         _tx_lane_depth(NORDIC_UART_TX_HIGH) == 0) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(delay_ms) + 1);
+    filled += _tx_fill_chunk(NORDIC_UART_TX_NORMAL, chunk + filled, max_len - filled);
+  }
+  esp_timer_stop(_tx_coalesce_timer);
+  return filled;
+}
+
+static void _tx_task(void *arg) {
+  static uint8_t chunk[BLE_ATT_ATTR_MAX_LEN];
+
+  while (_tx_running) {
+    // pick up room freed by consumers that return items with vRingbufferReturnItem()
+    _nordic_uart_flow_refresh();
+    if (_tx_send_priority())
+      continue;
+    size_t len = _tx_fill_chunk(NORDIC_UART_TX_NORMAL, chunk, _nordic_uart_tx_chunk_size());
+    if (len == 0) {
+      // every enqueue wakes the sender
+      ulTaskNotifyTake(pdTRUE, TX_IDLE_TIMEOUT);
+      continue;
+    }
+    // the MTU may have grown while the sender was waiting for data
+    const size_t max_len = _nordic_uart_tx_chunk_size();
+    if (len < max_len)
+      len = _tx_coalesce(chunk, len, max_len);
+    // the push is served once everything queued so far is in this chunk
+    portENTER_CRITICAL(&_tx_mux);
+    if (_tx_lanes[NORDIC_UART_TX_NORMAL].depth == len)
+      _tx_push = false;
+    portEXIT_CRITICAL(&_tx_mux);
+
+    // high priority data that came in meanwhile goes first
+    while (_tx_send_priority())
+      ;
+    _tx_broadcast(chunk, len, NORDIC_UART_TX_NORMAL);
+    _tx_consumed(NORDIC_UART_TX_NORMAL, len);
+  }
+
+  xSemaphoreGive(_tx_stopped_sem);
+  vTaskSuspend(NULL); // deleted by _nordic_uart_tx_deinit()
+}
+
+static esp_err_t _tx_enqueue(enum nordic_uart_tx_priority priority, const void *data, size_t len,
+                             TickType_t ticks_to_wait) {
+  struct tx_lane *lane = &_tx_lanes[priority];
+  const bool push = _tx_coalesce_ms != 0 && memchr(data, '\n', len) != NULL;
+
+  // account before sending so the sender never sees a depth lower than what it consumes
+  portENTER_CRITICAL(&_tx_mux);
+  _tx_depth += len;
+  if (_tx_depth > _tx_high_watermark)
+    _tx_high_watermark = _tx_depth;
+  lane->depth += len;
+  if (lane->depth > lane->high_watermark)
+    lane->high_watermark = lane->depth;
+  if (push)
+    _tx_push = true;
+  portEXIT_CRITICAL(&_tx_mux);
+
+  if (xRingbufferSend(lane->buf, data, len, ticks_to_wait) != pdTRUE) {
+    portENTER_CRITICAL(&_tx_mux);
+    _tx_depth -= len;
+    lane->depth -= len;
+    const bool idle = _tx_depth == 0;
+    portEXIT_CRITICAL(&_tx_mux);
+    if (idle)
+      xSemaphoreGive(_tx_idle_sem);
+    ESP_LOGD(_TAG, "TX queue full");
+    return ESP_FAIL;
+  }
+
+  // start the clock; a write the sender already took counts as sent at once
+  const int64_t now = esp_timer_get_time();
+  portENTER_CRITICAL(&_tx_mux);
+  lane->queued += len;
+  if ((int32_t)(lane->consumed - lane->queued) >= 0) {
+    _tx_lane_record(lane, now, now);
+  } else if (lane->timed_count < TX_LANE_TIMED) {
+    const int i = (lane->timed_head + lane->timed_count++) % TX_LANE_TIMED;
+    lane->timed[i].end = lane->queued;
+    lane->timed[i].at = now;
+  }
+  portEXIT_CRITICAL(&_tx_mux);
+  if (_tx_task_handle)
+    xTaskNotifyGive(_tx_task_handle);
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_tx_enqueue(const void *data, size_t len) { //
+  return _nordic_uart_tx_enqueue_priority(NORDIC_UART_TX_NORMAL, data, len);
+}
+
+esp_err_t _nordic_uart_tx_enqueue_priority(enum nordic_uart_tx_priority priority, const void *data, size_t len) {
+  if (priority >= NORDIC_UART_TX_PRIORITIES || _tx_lanes[priority].buf == NULL)
+    return ESP_FAIL;
+  if (len == 0)
+    return ESP_OK;
+  return _tx_enqueue(priority, data, len, 0);
+}
+
+// Blocking sends step aside between notifications while the high priority lane has data.
+void _nordic_uart_tx_yield(void) {
+  if (_tx_task_handle == NULL || xTaskGetCurrentTaskHandle() == _tx_task_handle)
+    return;
+  while (_tx_running && _tx_lane_depth(NORDIC_UART_TX_HIGH) != 0) {
+    if (xSemaphoreTake(_tx_priority_sem, TX_YIELD_TIMEOUT) == pdTRUE &&
+        _tx_lane_depth(NORDIC_UART_TX_HIGH) == 0) {
+      xSemaphoreGive(_tx_priority_sem); // pass it on to the next waiting sender
+      return;
+    }
+  }
+}
+
+// Blocking sends while coalescing: queue the fragments, waiting for room as the sender drains.
+// Pieces of half the queue let it start on one while the next is copied in.
+esp_err_t _nordic_uart_tx_enqueue_iov(const struct iovec *iov, int iovcnt) {
+  if (_tx_lanes[NORDIC_UART_TX_NORMAL].buf == NULL)
+    return ESP_FAIL;
+  for (int i = 0; i < iovcnt; ++i) {
+    const uint8_t *data = iov[i].iov_base;
+    for (size_t off = 0; off < iov[i].iov_len;) {
+      const size_t len = MIN(iov[i].iov_len - off, CONFIG_NORDIC_UART_TX_BUFFER_SIZE / 2);
+      if (_tx_enqueue(NORDIC_UART_TX_NORMAL, data + off, len, portMAX_DELAY) != ESP_OK)
+        return ESP_FAIL;
+      off += len;
+    }
+  }
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_set_tx_coalescing(uint32_t delay_ms) {
+  if (delay_ms > 1000) {
+    ESP_LOGE(_TAG, "Coalescing delay %u ms out of range", (unsigned)delay_ms);
+    return ESP_FAIL;
+  }
+  _tx_coalesce_ms = delay_ms;
+  // let a sender holding data back see the change
+  portENTER_CRITICAL(&_tx_mux);
+  _tx_push = _tx_depth != 0;
+  portEXIT_CRITICAL(&_tx_mux);
+  if (_tx_task_handle)
+    xTaskNotifyGive(_tx_task_handle);
+  return ESP_OK;
+}
+
+bool _nordic_uart_tx_coalescing(void) { //
+  return _tx_coalesce_ms != 0 && _tx_lanes[NORDIC_UART_TX_NORMAL].buf != NULL;
+}
+
+esp_err_t _nordic_uart_tx_flush(TickType_t ticks_to_wait) {
+  if (_tx_lanes[NORDIC_UART_TX_NORMAL].buf == NULL)
+    return ESP_FAIL;
+
+  // whatever the sender holds back for coalescing goes out now
+  portENTER_CRITICAL(&_tx_mux);
+  _tx_push = _tx_depth != 0;
+  portEXIT_CRITICAL(&_tx_mux);
+  if (_tx_task_handle)
+    xTaskNotifyGive(_tx_task_handle);
+
+  const TickType_t start = xTaskGetTickCount();
+  for (;;) {
+    if (_nordic_uart_tx_queue_depth() == 0)
+      return ESP_OK;
+    const TickType_t elapsed = xTaskGetTickCount() - start;
+    if (ticks_to_wait != portMAX_DELAY && elapsed >= ticks_to_wait)
+      return ESP_ERR_TIMEOUT;
+    xSemaphoreTake(_tx_idle_sem, ticks_to_wait == portMAX_DELAY ? portMAX_DELAY : ticks_to_wait - elapsed);
+  }
+}
+
+size_t _nordic_uart_tx_queue_depth(void) {
+  portENTER_CRITICAL(&_tx_mux);
+  const size_t depth = _tx_depth;
+  portEXIT_CRITICAL(&_tx_mux);
+  return depth;
+}
+
+size_t _nordic_uart_tx_queue_high_watermark(void) {
+  portENTER_CRITICAL(&_tx_mux);
+  const size_t high_watermark = _tx_high_watermark;
+  portEXIT_CRITICAL(&_tx_mux);
+  return high_watermark;
+}
+
+esp_err_t _nordic_uart_get_tx_lane_stats(enum nordic_uart_tx_priority priority,
+                                         struct nordic_uart_tx_lane_stats *stats) {
+  if (priority >= NORDIC_UART_TX_PRIORITIES || stats == NULL)
+    return ESP_ERR_INVALID_ARG;
+  const struct tx_lane *lane = &_tx_lanes[priority];
+  portENTER_CRITICAL(&_tx_mux);
+  stats->depth = lane->depth;
+  stats->high_watermark = lane->high_watermark;
+  stats->messages = lane->messages;
+  stats->latency_max_us = lane->latency_max_us;
+  stats->latency_avg_us = lane->messages ? (uint32_t)(lane->latency_total_us / lane->messages) : 0;
+  portEXIT_CRITICAL(&_tx_mux);
+  return ESP_OK;
+}
+
+// NimBLE reports BLE_GAP_EVENT_NOTIFY_TX as soon as a notification is queued, before the controller
+// has sent it, so room for the next one shows as an mbuf coming back to the pool.
+bool _nordic_uart_tx_wait_mbufs(TickType_t ticks_to_wait) {
+  const int free = os_msys_num_free();
+  for (TickType_t waited = 0; waited < ticks_to_wait; ++waited) {
+    // the sender gives up at once when it is stopped
+    if (xTaskGetCurrentTaskHandle() == _tx_task_handle && !_tx_running)
+      return false;
+    vTaskDelay(1);
+    if (os_msys_num_free() > free)
+      return true;
+  }
+  return false;
+}
+
+esp_err_t _nordic_uart_tx_deinit(void) {
+  if (_tx_lanes[NORDIC_UART_TX_NORMAL].buf == NULL && _tx_idle_sem == NULL)
+    return ESP_FAIL;
+
+  if (_tx_task_handle) {
+    _tx_running = false;
+    xTaskNotifyGive(_tx_task_handle);
+    xSemaphoreTake(_tx_stopped_sem, portMAX_DELAY);
+    _nordic_uart_task_reap(_tx_task_handle);
+    _tx_task_handle = NULL;
+  }
+
+  if (_tx_coalesce_timer)
+    esp_timer_stop(_tx_coalesce_timer);
+  for (int i = 0; i < NORDIC_UART_TX_PRIORITIES; ++i) {
+    if (_tx_lanes[i].buf)
+      vRingbufferDelete(_tx_lanes[i].buf);
+    _tx_lanes[i].buf = NULL;
+    _tx_lanes[i].depth = 0;
+  }
+#ifndef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  _nordic_uart_buf_free(_tx_ring_storage);
+  _tx_ring_storage = NULL;
+  _nordic_uart_buf_free(_tx_priority_ring_storage);
+  _tx_priority_ring_storage = NULL;
+#endif
+  if (_tx_idle_sem)
+    vSemaphoreDelete(_tx_idle_sem);
+  _tx_idle_sem = NULL;
+  if (_tx_stopped_sem)
+    vSemaphoreDelete(_tx_stopped_sem);
+  _tx_stopped_sem = NULL;
+  if (_tx_priority_sem)
+    vSemaphoreDelete(_tx_priority_sem);
+  _tx_priority_sem = NULL;
+  _tx_depth = 0;
+  _tx_push = false;
+
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_tx_init(void) {
+  _nordic_uart_tx_deinit();
+
+  _tx_idle_sem = xSemaphoreCreateBinaryStatic(&_tx_sems[0]);
+  _tx_stopped_sem = xSemaphoreCreateBinaryStatic(&_tx_sems[1]);
+  _tx_priority_sem = xSemaphoreCreateBinaryStatic(&_tx_sems[2]);
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  uint8_t *const ring_storage = _tx_ring_storage;
+  uint8_t *const priority_ring_storage = _tx_priority_ring_storage;
+#else
+  uint8_t *const ring_storage = _tx_ring_storage = _nordic_uart_buf_alloc(CONFIG_NORDIC_UART_TX_BUFFER_SIZE);
+  uint8_t *const priority_ring_storage = _tx_priority_ring_storage =
+      _nordic_uart_buf_alloc(CONFIG_NORDIC_UART_TX_PRIORITY_BUFFER_SIZE);
+#endif
+  memset(_tx_lanes, 0, sizeof(_tx_lanes));
+  struct tx_lane *const normal = &_tx_lanes[NORDIC_UART_TX_NORMAL];
+  struct tx_lane *const high = &_tx_lanes[NORDIC_UART_TX_HIGH];
+  normal->buf = ring_storage ? xRingbufferCreateStatic(CONFIG_NORDIC_UART_TX_BUFFER_SIZE, RINGBUF_TYPE_BYTEBUF,
+                                                       ring_storage, &_tx_rings[NORDIC_UART_TX_NORMAL])
+                             : NULL;
+  high->buf = priority_ring_storage ? xRingbufferCreateStatic(CONFIG_NORDIC_UART_TX_PRIORITY_BUFFER_SIZE,
+                                                              RINGBUF_TYPE_BYTEBUF, priority_ring_storage,
+                                                              &_tx_rings[NORDIC_UART_TX_HIGH])
+                                    : NULL;
+  if (normal->buf == NULL || high->buf == NULL || _tx_idle_sem == NULL || _tx_stopped_sem == NULL ||
+      _tx_priority_sem == NULL) {
+    ESP_LOGE(_TAG, "Failed to create TX queue");
+    _nordic_uart_tx_deinit();
+    return ESP_FAIL;
+  }
+  const esp_timer_create_args_t timer_args = {.callback = _tx_coalesce_timeout, .name = "nordic_uart_tx"};
+  if (_tx_coalesce_timer == NULL && esp_timer_create(&timer_args, &_tx_coalesce_timer) != ESP_OK) {
+    ESP_LOGE(_TAG, "Failed to create TX coalescing timer");
+    _nordic_uart_tx_deinit();
+    return ESP_FAIL;
+  }
+  _tx_depth = 0;
+  _tx_high_watermark = 0;
+
+  _tx_running = true;
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  _tx_task_handle = xTaskCreateStaticPinnedToCore(_tx_task, "nordic_uart_tx", TX_TASK_STACK_SIZE, NULL,
+                                                 TX_TASK_PRIORITY, _tx_task_stack, &_tx_task_tcb, TX_TASK_CORE);
+  if (_tx_task_handle == NULL) {
+#else
+  if (xTaskCreatePinnedToCore(_tx_task, "nordic_uart_tx", TX_TASK_STACK_SIZE, NULL, TX_TASK_PRIORITY,
+                              &_tx_task_handle, TX_TASK_CORE) != pdPASS) {
+#endif
+    ESP_LOGE(_TAG, "Failed to create TX task");
+    _tx_running = false;
+    _tx_task_handle = NULL;
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+}
+
+// Bytes reserved by _nordic_uart_tx_init(), whichever way they are allocated.
+size_t _nordic_uart_tx_footprint(void) {
+  return CONFIG_NORDIC_UART_TX_BUFFER_SIZE + CONFIG_NORDIC_UART_TX_PRIORITY_BUFFER_SIZE + sizeof(_tx_rings) +
+         sizeof(_tx_sems) + TX_TASK_STACK_SIZE + sizeof(StaticTask_t);
+}
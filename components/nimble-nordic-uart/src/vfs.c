@@ -0,0 +1,343 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+#ifdef CONFIG_NORDIC_UART_VFS
+#include "esp_vfs.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+
+static const char *_TAG = "NORDIC UART";
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+#define VFS_MAX_FDS 4
+// a blocking read re-checks at this interval whether the service was stopped or started
+#define VFS_READ_POLL pdMS_TO_TICKS(100)
+
+// Open descriptors share one RX stream; each keeps its own O_NONBLOCK.
+static int _vfs_fd_flags[VFS_MAX_FDS];
+static bool _vfs_fd_open[VFS_MAX_FDS];
+static bool _vfs_registered = false;
+
+// The ring buffer item being read, held until every byte of it has been copied out.
+static char *_vfs_item = NULL;
+static size_t _vfs_item_len = 0; // bytes to hand out, line ending included
+static size_t _vfs_item_pos = 0;
+static SemaphoreHandle_t _vfs_lock = NULL;   // guards the item; never held while blocking
+static SemaphoreHandle_t _vfs_rx_sem = NULL; // given whenever lines were queued
+static StaticSemaphore_t _vfs_sems[2];
+
+// One select() at a time, woken from the host task when lines arrive.
+struct nordic_uart_vfs_select {
+  esp_vfs_select_sem_t sem;
+  fd_set *readfds;
+  fd_set readfds_orig;
+};
+static struct nordic_uart_vfs_select _vfs_select;
+static bool _vfs_select_active = false;
+static portMUX_TYPE _vfs_mux = portMUX_INITIALIZER_UNLOCKED;
+
+static bool _vfs_fd_valid(int fd) { //
+  return fd >= 0 && fd < VFS_MAX_FDS && _vfs_fd_open[fd];
+}
+
+// call with _vfs_lock held
+static void _vfs_release_item(void) {
+  if (_vfs_item)
+    nordic_uart_return_item(_vfs_item);
+  _vfs_item = NULL;
+  _vfs_item_len = 0;
+  _vfs_item_pos = 0;
+}
+
+// Copy out of the held item and whatever else is queued, without blocking. Line framing gives each
+// line back with the '\n' the framer took off, so line editors see the end of every line; the
+// fragments of a long line are read back to back.
+// call with _vfs_lock held
+static size_t _vfs_drain(uint8_t *dst, size_t size) {
+  size_t copied = 0;
+  while (copied < size) {
+    if (_vfs_item == NULL) {
+      struct nordic_uart_rx_line line;
+      if (_nordic_uart_rx_receive_batch(&line, 1, 0, 0) == 0)
+        break;
+      char *item = line.data;
+      const size_t len = line.len;
+      _vfs_item = item;
+      _vfs_item_pos = 0;
+      // the NUL after the payload is overwritten by the line ending, the connection tag stays
+      _vfs_item_len = len;
+      if (_nordic_uart_get_framing() == NORDIC_UART_FRAMING_LINE && !line.continued) {
+        item[len] = '\n';
+        _vfs_item_len = len + 1;
+      }
+    }
+    const size_t n = MIN(size - copied, _vfs_item_len - _vfs_item_pos);
+    memcpy(dst + copied, _vfs_item + _vfs_item_pos, n);
+    copied += n;
+    _vfs_item_pos += n;
+    if (_vfs_item_pos == _vfs_item_len)
+      _vfs_release_item();
+  }
+  return copied;
+}
+
+static bool _vfs_readable(void) {
+  if (_vfs_item)
+    return true;
+  return _nordic_uart_rx_pending();
+}
+
+static ssize_t _vfs_read(int fd, void *dst, size_t size) {
+  if (!_vfs_fd_valid(fd)) {
+    errno = EBADF;
+    return -1;
+  }
+  if (size == 0)
+    return 0;
+  for (;;) {
+    xSemaphoreTake(_vfs_lock, portMAX_DELAY);
+    const size_t copied = _vfs_drain(dst, size);
+    xSemaphoreGive(_vfs_lock);
+    if (copied)
+      return copied;
+    if (_vfs_fd_flags[fd] & O_NONBLOCK) {
+      errno = EAGAIN;
+      return -1;
+    }
+    xSemaphoreTake(_vfs_rx_sem, VFS_READ_POLL);
+  }
+}
+
+// Blocking writes go out like nordic_uart_write() once the TX queue has drained; O_NONBLOCK ones are
+// queued for the sender task and may be short. Output with no central connected is discarded, as on a
+// UART without a cable.
+static ssize_t _vfs_write(int fd, const void *data, size_t size) {
+  if (!_vfs_fd_valid(fd)) {
+    errno = EBADF;
+    return -1;
+  }
+  uint16_t handle;
+  if (size == 0 || _nordic_uart_conn_handles(&handle, 1) == 0)
+    return size;
+  if (_vfs_fd_flags[fd] & O_NONBLOCK) {
+    const size_t len = MIN(size, CONFIG_NORDIC_UART_TX_BUFFER_SIZE / 2);
+    if (_nordic_uart_tx_enqueue(data, len) != ESP_OK) {
+      errno = EAGAIN;
+      return -1;
+    }
+    return len;
+  }
+  // let earlier non-blocking writes go out first
+  if (_nordic_uart_tx_flush(portMAX_DELAY) != ESP_OK || _nordic_uart_write(data, size) != ESP_OK) {
+    errno = EIO;
+    return -1;
+  }
+  return size;
+}
+
+static int _vfs_open(const char *path, int flags, int mode) {
+  if (path[0] != '\0' && strcmp(path, "/") != 0) {
+    errno = ENOENT;
+    return -1;
+  }
+  portENTER_CRITICAL(&_vfs_mux);
+  int fd;
+  for (fd = 0; fd < VFS_MAX_FDS && _vfs_fd_open[fd]; ++fd)
+    ;
+  if (fd < VFS_MAX_FDS) {
+    _vfs_fd_open[fd] = true;
+    _vfs_fd_flags[fd] = flags;
+  }
+  portEXIT_CRITICAL(&_vfs_mux);
+  if (fd == VFS_MAX_FDS) {
+    errno = ENFILE;
+    return -1;
+  }
+  return fd;
+}
+
+static int _vfs_close(int fd) {
+  if (!_vfs_fd_valid(fd)) {
+    errno = EBADF;
+    return -1;
+  }
+  _vfs_fd_open[fd] = false;
+  return 0;
+}
+
+static int _vfs_fstat(int fd, struct stat *st) {
+  if (!_vfs_fd_valid(fd)) {
+    errno = EBADF;
+    return -1;
+  }
+  memset(st, 0, sizeof(*st));
+  st->st_mode = S_IFCHR;
+  return 0;
+}
+
+static int _vfs_fcntl(int fd, int cmd, int arg) {
+  if (!_vfs_fd_valid(fd)) {
+    errno = EBADF;
+    return -1;
+  }
+  switch (cmd) {
+  case F_GETFL:
+    return _vfs_fd_flags[fd];
+  case F_SETFL:
+    _vfs_fd_flags[fd] = arg;
+    return 0;
+  default:
+    errno = ENOSYS;
+    return -1;
+  }
+}
+
+static int _vfs_fsync(int fd) {
+  if (!_vfs_fd_valid(fd)) {
+    errno = EBADF;
+    return -1;
+  }
+  return _nordic_uart_tx_flush(portMAX_DELAY) == ESP_OK ? 0 : -1;
+}
+
+#ifdef CONFIG_VFS_SUPPORT_SELECT
+// Writes never wait for room, so every descriptor asked for is writable at once; readable ones are
+// marked here or by _nordic_uart_vfs_rx_ready() once lines arrive.
+static esp_err_t _vfs_start_select(int nfds, fd_set *readfds, fd_set *writefds, fd_set *exceptfds,
+                                   esp_vfs_select_sem_t sem, void **end_select_args) {
+  const fd_set readfds_orig = *readfds;
+  const fd_set writefds_orig = *writefds;
+  FD_ZERO(readfds);
+  FD_ZERO(writefds);
+  FD_ZERO(exceptfds);
+
+  const bool readable = _vfs_readable();
+  bool ready = false;
+  portENTER_CRITICAL(&_vfs_mux);
+  if (_vfs_select_active) {
+    portEXIT_CRITICAL(&_vfs_mux);
+    ESP_LOGE(_TAG, "Only one select() at a time");
+    return ESP_ERR_INVALID_STATE;
+  }
+  for (int fd = 0; fd < MIN(nfds, VFS_MAX_FDS); ++fd) {
+    if (!_vfs_fd_open[fd])
+      continue;
+    if (FD_ISSET(fd, &writefds_orig)) {
+      FD_SET(fd, writefds);
+      ready = true;
+    }
+    if (readable && FD_ISSET(fd, &readfds_orig)) {
+      FD_SET(fd, readfds);
+      ready = true;
+    }
+  }
+  _vfs_select.sem = sem;
+  _vfs_select.readfds = readfds;
+  _vfs_select.readfds_orig = readfds_orig;
+  _vfs_select_active = true;
+  portEXIT_CRITICAL(&_vfs_mux);
+
+  if (ready)
+    esp_vfs_select_triggered(sem);
+  *end_select_args = &_vfs_select;
+  return ESP_OK;
+}
+
+static esp_err_t _vfs_end_select(void *end_select_args) {
+  portENTER_CRITICAL(&_vfs_mux);
+  _vfs_select_active = false;
+  portEXIT_CRITICAL(&_vfs_mux);
+  return ESP_OK;
+}
+#endif
+#endif
+
+// Called on the host task once per write that queued lines.
+void _nordic_uart_vfs_rx_ready(void) {
+#ifdef CONFIG_NORDIC_UART_VFS
+  if (!_vfs_registered)
+    return;
+  xSemaphoreGive(_vfs_rx_sem);
+#ifdef CONFIG_VFS_SUPPORT_SELECT
+  bool ready = false;
+  esp_vfs_select_sem_t sem;
+  portENTER_CRITICAL(&_vfs_mux);
+  if (_vfs_select_active) {
+    for (int fd = 0; fd < VFS_MAX_FDS; ++fd) {
+      if (_vfs_fd_open[fd] && FD_ISSET(fd, &_vfs_select.readfds_orig)) {
+        FD_SET(fd, _vfs_select.readfds);
+        ready = true;
+      }
+    }
+    sem = _vfs_select.sem;
+  }
+  portEXIT_CRITICAL(&_vfs_mux);
+  if (ready)
+    esp_vfs_select_triggered(sem);
+#endif
+#endif
+}
+
+// Give back a partly read line before the ring buffer goes away.
+void _nordic_uart_vfs_reset(void) {
+#ifdef CONFIG_NORDIC_UART_VFS
+  if (!_vfs_registered)
+    return;
+  xSemaphoreTake(_vfs_lock, portMAX_DELAY);
+  _vfs_release_item();
+  xSemaphoreGive(_vfs_lock);
+#endif
+}
+
+esp_err_t _nordic_uart_vfs_register(void) {
+#ifdef CONFIG_NORDIC_UART_VFS
+  if (_vfs_registered)
+    return ESP_FAIL;
+  if (_vfs_lock == NULL) {
+    _vfs_lock = xSemaphoreCreateMutexStatic(&_vfs_sems[0]);
+    _vfs_rx_sem = xSemaphoreCreateBinaryStatic(&_vfs_sems[1]);
+  }
+  const esp_vfs_t vfs = {
+      .flags = ESP_VFS_FLAG_DEFAULT,
+      .write = &_vfs_write,
+      .read = &_vfs_read,
+      .open = &_vfs_open,
+      .close = &_vfs_close,
+      .fstat = &_vfs_fstat,
+      .fcntl = &_vfs_fcntl,
+      .fsync = &_vfs_fsync,
+#ifdef CONFIG_VFS_SUPPORT_SELECT
+      .start_select = &_vfs_start_select,
+      .end_select = &_vfs_end_select,
+#endif
+  };
+  const esp_err_t err = esp_vfs_register(NORDIC_UART_VFS_PATH, &vfs, NULL);
+  if (err != ESP_OK) {
+    ESP_LOGE(_TAG, "Failed to register %s: %s", NORDIC_UART_VFS_PATH, esp_err_to_name(err));
+    return ESP_FAIL;
+  }
+  memset(_vfs_fd_open, 0, sizeof(_vfs_fd_open));
+  _vfs_registered = true;
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+esp_err_t _nordic_uart_vfs_unregister(void) {
+#ifdef CONFIG_NORDIC_UART_VFS
+  if (!_vfs_registered)
+    return ESP_FAIL;
+  _nordic_uart_vfs_reset();
+  _vfs_registered = false;
+  return esp_vfs_unregister(NORDIC_UART_VFS_PATH) == ESP_OK ? ESP_OK : ESP_FAIL;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
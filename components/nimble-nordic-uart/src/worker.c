@@ -0,0 +1,251 @@
+#include "nordic-uart-private.h"
+
+#include "esp_log.h"
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/task.h>
+
+// Line framing of the centrals' writes. It runs on the NimBLE host task, or with CONFIG_NORDIC_UART_RX_WORKER
+// on a task of its own, typically pinned to the core the host task is not on. The host task then only queues
+// the write's mbuf chain, and waits a short while for the worker before it touches the line buffers itself (on a
+// disconnect or a capability change), so lines are still put in the RX ring by one task at a time. When the
+// worker does not catch up in time, a disconnect is handed to it and a capability change is turned down.
+
+// Frame one write into the line buffer of conn_handle; arrival_us stamps its lines in the latency mode.
+esp_err_t _nordic_uart_rx_frame_write(uint16_t conn_handle, const struct os_mbuf *om, int64_t arrival_us) {
+  if (_nordic_uart_linebuf_select(conn_handle) != ESP_OK)
+    return ESP_FAIL;
+  _nordic_uart_latency_arrival(arrival_us);
+  // long writes arrive as a chain of mbufs
+  for (; om; om = SLIST_NEXT(om, om_next)) {
+    _nordic_uart_rx_append_block(conn_handle, om->om_data, om->om_len);
+  }
+  _nordic_uart_latency_arrival(0);
+  return ESP_OK;
+}
+
+// The Ctrl-C of a disconnect, then the connection's line buffer and decoder are free for the next central.
+void _nordic_uart_rx_hangup(uint16_t conn_handle) {
+  if (_nordic_uart_linebuf_select(conn_handle) == ESP_OK) {
+    _nordic_uart_linebuf_hangup(); // send Ctrl-C in line framing
+    _nordic_uart_linebuf_release(conn_handle);
+  }
+  _nordic_uart_compress_disconnected(conn_handle);
+}
+
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+static const char *_TAG = "NORDIC UART";
+
+#define RX_WORKER_CORE _NORDIC_UART_TASK_CORE(CONFIG_NORDIC_UART_RX_WORKER_CORE)
+
+enum nordic_uart_rx_work_kind {
+  RX_WORK_WRITE,
+  RX_WORK_FLUSH,  // give _rx_worker_done_sem once everything before it is framed
+  RX_WORK_HANGUP, // _nordic_uart_rx_hangup() after the writes before it
+  RX_WORK_STOP,
+};
+
+struct nordic_uart_rx_work {
+  enum nordic_uart_rx_work_kind kind;
+  uint16_t conn_handle;
+  struct os_mbuf *om; // owned by the worker until framed
+  int64_t arrival_us;
+  uint32_t flush_seq;
+};
+
+// Writes never take the last slots, so a flush and the hangup of every central, or the stop request, always
+// fit. A flush leaves the hangup slots alone.
+#define RX_WORKER_HANGUP_SLOTS CONFIG_NORDIC_UART_MAX_CONNECTIONS
+#define RX_WORKER_RESERVED (1 + RX_WORKER_HANGUP_SLOTS)
+#define RX_WORKER_SLOTS (CONFIG_NORDIC_UART_RX_WORKER_QUEUE_LENGTH + RX_WORKER_RESERVED)
+// The host task waits this long at most for the worker; lines do not wait for room in the RX ring meanwhile,
+// so only a worker kept off its core by busier tasks takes longer.
+#define RX_WORKER_FLUSH_TIMEOUT pdMS_TO_TICKS(50)
+
+static bool _rx_worker_enabled = false;
+static QueueHandle_t _rx_work_queue = NULL;
+static StaticQueue_t _rx_work_queue_buf;
+static uint8_t _rx_work_storage[RX_WORKER_SLOTS * sizeof(struct nordic_uart_rx_work)];
+static SemaphoreHandle_t _rx_worker_done_sem = NULL;
+static StaticSemaphore_t _rx_worker_done_sem_buf;
+static volatile uint32_t _rx_flush_seq;           // host task: last flush requested
+static volatile uint32_t _rx_flushed_seq;         // worker: last flush reached
+static volatile bool _rx_worker_draining = false; // until the worker reaches the last flush
+static TaskHandle_t _rx_worker_task_handle = NULL;
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+static StackType_t _rx_worker_task_stack[CONFIG_NORDIC_UART_RX_WORKER_STACK_SIZE / sizeof(StackType_t)];
+static StaticTask_t _rx_worker_task_tcb;
+#endif
+
+static void _rx_worker_task(void *arg) {
+  struct nordic_uart_rx_work work;
+  for (;;) {
+    if (xQueueReceive(_rx_work_queue, &work, portMAX_DELAY) != pdTRUE)
+      continue;
+    if (work.kind == RX_WORK_STOP)
+      break;
+    if (work.kind == RX_WORK_FLUSH) {
+      if (work.flush_seq == _rx_flush_seq)
+        _rx_worker_draining = false;
+      _rx_flushed_seq = work.flush_seq;
+      xSemaphoreGive(_rx_worker_done_sem);
+      continue;
+    }
+    if (work.kind == RX_WORK_HANGUP) {
+      _nordic_uart_rx_hangup(work.conn_handle);
+    } else {
+      if (_nordic_uart_rx_frame_write(work.conn_handle, work.om, work.arrival_us) != ESP_OK)
+        ESP_LOGW(_TAG, "No line buffer for connection %d", work.conn_handle);
+      os_mbuf_free_chain(work.om);
+    }
+    // one wakeup for every line this write completed
+    _nordic_uart_events_post(0);
+  }
+  vTaskSuspend(NULL); // deleted by _nordic_uart_rx_worker_stop()
+}
+#endif
+
+bool _nordic_uart_rx_worker_active(void) {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  return _rx_worker_task_handle != NULL;
+#else
+  return false;
+#endif
+}
+
+bool _nordic_uart_rx_worker_draining(void) {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  return _rx_worker_draining;
+#else
+  return false;
+#endif
+}
+
+// Hand a write to the worker, which frees the chain. Call on the host task only, the single producer; a full
+// queue rejects the write at once rather than holding the host task.
+esp_err_t _nordic_uart_rx_worker_post(uint16_t conn_handle, struct os_mbuf *om, int64_t arrival_us) {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  const struct nordic_uart_rx_work work = {
+      .kind = RX_WORK_WRITE, .conn_handle = conn_handle, .om = om, .arrival_us = arrival_us};
+  if (_rx_work_queue == NULL || uxQueueSpacesAvailable(_rx_work_queue) <= RX_WORKER_RESERVED ||
+      xQueueSend(_rx_work_queue, &work, 0) != pdTRUE) {
+    _NORDIC_UART_STAT_ADD(rx_buf_full, 1);
+    ESP_LOGW(_TAG, "RX worker queue full");
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// Wait until the worker has framed every write queued so far, for RX_WORKER_FLUSH_TIMEOUT at most; host task
+// only. ESP_ERR_TIMEOUT means the worker still owns the line buffers.
+esp_err_t _nordic_uart_rx_worker_flush(void) {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  if (_rx_worker_task_handle == NULL)
+    return ESP_OK;
+  const uint32_t seq = ++_rx_flush_seq;
+  const struct nordic_uart_rx_work work = {.kind = RX_WORK_FLUSH, .flush_seq = seq};
+  _rx_worker_draining = true;
+  if (uxQueueSpacesAvailable(_rx_work_queue) <= RX_WORKER_HANGUP_SLOTS ||
+      xQueueSend(_rx_work_queue, &work, 0) != pdTRUE) {
+    // the last flush, which timed out, is still queued and drains the worker
+    return ESP_ERR_TIMEOUT;
+  }
+  const TickType_t start = xTaskGetTickCount();
+  while (_rx_flushed_seq != seq) {
+    const TickType_t elapsed = xTaskGetTickCount() - start;
+    if (elapsed >= RX_WORKER_FLUSH_TIMEOUT) {
+      ESP_LOGW(_TAG, "RX worker busy");
+      return ESP_ERR_TIMEOUT;
+    }
+    xSemaphoreTake(_rx_worker_done_sem, RX_WORKER_FLUSH_TIMEOUT - elapsed);
+  }
+#endif
+  return ESP_OK;
+}
+
+// Hang up conn_handle after the writes the worker still has, when a flush timed out; host task only.
+esp_err_t _nordic_uart_rx_worker_hangup(uint16_t conn_handle) {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  const struct nordic_uart_rx_work work = {.kind = RX_WORK_HANGUP, .conn_handle = conn_handle};
+  if (_rx_work_queue == NULL || xQueueSend(_rx_work_queue, &work, 0) != pdTRUE) {
+    ESP_LOGE(_TAG, "RX worker queue full, line buffer of %d not released", conn_handle);
+    return ESP_FAIL;
+  }
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
+
+// Stop the worker and free the chains it has not framed; call once the host task has stopped
+// and before the mbuf pool goes away.
+void _nordic_uart_rx_worker_stop(void) {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  struct nordic_uart_rx_work work = {.kind = RX_WORK_STOP};
+  if (_rx_worker_task_handle) {
+    xQueueSendToFront(_rx_work_queue, &work, portMAX_DELAY);
+    _nordic_uart_task_reap(_rx_worker_task_handle);
+    _rx_worker_task_handle = NULL;
+  }
+  if (_rx_work_queue) {
+    while (xQueueReceive(_rx_work_queue, &work, 0) == pdTRUE) {
+      if (work.kind == RX_WORK_WRITE)
+        os_mbuf_free_chain(work.om);
+    }
+    vQueueDelete(_rx_work_queue);
+    _rx_work_queue = NULL;
+  }
+  if (_rx_worker_done_sem)
+    vSemaphoreDelete(_rx_worker_done_sem);
+  _rx_worker_done_sem = NULL;
+  _rx_worker_draining = false;
+#endif
+}
+
+esp_err_t _nordic_uart_rx_worker_start(void) {
+  _nordic_uart_rx_worker_stop();
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  if (!_rx_worker_enabled)
+    return ESP_OK;
+  _rx_work_queue = xQueueCreateStatic(RX_WORKER_SLOTS, sizeof(struct nordic_uart_rx_work), _rx_work_storage,
+                                      &_rx_work_queue_buf);
+  _rx_flush_seq = _rx_flushed_seq = 0;
+  _rx_worker_done_sem = xSemaphoreCreateBinaryStatic(&_rx_worker_done_sem_buf);
+  if (_rx_work_queue == NULL || _rx_worker_done_sem == NULL) {
+    ESP_LOGE(_TAG, "Failed to create RX worker queue");
+    _nordic_uart_rx_worker_stop();
+    return ESP_FAIL;
+  }
+#ifdef CONFIG_NORDIC_UART_BUFFER_ALLOC_STATIC
+  _rx_worker_task_handle = xTaskCreateStaticPinnedToCore(
+      _rx_worker_task, "nordic_uart_rx", CONFIG_NORDIC_UART_RX_WORKER_STACK_SIZE, NULL,
+      CONFIG_NORDIC_UART_RX_WORKER_PRIORITY, _rx_worker_task_stack, &_rx_worker_task_tcb, RX_WORKER_CORE);
+  if (_rx_worker_task_handle == NULL) {
+#else
+  if (xTaskCreatePinnedToCore(_rx_worker_task, "nordic_uart_rx", CONFIG_NORDIC_UART_RX_WORKER_STACK_SIZE, NULL,
+                              CONFIG_NORDIC_UART_RX_WORKER_PRIORITY, &_rx_worker_task_handle,
+                              RX_WORKER_CORE) != pdPASS) {
+#endif
+    ESP_LOGE(_TAG, "Failed to create RX worker task");
+    _rx_worker_task_handle = NULL;
+    _nordic_uart_rx_worker_stop();
+    return ESP_FAIL;
+  }
+#endif
+  return ESP_OK;
+}
+
+esp_err_t _nordic_uart_set_rx_worker(bool enable) {
+#ifdef CONFIG_NORDIC_UART_RX_WORKER
+  if (_nordic_uart_linebuf_initialized())
+    return ESP_ERR_INVALID_STATE;
+  _rx_worker_enabled = enable;
+  return ESP_OK;
+#else
+  return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
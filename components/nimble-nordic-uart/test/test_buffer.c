@@ -1,18 +1,30 @@
 #include "unity.h"
 
-#include "nimble-nordic-uart.h"
+#include "nordic-uart-private.h"
 
+#include "esp_cpu.h"
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/ringbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
 TEST_CASE("buffer init / deinit", "[buffer]") {
   TEST_ESP_OK(_nordic_uart_buf_init());
   TEST_ESP_OK(_nordic_uart_buf_deinit());
   TEST_ESP_ERR(ESP_FAIL, _nordic_uart_buf_deinit());
 }
 
+TEST_CASE("buffer footprint covers the configured sizes", "[buffer]") {
+  TEST_ASSERT_GREATER_OR_EQUAL(CONFIG_NORDIC_UART_RX_BUFFER_SIZE +
+                                   CONFIG_NORDIC_UART_MAX_CONNECTIONS * (CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1),
+                               _nordic_uart_buf_footprint());
+  TEST_ASSERT_GREATER_OR_EQUAL(CONFIG_NORDIC_UART_TX_BUFFER_SIZE, _nordic_uart_tx_footprint());
+}
+
 TEST_CASE("buffer append", "[buffer]") {
   size_t item_size;
   char *str;
@@ -64,6 +76,71 @@ TEST_CASE("line buffer overflow", "[buffer]") {
   TEST_ESP_OK(_nordic_uart_buf_deinit());
 }
 
+TEST_CASE("long lines are queued in fragments and joined again", "[buffer]") {
+  static char line[CONFIG_NORDIC_UART_MAX_LINE_LENGTH * 5 / 2 + 1];
+  struct nordic_uart_rx_line items[4], joined;
+  struct nordic_uart_line_assembler assembler;
+  for (size_t i = 0; i < sizeof(line) - 1; ++i)
+    line[i] = 'a' + i % 26;
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  TEST_ESP_OK(_nordic_uart_set_long_lines(true));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)line, sizeof(line) - 1));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"\r\nshort\n", 8));
+  TEST_ASSERT_EQUAL(4, _nordic_uart_rx_receive_batch(items, 4, 0, 1));
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_MAX_LINE_LENGTH, items[0].len);
+  TEST_ASSERT_TRUE(items[0].continued);
+  TEST_ASSERT_TRUE(items[1].continued);
+  TEST_ASSERT_EQUAL_MEMORY(line + CONFIG_NORDIC_UART_MAX_LINE_LENGTH, items[1].data, items[1].len);
+  TEST_ASSERT_FALSE(items[2].continued);
+  TEST_ASSERT_EQUAL(sizeof(line) - 1 - 2 * CONFIG_NORDIC_UART_MAX_LINE_LENGTH, items[2].len);
+  TEST_ASSERT_EQUAL_UINT16(BLE_HS_CONN_HANDLE_NONE, items[2].conn_handle);
+  TEST_ASSERT_EQUAL_STRING("short", items[3].data);
+
+  nordic_uart_line_assembler_init(&assembler, sizeof(line));
+  TEST_ASSERT_FALSE(nordic_uart_line_assembler_feed(&assembler, &items[0], &joined));
+  TEST_ASSERT_FALSE(nordic_uart_line_assembler_feed(&assembler, &items[1], &joined));
+  TEST_ASSERT_TRUE(nordic_uart_line_assembler_feed(&assembler, &items[2], &joined));
+  TEST_ASSERT_EQUAL(sizeof(line) - 1, joined.len);
+  TEST_ASSERT_EQUAL_STRING(line, joined.data);
+  // whole lines are passed through without a copy
+  TEST_ASSERT_TRUE(nordic_uart_line_assembler_feed(&assembler, &items[3], &joined));
+  TEST_ASSERT_TRUE(joined.data == items[3].data);
+  _nordic_uart_rx_release_batch(items, 4);
+
+  // a line exactly as long as the buffer needs no fragment; a Ctrl-C drops the line it breaks off
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)line, CONFIG_NORDIC_UART_MAX_LINE_LENGTH));
+  TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)line, CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1));
+  TEST_ESP_OK(_nordic_uart_linebuf_append('\003'));
+  TEST_ASSERT_EQUAL(3, _nordic_uart_rx_receive_batch(items, 4, 0, 1));
+  TEST_ASSERT_FALSE(items[0].continued);
+  TEST_ASSERT_EQUAL(CONFIG_NORDIC_UART_MAX_LINE_LENGTH, items[0].len);
+  TEST_ASSERT_TRUE(items[1].continued);
+  TEST_ASSERT_TRUE(nordic_uart_line_assembler_feed(&assembler, &items[0], &joined));
+  TEST_ASSERT_FALSE(nordic_uart_line_assembler_feed(&assembler, &items[1], &joined));
+  TEST_ASSERT_TRUE(nordic_uart_line_assembler_feed(&assembler, &items[2], &joined));
+  TEST_ASSERT_EQUAL_STRING("\003", joined.data);
+  _nordic_uart_rx_release_batch(items, 3);
+
+  // lines longer than the assembler takes are cut
+  nordic_uart_line_assembler_deinit(&assembler);
+  nordic_uart_line_assembler_init(&assembler, 300);
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)line, sizeof(line) - 1));
+  TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
+  TEST_ASSERT_EQUAL(3, _nordic_uart_rx_receive_batch(items, 4, 0, 1));
+  TEST_ASSERT_FALSE(nordic_uart_line_assembler_feed(&assembler, &items[0], &joined));
+  TEST_ASSERT_FALSE(nordic_uart_line_assembler_feed(&assembler, &items[1], &joined));
+  TEST_ASSERT_TRUE(nordic_uart_line_assembler_feed(&assembler, &items[2], &joined));
+  TEST_ASSERT_EQUAL(300, joined.len);
+  TEST_ASSERT_EQUAL_MEMORY(line, joined.data, 300);
+  _nordic_uart_rx_release_batch(items, 3);
+  nordic_uart_line_assembler_deinit(&assembler);
+
+  TEST_ESP_OK(_nordic_uart_set_long_lines(false));
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+}
+
 TEST_CASE("ring buffer overflow", "[buffer]") {
   size_t item_size;
   char *str;
@@ -92,3 +169,224 @@ TEST_CASE("ring buffer overflow", "[buffer]") {
 
   TEST_ESP_OK(_nordic_uart_buf_deinit());
 }
+
+TEST_CASE("received lines are tagged with their connection", "[buffer]") {
+  size_t item_size;
+  char *str;
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  TEST_ESP_OK(_nordic_uart_linebuf_append('a'));
+  TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
+  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  TEST_ASSERT_EQUAL_STRING("a", str);
+  TEST_ASSERT_EQUAL_UINT16(BLE_HS_CONN_HANDLE_NONE, _nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+
+#if CONFIG_NORDIC_UART_MAX_CONNECTIONS >= 2
+  // partial lines from two connections must not mix
+  TEST_ESP_OK(_nordic_uart_linebuf_select(1));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"he", 2));
+  TEST_ESP_OK(_nordic_uart_linebuf_select(2));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"wo", 2));
+  TEST_ESP_OK(_nordic_uart_linebuf_select(1));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"llo\r\n", 5));
+  TEST_ESP_OK(_nordic_uart_linebuf_select(2));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"rld\n", 4));
+
+  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  TEST_ASSERT_EQUAL_STRING("hello", str);
+  TEST_ASSERT_EQUAL_UINT16(1, _nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  TEST_ASSERT_EQUAL_STRING("world", str);
+  TEST_ASSERT_EQUAL_UINT16(2, _nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+
+  // a released line buffer starts empty for the next connection
+  TEST_ESP_OK(_nordic_uart_linebuf_select(1));
+  TEST_ESP_OK(_nordic_uart_linebuf_append('x'));
+  _nordic_uart_linebuf_release(1);
+  TEST_ESP_OK(_nordic_uart_linebuf_select(3));
+  TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
+  str = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 1);
+  TEST_ASSERT_EQUAL_STRING("", str);
+  TEST_ASSERT_EQUAL_UINT16(3, _nordic_uart_rx_item_conn_handle(str, item_size));
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, str);
+#endif
+
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+}
+
+TEST_CASE("batch receive takes queued lines up to its limits", "[buffer]") {
+  struct nordic_uart_rx_line lines[8];
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  TEST_ASSERT_EQUAL(0, _nordic_uart_rx_receive_batch(lines, 8, 0, 1));
+
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"one\ntwo\nthree\nfour\nfive\n", 24));
+  TEST_ASSERT_EQUAL(3, _nordic_uart_rx_receive_batch(lines, 3, 0, 1));
+  TEST_ASSERT_EQUAL_STRING("one", lines[0].data);
+  TEST_ASSERT_EQUAL_STRING("two", lines[1].data);
+  TEST_ASSERT_EQUAL_STRING("three", lines[2].data);
+  TEST_ASSERT_EQUAL(5, lines[2].len);
+  TEST_ASSERT_EQUAL_UINT16(BLE_HS_CONN_HANDLE_NONE, lines[0].conn_handle);
+
+  // a second batch may be taken before the first is given back
+  struct nordic_uart_rx_line more[8];
+  TEST_ASSERT_EQUAL(2, _nordic_uart_rx_receive_batch(more, 8, 0, 1));
+  TEST_ASSERT_EQUAL_STRING("four", more[0].data);
+  TEST_ASSERT_EQUAL_STRING("five", more[1].data);
+  _nordic_uart_rx_release_batch(lines, 3);
+  _nordic_uart_rx_release_batch(more, 2);
+
+  // the byte budget ends the batch once reached, but the first line is always taken
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"abcdef\nab\ncd\nef\n", 16));
+  TEST_ASSERT_EQUAL(1, _nordic_uart_rx_receive_batch(lines, 8, 4, 1));
+  TEST_ASSERT_EQUAL_STRING("abcdef", lines[0].data);
+  _nordic_uart_rx_release_batch(lines, 1);
+  TEST_ASSERT_EQUAL(2, _nordic_uart_rx_receive_batch(lines, 8, 4, 1));
+  TEST_ASSERT_EQUAL_STRING("cd", lines[1].data);
+  _nordic_uart_rx_release_batch(lines, 2);
+  TEST_ASSERT_EQUAL(1, _nordic_uart_rx_receive_batch(lines, 8, 4, 1));
+  _nordic_uart_rx_release_batch(lines, 1);
+
+  // every item went back, so the ring buffer is empty again
+  TEST_ASSERT_EQUAL(0, _nordic_uart_rx_receive_batch(lines, 8, 0, 0));
+  TEST_ASSERT_EQUAL(xRingbufferGetMaxItemSize(nordic_uart_rx_buf_handle),
+                    xRingbufferGetCurFreeSize(nordic_uart_rx_buf_handle));
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+}
+
+// Drain the ring buffer into `out` as a sequence of (size, bytes) records.
+static size_t drain_ring_buffer(uint8_t *out, size_t max_len) {
+  size_t len = 0;
+  size_t item_size;
+  uint8_t *item;
+  while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL) {
+    TEST_ASSERT_LESS_OR_EQUAL(max_len, len + sizeof(item_size) + item_size);
+    memcpy(out + len, &item_size, sizeof(item_size));
+    memcpy(out + len + sizeof(item_size), item, item_size);
+    len += sizeof(item_size) + item_size;
+    vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+  }
+  return len;
+}
+
+TEST_CASE("block append matches per-character append", "[buffer]") {
+  static const char alphabet[] = "abcdefghij \t\r\n\n\0\003~";
+  static uint8_t input[600];
+  static uint8_t expected[4096];
+  static uint8_t actual[4096];
+
+  srand(1234);
+  for (int round = 0; round < 200; ++round) {
+    const size_t len = rand() % sizeof(input);
+    // mostly text with sparse control characters, sometimes long unbroken runs to hit overflow
+    const bool long_lines = round % 4 == 0;
+    // and half of those delivered in fragments
+    TEST_ESP_OK(_nordic_uart_set_long_lines(round % 8 == 0));
+    for (size_t i = 0; i < len; ++i) {
+      input[i] = (long_lines && rand() % 64) ? 'x' : alphabet[rand() % (sizeof(alphabet) - 1)];
+    }
+
+    TEST_ESP_OK(_nordic_uart_buf_init());
+    esp_err_t expected_ret = ESP_OK;
+    for (size_t i = 0; i < len; ++i) {
+      if (_nordic_uart_linebuf_append(input[i]) != ESP_OK)
+        expected_ret = ESP_FAIL;
+    }
+    TEST_ESP_OK(_nordic_uart_linebuf_append('\n'));
+    const size_t expected_len = drain_ring_buffer(expected, sizeof(expected));
+    TEST_ESP_OK(_nordic_uart_buf_deinit());
+
+    TEST_ESP_OK(_nordic_uart_buf_init());
+    esp_err_t actual_ret = ESP_OK;
+    // feed in random pieces, as mbuf chains would split it
+    for (size_t pos = 0; pos < len;) {
+      const size_t max_piece = 1 + rand() % 100;
+      const size_t piece = MIN(len - pos, max_piece);
+      if (_nordic_uart_linebuf_append_block(&input[pos], piece) != ESP_OK)
+        actual_ret = ESP_FAIL;
+      pos += piece;
+    }
+    TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"\n", 1));
+    const size_t actual_len = drain_ring_buffer(actual, sizeof(actual));
+    TEST_ESP_OK(_nordic_uart_buf_deinit());
+
+    TEST_ASSERT_EQUAL(expected_ret, actual_ret);
+    TEST_ASSERT_EQUAL(expected_len, actual_len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, actual, expected_len);
+  }
+  TEST_ESP_OK(_nordic_uart_set_long_lines(false));
+}
+
+TEST_CASE("line buffer append throughput", "[buffer][bench]") {
+  static uint8_t input[3000];
+  size_t item_size;
+  void *item;
+
+  // 100 character lines ending in CRLF
+  for (size_t i = 0; i < sizeof(input); ++i) {
+    const size_t col = i % 102;
+    input[i] = col < 100 ? 'a' + col % 26 : (col == 100 ? '\r' : '\n');
+  }
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  uint32_t scalar_cycles = 0;
+  uint32_t block_cycles = 0;
+  for (int round = 0; round < 20; ++round) {
+    uint32_t start = esp_cpu_get_cycle_count();
+    for (size_t i = 0; i < sizeof(input); ++i) {
+      _nordic_uart_linebuf_append(input[i]);
+    }
+    scalar_cycles += esp_cpu_get_cycle_count() - start;
+    while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL)
+      vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+
+    start = esp_cpu_get_cycle_count();
+    _nordic_uart_linebuf_append_block(input, sizeof(input));
+    block_cycles += esp_cpu_get_cycle_count() - start;
+    while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL)
+      vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+  }
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+
+  const float bytes = 20.0f * sizeof(input);
+  printf("linebuf append: scalar %.3f bytes/cycle, block %.3f bytes/cycle\n", bytes / scalar_cycles,
+         bytes / block_cycles);
+}
+
+TEST_CASE("batch receive drain rate", "[buffer][bench]") {
+  static uint8_t input[64 * 9];
+  static struct nordic_uart_rx_line lines[16];
+  size_t item_size;
+  void *item;
+
+  // a paste burst of 64 eight character lines
+  for (size_t i = 0; i < sizeof(input); ++i) {
+    input[i] = i % 9 == 8 ? '\n' : 'a' + i % 9;
+  }
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  uint32_t line_cycles = 0;
+  uint32_t batch_cycles = 0;
+  for (int round = 0; round < 20; ++round) {
+    TEST_ESP_OK(_nordic_uart_linebuf_append_block(input, sizeof(input)));
+    uint32_t start = esp_cpu_get_cycle_count();
+    while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL)
+      nordic_uart_return_item(item);
+    line_cycles += esp_cpu_get_cycle_count() - start;
+
+    TEST_ESP_OK(_nordic_uart_linebuf_append_block(input, sizeof(input)));
+    start = esp_cpu_get_cycle_count();
+    size_t count;
+    while ((count = nordic_uart_receive_batch(lines, 16, 0, 0)) > 0)
+      nordic_uart_release_batch(lines, count);
+    batch_cycles += esp_cpu_get_cycle_count() - start;
+  }
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+
+  const float count = 20.0f * 64;
+  printf("rx drain: per line %.0f cycles/line, batch of 16 %.0f cycles/line\n", line_cycles / count,
+         batch_cycles / count);
+}
@@ -0,0 +1,140 @@
+#include "unity.h"
+
+#include "nordic-uart-private.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef CONFIG_NORDIC_UART_COMPRESSION
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static struct nordic_uart_lz_enc enc;
+static struct nordic_uart_lz_dec dec;
+
+// Log lines of the kind the device sends: fixed prefixes, counters and a few words.
+static size_t make_log(char *buf, size_t size, unsigned seed) {
+  static const char *const tags[] = {"wifi", "sensor", "app_main", "nvs"};
+  static const char *const words[] = {"connected", "reading", "temperature", "retry", "ok", "timeout"};
+  size_t len = 0;
+  srand(seed);
+  for (unsigned i = 0; len + 80 < size; ++i) {
+    len += snprintf(buf + len, size - len, "I (%u) %s: %s %s=%d\r\n", 1000 + i * 37 + rand() % 10,
+                    tags[rand() % 4], words[rand() % 6], words[rand() % 6], rand() % 1000);
+  }
+  return len;
+}
+
+// Compress in pieces of random size with a flush after each, as separate sends would.
+static size_t compress_in_pieces(const uint8_t *data, size_t len, uint8_t *out) {
+  size_t out_len = 0;
+  for (size_t pos = 0; pos < len;) {
+    const size_t max_piece = 1 + rand() % 300;
+    const size_t piece = MIN(len - pos, max_piece);
+    out_len += _nordic_uart_lz_compress(&enc, data + pos, piece, out + out_len);
+    if (rand() % 2)
+      out_len += _nordic_uart_lz_flush(&enc, out + out_len);
+    pos += piece;
+  }
+  return out_len + _nordic_uart_lz_flush(&enc, out + out_len);
+}
+
+// Decompress in pieces of random size into an output buffer of random size.
+static size_t decompress_in_pieces(const uint8_t *data, size_t len, uint8_t *out, size_t out_size) {
+  size_t out_len = 0;
+  bool error = false;
+  for (size_t pos = 0; pos < len;) {
+    const size_t max_piece = 1 + rand() % 50;
+    const uint8_t *in = data + pos;
+    size_t in_len = MIN(len - pos, max_piece);
+    pos += in_len;
+    size_t n;
+    do {
+      n = _nordic_uart_lz_decompress(&dec, &in, &in_len, out + out_len, MIN(out_size - out_len, 1 + rand() % 64),
+                                     &error);
+      out_len += n;
+    } while (n > 0 && out_len < out_size);
+    TEST_ASSERT_EQUAL(0, in_len);
+  }
+  TEST_ASSERT_FALSE(error);
+  return out_len;
+}
+
+TEST_CASE("compressor produces the reference tokens", "[compress]") {
+  uint8_t out[64];
+  _nordic_uart_lz_enc_reset(&enc);
+  size_t len = _nordic_uart_lz_compress(&enc, (const uint8_t *)"abcabcabcx", 10, out);
+  len += _nordic_uart_lz_flush(&enc, out + len);
+  // 3 literals, 6 bytes from 3 back, 1 literal
+  TEST_ASSERT_EQUAL_MEMORY("\x02" "abc" "\x80\x02" "\x00" "x", out, 8);
+  TEST_ASSERT_EQUAL(8, len);
+
+  // a later send refers back into the earlier one; a long match takes the extra length byte
+  uint8_t run[100];
+  memset(run, 'a', sizeof(run));
+  len = _nordic_uart_lz_compress(&enc, run, sizeof(run), out);
+  len += _nordic_uart_lz_flush(&enc, out + len);
+  TEST_ASSERT_EQUAL_MEMORY("\x00" "a" "\xe0\x5a\x00", out, 5);
+  TEST_ASSERT_EQUAL(5, len);
+}
+
+TEST_CASE("compressed streams round trip in any split", "[compress]") {
+  static uint8_t data[6000];
+  static uint8_t packed[_NORDIC_UART_LZ_BOUND(sizeof(data)) * 2];
+  static uint8_t unpacked[sizeof(data)];
+
+  for (int round = 0; round < 20; ++round) {
+    // log text, random bytes and long runs
+    size_t len;
+    if (round % 3 == 0) {
+      len = make_log((char *)data, sizeof(data), round);
+    } else {
+      srand(round);
+      len = sizeof(data) - rand() % 1000;
+      for (size_t i = 0; i < len; ++i)
+        data[i] = round % 3 == 1 ? rand() : (i / 300) % 3;
+    }
+    srand(round * 31);
+    _nordic_uart_lz_enc_reset(&enc);
+    _nordic_uart_lz_dec_reset(&dec);
+    const size_t packed_len = compress_in_pieces(data, len, packed);
+    TEST_ASSERT_EQUAL(len, decompress_in_pieces(packed, packed_len, unpacked, sizeof(unpacked)));
+    TEST_ASSERT_EQUAL_MEMORY(data, unpacked, len);
+    if (round % 3 == 0)
+      TEST_ASSERT_LESS_THAN(len / 2, packed_len);
+  }
+}
+
+TEST_CASE("decompressor rejects references outside the window", "[compress]") {
+  uint8_t out[16];
+  bool error = false;
+  // a match before anything was sent
+  _nordic_uart_lz_dec_reset(&dec);
+  const uint8_t *in = (const uint8_t *)"\x20\x00" "\x01xy";
+  size_t in_len = 5;
+  TEST_ASSERT_EQUAL(2, _nordic_uart_lz_decompress(&dec, &in, &in_len, out, sizeof(out), &error));
+  TEST_ASSERT_TRUE(error);
+  TEST_ASSERT_EQUAL_MEMORY("xy", out, 2);
+
+#if _NORDIC_UART_LZ_WINDOW < 8192
+  // one reaching past the window
+  static uint8_t fill[_NORDIC_UART_LZ_WINDOW + 1];
+  static uint8_t fill_out[_NORDIC_UART_LZ_WINDOW + 1];
+  memset(fill, 'z', sizeof(fill));
+  _nordic_uart_lz_enc_reset(&enc);
+  size_t fill_len = _nordic_uart_lz_compress(&enc, fill, sizeof(fill), fill_out);
+  fill_len += _nordic_uart_lz_flush(&enc, fill_out + fill_len);
+  in = fill_out;
+  in_len = fill_len;
+  error = false;
+  while (in_len)
+    _nordic_uart_lz_decompress(&dec, &in, &in_len, fill, sizeof(fill), &error);
+  TEST_ASSERT_FALSE(error);
+  const uint8_t far[] = {0x20 | (_NORDIC_UART_LZ_WINDOW >> 8), _NORDIC_UART_LZ_WINDOW & 0xff};
+  in = far;
+  in_len = sizeof(far);
+  TEST_ASSERT_EQUAL(0, _nordic_uart_lz_decompress(&dec, &in, &in_len, out, sizeof(out), &error));
+  TEST_ASSERT_TRUE(error);
+#endif
+}
+#endif
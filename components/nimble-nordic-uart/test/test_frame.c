@@ -0,0 +1,204 @@
+#include "unity.h"
+
+#include "nordic-uart-private.h"
+
+#include "esp_cpu.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/ringbuf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+
+static const enum nordic_uart_framing framings[] = {
+    NORDIC_UART_FRAMING_LINE,
+    NORDIC_UART_FRAMING_COBS,
+    NORDIC_UART_FRAMING_SLIP,
+    NORDIC_UART_FRAMING_VARINT,
+};
+static const char *const framing_names[] = {"line", "cobs", "slip", "varint"};
+
+static void assert_encoding(enum nordic_uart_framing framing, const void *data, size_t len, const void *expected,
+                            size_t expected_len) {
+  uint8_t out[NORDIC_UART_FRAME_ENCODED_MAX(300)];
+  TEST_ASSERT_EQUAL(expected_len, _nordic_uart_frame_encode(framing, data, len, out, sizeof(out)));
+  TEST_ASSERT_EQUAL_MEMORY(expected, out, expected_len);
+  // one byte short is refused
+  TEST_ASSERT_EQUAL(0, _nordic_uart_frame_encode(framing, data, len, out, expected_len - 1));
+}
+
+// Next item from the ring buffer, which must match the frame.
+static void assert_frame(const void *frame, size_t len) {
+  size_t item_size;
+  uint8_t *item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0);
+  TEST_ASSERT_NOT_NULL(item);
+  TEST_ASSERT_EQUAL(len, _nordic_uart_rx_item_len(item_size));
+  TEST_ASSERT_EQUAL_MEMORY(frame, item, len);
+  TEST_ASSERT_EQUAL_UINT8(0, item[len]);
+  vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+}
+
+static void assert_no_frame(void) {
+  size_t item_size;
+  TEST_ASSERT_NULL(xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0));
+}
+
+TEST_CASE("frame encoders produce the reference encodings", "[frame]") {
+  assert_encoding(NORDIC_UART_FRAMING_LINE, "ab", 2, "ab\r\n", 4);
+
+  assert_encoding(NORDIC_UART_FRAMING_COBS, "", 0, "\x01\x00", 2);
+  assert_encoding(NORDIC_UART_FRAMING_COBS, "\x00", 1, "\x01\x01\x00", 3);
+  assert_encoding(NORDIC_UART_FRAMING_COBS, "\x11\x22\x00\x33", 4, "\x03\x11\x22\x02\x33\x00", 6);
+  uint8_t run[254];
+  uint8_t run_encoded[257];
+  memset(run, 0x5a, sizeof(run));
+  run_encoded[0] = 0xff;
+  memset(run_encoded + 1, 0x5a, sizeof(run));
+  run_encoded[255] = 0x01;
+  run_encoded[256] = 0x00;
+  assert_encoding(NORDIC_UART_FRAMING_COBS, run, sizeof(run), run_encoded, sizeof(run_encoded));
+
+  assert_encoding(NORDIC_UART_FRAMING_SLIP, "\xc0\xdb\x01", 3, "\xdb\xdc\xdb\xdd\x01\xc0", 6);
+
+  assert_encoding(NORDIC_UART_FRAMING_VARINT, "", 0, "\x00", 1);
+  static uint8_t long_frame[300];
+  static uint8_t long_encoded[302];
+  memset(long_frame, 0, sizeof(long_frame));
+  memset(long_encoded, 0, sizeof(long_encoded));
+  long_encoded[0] = 0xac;
+  long_encoded[1] = 0x02;
+  assert_encoding(NORDIC_UART_FRAMING_VARINT, long_frame, sizeof(long_frame), long_encoded, sizeof(long_encoded));
+}
+
+TEST_CASE("framers decode what the encoders produce", "[frame]") {
+  static uint8_t frames[8][CONFIG_NORDIC_UART_MAX_LINE_LENGTH];
+  static size_t frame_lens[8];
+  static uint8_t stream[8 * NORDIC_UART_FRAME_ENCODED_MAX(CONFIG_NORDIC_UART_MAX_LINE_LENGTH)];
+
+  srand(4321);
+  for (size_t f = 0; f < sizeof(framings) / sizeof(framings[0]); ++f) {
+    const enum nordic_uart_framing framing = framings[f];
+    TEST_ESP_OK(_nordic_uart_buf_init());
+    TEST_ESP_OK(_nordic_uart_set_framing(framing));
+
+    for (int round = 0; round < 50; ++round) {
+      // a few frames back to back, sized so they all fit the ring buffer
+      const size_t count = 1 + rand() % 8;
+      const size_t max_len = MIN(CONFIG_NORDIC_UART_MAX_LINE_LENGTH, CONFIG_NORDIC_UART_RX_BUFFER_SIZE / 16);
+      size_t stream_len = 0;
+      for (size_t i = 0; i < count; ++i) {
+        // SLIP cannot carry empty frames; the line framer needs text
+        frame_lens[i] = (framing == NORDIC_UART_FRAMING_SLIP ? 1 : 0) + rand() % max_len;
+        for (size_t j = 0; j < frame_lens[i]; ++j) {
+          if (framing == NORDIC_UART_FRAMING_LINE)
+            frames[i][j] = 'a' + rand() % 26;
+          else
+            frames[i][j] = rand() % 4 ? rand() : "\x00\xc0\xdb"[rand() % 3];
+        }
+        stream_len += _nordic_uart_frame_encode(framing, frames[i], frame_lens[i], stream + stream_len,
+                                                sizeof(stream) - stream_len);
+      }
+
+      // fed in random pieces, as mbuf chains would split it
+      for (size_t pos = 0; pos < stream_len;) {
+        const size_t max_piece = 1 + rand() % 100;
+        const size_t piece = MIN(stream_len - pos, max_piece);
+        TEST_ESP_OK(_nordic_uart_frame_append_block(stream + pos, piece));
+        pos += piece;
+      }
+      for (size_t i = 0; i < count; ++i) {
+        assert_frame(frames[i], frame_lens[i]);
+      }
+      assert_no_frame();
+    }
+
+    TEST_ESP_OK(_nordic_uart_set_framing(NORDIC_UART_FRAMING_LINE));
+    TEST_ESP_OK(_nordic_uart_buf_deinit());
+  }
+}
+
+TEST_CASE("framers drop oversized and broken frames", "[frame]") {
+  static uint8_t big[CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1];
+  static uint8_t encoded[NORDIC_UART_FRAME_ENCODED_MAX(sizeof(big))];
+  memset(big, 0x42, sizeof(big));
+
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  for (size_t f = 1; f < sizeof(framings) / sizeof(framings[0]); ++f) {
+    TEST_ESP_OK(_nordic_uart_set_framing(framings[f]));
+    // one byte too long for the line buffer, then a good frame
+    const size_t len = _nordic_uart_frame_encode(framings[f], big, sizeof(big), encoded, sizeof(encoded));
+    TEST_ASSERT_EQUAL(ESP_FAIL, _nordic_uart_frame_append_block(encoded, len));
+    assert_no_frame();
+    const size_t ok_len = _nordic_uart_frame_encode(framings[f], "ok", 2, encoded, sizeof(encoded));
+    TEST_ESP_OK(_nordic_uart_frame_append_block(encoded, ok_len));
+    assert_frame("ok", 2);
+  }
+
+  // a COBS block cut short by the delimiter
+  TEST_ESP_OK(_nordic_uart_set_framing(NORDIC_UART_FRAMING_COBS));
+  TEST_ASSERT_EQUAL(ESP_FAIL, _nordic_uart_frame_append_block((const uint8_t *)"\x05\x11\x22\x00", 4));
+  assert_no_frame();
+  TEST_ESP_OK(_nordic_uart_frame_append_block((const uint8_t *)"\x02\x11\x00", 3));
+  assert_frame("\x11", 1);
+
+  // a varint length beyond 32 bits
+  TEST_ESP_OK(_nordic_uart_set_framing(NORDIC_UART_FRAMING_VARINT));
+  TEST_ASSERT_EQUAL(ESP_FAIL, _nordic_uart_frame_append_block((const uint8_t *)"\xff\xff\xff\xff\x7f", 5));
+  TEST_ESP_OK(_nordic_uart_frame_append_block((const uint8_t *)"\x01z", 2));
+  assert_frame("z", 1);
+
+  // a lost connection drops its partial frame instead of sending Ctrl-C
+  TEST_ESP_OK(_nordic_uart_frame_append_block((const uint8_t *)"\x05\x01\x02", 3));
+  TEST_ESP_OK(_nordic_uart_linebuf_hangup());
+  assert_no_frame();
+  TEST_ESP_OK(_nordic_uart_set_framing(NORDIC_UART_FRAMING_LINE));
+  TEST_ESP_OK(_nordic_uart_linebuf_hangup());
+  assert_frame("\003", 1);
+
+#ifdef CONFIG_NORDIC_UART_STATS
+  struct nordic_uart_stats stats;
+  TEST_ESP_OK(_nordic_uart_get_stats(&stats));
+  TEST_ASSERT_GREATER_OR_EQUAL(2, stats.rx_frame_errors);
+#endif
+  TEST_ASSERT_EQUAL(ESP_FAIL, _nordic_uart_set_framing((enum nordic_uart_framing)42));
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+}
+
+TEST_CASE("framer throughput", "[frame][bench]") {
+  static uint8_t payload[100];
+  static uint8_t input[30 * NORDIC_UART_FRAME_ENCODED_MAX(sizeof(payload))];
+  size_t item_size;
+  void *item;
+
+  for (size_t f = 0; f < sizeof(framings) / sizeof(framings[0]); ++f) {
+    const enum nordic_uart_framing framing = framings[f];
+    // 30 frames of 100 bytes: text for lines, binary with the odd delimiter byte otherwise
+    srand(99);
+    for (size_t i = 0; i < sizeof(payload); ++i) {
+      payload[i] = framing == NORDIC_UART_FRAMING_LINE ? 'a' + i % 26 : rand();
+    }
+    uint32_t start = esp_cpu_get_cycle_count();
+    size_t len = 0;
+    for (int i = 0; i < 30; ++i) {
+      len += _nordic_uart_frame_encode(framing, payload, sizeof(payload), input + len, sizeof(input) - len);
+    }
+    const uint32_t encode_cycles = esp_cpu_get_cycle_count() - start;
+
+    TEST_ESP_OK(_nordic_uart_buf_init());
+    TEST_ESP_OK(_nordic_uart_set_framing(framing));
+    uint32_t decode_cycles = 0;
+    for (int round = 0; round < 20; ++round) {
+      start = esp_cpu_get_cycle_count();
+      _nordic_uart_frame_append_block(input, len);
+      decode_cycles += esp_cpu_get_cycle_count() - start;
+      while ((item = xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, 0)) != NULL)
+        vRingbufferReturnItem(nordic_uart_rx_buf_handle, item);
+    }
+    TEST_ESP_OK(_nordic_uart_set_framing(NORDIC_UART_FRAMING_LINE));
+    TEST_ESP_OK(_nordic_uart_buf_deinit());
+
+    printf("%-6s framer: encode %.3f bytes/cycle, decode %.3f bytes/cycle (%zu encoded bytes)\n", framing_names[f],
+           30.0f * sizeof(payload) / encode_cycles, 20.0f * len / decode_cycles, len);
+  }
+}
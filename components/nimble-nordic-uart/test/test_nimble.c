@@ -1,7 +1,7 @@
 #include "unity.h"
 #include <limits.h>
 
-#include "nimble-nordic-uart.h"
+#include "nordic-uart-private.h"
 
 TEST_CASE("nordic_uart_start", "[nimble]") {
   TEST_ESP_OK(nordic_uart_start("Nordic UART", NULL));
@@ -25,3 +25,26 @@ TEST_CASE("twice nordic_uart_start and stop", "[nimble]") {
   vTaskDelay(500 / portTICK_PERIOD_MS);
   nordic_uart_stop();
 }
+
+TEST_CASE("notify payload size follows MTU", "[nimble]") {
+  TEST_ASSERT_EQUAL_UINT16(20, _nordic_uart_notify_payload_size(0));
+  TEST_ASSERT_EQUAL_UINT16(20, _nordic_uart_notify_payload_size(BLE_ATT_MTU_DFLT));
+  TEST_ASSERT_EQUAL_UINT16(182, _nordic_uart_notify_payload_size(185));
+  TEST_ASSERT_EQUAL_UINT16(244, _nordic_uart_notify_payload_size(247));
+  TEST_ASSERT_EQUAL_UINT16(509, _nordic_uart_notify_payload_size(512));
+  TEST_ASSERT_EQUAL_UINT16(BLE_ATT_ATTR_MAX_LEN, _nordic_uart_notify_payload_size(517));
+  TEST_ASSERT_EQUAL_UINT16(BLE_ATT_ATTR_MAX_LEN, _nordic_uart_notify_payload_size(527));
+}
+
+TEST_CASE("nordic_uart_send_async and flush", "[nimble]") {
+  TEST_ESP_ERR(ESP_FAIL, nordic_uart_send_async("not started"));
+
+  TEST_ESP_OK(nordic_uart_start("Nordic UART", NULL));
+  TEST_ESP_OK(nordic_uart_send_async("hello"));
+  TEST_ESP_OK(nordic_uart_send_async("world"));
+  TEST_ESP_OK(nordic_uart_flush(pdMS_TO_TICKS(1000)));
+  TEST_ASSERT_EQUAL(0, nordic_uart_tx_queue_depth());
+  TEST_ASSERT_GREATER_OR_EQUAL(5, nordic_uart_tx_queue_high_watermark());
+  vTaskDelay(500 / portTICK_PERIOD_MS);
+  nordic_uart_stop();
+}
@@ -0,0 +1,155 @@
+#include "unity.h"
+
+#include "nordic-uart-private.h"
+
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/semphr.h"
+#include "freertos/task.h"
+#include <string.h>
+
+#define SPSC_STRESS_RECORDS 50000
+#define SPSC_STRESS_MAX_LEN 61
+
+// Record i is (i % SPSC_STRESS_MAX_LEN) bytes of 'a' + i % 26, so any torn or reordered record shows.
+static size_t spsc_fill(uint32_t i, char *out) {
+  const size_t len = i % SPSC_STRESS_MAX_LEN;
+  memset(out, 'a' + i % 26, len);
+  return len;
+}
+
+struct spsc_stress {
+  struct nordic_uart_spsc ring;
+  SemaphoreHandle_t done;
+  uint32_t timeouts;
+};
+
+static void spsc_producer_task(void *arg) {
+  struct spsc_stress *stress = arg;
+  char data[SPSC_STRESS_MAX_LEN];
+  for (uint32_t i = 0; i < SPSC_STRESS_RECORDS; ++i) {
+    const size_t len = spsc_fill(i, data);
+    // time out now and then so both the sleeping and the retrying path run
+    while (_nordic_uart_spsc_push(&stress->ring, data, len, (uint16_t)i, i % 7 ? pdMS_TO_TICKS(1000) : 0) != ESP_OK)
+      stress->timeouts++;
+  }
+  xSemaphoreGive(stress->done);
+  vTaskDelete(NULL);
+}
+
+TEST_CASE("spsc ring passes records between two tasks in order", "[spsc]") {
+  static WORD_ALIGNED_ATTR uint8_t storage[256];
+  static struct spsc_stress stress;
+  char expected[SPSC_STRESS_MAX_LEN];
+  TEST_ESP_OK(_nordic_uart_spsc_init(&stress.ring, storage, sizeof(storage)));
+  stress.done = xSemaphoreCreateBinary();
+  stress.timeouts = 0;
+  xTaskCreate(spsc_producer_task, "spsc_producer", 4096, &stress, 5, NULL);
+
+  const char *held[3];
+  size_t held_count = 0;
+  for (uint32_t i = 0; i < SPSC_STRESS_RECORDS; ++i) {
+    size_t len;
+    uint16_t tag;
+    const char *record = _nordic_uart_spsc_receive(&stress.ring, &len, &tag, pdMS_TO_TICKS(1000));
+    TEST_ASSERT_NOT_NULL(record);
+    TEST_ASSERT_EQUAL((uint16_t)i, tag);
+    TEST_ASSERT_EQUAL(spsc_fill(i, expected), len);
+    TEST_ASSERT_EQUAL_MEMORY(expected, record, len);
+    TEST_ASSERT_EQUAL('\0', record[len]);
+    // like a batch reader: hold up to three records, give them back with one release before waiting
+    held[held_count++] = record;
+    if (held_count == 3 || !_nordic_uart_spsc_pending(&stress.ring)) {
+      _nordic_uart_spsc_release(&stress.ring, held[held_count - 1]);
+      held_count = 0;
+    }
+  }
+  TEST_ASSERT_EQUAL(0, held_count);
+  TEST_ASSERT_TRUE(xSemaphoreTake(stress.done, pdMS_TO_TICKS(1000)));
+  TEST_ASSERT_FALSE(_nordic_uart_spsc_pending(&stress.ring));
+  TEST_ASSERT_EQUAL(stress.ring.head, stress.ring.tail);
+  vSemaphoreDelete(stress.done);
+  _nordic_uart_spsc_deinit(&stress.ring);
+}
+
+TEST_CASE("spsc ring wraps records to the start and times out when full", "[spsc]") {
+  static WORD_ALIGNED_ATTR uint8_t storage[64];
+  struct nordic_uart_spsc ring;
+  size_t len;
+  uint16_t tag;
+  TEST_ESP_ERR(ESP_ERR_INVALID_ARG, _nordic_uart_spsc_init(&ring, NULL, sizeof(storage)));
+  TEST_ESP_OK(_nordic_uart_spsc_init(&ring, storage, sizeof(storage)));
+  TEST_ASSERT_NULL(_nordic_uart_spsc_receive(&ring, &len, &tag, 0));
+  TEST_ESP_ERR(ESP_ERR_INVALID_SIZE, _nordic_uart_spsc_push(&ring, storage, sizeof(storage), 0, 0));
+  TEST_ASSERT_EQUAL(64 - 4 - 5, _nordic_uart_spsc_free_size(&ring));
+
+  // three 20 byte records (4 header + 15 payload + NUL) fill 60 bytes, a fourth does not fit
+  TEST_ESP_OK(_nordic_uart_spsc_push(&ring, "first record...", 15, 1, 0));
+  TEST_ESP_OK(_nordic_uart_spsc_push(&ring, "second record..", 15, 2, 0));
+  TEST_ESP_OK(_nordic_uart_spsc_push(&ring, "third record...", 15, 3, 0));
+  TEST_ASSERT_EQUAL(0, _nordic_uart_spsc_free_size(&ring));
+  TEST_ESP_ERR(ESP_ERR_TIMEOUT, _nordic_uart_spsc_push(&ring, "x", 1, 4, pdMS_TO_TICKS(10)));
+
+  char *first = _nordic_uart_spsc_receive(&ring, &len, &tag, 0);
+  TEST_ASSERT_EQUAL_STRING("first record...", first);
+  TEST_ASSERT_EQUAL(1, tag);
+  TEST_ASSERT_TRUE((uint8_t *)first == storage + 4); // read in place
+  char *second = _nordic_uart_spsc_receive(&ring, &len, &tag, 0);
+  TEST_ASSERT_EQUAL_STRING("second record..", second);
+  // received but not released: still no room
+  TEST_ESP_ERR(ESP_ERR_TIMEOUT, _nordic_uart_spsc_push(&ring, "x", 1, 4, 0));
+  _nordic_uart_spsc_release(&ring, second);
+  TEST_ASSERT_EQUAL(40 - 4 - 5, _nordic_uart_spsc_free_size(&ring));
+
+  // 4 bytes are left at the end, so the next record wraps to the start
+  TEST_ESP_OK(_nordic_uart_spsc_push(&ring, "wrapped", 7, 5, 0));
+  TEST_ASSERT_TRUE(_nordic_uart_spsc_pending(&ring));
+  char *third = _nordic_uart_spsc_receive(&ring, &len, &tag, 0);
+  TEST_ASSERT_EQUAL_STRING("third record...", third);
+  char *wrapped = _nordic_uart_spsc_receive(&ring, &len, &tag, 0);
+  TEST_ASSERT_TRUE((uint8_t *)wrapped == storage + 4);
+  TEST_ASSERT_EQUAL_STRING("wrapped", wrapped);
+  TEST_ASSERT_EQUAL(7, len);
+  TEST_ASSERT_EQUAL(5, tag);
+  TEST_ASSERT_FALSE(_nordic_uart_spsc_pending(&ring));
+  _nordic_uart_spsc_release(&ring, third);
+  _nordic_uart_spsc_release(&ring, wrapped);
+  // empty again; the next record may run up to the end
+  TEST_ASSERT_EQUAL(64 - 12 - 5, _nordic_uart_spsc_free_size(&ring));
+  _nordic_uart_spsc_deinit(&ring);
+}
+
+#ifdef CONFIG_NORDIC_UART_RX_SPSC
+TEST_CASE("spsc transport hands lines to the reader in place", "[spsc]") {
+  struct nordic_uart_rx_line lines[4];
+  TEST_ESP_OK(_nordic_uart_buf_init());
+  TEST_ASSERT_NULL(nordic_uart_rx_buf_handle);
+  const size_t empty = _nordic_uart_rx_free_size();
+  TEST_ASSERT_GREATER_OR_EQUAL(CONFIG_NORDIC_UART_RX_BUFFER_SIZE - 16, empty);
+
+  TEST_ESP_OK(_nordic_uart_linebuf_select(7));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"hello\r\nworld\n", 13));
+  TEST_ESP_OK(_nordic_uart_linebuf_select(9));
+  TEST_ESP_OK(_nordic_uart_linebuf_append_block((const uint8_t *)"third\n", 6));
+  TEST_ASSERT_TRUE(_nordic_uart_rx_pending());
+  TEST_ASSERT_LESS_THAN(empty, _nordic_uart_rx_free_size());
+
+  TEST_ASSERT_EQUAL(2, nordic_uart_receive_batch(lines, 2, 0, 0));
+  TEST_ASSERT_EQUAL_STRING("hello", lines[0].data);
+  TEST_ASSERT_EQUAL(5, lines[0].len);
+  TEST_ASSERT_EQUAL(7, lines[0].conn_handle);
+  TEST_ASSERT_EQUAL_STRING("world", lines[1].data);
+  TEST_ASSERT_EQUAL(1, nordic_uart_receive_batch(&lines[2], 2, 0, pdMS_TO_TICKS(10)));
+  TEST_ASSERT_EQUAL_STRING("third", lines[2].data);
+  TEST_ASSERT_EQUAL(9, lines[2].conn_handle);
+  TEST_ASSERT_FALSE(_nordic_uart_rx_pending());
+  TEST_ASSERT_EQUAL(0, nordic_uart_receive_batch(&lines[3], 1, 0, 0));
+
+  nordic_uart_release_batch(lines, 2);
+  nordic_uart_return_item(lines[2].data);
+  // empty, with the next line starting after the three records
+  TEST_ASSERT_GREATER_THAN(empty - 64, _nordic_uart_rx_free_size());
+  TEST_ESP_OK(_nordic_uart_buf_deinit());
+  TEST_ASSERT_EQUAL(0, nordic_uart_receive_batch(lines, 1, 0, 0));
+}
+#endif
@@ -1,5 +1,6 @@
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "esp_log.h"
 #include "freertos/FreeRTOS.h"
@@ -9,28 +10,40 @@
 
 void echoTask(void *parameter) {
   static char mbuf[CONFIG_NORDIC_UART_MAX_LINE_LENGTH + 1];
+  static struct nordic_uart_rx_line lines[16];
 
   for (;;) {
-    size_t item_size;
-    if (nordic_uart_rx_buf_handle) {
-      const char *item = (char *)xRingbufferReceive(nordic_uart_rx_buf_handle, &item_size, portMAX_DELAY);
+    // sleep until the component has lines or a central came or went
+    uint32_t events;
+    xTaskNotifyWait(0, UINT32_MAX, &events, portMAX_DELAY);
+    if (events & NORDIC_UART_EVENT_CONNECTED)
+      puts("connected");
+    if (events & NORDIC_UART_EVENT_DISCONNECTED)
+      puts("disconnected");
+    if (!(events & NORDIC_UART_EVENT_RX))
+      continue;
 
-      if (item) {
+    // a pasted burst of lines is taken in one go instead of one wakeup per line
+    size_t count;
+    while ((count = nordic_uart_receive_batch(lines, 16, 0, 0)) > 0) {
+      for (size_t n = 0; n < count; ++n) {
+        const char *item = lines[n].data;
+        const size_t len = strlen(item);
         int i;
-        for (i = 0; i < item_size; ++i) {
+        for (i = 0; i < len; ++i) {
           if (item[i] >= 'a' && item[i] <= 'z')
             mbuf[i] = item[i] - 0x20;
           else
             mbuf[i] = item[i];
         }
-        mbuf[item_size] = '\0';
+        mbuf[len] = '\0';
 
-        nordic_uart_sendln(mbuf);
+        // reply to the central that sent the line
+        const struct iovec iov[] = {{.iov_base = mbuf, .iov_len = len}, {.iov_base = "\r\n", .iov_len = 2}};
+        nordic_uart_writev_to(lines[n].conn_handle, iov, 2);
         puts(mbuf);
-        vRingbufferReturnItem(nordic_uart_rx_buf_handle, (void *)item);
       }
-    } else {
-      vTaskDelay(1000 / portTICK_PERIOD_MS);
+      nordic_uart_release_batch(lines, count);
     }
   }
 
@@ -38,6 +51,10 @@ void echoTask(void *parameter) {
 }
 
 void app_main(void) {
+  TaskHandle_t echo_task;
+  xTaskCreate(echoTask, "echoTask", 5000, NULL, 1, &echo_task);
+  // register before starting so nothing that arrives early is missed
+  nordic_uart_notify_task(echo_task,
+                          NORDIC_UART_EVENT_RX | NORDIC_UART_EVENT_CONNECTED | NORDIC_UART_EVENT_DISCONNECTED);
   nordic_uart_start("Nordic UART", NULL);
-  xTaskCreate(echoTask, "echoTask", 5000, NULL, 1, NULL);
 }